@@ -50,6 +50,12 @@ fn buildKernel(
         "enable-guest-output",
         "Enable guest output to stdout and stderr. Default is disabled.",
     ) orelse false;
+    const enable_profiler = b.option(
+        bool,
+        "enable-profiler",
+        "Enable the guest sampling profiler, which samples user stacks from " ++
+            "the APIC timer interrupt. Default is disabled.",
+    ) orelse false;
 
     // Kernel build options
     const build_options = b.addOptions();
@@ -59,6 +65,7 @@ fn buildKernel(
         shared_options.instruction_count,
     );
     build_options.addOption(bool, "enable_guest_output", enable_guest_output);
+    build_options.addOption(bool, "enable_profiler", enable_profiler);
     exe.root_module.addOptions("build_options", build_options);
 
     b.installArtifact(exe);
@@ -195,13 +202,30 @@ fn buildHypervisor(
             "corpus.cpp",
             "elf_debug.cpp",
             "elf_parser.cpp",
+            "fuzz_worker.cpp",
+            "libc_subst.cpp",
+            "patches.cpp",
+            "stub_hooks.cpp",
+            "displaced_inst.cpp",
+            "coverage_exporter.cpp",
+            "mapped_file.cpp",
+            "line_table.cpp",
+            "unwind_table.cpp",
             "elfs.cpp",
             "files.cpp",
+            "harness.cpp",
             "hypercalls.cpp",
+            "library_resolver.cpp",
             "main.cpp",
             "mutator.cpp",
             "mmu.cpp",
             "page_walker.cpp",
+            "profiler.cpp",
+            "exit_recorder.cpp",
+            "symbol_index.cpp",
+            "console.cpp",
+            "replay.cpp",
+            "stats.cpp",
             "tracing.cpp",
             "utils.cpp",
             "vm.cpp",
@@ -218,6 +242,7 @@ fn buildHypervisor(
     exe.linkSystemLibrary("dwarf");
     exe.linkSystemLibrary("elf");
     exe.linkSystemLibrary("crypto");
+    exe.linkSystemLibrary("dl");
 
     b.installArtifact(exe);
 }
@@ -285,19 +310,50 @@ fn buildHypervisorTests(b: *std.Build, std_target: std.Build.ResolvedTarget, std
     exe.addIncludePath(b.path("hypervisor/include"));
     exe.addCSourceFiles(.{
         .files = &.{
+            "hypervisor/src/corpus.cpp",
             "hypervisor/src/elf_debug.cpp",
             "hypervisor/src/elf_parser.cpp",
+            "hypervisor/src/fuzz_worker.cpp",
+            "hypervisor/src/libc_subst.cpp",
+            "hypervisor/src/patches.cpp",
+            "hypervisor/src/stub_hooks.cpp",
+            "hypervisor/src/displaced_inst.cpp",
+            "hypervisor/src/coverage_exporter.cpp",
+            "hypervisor/src/mapped_file.cpp",
+            "hypervisor/src/line_table.cpp",
+            "hypervisor/src/unwind_table.cpp",
             "hypervisor/src/elfs.cpp",
             "hypervisor/src/files.cpp",
+            "hypervisor/src/harness.cpp",
             "hypervisor/src/hypercalls.cpp",
+            "hypervisor/src/library_resolver.cpp",
+            "hypervisor/src/mutator.cpp",
             "hypervisor/src/mmu.cpp",
             "hypervisor/src/page_walker.cpp",
+            "hypervisor/src/profiler.cpp",
+            "hypervisor/src/exit_recorder.cpp",
+            "hypervisor/src/symbol_index.cpp",
+            "hypervisor/src/console.cpp",
+            "hypervisor/src/replay.cpp",
+            "hypervisor/src/stats.cpp",
             "hypervisor/src/tracing.cpp",
             "hypervisor/src/utils.cpp",
             "hypervisor/src/vm.cpp",
             "tests/hypervisor/files.cpp",
+            "tests/hypervisor/library_resolver.cpp",
+            "tests/hypervisor/libc_subst.cpp",
+            "tests/hypervisor/patches.cpp",
+            "tests/hypervisor/displaced_inst.cpp",
+            "tests/hypervisor/coverage.cpp",
+            "tests/hypervisor/harness.cpp",
+            "tests/hypervisor/histogram.cpp",
             "tests/hypervisor/hooks.cpp",
             "tests/hypervisor/inst_count.cpp",
+            "tests/hypervisor/line_table.cpp",
+            "tests/hypervisor/mmu.cpp",
+            "tests/hypervisor/symbols.cpp",
+            "tests/hypervisor/tracing.cpp",
+            "tests/hypervisor/unwind_table.cpp",
             "tests/hypervisor/main.cpp",
         },
         .flags = &.{
@@ -310,6 +366,7 @@ fn buildHypervisorTests(b: *std.Build, std_target: std.Build.ResolvedTarget, std
     exe.linkSystemLibrary("dwarf");
     exe.linkSystemLibrary("elf");
     exe.linkSystemLibrary("crypto");
+    exe.linkSystemLibrary("dl");
 
     const install = b.addInstallArtifact(exe, .{});
     const build_step = b.step("hypervisor_tests", "Build hypervisor tests");
@@ -324,6 +381,34 @@ fn buildHypervisorTests(b: *std.Build, std_target: std.Build.ResolvedTarget, std
     const test_hooks_install = b.addInstallArtifact(test_hooks_exe, .{});
     install.step.dependOn(&test_hooks_install.step);
 
+    const test_input_exe = b.addExecutable(.{
+        .name = "test_input",
+        .target = std_target,
+    });
+    test_input_exe.addCSourceFile(.{ .file = b.path("tests/hypervisor/binaries/input.c") });
+    test_input_exe.linkLibC();
+    const test_input_install = b.addInstallArtifact(test_input_exe, .{});
+    install.step.dependOn(&test_input_install.step);
+
+    const test_patches_exe = b.addExecutable(.{
+        .name = "test_patches",
+        .target = std_target,
+    });
+    test_patches_exe.addCSourceFile(.{ .file = b.path("tests/hypervisor/binaries/patches.c") });
+    test_patches_exe.linkLibC();
+    const test_patches_install = b.addInstallArtifact(test_patches_exe, .{});
+    install.step.dependOn(&test_patches_install.step);
+
+    const test_coverage_exe = b.addExecutable(.{
+        .name = "test_coverage",
+        .target = std_target,
+    });
+    test_coverage_exe.addCSourceFile(.{ .file = b.path("tests/hypervisor/binaries/coverage.c") });
+    test_coverage_exe.addCSourceFile(.{ .file = b.path("tests/hypervisor/binaries/coverage_other.c") });
+    test_coverage_exe.linkLibC();
+    const test_coverage_install = b.addInstallArtifact(test_coverage_exe, .{});
+    install.step.dependOn(&test_coverage_install.step);
+
     const test_files_exe = b.addExecutable(.{
         .name = "test_files",
         .target = std_target,
@@ -332,11 +417,29 @@ fn buildHypervisorTests(b: *std.Build, std_target: std.Build.ResolvedTarget, std
     test_files_exe.linkLibC();
     const test_files_install = b.addInstallArtifact(test_files_exe, .{});
     install.step.dependOn(&test_files_install.step);
+
+    const test_libc_subst_exe = b.addExecutable(.{
+        .name = "test_libc_subst",
+        .target = std_target,
+    });
+    test_libc_subst_exe.addCSourceFile(.{ .file = b.path("tests/hypervisor/binaries/libc_subst.c") });
+    test_libc_subst_exe.linkLibC();
+    const test_libc_subst_install = b.addInstallArtifact(test_libc_subst_exe, .{});
+    install.step.dependOn(&test_libc_subst_install.step);
+
+    const test_harness_exe = b.addExecutable(.{
+        .name = "test_harness",
+        .target = std_target,
+    });
+    test_harness_exe.addCSourceFile(.{ .file = b.path("tests/hypervisor/binaries/harness.c") });
+    test_harness_exe.linkLibC();
+    const test_harness_install = b.addInstallArtifact(test_harness_exe, .{});
+    install.step.dependOn(&test_harness_install.step);
 }
 
 fn buildExperiments(b: *std.Build, std_target: std.Build.ResolvedTarget, std_optimize: std.builtin.OptimizeMode) void {
     const exe = b.addExecutable(.{
-        .name = "resets_exp",
+        .name = "sweep_exp",
         .target = std_target,
         .optimize = std_optimize,
     });
@@ -344,28 +447,50 @@ fn buildExperiments(b: *std.Build, std_target: std.Build.ResolvedTarget, std_opt
     exe.addCSourceFiles(.{
         .root = b.path("hypervisor"),
         .files = &.{
-            "experiments/resets/resets_exp.cpp",
+            "experiments/sweep/sweep_exp.cpp",
+            "src/corpus.cpp",
             "src/elf_debug.cpp",
             "src/elf_parser.cpp",
+            "src/fuzz_worker.cpp",
+            "src/libc_subst.cpp",
+            "src/patches.cpp",
+            "src/stub_hooks.cpp",
+            "src/displaced_inst.cpp",
+            "src/coverage_exporter.cpp",
+            "src/mapped_file.cpp",
+            "src/line_table.cpp",
+            "src/unwind_table.cpp",
             "src/elfs.cpp",
             "src/files.cpp",
+            "src/harness.cpp",
             "src/hypercalls.cpp",
+            "src/library_resolver.cpp",
             "src/mmu.cpp",
+            "src/mutator.cpp",
             "src/page_walker.cpp",
+            "src/profiler.cpp",
+            "src/exit_recorder.cpp",
+            "src/symbol_index.cpp",
+            "src/console.cpp",
+            "src/replay.cpp",
+            "src/stats.cpp",
             "src/utils.cpp",
             "src/tracing.cpp",
             "src/vm.cpp",
         },
         .flags = &.{
             "-std=c++11",
+            "-pthread",
         },
     });
+    exe.defineCMacro("ENABLE_COVERAGE_BREAKPOINTS", null);
     exe.defineCMacro("ENABLE_INSTRUCTION_COUNT", null);
     exe.linkLibC();
     exe.linkLibCpp();
     exe.linkSystemLibrary("dwarf");
     exe.linkSystemLibrary("elf");
     exe.linkSystemLibrary("crypto");
+    exe.linkSystemLibrary("dl");
     const install = b.addInstallArtifact(exe, .{});
     const build_step = b.step("experiments", "Build experiments");
     build_step.dependOn(&install.step);
@@ -380,6 +505,83 @@ fn buildExperiments(b: *std.Build, std_target: std.Build.ResolvedTarget, std_opt
     install.step.dependOn(&resets_test_install.step);
 }
 
+fn buildBench(b: *std.Build, std_target: std.Build.ResolvedTarget, std_optimize: std.builtin.OptimizeMode) void {
+    const exe = b.addExecutable(.{
+        .name = "bench",
+        .target = std_target,
+        .optimize = std_optimize,
+    });
+    exe.addIncludePath(b.path("hypervisor/include"));
+    exe.addCSourceFiles(.{
+        .root = b.path("hypervisor"),
+        .files = &.{
+            "bench/bench.cpp",
+            "src/corpus.cpp",
+            "src/elf_debug.cpp",
+            "src/elf_parser.cpp",
+            "src/libc_subst.cpp",
+            "src/patches.cpp",
+            "src/stub_hooks.cpp",
+            "src/displaced_inst.cpp",
+            "src/coverage_exporter.cpp",
+            "src/mapped_file.cpp",
+            "src/line_table.cpp",
+            "src/unwind_table.cpp",
+            "src/elfs.cpp",
+            "src/exit_recorder.cpp",
+            "src/symbol_index.cpp",
+            "src/console.cpp",
+            "src/replay.cpp",
+            "src/files.cpp",
+            "src/harness.cpp",
+            "src/hypercalls.cpp",
+            "src/library_resolver.cpp",
+            "src/mmu.cpp",
+            "src/mutator.cpp",
+            "src/page_walker.cpp",
+            "src/profiler.cpp",
+            "src/stats.cpp",
+            "src/tracing.cpp",
+            "src/utils.cpp",
+            "src/vm.cpp",
+        },
+        .flags = &.{
+            "-std=c++11",
+            "-pthread",
+            "-fno-exceptions",
+            "-Wall",
+        },
+    });
+    exe.defineCMacro("ENABLE_COVERAGE_BREAKPOINTS", null);
+    exe.defineCMacro("ENABLE_MUTATIONS", null);
+    exe.defineCMacro("ENABLE_INSTRUCTION_COUNT", null);
+    exe.linkLibC();
+    exe.linkLibCpp();
+    exe.linkSystemLibrary("dwarf");
+    exe.linkSystemLibrary("elf");
+    exe.linkSystemLibrary("crypto");
+    exe.linkSystemLibrary("dl");
+    const install = b.addInstallArtifact(exe, .{});
+
+    // Guest binary used by the vm exit benchmarks
+    const exits_exe = b.addExecutable(.{
+        .name = "bench_exits",
+        .target = std_target,
+    });
+    exits_exe.addAssemblyFile(b.path("hypervisor/bench/binaries/exits.s"));
+    const exits_install = b.addInstallArtifact(exits_exe, .{});
+    install.step.dependOn(&exits_install.step);
+
+    // Run the benchmarks, after installing the kernel. Arguments after `--`
+    // are passed to the bench binary.
+    const run = b.addRunArtifact(exe);
+    run.step.dependOn(&install.step);
+    run.step.dependOn(b.getInstallStep());
+    if (b.args) |args| run.addArgs(args);
+    const run_step = b.step("bench", "Build and run hypervisor microbenchmarks");
+    run_step.dependOn(&run.step);
+}
+
 pub fn build(b: *std.Build) void {
     const std_target = b.standardTargetOptions(.{});
 
@@ -400,4 +602,5 @@ pub fn build(b: *std.Build) void {
     buildSyscallsTests(b, std_target, std_optimize);
     buildHypervisorTests(b, std_target, std_optimize);
     buildExperiments(b, std_target, std_optimize);
+    buildBench(b, std_target, std_optimize);
 }
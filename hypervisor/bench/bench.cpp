@@ -0,0 +1,369 @@
+#include <iostream>
+#include <fstream>
+#include <functional>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <getopt.h>
+#include "vm.h"
+#include "corpus.h"
+#include "utils.h"
+
+using namespace std;
+
+// Microbenchmarks of the hot paths of the fuzzer. Results are written as JSON
+// to bench.json, which can be compared against a previous run with compare.py.
+
+const char* KERNEL_PATH = "./zig-out/bin/kernel";
+const char* EXITS_PATH  = "./zig-out/bin/bench_exits";
+const vsize_t MEMORY    = 64*1024*1024;
+
+struct Options {
+	string filter;
+	string output = "bench.json";
+	size_t repetitions = 5;
+	double min_time = 0.2;
+};
+
+struct Result {
+	string name;
+	size_t iterations;
+
+	// Nanoseconds per iteration of each repetition
+	vector<double> ns_per_iter;
+};
+
+// Function that performs `n` iterations of a benchmark and returns the
+// nanoseconds they took. Benchmarks time themselves so they can leave out the
+// setup of each iteration.
+typedef function<uint64_t(size_t n)> bench_fn_t;
+
+class Bench {
+public:
+	Bench(const Options& options)
+		: m_options(options)
+	{}
+
+	bool enabled(const string& name) const {
+		return name.find(m_options.filter) != string::npos;
+	}
+
+	void run(const string& name, bench_fn_t fn) {
+		if (!enabled(name))
+			return;
+
+		// Find out how many iterations take `min_time`. This also warms up.
+		uint64_t min_ns = m_options.min_time * 1e9;
+		size_t n = 1;
+		uint64_t ns = fn(n);
+		while (ns < min_ns / 10) {
+			n *= 10;
+			ns = fn(n);
+		}
+		n = max<size_t>(1, n * min_ns / max<uint64_t>(ns, 1));
+
+		Result result = { name, n, {} };
+		for (size_t i = 0; i < m_options.repetitions; i++)
+			result.ns_per_iter.push_back((double)fn(n) / n);
+		printf("%-40s %12.1f ns/iter\n", name.c_str(), median(result));
+		m_results.push_back(result);
+	}
+
+	void write_json(ostream& os) const {
+		os << "{\"benchmarks\":[";
+		for (size_t i = 0; i < m_results.size(); i++) {
+			const Result& r = m_results[i];
+			os << (i ? "," : "") << "\n  {\"name\":\"" << r.name << "\""
+			   << ",\"iterations\":" << r.iterations
+			   << ",\"median_ns\":" << median(r)
+			   << ",\"min_ns\":" << *min_element(r.ns_per_iter.begin(), r.ns_per_iter.end())
+			   << ",\"max_ns\":" << *max_element(r.ns_per_iter.begin(), r.ns_per_iter.end())
+			   << "}";
+		}
+		os << "\n]}" << endl;
+	}
+
+private:
+	const Options& m_options;
+	vector<Result> m_results;
+
+	static double median(const Result& result) {
+		vector<double> v = result.ns_per_iter;
+		sort(v.begin(), v.end());
+		return v[v.size()/2];
+	}
+};
+
+uint64_t elapsed_ns(chrono::steady_clock::time_point start) {
+	auto elapsed = chrono::steady_clock::now() - start;
+	return chrono::duration_cast<chrono::nanoseconds>(elapsed).count();
+}
+
+void bench_mmu_reset(Bench& bench, Vm& base) {
+	for (size_t dirty : {0, 1, 16, 64, 256, 1024, 4096}) {
+		Vm runner(base);
+		Stats stats;
+		bench.run("mmu_reset/dirty:" + to_string(dirty), [&](size_t n) {
+			uint64_t ns = 0;
+			for (size_t i = 0; i < n; i++) {
+				for (size_t j = 0; j < dirty; j++)
+					runner.mmu().writep<uint8_t>(j*PAGE_SIZE, 0);
+				auto start = chrono::steady_clock::now();
+				runner.mmu().reset(base.mmu());
+				ns += elapsed_ns(start);
+			}
+			return ns;
+		});
+	}
+}
+
+void bench_virt_to_phys(Bench& bench, Vm& base) {
+	// Translate every page of the loaded segments
+	vector<vaddr_t> addrs;
+	for (const segment_t& segment : base.elf().segments()) {
+		if (segment.type != PT_LOAD)
+			continue;
+		for (vsize_t off = 0; off < segment.memsize; off += PAGE_SIZE)
+			addrs.push_back(segment.vaddr + off);
+	}
+	ASSERT(!addrs.empty(), "no loaded segments");
+
+	// Hits are the common case, as the TLB is only flushed when memory is
+	// reset. Misses, which perform a page walk, are what the first accesses
+	// to each page after a reset cost.
+	for (bool flush : {false, true}) {
+		bench.run(string("virt_to_phys/") + (flush ? "miss" : "hit"), [&](size_t n) {
+			paddr_t sum = 0;
+			auto start = chrono::steady_clock::now();
+			for (size_t i = 0; i < n; i++) {
+				if (flush)
+					base.mmu().flush_tlb();
+				sum += base.mmu().virt_to_phys(addrs[i % addrs.size()]);
+			}
+			uint64_t ns = elapsed_ns(start);
+			asm volatile("" : : "r"(sum));
+			return ns;
+		});
+	}
+}
+
+void bench_addr_to_symbol(Bench& bench, const Vm& base) {
+	// Symbolize an address inside each function of the user elf and kernel
+	vector<vaddr_t> addrs;
+	for (const ElfParser* elf : base.elfs().all_elfs())
+		for (const symbol_t& symbol : elf->symbols())
+			if (symbol.type == STT_FUNC && symbol.value && symbol.size > 1)
+				addrs.push_back(symbol.value + symbol.size/2);
+	ASSERT(!addrs.empty(), "no function symbols");
+
+	bench.run("addr_to_symbol", [&](size_t n) {
+		size_t len = 0;
+		auto start = chrono::steady_clock::now();
+		for (size_t i = 0; i < n; i++)
+			len += base.elfs().addr_to_symbol_str(addrs[i % addrs.size()]).size();
+		uint64_t ns = elapsed_ns(start);
+		asm volatile("" : : "r"(len));
+		return ns;
+	});
+}
+
+void bench_vm_clone(Bench& bench, const Vm& base) {
+	bench.run("vm_clone", [&](size_t n) {
+		auto start = chrono::steady_clock::now();
+		for (size_t i = 0; i < n; i++)
+			Vm runner(base);
+		return elapsed_ns(start);
+	});
+}
+
+void bench_vm_exits(Bench& bench, Vm& base) {
+	Stats stats;
+
+	// Bare vm entry and exit: the breakpoint at `spin` is hit as soon as we
+	// enter the guest
+	if (bench.enabled("vm_exit/breakpoint")) {
+		Vm runner(base);
+		runner.set_breakpoint(runner.elf().resolve_symbol("spin"));
+		bench.run("vm_exit/breakpoint", [&](size_t n) {
+			auto start = chrono::steady_clock::now();
+			for (size_t i = 0; i < n; i++)
+				runner.run(stats);
+			return elapsed_ns(start);
+		});
+	}
+
+	// Exit syscall until the EndRun hypercall. User code can't issue
+	// hypercalls, so this is the shortest path to one from the guest.
+	if (bench.enabled("hypercall/end_run")) {
+		Vm vm(base);
+		vm.regs().rip = vm.elf().resolve_symbol("do_exit");
+		Vm runner(vm);
+		bench.run("hypercall/end_run", [&](size_t n) {
+			uint64_t ns = 0;
+			for (size_t i = 0; i < n; i++) {
+				auto start = chrono::steady_clock::now();
+				Vm::RunEndReason reason = runner.run(stats);
+				ns += elapsed_ns(start);
+				ASSERT(reason == Vm::RunEndReason::Exit, "unexpected reason: %s",
+				       Vm::reason_str(reason));
+				runner.reset(vm, stats);
+			}
+			return ns;
+		});
+	}
+}
+
+void bench_shared_coverage(Bench& bench) {
+#ifdef ENABLE_COVERAGE_BREAKPOINTS
+	// Coverage of a run which hits `blocks` basic blocks, which are already
+	// in the shared coverage as in most runs
+	for (size_t blocks : {1, 16, 256}) {
+		SharedCoverage shared;
+		Coverage cov;
+		for (size_t i = 0; i < blocks; i++)
+			cov.add(0x400000 + i*0x10);
+		shared.add(cov);
+		bench.run("shared_coverage_add/blocks:" + to_string(blocks), [&](size_t n) {
+			auto start = chrono::steady_clock::now();
+			for (size_t i = 0; i < n; i++)
+				shared.add(cov);
+			return elapsed_ns(start);
+		});
+	}
+#endif
+}
+
+void bench_mutator(Bench& bench) {
+	ASSERT(Mutator::mut_strats.size() == Mutator::mut_strats_names.size(),
+	       "mutation strategies and names mismatch");
+	vector<string> corpus = { string(128, 'a'), string(512, 'b'), string(64, 'c') };
+	const string seed(256, 'x');
+	Mutator mutator(corpus);
+	mutator.set_max_input_size(4096);
+	Rng rng;
+	string input;
+	input.reserve(mutator.max_input_size());
+	for (size_t i = 0; i < Mutator::mut_strats.size(); i++) {
+		Mutator::mutation_strat_t strat = Mutator::mut_strats[i];
+		// Mutations are too fast to time individually, so this includes
+		// restoring the seed, which is the same for every strategy
+		bench.run(string("mutator/") + Mutator::mut_strats_names[i], [&](size_t n) {
+			auto start = chrono::steady_clock::now();
+			for (size_t j = 0; j < n; j++) {
+				input.assign(seed);
+				(mutator.*strat)(input, rng);
+			}
+			return elapsed_ns(start);
+		});
+	}
+}
+
+void bench_corpus(Bench& bench) {
+	char tmp[] = "/tmp/kvm-fuzz-bench-XXXXXX";
+	ERROR_ON(!mkdtemp(tmp), "mkdtemp");
+	string input_dir = string(tmp) + "/in", output_dir = string(tmp) + "/out";
+	utils::create_folder(input_dir);
+	for (size_t i = 0; i < 16; i++)
+		utils::write_file(input_dir + "/" + to_string(i), string(64 + i*16, 'a' + i));
+
+	size_t max_threads = thread::hardware_concurrency();
+	for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+		Corpus corpus(threads, input_dir, output_dir);
+		corpus.set_mode_normal(Coverage());
+		ThreadStats stats(threads);
+
+		// Every thread gets `n` inputs, and we measure the time until all of
+		// them finish
+		bench.run("corpus_get_new_input/threads:" + to_string(threads), [&](size_t n) {
+			vector<thread> workers;
+			auto start = chrono::steady_clock::now();
+			for (size_t id = 0; id < threads; id++) {
+				workers.push_back(thread([&, id]() {
+					Rng rng;
+					for (size_t i = 0; i < n; i++)
+						corpus.get_new_input(id, rng, stats[id]);
+				}));
+			}
+			for (thread& t : workers)
+				t.join();
+			return elapsed_ns(start);
+		});
+	}
+	system(("rm -rf " + string(tmp)).c_str());
+}
+
+void print_usage() {
+	printf("Usage: bench [options]\n"
+	       "  -f, --filter str   Only run benchmarks whose name contains str\n"
+	       "  -o, --output path  Write JSON results to path (default: bench.json)\n"
+	       "  -r, --reps n       Repetitions of each benchmark (default: 5)\n"
+	       "  -t, --time s       Minimum time of each repetition (default: 0.2)\n"
+	       "  -h, --help         Print usage\n");
+}
+
+bool parse_options(int argc, char** argv, Options& options) {
+	option long_options[] = {
+		{"filter", required_argument, nullptr, 'f'},
+		{"output", required_argument, nullptr, 'o'},
+		{"reps", required_argument, nullptr, 'r'},
+		{"time", required_argument, nullptr, 't'},
+		{"help", no_argument, nullptr, 'h'},
+		{0, 0, 0, 0},
+	};
+	int opt;
+	while ((opt = getopt_long(argc, argv, "f:o:r:t:h", long_options, nullptr)) > 0) {
+		switch (opt) {
+			case 'f':
+				options.filter = optarg;
+				break;
+			case 'o':
+				options.output = optarg;
+				break;
+			case 'r':
+				if (sscanf(optarg, "%lu", &options.repetitions) < 1 || !options.repetitions) {
+					print_usage();
+					return false;
+				}
+				break;
+			case 't':
+				if (sscanf(optarg, "%lf", &options.min_time) < 1 || options.min_time <= 0) {
+					print_usage();
+					return false;
+				}
+				break;
+			default:
+				print_usage();
+				return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	if (!parse_options(argc, argv, options))
+		return EXIT_FAILURE;
+
+	Bench bench(options);
+
+	// Base vm, stopped at `spin`
+	Stats stats;
+	Vm base(MEMORY, KERNEL_PATH, EXITS_PATH, {EXITS_PATH});
+	base.run_until(base.elf().resolve_symbol("spin"), stats);
+
+	bench_mmu_reset(bench, base);
+	bench_virt_to_phys(bench, base);
+	bench_addr_to_symbol(bench, base);
+	bench_vm_clone(bench, base);
+	bench_vm_exits(bench, base);
+	bench_shared_coverage(bench);
+	bench_mutator(bench);
+	bench_corpus(bench);
+
+	ofstream os(options.output);
+	ERROR_ON(!os.good(), "opening %s", options.output.c_str());
+	bench.write_json(os);
+	printf("Results written to %s\n", options.output.c_str());
+	return 0;
+}
@@ -0,0 +1,15 @@
+.global _start
+.global spin
+.global do_exit
+
+# Guest used by the vm exit benchmarks. The hypervisor places a breakpoint at
+# `spin` to measure a bare vm entry and exit, and starts running at `do_exit`
+# to measure the exit syscall until the EndRun hypercall.
+.text
+_start:
+spin:
+	nop
+do_exit:
+	mov $60, %eax
+	xor %edi, %edi
+	syscall
@@ -0,0 +1,50 @@
+#!/usr/bin/env python3
+import sys
+import json
+import argparse
+
+# Compare the results of two runs of the microbenchmarks. Exits with status 1
+# if any benchmark got slower than the threshold.
+
+def read_results(path):
+	with open(path) as f:
+		return {b["name"]: b for b in json.load(f)["benchmarks"]}
+
+def main():
+	parser = argparse.ArgumentParser(description="Compare benchmark results against a baseline")
+	parser.add_argument("baseline", help="baseline JSON, e.g. from a previous `zig build bench`")
+	parser.add_argument("current", help="current JSON")
+	parser.add_argument("-t", "--threshold", type=float, default=10,
+	                    help="regression threshold, in percent (default: 10)")
+	args = parser.parse_args()
+
+	baseline = read_results(args.baseline)
+	current = read_results(args.current)
+	regressions = 0
+	print("%-40s %14s %14s %9s" % ("benchmark", "baseline ns", "current ns", "change"))
+	for name, bench in current.items():
+		if name not in baseline:
+			print("%-40s %14s %14.1f %9s" % (name, "-", bench["median_ns"], "new"))
+			continue
+
+		# Use the minimum of the baseline and the median of the current run,
+		# so noise in the baseline doesn't hide regressions and a single slow
+		# repetition doesn't report one
+		old = baseline[name]["min_ns"]
+		new = bench["median_ns"]
+		change = (new - old) / old * 100 if old else 0
+		mark = ""
+		if change > args.threshold:
+			mark = "  REGRESSION"
+			regressions += 1
+		print("%-40s %14.1f %14.1f %+8.1f%%%s" % (name, old, new, change, mark))
+
+	for name in baseline.keys() - current.keys():
+		print("%-40s %14.1f %14s %9s" % (name, baseline[name]["min_ns"], "-", "missing"))
+
+	if regressions:
+		print("%d benchmarks regressed more than %.1f%%" % (regressions, args.threshold))
+		sys.exit(1)
+
+if __name__ == "__main__":
+	main()
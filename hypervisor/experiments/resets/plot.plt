@@ -8,7 +8,13 @@ set ylabel "Executions per second"
 set logscale x
 set logscale y
 
-plot "./hypervisor/experiments/resets/output_kvmfuzz" using 1:2 with lines title "kvm-fuzz", \
+# kvmfuzz: converted from the output of the previous resets_exp, which took a
+# single measure. Regenerate it with:
+#   ./zig-out/bin/sweep_exp -j 1 -d 1-10000:10 -o ./hypervisor/experiments/resets/output_kvmfuzz.csv
+# Its columns are: coverage, memory, dirty_pages, jobs, fcps, fcps_ci95, ...
+kvmfuzz="< tail -n +2 ./hypervisor/experiments/resets/output_kvmfuzz.csv | tr ',' ' '"
+
+plot kvmfuzz using 3:5 with lines title "kvm-fuzz", \
      "./hypervisor/experiments/resets/output_nyx" using 1:2 with lines title "Nyx", \
      "./hypervisor/experiments/resets/output_aflpp" using 1:2 with lines title "AFL++"
 
@@ -5,11 +5,15 @@ set ylabel "Speedup"
 set xlabel "Cores"
 
 # aflpp: empty
-# kvmfuzz: readelf -l
+# kvmfuzz: fuzzing readelf -a, converted from the output of the previous
+# script, which took a single measure. Regenerate it with:
+#   ./zig-out/bin/sweep_exp -m 8M -i ./in -o ./hypervisor/experiments/scalability/output_kvmfuzz.csv -- ./test_bins/readelf-static -a input
+# Its columns are: coverage, memory, dirty_pages, jobs, fcps, fcps_ci95, ...
+kvmfuzz="< tail -n +2 ./hypervisor/experiments/scalability/output_kvmfuzz.csv | tr ',' ' '"
 first_val_aflpp=system("awk 'FNR == 1 {print $2}' ./hypervisor/experiments/scalability/output_aflpp")
-first_val_kvmfuzz=system("awk 'FNR == 1 {print $2}' ./hypervisor/experiments/scalability/output_kvmfuzz")
+first_val_kvmfuzz=system("awk -F, 'FNR == 2 {print $5}' ./hypervisor/experiments/scalability/output_kvmfuzz.csv")
 
-plot "./hypervisor/experiments/scalability/output_kvmfuzz" using ($1):($2/first_val_kvmfuzz) with lines title "kvm-fuzz", \
+plot kvmfuzz using ($4):($5/first_val_kvmfuzz):($6/first_val_kvmfuzz) with yerrorlines title "kvm-fuzz", \
      "./hypervisor/experiments/scalability/output_aflpp" using ($1):($2/first_val_aflpp) with lines title "AFL++"
 
 set terminal pdfcairo enhanced color notransparent
@@ -0,0 +1,441 @@
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cctype>
+#include <cstring>
+#include <memory>
+#include <getopt.h>
+#include "vm.h"
+#include "corpus.h"
+#include "harness.h"
+#include "patches.h"
+#include "replay.h"
+#include "fuzz_worker.h"
+#include "utils.h"
+
+using namespace std;
+
+// Measures fuzz cases per second of the hypervisor for every combination of
+// number of threads, memory size, dirty pages and coverage backend. Results
+// are written as CSV, one line per combination, which is what the plot.plt
+// files of the resets and scalability experiments read.
+// By default it runs resets_test, which dirties a given number of pages each
+// run. If a binary is given, it's fuzzed with the fuzzer's worker loop
+// instead, mutating inputs of the given corpus and reporting coverage, so
+// the whole fuzz loop is measured on a real target.
+
+const char* KERNEL_PATH = "./zig-out/bin/kernel";
+const char* TEST_PATH   = "./zig-out/bin/resets_test";
+
+enum class CoverageType {
+	None,
+	Compiled,
+};
+
+struct Config {
+	size_t jobs;
+	size_t memory;
+	size_t dirty_pages;
+	CoverageType coverage;
+};
+
+struct Options {
+	vector<size_t> jobs;
+	vector<size_t> memory = { 64*1024*1024 };
+	vector<size_t> dirty_pages = { 0 };
+	vector<CoverageType> coverage = { CoverageType::None };
+	size_t repetitions = 5;
+	double warmup = 1;
+	double duration = 2;
+	bool pin = true;
+	string output;
+
+	// Fuzzed binary and its arguments, or empty for resets_test
+	vector<string> binary_argv;
+	string input_dir;
+	string fuzz_output_dir = "./sweep_output";
+	size_t timeout_ms = 2;
+};
+
+struct Measure {
+	double fcps_mean;
+	double fcps_ci95;
+	double reset_pages_per_case;
+};
+
+const char* coverage_str(CoverageType coverage) {
+#if defined(ENABLE_COVERAGE_BREAKPOINTS)
+	const char* compiled = "breakpoints";
+#elif defined(ENABLE_COVERAGE_INTEL_PT)
+	const char* compiled = "intelpt";
+#else
+	const char* compiled = "none";
+#endif
+	return (coverage == CoverageType::None ? "none" : compiled);
+}
+
+// Two-sided 95% quantile of the Student's t distribution with `n` degrees of
+// freedom
+double t_quantile_95(size_t n) {
+	static const double table[] = {
+		0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+		2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093,
+		2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045,
+		2.042,
+	};
+	return (n < sizeof(table)/sizeof(*table) ? table[n] : 1.96);
+}
+
+void resets_worker(const Vm& base, Stats& stats, const atomic<bool>& stop) {
+	Vm runner(base);
+	Vm::RunEndReason reason;
+	while (!stop) {
+		reason = runner.run(stats);
+		ASSERT(reason == Vm::RunEndReason::Breakpoint, "unexpected reason: %s",
+		       Vm::reason_str(reason));
+		runner.reset_coverage();
+		runner.reset(base, stats);
+		stats.cases++;
+	}
+}
+
+uint64_t total_cases(const ThreadStats& stats) {
+	uint64_t cases = 0;
+	for (size_t i = 0; i < stats.size(); i++)
+		cases += stats[i].cases;
+	return cases;
+}
+
+uint64_t total_reset_pages(const ThreadStats& stats) {
+	uint64_t pages = 0;
+	for (size_t i = 0; i < stats.size(); i++)
+		pages += stats[i].reset_pages;
+	return pages;
+}
+
+// Set up resets_test as the fuzzer would, running until the fork point and
+// ending runs at fuzz_end
+unique_ptr<Vm> setup_resets(const Config& config, Stats& stats) {
+	unique_ptr<Vm> base(new Vm(config.memory, KERNEL_PATH, TEST_PATH,
+	                           {TEST_PATH, to_string(config.dirty_pages)}));
+	vaddr_t start_addr = base->elf().resolve_symbol("fuzz_start");
+	vaddr_t end_addr = base->elf().resolve_symbol("fuzz_end");
+	ASSERT(start_addr && end_addr, "no fuzz_start or fuzz_end in %s", TEST_PATH);
+	base->run_until(start_addr, stats);
+	base->set_breakpoint(end_addr);
+	return base;
+}
+
+// Set up the fuzzed binary as the fuzzer does without any optional feature:
+// inputs are read from the file "input", runs start at main and end at exit
+unique_ptr<Vm> setup_fuzz(const Config& config, const Options& options,
+                          const Corpus& corpus, Stats& stats)
+{
+	const string& binary = options.binary_argv[0];
+	unique_ptr<Vm> base(new Vm(config.memory, KERNEL_PATH, binary,
+	                           options.binary_argv));
+	base->create_input_slot(corpus.max_input_size());
+	vaddr_t fork_addr = base->elf().resolve_symbol("main");
+	if (!fork_addr)
+		fork_addr = base->elf().entry();
+	base->run_until(fork_addr, stats);
+	vaddr_t exit_addr = base->elfs().resolve_symbol("exit");
+	if (exit_addr)
+		base->set_breakpoint(exit_addr);
+	base->reset_timer();
+	base->set_timeout(options.timeout_ms * 1000);
+	return base;
+}
+
+Measure measure(const Config& config, const Options& options) {
+	Stats stats;
+	bool fuzz = !options.binary_argv.empty();
+	unique_ptr<Corpus> corpus;
+	unique_ptr<Vm> base;
+	if (fuzz) {
+		corpus.reset(new Corpus(config.jobs, options.input_dir, options.fuzz_output_dir));
+		base = setup_fuzz(config, options, *corpus, stats);
+	} else {
+		base = setup_resets(config, stats);
+	}
+	if (config.coverage == CoverageType::Compiled)
+		base->setup_coverage();
+
+	// Run the seed inputs to get the initial coverage, as the fuzzer does
+	Harness harness;
+	FixupPlugin fixup;
+	Replay replay;
+	if (fuzz) {
+		Vm runner(*base);
+		for (size_t i = 0; i < corpus->size(); i++) {
+			set_input(runner, harness, corpus->element(i));
+			runner.run(stats);
+			runner.reset(*base, stats);
+		}
+		corpus->set_mode_normal(runner.coverage());
+	}
+
+	// Create threads, binding each one to a core as the fuzzer does
+	atomic<bool> stop(false);
+	ThreadStats thread_stats(config.jobs);
+	vector<thread> threads;
+	cpu_set_t cpu;
+	worker_t fuzz_worker = get_worker(Timetrace::Off);
+	for (size_t i = 0; i < config.jobs; i++) {
+		thread t;
+		if (fuzz)
+			t = thread(fuzz_worker, (int)i, cref(*base), (const Vm*)nullptr,
+			           cref(harness), cref(fixup), ref(*corpus), ref(replay),
+			           ref(thread_stats[i]), cref(stop));
+		else
+			t = thread(resets_worker, cref(*base), ref(thread_stats[i]), cref(stop));
+		if (options.pin) {
+			CPU_ZERO(&cpu);
+			CPU_SET(i % thread::hardware_concurrency(), &cpu);
+			int ret = pthread_setaffinity_np(t.native_handle(), sizeof(cpu), &cpu);
+			ASSERT(ret == 0, "Binding thread to core %lu: %s", i, strerror(ret));
+		}
+		threads.push_back(move(t));
+	}
+
+	// Warm up, then take one measure of fuzz cases per second for each
+	// repetition
+	this_thread::sleep_for(chrono::duration<double>(options.warmup));
+	vector<double> fcps;
+	uint64_t cases_start = total_cases(thread_stats);
+	uint64_t pages_start = total_reset_pages(thread_stats);
+	uint64_t cases_old = cases_start, cases_now;
+	auto time_old = chrono::steady_clock::now(), time_now = time_old;
+	for (size_t i = 0; i < options.repetitions; i++) {
+		this_thread::sleep_for(chrono::duration<double>(options.duration));
+		cases_now = total_cases(thread_stats);
+		time_now = chrono::steady_clock::now();
+		chrono::duration<double> elapsed = time_now - time_old;
+		fcps.push_back((cases_now - cases_old) / elapsed.count());
+		cases_old = cases_now;
+		time_old = time_now;
+	}
+	uint64_t pages = total_reset_pages(thread_stats) - pages_start;
+
+	stop = true;
+	for (thread& t : threads)
+		t.join();
+
+	Measure result;
+	size_t n = fcps.size();
+	double sum = 0, sum_sq = 0;
+	for (double value : fcps)
+		sum += value;
+	result.fcps_mean = sum / n;
+	for (double value : fcps)
+		sum_sq += (value - result.fcps_mean) * (value - result.fcps_mean);
+	double stddev = (n > 1 ? sqrt(sum_sq / (n - 1)) : 0);
+	result.fcps_ci95 = t_quantile_95(n - 1) * stddev / sqrt(n);
+	result.reset_pages_per_case = (double)pages / max<uint64_t>(cases_old - cases_start, 1);
+	return result;
+}
+
+bool parse_size(const string& s, size_t& result) {
+	size_t i = 0;
+	result = stoul(s, &i);
+	switch (s[i]) {
+		case 'G':
+			result *= 1024;
+		case 'M':
+			result *= 1024;
+		case 'K':
+			result *= 1024;
+		case 0:
+			break;
+		default:
+			return false;
+	}
+	return true;
+}
+
+// Parse a comma-separated list of sizes, where each element can also be a
+// range `start-end` or `start-end:step`
+bool parse_list(const string& s, vector<size_t>& result) {
+	result.clear();
+	for (string element : utils::split_string(s, ",")) {
+		size_t start, end, step = 1;
+		size_t colon = element.find(':');
+		if (colon != string::npos) {
+			if (!isdigit(element[colon + 1]) ||
+			    !parse_size(element.substr(colon + 1), step) || step == 0)
+				return false;
+			element = element.substr(0, colon);
+		}
+
+		size_t dash = element.find('-');
+		if (!isdigit(element[0]) || (dash != string::npos && !isdigit(element[dash + 1])))
+			return false;
+		if (dash == string::npos) {
+			if (!parse_size(element, start))
+				return false;
+			end = start;
+		} else {
+			if (!parse_size(element.substr(0, dash), start) ||
+			    !parse_size(element.substr(dash + 1), end) || start > end)
+				return false;
+		}
+		for (size_t i = start; i <= end; i += step)
+			result.push_back(i);
+	}
+	return !result.empty();
+}
+
+bool parse_coverage(const string& s, vector<CoverageType>& result) {
+	result.clear();
+	for (const string& element : utils::split_string(s, ",")) {
+		if (element == "none")
+			result.push_back(CoverageType::None);
+		else if (element == coverage_str(CoverageType::Compiled))
+			result.push_back(CoverageType::Compiled);
+		else
+			return false;
+	}
+	return !result.empty();
+}
+
+void print_usage() {
+	printf("Usage: sweep_exp [options] [-- binary [args]]\n"
+	       "Runs resets_test, or fuzzes binary with the corpus given with -i.\n"
+	       "Lists are comma-separated, and numeric ones accept ranges such as 1-8 or\n"
+	       "1-1000:10.\n"
+	       "  -j, --jobs list       Number of threads (default: 1-%u)\n"
+	       "  -m, --memory list     Vm memory, optionally followed by K, M or G (default: 64M)\n"
+	       "  -d, --dirty list      Pages dirtied by each run of resets_test (default: 0)\n"
+	       "  -c, --coverage list   Coverage backends: none or %s (default: none)\n"
+	       "  -r, --reps n          Measures of each combination (default: 5)\n"
+	       "  -w, --warmup secs     Time before measuring (default: 1)\n"
+	       "  -t, --time secs       Duration of each measure (default: 2)\n"
+	       "      --no-pin          Don't bind threads to cores\n"
+	       "  -i, --input dir       Corpus of the fuzzed binary\n"
+	       "      --timeout ms      Timeout of each run of the fuzzed binary (default: 2)\n"
+	       "      --fuzz-output dir Output of the fuzzed binary (default: ./sweep_output)\n"
+	       "  -o, --output path     Write CSV to path instead of stdout\n"
+	       "  -h, --help            Print usage\n",
+	       thread::hardware_concurrency(), coverage_str(CoverageType::Compiled));
+}
+
+bool parse_options(int argc, char** argv, Options& options) {
+	enum LongOptions {
+		NoPin = 0x100,
+		Timeout,
+		FuzzOutput,
+	};
+	option long_options[] = {
+		{"jobs", required_argument, nullptr, 'j'},
+		{"memory", required_argument, nullptr, 'm'},
+		{"dirty", required_argument, nullptr, 'd'},
+		{"coverage", required_argument, nullptr, 'c'},
+		{"reps", required_argument, nullptr, 'r'},
+		{"warmup", required_argument, nullptr, 'w'},
+		{"time", required_argument, nullptr, 't'},
+		{"no-pin", no_argument, nullptr, LongOptions::NoPin},
+		{"input", required_argument, nullptr, 'i'},
+		{"timeout", required_argument, nullptr, LongOptions::Timeout},
+		{"fuzz-output", required_argument, nullptr, LongOptions::FuzzOutput},
+		{"output", required_argument, nullptr, 'o'},
+		{"help", no_argument, nullptr, 'h'},
+		{0, 0, 0, 0},
+	};
+
+	for (size_t i = 1; i <= thread::hardware_concurrency(); i++)
+		options.jobs.push_back(i);
+
+	int opt;
+	bool ok = true, dirty = false;
+	while (ok && (opt = getopt_long(argc, argv, "j:m:d:c:r:w:t:i:o:h", long_options, nullptr)) > 0) {
+		switch (opt) {
+			case 'j':
+				ok = parse_list(optarg, options.jobs);
+				for (size_t jobs : options.jobs)
+					ok = ok && jobs > 0;
+				break;
+			case 'm':
+				ok = parse_list(optarg, options.memory);
+				break;
+			case 'd':
+				ok = parse_list(optarg, options.dirty_pages);
+				dirty = true;
+				break;
+			case 'c':
+				ok = parse_coverage(optarg, options.coverage);
+				break;
+			case 'r':
+				ok = sscanf(optarg, "%lu", &options.repetitions) == 1 && options.repetitions > 0;
+				break;
+			case 'w':
+				ok = sscanf(optarg, "%lf", &options.warmup) == 1 && options.warmup >= 0;
+				break;
+			case 't':
+				ok = sscanf(optarg, "%lf", &options.duration) == 1 && options.duration > 0;
+				break;
+			case LongOptions::NoPin:
+				options.pin = false;
+				break;
+			case 'i':
+				options.input_dir = optarg;
+				break;
+			case LongOptions::Timeout:
+				ok = sscanf(optarg, "%lu", &options.timeout_ms) == 1 && options.timeout_ms > 0;
+				break;
+			case LongOptions::FuzzOutput:
+				options.fuzz_output_dir = optarg;
+				break;
+			case 'o':
+				options.output = optarg;
+				break;
+			default:
+				ok = false;
+		}
+	}
+
+	// The fuzzed binary and its arguments. Dirty pages only apply to
+	// resets_test, and the fuzzed binary needs a corpus.
+	for (int i = optind; i < argc; i++)
+		options.binary_argv.push_back(argv[i]);
+	bool fuzz = !options.binary_argv.empty();
+	ok = ok && (fuzz ? !dirty && !options.input_dir.empty() : options.input_dir.empty());
+	if (!ok)
+		print_usage();
+	return ok;
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	if (!parse_options(argc, argv, options))
+		return EXIT_FAILURE;
+
+	ofstream file;
+	if (!options.output.empty()) {
+		file.open(options.output);
+		ERROR_ON(!file.good(), "opening %s", options.output.c_str());
+	}
+	ostream& os = (options.output.empty() ? cout : file);
+
+	const string target = (options.binary_argv.empty() ? "resets_test"
+	                                                   : options.binary_argv[0]);
+	os << "coverage,memory,dirty_pages,jobs,fcps,fcps_ci95,fcps_per_job,"
+	      "reset_pages_per_case,target" << endl;
+	for (CoverageType coverage : options.coverage)
+	for (size_t memory : options.memory)
+	for (size_t dirty_pages : options.dirty_pages)
+	for (size_t jobs : options.jobs) {
+		Config config = { jobs, memory, dirty_pages, coverage };
+		Measure m = measure(config, options);
+		os << coverage_str(coverage) << "," << memory << "," << dirty_pages
+		   << "," << jobs << "," << m.fcps_mean << "," << m.fcps_ci95 << ","
+		   << m.fcps_mean / jobs << "," << m.reset_pages_per_case << ","
+		   << target << endl;
+		fprintf(stderr, "coverage %s, memory %lu, dirty pages %lu, jobs %lu: "
+		        "%.0f +- %.0f fcps\n", coverage_str(coverage), memory, dirty_pages,
+		        jobs, m.fcps_mean, m.fcps_ci95);
+	}
+	return 0;
+}
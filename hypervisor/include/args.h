@@ -4,6 +4,9 @@
 #include <string>
 #include <vector>
 #include <tracing.h>
+#include <stats.h>
+#include <harness.h>
+#include <libc_subst.h>
 
 struct Args {
 	static const uint DEFAULT_NUM_THREADS;
@@ -15,6 +18,11 @@ struct Args {
 	std::string input_dir = "./in";
 	std::string output_dir = "./out";
 	std::vector<std::string> memory_files;
+	std::string sysroot;
+	std::string harness;
+	bool end_at_return = false;
+	std::vector<std::string> end_symbols;
+	Harness::Layout harness_layout = Harness::DEFAULT_LAYOUT;
 	std::string binary_path;
 	std::vector<std::string> binary_argv;
 	bool single_run = false;
@@ -23,6 +31,21 @@ struct Args {
 	bool minimize_crashes = false;
 	Tracing::Type tracing_type = Tracing::Type::None;
 	Tracing::Unit tracing_unit = Tracing::Unit::Cycles;
+	size_t tracing_sample = 0;
+	Timetrace timetrace = Timetrace::Off;
+	size_t profile_period = 0;
+	size_t exit_recorder_size = 0;
+	size_t slow_case_us = 0;
+	size_t output_limit = 0;
+	bool capture_output = false;
+	size_t coverage_report = 0;
+	std::string patches_path;
+	std::string patch_fixup_path;
+	unsigned libc_subst = 0;
+	size_t libc_heap = 0;
+	bool record = false;
+	uint64_t seed = 0;
+	std::string replay_dir;
 
 	// Args(int argc, char** argv);
 	bool parse(int argc, char** argv);
@@ -0,0 +1,31 @@
+#ifndef _CODE_BUILDER_H
+#define _CODE_BUILDER_H
+
+#include <vector>
+#include "common.h"
+
+// Helpers for assembling the code the hypervisor places in the guest, such
+// as stub hook trampolines, patches and libc substitutions
+
+// Append the bytes of `value`, such as an immediate or a displacement
+template <class T>
+void append(std::vector<uint8_t>& code, T value) {
+	const uint8_t* p = (const uint8_t*)&value;
+	code.insert(code.end(), p, p + sizeof(value));
+}
+
+// Append a jump placed at `from` to `to`. Elfs and libraries may be too far
+// from the code placed by the hypervisor for a relative jump, in which case
+// it jumps to an absolute address: jmp [rip]; .quad to
+inline void append_jmp(std::vector<uint8_t>& code, vaddr_t from, vaddr_t to) {
+	int64_t rel = to - (from + 5);
+	if (rel == (int32_t)rel) {
+		code.push_back(0xE9);
+		append<int32_t>(code, rel);
+	} else {
+		code.insert(code.end(), {0xFF, 0x25, 0x00, 0x00, 0x00, 0x00});
+		append<uint64_t>(code, to);
+	}
+}
+
+#endif
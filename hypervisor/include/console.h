@@ -0,0 +1,67 @@
+#ifndef _CONSOLE_H
+#define _CONSOLE_H
+
+#include <string>
+#include <chrono>
+#include "common.h"
+
+class Vm;
+
+// Guest console. The kernel appends its output and the output of the target
+// to a ring in its memory, which we drain at the end of each run, or when the
+// kernel flushes it because it's full. Output printed by each runner can be
+// rate limited, and the output of each run can be captured so it's saved
+// along with crashes.
+class Console {
+public:
+	// Keep this the same as in the kernel
+	static const size_t RING_SIZE = 4096;
+
+	// Maximum output captured for a single run
+	static const size_t MAX_CAPTURE_SIZE = 64*1024;
+
+	Console(Vm& vm);
+	Console(Vm& vm, const Console& other);
+
+	// Submitted by the kernel
+	void set_ring_addr(vaddr_t ring_addr);
+
+	// Print at most `bytes_per_sec` bytes per second, or unlimited if it's 0.
+	// Output over the limit is dropped.
+	void set_rate_limit(size_t bytes_per_sec);
+
+	// Keep the output of each run, which can be obtained with `captured()`
+	void set_capture(bool capture);
+	bool capturing() const;
+	const std::string& captured() const;
+
+	// Print the output in the ring and empty it
+	void drain();
+
+	// Clear captured output of last run
+	void reset();
+
+private:
+	// Keep this the same as in the kernel
+	struct RingHeader {
+		uint64_t len;
+	};
+
+	Vm& m_vm;
+	vaddr_t m_ring_addr;
+	size_t m_rate_limit;
+	bool m_capture;
+	std::string m_captured;
+
+	// Whether last output ended with a newline, so the next one needs prefix
+	bool m_line_start;
+
+	// Bytes printed and dropped in the current second
+	std::chrono::steady_clock::time_point m_window_start;
+	size_t m_window_bytes;
+	size_t m_dropped_bytes;
+
+	void print(const char* data, size_t len);
+};
+
+#endif
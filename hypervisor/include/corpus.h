@@ -11,11 +11,14 @@
 #include "files.h"
 #include "mutator.h"
 #include "rng.h"
+#include "replay.h"
 
 class Corpus {
 public:
 	static constexpr const char* CORPUS_DIR      = "corpus";
 	static constexpr const char* CRASHES_DIR     = "crashes";
+	static constexpr const char* CRASHES_OUT_DIR = "crashes_output";
+	static constexpr const char* CRASHES_PATCHED_DIR = "crashes_patched";
 	static constexpr const char* MIN_CORPUS_DIR  = "minimized_corpus";
 	static constexpr const char* MIN_CRASHES_DIR = "minimized_crashes";
 
@@ -30,6 +33,12 @@ public:
 	std::string seed_filename(size_t i) const;
 	FileRef element(size_t i) const;
 
+#ifdef ENABLE_COVERAGE_BREAKPOINTS
+	// Get the basic blocks covered after the first `from` ones. Returns the
+	// number of blocks covered so far.
+	size_t new_blocks(size_t from, std::vector<vaddr_t>& blocks);
+#endif
+
 	// Set mode. This must be called before doing anything else. Normal mode
 	// requires the total coverage of the seed corpus, while minimization
 	// modes require the coverage or fault associated to each seed input.
@@ -37,13 +46,26 @@ public:
 	void set_mode_corpus_min(const std::vector<Coverage>& coverages);
 	void set_mode_crashes_min(const std::vector<FaultInfo>& faults);
 
+	// Record the choices of each thread to `replay`, or take them from it,
+	// depending on its mode
+	void set_replay(Replay& replay);
+
 	// Get a new mutated input, which will be a constant reference to
 	// `mutated_inputs[id]`
+	template <Timetrace timetrace = Timetrace::Off>
 	FileRef get_new_input(int id, Rng& rng, Stats& stats);
 
 	// Report a new crash on a given vm
 	void report_crash(int id, Vm& vm);
 
+	// Report a crash of an input other than the last mutated input of the
+	// thread, such as an input fixed up to reproduce it without patches
+	void report_crash(Vm& vm, const std::string& input);
+
+	// Report a crash that only happens on the patched vm. They are saved apart
+	// and aren't counted as unique crashes.
+	void report_patched_crash(int id, Vm& vm);
+
 	// Report coverage of a run
 	void report_coverage(int id, const Coverage& cov);
 
@@ -59,6 +81,8 @@ private:
 	std::string m_input_dir;
 	std::string m_output_dir_corpus;
 	std::string m_output_dir_crashes;
+	std::string m_output_dir_crashes_output;
+	std::string m_output_dir_crashes_patched;
 	std::string m_output_dir_min_corpus;
 	std::string m_output_dir_min_crashes;
 
@@ -70,6 +94,9 @@ private:
 	std::unordered_set<FaultInfo> m_crashes;
 	std::atomic_flag m_lock_crashes;
 
+	// Unique crashes that only happen on the patched vm
+	std::unordered_set<FaultInfo> m_crashes_patched;
+
 	// Vector with one mutated input for each thread. No need to lock
 	std::vector<std::string> m_mutated_inputs;
 
@@ -95,11 +122,20 @@ private:
 	// Input mutation
 	Mutator m_mutator;
 
-	// Add input to corpus and write it to corpus dir
-	void add_input(const std::string& new_input);
+	// Session being recorded or replayed, if any
+	Replay* m_replay;
+
+	// Take the corpus lock once it has at least `size` elements
+	void lock_corpus_with_size(size_t size);
+
+	// Add input to corpus and write it to corpus dir, returning its index. If
+	// `index` is given, wait until it's the next free index.
+	size_t add_input(const std::string& new_input,
+	                 size_t index = Replay::NOT_ADDED);
 
-	// Mutate input in `mutated_inputs[id]`
-	void mutate_input(int id, Rng& rng);
+	// Mutate input in `mutated_inputs[id]`, splicing only with the first
+	// `corpus_size` elements of the corpus
+	void mutate_input(int id, Rng& rng, size_t corpus_size);
 
 	// Check if last mutation reduced the file size while keeping the fault/cov
 	// the same. In that case, replace associated input in the corpus with
@@ -121,8 +157,9 @@ private:
 	// is overloaded so we can get it from `m_mutated_inputs[id]` in case we
 	// decide not to add crash files to corpus.
 	void write_corpus_file(size_t i);
-	void write_crash_file(int id, const FaultInfo& fault);
+	void write_crash_file(const std::string& input, const FaultInfo& fault);
 	void write_crash_file(size_t i, const FaultInfo& fault);
+	void write_crash_output_file(const FaultInfo& fault, const std::string& output);
 	void write_min_corpus_file(size_t i);
 	void write_min_crash_file(size_t i);
 };
\ No newline at end of file
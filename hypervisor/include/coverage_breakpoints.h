@@ -3,6 +3,7 @@
 
 #include <set>
 #include <unordered_set>
+#include <vector>
 #include <atomic>
 #include "common.h"
 
@@ -38,7 +39,8 @@ private:
 
 class SharedCoverageBreakpoints : public CoverageBreakpoints<std::unordered_set<vaddr_t>> {
 public:
-	using CoverageBreakpoints::operator=;
+	template <class T>
+	SharedCoverageBreakpoints& operator=(const CoverageBreakpoints<T>& other);
 	bool add(vaddr_t) = delete;
 
 	// Number of basic blocks added with `add`
@@ -47,8 +49,16 @@ public:
 	template <class T>
 	bool add(const CoverageBreakpoints<T>& other);
 
+	// Append to `result` the blocks covered after the first `from` ones, in
+	// the order they were covered. Returns the number of blocks covered so far,
+	// which can be used as `from` in the next call.
+	size_t new_blocks(size_t from, std::vector<vaddr_t>& result);
+
 private:
 	std::atomic_flag m_lock = ATOMIC_FLAG_INIT;
+
+	// Blocks in the order they were covered
+	std::vector<vaddr_t> m_log;
 };
 
 
@@ -110,6 +120,15 @@ typename T::iterator CoverageBreakpoints<T>::end() {
 	return m_basic_blocks.end();
 }
 
+template <class T>
+SharedCoverageBreakpoints& SharedCoverageBreakpoints::operator=(
+	const CoverageBreakpoints<T>& other
+) {
+	CoverageBreakpoints::operator=(other);
+	m_log.assign(blocks().begin(), blocks().end());
+	return *this;
+}
+
 inline size_t SharedCoverageBreakpoints::count() const {
 	return blocks().size();
 }
@@ -122,12 +141,25 @@ inline bool SharedCoverageBreakpoints::add(const CoverageBreakpoints<T>& other)
 	// This could also be done as a bitmap if we want more performance, but
 	// it isn't worth it for now.
 	size_t prev_count = count();
-	blocks().insert(other.blocks().begin(), other.blocks().end());
+	for (vaddr_t block : other.blocks())
+		if (blocks().insert(block).second)
+			m_log.push_back(block);
 	bool new_cov = count() != prev_count;
 
 	m_lock.clear();
 	return new_cov;
 }
 
+inline size_t SharedCoverageBreakpoints::new_blocks(size_t from,
+                                                    std::vector<vaddr_t>& result)
+{
+	while (m_lock.test_and_set());
+	size_t n = m_log.size();
+	if (from < n)
+		result.insert(result.end(), m_log.begin() + from, m_log.end());
+	m_lock.clear();
+	return n;
+}
+
 
 #endif
\ No newline at end of file
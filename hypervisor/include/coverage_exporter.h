@@ -0,0 +1,75 @@
+#ifndef _COVERAGE_EXPORTER_H
+#define _COVERAGE_EXPORTER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include "common.h"
+
+class Elfs;
+
+// Writes the covered basic blocks to the output directory as a report of
+// covered functions and source lines, both in lcov tracefile format to
+// `coverage.info`, so it can be rendered with genhtml, and as JSON to
+// `coverage.json`. Lines and functions of the known basic blocks which
+// haven't been covered are reported with zero hits. Each block is symbolized
+// only once, so updating the reports only costs the blocks covered since the
+// last update.
+class CoverageExporter {
+public:
+	static constexpr const char* LCOV_FILENAME = "coverage.info";
+	static constexpr const char* JSON_FILENAME = "coverage.json";
+
+	// `basic_blocks` are every basic block of the binary, such as the ones
+	// read by Vm::setup_coverage
+	CoverageExporter(const Elfs& elfs, const std::vector<vaddr_t>& basic_blocks,
+	                 const std::string& output_dir);
+
+	// Add basic blocks which haven't been added before
+	void add(const std::vector<vaddr_t>& blocks);
+
+	// Write both reports with the blocks added so far
+	void dump() const;
+
+	// Number of blocks added
+	size_t blocks() const;
+
+	// Number of blocks whose source line is unknown
+	size_t unknown_blocks() const;
+
+private:
+	struct Function {
+		std::string name;
+		std::string elf;
+		std::string file;
+
+		// First line
+		size_t line;
+
+		// Covered blocks
+		size_t blocks;
+	};
+
+	const Elfs& m_elfs;
+	std::string m_lcov_path;
+	std::string m_json_path;
+	size_t m_blocks;
+	size_t m_unknown_blocks;
+
+	// Number of covered blocks in each line of each source file
+	std::map<std::string, std::map<size_t, size_t>> m_lines;
+
+	// Functions by start address, as static functions of different files or
+	// elfs may have the same name
+	std::map<vaddr_t, Function> m_functions;
+
+	// Get the counter of covered blocks of the line and the function of a
+	// block, creating them if they don't exist. They are null if unknown.
+	void locate(vaddr_t block, size_t*& line_blocks, Function*& function);
+
+	void add(vaddr_t block);
+	void dump_lcov() const;
+	void dump_json() const;
+};
+
+#endif
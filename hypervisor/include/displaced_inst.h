@@ -0,0 +1,74 @@
+#ifndef _DISPLACED_INST_H
+#define _DISPLACED_INST_H
+
+#include <vector>
+#include <linux/kvm.h>
+#include "common.h"
+
+class Mmu;
+
+// Instruction displaced by a breakpoint that must keep executing, such as a
+// hook. Executing it the usual way means removing the breakpoint, single
+// stepping and setting the breakpoint again, which costs another vm exit and
+// a few ioctls. Instead, the instructions most commonly found at function
+// prologues and basic block entries are decoded once and emulated on the
+// registers: nop and endbr64, push, mov and lea to registers, and add and sub
+// of an immediate to a register.
+class DisplacedInst {
+public:
+	// Maximum length of an x86 instruction
+	static const size_t MAX_LEN = 15;
+
+	// Not emulable instruction
+	DisplacedInst();
+
+	// Decode the instruction at `code`, given that `len` bytes are available
+	static DisplacedInst decode(const uint8_t* code, size_t len);
+
+	bool emulable() const;
+	size_t length() const;
+
+	// Emulate the instruction, which must be at `regs.rip`. Returns false
+	// without modifying anything if it can't be emulated, for example when
+	// pushing to a stack that isn't mapped, in which case it must be executed.
+	bool emulate(kvm_regs& regs, Mmu& mmu) const;
+
+	// Append to `out` an instruction equivalent to this one that can be
+	// placed at any address, given the original bytes and address
+	void relocate(const uint8_t* code, vaddr_t addr, std::vector<uint8_t>& out) const;
+
+private:
+	enum Op : uint8_t {
+		None,
+		Nop,
+		Push,
+		Mov,
+		Mov32,
+		Lea,
+		Add,
+		Sub,
+	};
+
+	static const uint8_t NO_REG = 0xFF;
+
+	Op m_op;
+	uint8_t m_len;
+	uint8_t m_dst;
+	uint8_t m_src;
+
+	// Memory operand of lea. The base can also be NO_REG or the next rip.
+	uint8_t m_base;
+	uint8_t m_index;
+	uint8_t m_scale;
+	bool    m_rip_relative;
+	int64_t m_disp;
+
+	// Immediate of add and sub
+	int64_t m_imm;
+
+	// Decode the ModRM byte at `code[i]` and what follows it, advancing `i`
+	bool decode_modrm(const uint8_t* code, size_t len, size_t& i, uint8_t rex,
+	                  uint8_t& mod, uint8_t& reg, uint8_t& rm);
+};
+
+#endif
@@ -3,9 +3,14 @@
 
 #include <libdwarf/libdwarf.h>
 #include <vector>
+#include <string>
+#include <atomic>
 #include "common.h"
 
 class Mmu;
+class LineTable;
+class UnwindTable;
+class StackReader;
 
 // https://software.intel.com/sites/default/files/article/402129/mpx-linux64-abi.pdf
 // figure 3.38: DWARF Register Numer Mapping
@@ -51,13 +56,24 @@ class ElfDebug {
 
 		// Given the registers at a given frame, updates them to the values
 		// they had the previous frame. Returns whether it was successful or not.
-		bool next_frame(vaddr_t regs[DwarfReg::MAX], Mmu& mmu) const;
+		// The first call precompiles the CFI into an UnwindTable.
+		bool next_frame(vaddr_t regs[DwarfReg::MAX], StackReader& stack) const;
+
+		// Same as next_frame, but interpreting the CFI with libdwarf. Used for
+		// rows the unwind table doesn't support, and for checking the table.
+		bool next_frame_cfi(vaddr_t regs[DwarfReg::MAX], StackReader& stack) const;
 
 		// Returns the source file and line associated with given virtual address.
-		// Returned string can be empty if it couldn't be retrieved.
+		// Returned string can be empty if it couldn't be retrieved. The first
+		// call decodes every line program into a LineTable, which is cached
+		// in LINE_TABLES_DIR.
 		std::string addr_to_source(vaddr_t addr) const;
 
+		static constexpr const char* LINE_TABLES_DIR = "./line_tables";
+
 	private:
+		const uint8_t* m_data;
+		size_t m_size;
 		dwarf_elf_handle m_elf;
 		Dwarf_Debug m_dwarf;
 		Dwarf_Cie* m_cie_data;
@@ -65,20 +81,26 @@ class ElfDebug {
 		Dwarf_Signed m_cie_count;
 		Dwarf_Signed m_fde_count;
 
+		// Line table and unwind table, created on first use
+		mutable std::atomic<LineTable*> m_lines;
+		mutable std::atomic<UnwindTable*> m_unwind;
+
+		// Get the line table, loading it from the cache or building it
+		const LineTable& lines() const;
+
+		// Decode the line programs of every compilation unit
+		LineTable* build_line_table() const;
+
+		const UnwindTable& unwind() const;
+
+		// Get the rules of every row of every FDE
+		UnwindTable* build_unwind_table() const;
+
 		// Get the information about where are the registers of the previous
 		// frame located.
 		bool get_current_frame_regs_info(vaddr_t instruction_pointer,
 		                                 Dwarf_Regtable3* regtable) const;
 
-		// Returns whether given pc is inside given die.
-		bool die_has_pc(Dwarf_Die die, Dwarf_Addr pc) const;
-
-		// Get the source string associated to pc from give cu die.
-		std::string get_source_str_cu_die(Dwarf_Die cu_die, Dwarf_Addr pc) const;
-
-		// Get the source string associated to given line.
-		std::string get_source_str_from_line(Dwarf_Line line) const;
-
 		// Not used for now, as symbols are obtained without DWARF info.
 		std::string get_symbol_cu_die(Dwarf_Die cu_die, Dwarf_Addr pc) const;
 };
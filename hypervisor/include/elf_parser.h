@@ -3,10 +3,13 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 #include <elf.h>
 #include "common.h"
 #include "kvm_aux.h"
 #include "elf_debug.h"
+#include "symbol_index.h"
+#include "mapped_file.h"
 
 #define BITS 64
 
@@ -99,8 +102,9 @@ struct relocation_t {
 
 class ElfParser {
 	public:
-		// Create an elf parser, loading file from disk. This object owns the
-		// memory and is responsible of freeing it.
+		// Create an elf parser, mapping the file from disk. The mapping is
+		// shared with copies of this object and with other users of the same
+		// file.
 		ElfParser(const std::string& elf_path = "");
 
 		// Create and elf parser, using data from memory. Caller owns the memory,
@@ -131,17 +135,19 @@ class ElfParser {
 		std::string interpreter() const;
 		std::vector<segment_t> segments() const;
 		std::vector<section_t> sections() const;
-		std::vector<symbol_t> symbols() const;
+		const std::vector<symbol_t>& symbols() const;
 		//std::vector<relocation_t> relocations() const;
 		std::pair<vaddr_t, vaddr_t> section_limits(const std::string& name) const;
 		std::pair<vaddr_t, vaddr_t> symbol_limits(const std::string& name) const;
 		std::string md5() const;
 
-		// Get dynamic libraries dependencies using ldd
-		std::vector<std::string> get_dependencies() const;
-
 		vaddr_t resolve_symbol(const std::string& symbol_name) const;
 		bool addr_to_symbol(vaddr_t addr, symbol_t& result) const;
+
+		// Get the name of the symbol `addr` belongs to and the offset of `addr`
+		// within it, without copying the symbol
+		bool addr_to_symbol_name(vaddr_t addr, const char*& name,
+		                         vsize_t& offset) const;
 		std::string addr_to_symbol_str(vaddr_t addr) const;
 		std::string addr_to_source(vaddr_t addr) const;
 		std::string addr_to_symbol_and_source(vaddr_t addr, bool is_ret_addr = false) const;
@@ -154,7 +160,8 @@ class ElfParser {
 		);
 
 	private:
-		bool m_owns_data;
+		// Mapping of the file, if this object loaded it from disk
+		std::shared_ptr<const MappedFile> m_file;
 		const uint8_t* m_data;
 		vsize_t m_size;
 
@@ -179,6 +186,9 @@ class ElfParser {
 		std::vector<symbol_t> m_symbols;
 		std::vector<relocation_t> m_relocations;
 
+		// Index of m_symbols for addr_to_symbol, relative to the load address
+		SymbolIndex m_symbol_index;
+
 		// Debug information of this binary
 		ElfDebug m_debug;
 
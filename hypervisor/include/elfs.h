@@ -6,25 +6,57 @@ class Elfs {
 public:
 	Elfs();
 
-	Elfs(const std::string& binary_path, const std::string& kernel_path);
+	Elfs(const std::string& binary_path, const std::string& kernel_path,
+	     const std::string& sysroot = "");
 
 	~Elfs();
 
-	void init(const std::string& binary_path, const std::string& kernel_path);
+	// Load the binary and the kernel. The interpreter and the libraries of
+	// the binary are looked up inside `sysroot`, if given.
+	void init(const std::string& binary_path, const std::string& kernel_path,
+	          const std::string& sysroot = "");
 
 	ElfParser& elf();
 	ElfParser& kernel();
 	ElfParser* interpreter();
+	const std::string& sysroot() const;
 	std::vector<const ElfParser*> all_elfs() const;
 	std::vector<const ElfParser*> target_elfs() const;
+
+	// Get the elf whose executable segments contain `addr`, or nullptr
+	const ElfParser* elf_with_addr(vaddr_t addr) const;
+
+	// Get the symbol `addr` belongs to in the elf that contains it, in the
+	// form `symbol + 0x<offset>`, or an empty string
+	std::string addr_to_symbol_str(vaddr_t addr) const;
+
+	// Get the address of a function defined by the binary or its libraries,
+	// or 0. Symbols that aren't functions are ignored, as callers place
+	// breakpoints or patches there.
+	vaddr_t resolve_symbol(const std::string& symbol_name) const;
+
 	void add_library(const std::string& filename, FileRef content);
 	void set_library_load_addr(const std::string& filename, vaddr_t load_addr);
 
+	// Rebuild the address ranges used by elf_with_addr. Must be called after
+	// changing the load address of an elf through elf() or interpreter().
+	void update_modules();
+
 private:
+	struct Module {
+		vaddr_t start;
+		vaddr_t end;
+		const ElfParser* elf;
+	};
+
 	ElfParser  m_elf;
 	ElfParser  m_kernel;
 	ElfParser* m_interpreter;
+	std::string m_sysroot;
 
 	// These don't own memory
 	std::unordered_map<std::string, ElfParser> m_libraries;
+
+	// Executable ranges of loaded elfs, sorted by start address
+	std::vector<Module> m_modules;
 };
\ No newline at end of file
@@ -0,0 +1,94 @@
+#ifndef _EXIT_RECORDER_H
+#define _EXIT_RECORDER_H
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <atomic>
+#include <chrono>
+#include "common.h"
+#include "kvm_aux.h"
+#include "stats.h"
+
+class Vm;
+
+// Flight recorder of vm exits. It keeps the last exits of a Vm in a ring,
+// together with the accumulated cost of each exit reason, hypercall and
+// breakpoint address, so we can find out what is slowing down the fuzzer.
+// They are dumped to a file when the user sends SIGUSR1 or when a run takes
+// longer than a given threshold.
+class ExitRecorder {
+public:
+	struct Entry {
+		uint32_t exit_reason;
+
+		// Hypercall number for IO exits, exception number for debug exits
+		uint32_t detail;
+
+		vaddr_t rip;
+
+		// Cycles since we entered the guest until it exited, and cycles
+		// spent handling the exit.
+		cycle_t guest_cycles;
+		cycle_t handle_cycles;
+	};
+
+	struct Cost {
+		uint64_t count;
+		cycle_t  cycles;
+	};
+
+	ExitRecorder(Vm& vm);
+	ExitRecorder(Vm& vm, const ExitRecorder& other);
+
+	bool enabled() const;
+
+	// Record the last `size` exits. Dumps will be written to `output_dir`, and
+	// will happen when a run takes longer than `slow_threshold`, unless it is
+	// zero.
+	void enable(size_t size, const std::string& output_dir,
+	            std::chrono::microseconds slow_threshold);
+
+	// Fill an entry with the information of the current exit. It must be
+	// called before handling the exit, as that may modify registers.
+	// `entry_cycles` is the TSC value when we entered the guest.
+	Entry begin_exit(const kvm_run* vcpu_run, const kvm_regs& regs,
+	                 cycle_t entry_cycles) const;
+
+	// Record the exit after it has been handled
+	void end_exit(Entry& entry);
+
+	// Dump if SIGUSR1 was received since last check, or if `run_time` is above
+	// the slow threshold
+	void check_dump(size_t id, std::chrono::microseconds run_time);
+
+	// Write the ring and the cost tables to `<output_dir>/<id>.txt`
+	void dump(size_t id, const std::string& why);
+
+	// Ask every ExitRecorder to dump. This is async-signal-safe.
+	static void request_dump();
+
+private:
+	// Minimum time between two dumps caused by slow runs
+	static const std::chrono::seconds SLOW_DUMP_INTERVAL;
+
+	static std::atomic<unsigned int> s_dump_requests;
+
+	Vm& m_vm;
+	std::string m_output_dir;
+	std::chrono::microseconds m_slow_threshold;
+	std::chrono::steady_clock::time_point m_last_slow_dump;
+	unsigned int m_dump_requests;
+
+	// Last exits. `m_next` is the position where the next one will be stored.
+	std::vector<Entry> m_ring;
+	size_t m_next;
+	uint64_t m_total_exits;
+
+	// Cost tables
+	std::map<uint32_t, Cost> m_exit_reasons_cost;
+	std::vector<Cost> m_hypercalls_cost;
+	std::unordered_map<vaddr_t, Cost> m_breakpoints_cost;
+};
+
+#endif
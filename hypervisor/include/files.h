@@ -2,8 +2,10 @@
 #define _SHARED_FILES_H
 
 #include <vector>
+#include <memory>
 #include <unordered_map>
 #include "elf_parser.h"
+#include "mapped_file.h"
 
 struct FileRef {
 	const void* ptr;
@@ -54,11 +56,18 @@ public:
 	// Don't let setting a file by reference.
 	GuestFile set_file(const std::string& path, FileRef content) = delete;
 	GuestFile set_file(const std::string& path, std::string content);
+
 	GuestFile set_file(const std::string& path);
 
+	// Set the file at `path` with the content of `host_path` in the host, or
+	// of `path` if it's empty. The file is mapped rather than read.
+	GuestFile map_file(const std::string& path, const std::string& host_path = "");
+
 private:
-	// Backing file contents
+	// Backing file contents, either owned strings or mapped files. Each path
+	// is in only one of them.
 	std::unordered_map<std::string, std::string> m_file_contents;
+	std::unordered_map<std::string, std::shared_ptr<const MappedFile>> m_mapped_files;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,41 @@
+#ifndef _FUZZ_WORKER_H
+#define _FUZZ_WORKER_H
+
+#include <atomic>
+#include <memory>
+#include "common.h"
+#include "files.h"
+#include "stats.h"
+
+class Vm;
+class Harness;
+class FixupPlugin;
+class Corpus;
+class Replay;
+
+// Write an input to a Vm, either to the buffer of the harness if it's enabled
+// or to the input slot, which the guest reads as the file "input"
+void set_input(Vm& vm, const Harness& harness, FileRef input);
+
+// Run an input that crashed `runner`, which is patched, on the vm without
+// patches after fixing it up, to tell real crashes from crashes caused by the
+// patches. The former are reported as usual, and the latter are saved to
+// Corpus::CRASHES_PATCHED_DIR. The verifier vm is created from `unpatched`
+// the first time it's needed.
+void verify_crash(int id, Vm& runner, const Vm& unpatched,
+                  std::unique_ptr<Vm>& verifier, const Harness& harness,
+                  const FixupPlugin& fixup, Corpus& corpus, FileRef input);
+
+// Fuzzing loop of each thread: get a new input from the corpus, run it on a
+// copy of `base`, report crashes and coverage, and reset. Crashes are
+// verified on `unpatched` if it isn't null. It runs until `stop` is set, or
+// until every recorded case has been run when replaying.
+typedef void (*worker_t)(int id, const Vm& base, const Vm* unpatched,
+                         const Harness& harness, const FixupPlugin& fixup,
+                         Corpus& corpus, Replay& replay, Stats& stats,
+                         const std::atomic<bool>& stop);
+
+// Worker instantiation of a timetracing level, so it can be chosen at runtime
+worker_t get_worker(Timetrace timetrace);
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef _HARNESS_H
+#define _HARNESS_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include "common.h"
+#include "kvm_aux.h"
+#include "files.h"
+
+class Vm;
+
+// Input injection into the buffer of a harness function, such as
+// LLVMFuzzerTestOneInput, instead of emulating a file that the target opens
+// and reads. The Vm is snapshotted at the entry of the function, and for each
+// run the input is written into the buffer it receives and its length is set
+// in the corresponding register. The run ends when the function returns.
+class Harness {
+public:
+	typedef __u64 kvm_regs::*Reg;
+
+	// Registers holding the arguments of the harness function
+	struct Layout {
+		// Pointer to the buffer
+		Reg ptr;
+
+		// Length of the input, which is set for each run
+		Reg len;
+
+		// Size of the buffer, if the function receives it. Otherwise, the
+		// buffer is assumed to be as big as `max_size`, or as the length the
+		// function receives when the harness is set up if it's 0.
+		Reg size;
+
+		// Maximum number of bytes written to the buffer, or 0 for no fixed
+		// size
+		size_t max_size;
+	};
+
+	// Default layout: LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+	static const Layout DEFAULT_LAYOUT;
+
+	// Parse a layout in the form `ptr,len[,size]`, where each element is the
+	// name of an argument register and size can also be a number
+	static bool parse_layout(const std::string& spec, Layout& layout);
+
+	// Disabled harness
+	Harness();
+
+	// Set up the harness for a Vm which is at the entry of the harness function
+	Harness(Vm& vm, const Layout& layout, size_t max_input_size);
+
+	bool enabled() const;
+
+	// Address the harness function returns to
+	vaddr_t return_addr() const;
+
+	// Number of bytes of the inputs that fit in the buffer
+	size_t capacity() const;
+
+	// Write the input to the buffer of a Vm that has been reset to the state
+	// of the Vm the harness was set up with. Inputs bigger than the buffer
+	// are truncated.
+	void set_input(Vm& vm, FileRef input) const;
+
+private:
+	Layout m_layout;
+	vaddr_t m_buffer;
+	size_t m_capacity;
+	vaddr_t m_return_addr;
+
+	// Physical address of each page of the buffer. The Vm is reset to the
+	// same memory before each run, so translations never change.
+	std::vector<paddr_t> m_pages;
+};
+
+// Get the addresses where runs end before the exit syscall, given a Vm
+// stopped where runs start: the libc function `exit`, which avoids running
+// exit handlers, the given functions and, if `at_return`, the address the
+// current function returns to, which skips the teardown of the target as
+// well. The return address of the harness is left out, as its breakpoint is
+// set separately. Returns false if runs can't end at return because they
+// start at the entry point, which never returns.
+bool get_end_addrs(Vm& vm, const Harness& harness, bool at_return,
+                   const std::vector<std::string>& end_symbols,
+                   std::set<vaddr_t>& end_addrs);
+
+#endif
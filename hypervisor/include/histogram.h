@@ -0,0 +1,161 @@
+#ifndef _HISTOGRAM_H
+#define _HISTOGRAM_H
+
+#include <cstdint>
+#include <atomic>
+
+// Counter which is written by a single thread and may be read by others.
+// As there's only one writer, updates don't need an atomic read-modify-write:
+// a relaxed load followed by a relaxed store compiles to a plain add, while
+// still allowing other threads to read it without tearing. Copying a Counter
+// takes a snapshot of its value.
+class Counter {
+public:
+	Counter(uint64_t value = 0)
+		: m_value(value)
+	{}
+
+	Counter(const Counter& other)
+		: m_value(other.get())
+	{}
+
+	Counter& operator=(const Counter& other) {
+		set(other.get());
+		return *this;
+	}
+
+	uint64_t get() const {
+		return m_value.load(std::memory_order_relaxed);
+	}
+
+	void set(uint64_t value) {
+		m_value.store(value, std::memory_order_relaxed);
+	}
+
+	operator uint64_t() const {
+		return get();
+	}
+
+	Counter& operator+=(uint64_t value) {
+		set(get() + value);
+		return *this;
+	}
+
+	Counter& operator-=(uint64_t value) {
+		set(get() - value);
+		return *this;
+	}
+
+	Counter& operator++() {
+		return *this += 1;
+	}
+
+	uint64_t operator++(int) {
+		uint64_t value = get();
+		set(value + 1);
+		return value;
+	}
+
+private:
+	std::atomic<uint64_t> m_value;
+};
+
+// Log-linear histogram, in the spirit of HdrHistogram. Values are grouped in
+// buckets whose width doubles every SUB_BUCKETS buckets, so the relative error
+// of a reported percentile is bounded by 1/SUB_BUCKETS whatever the magnitude
+// of the value. Recording a value doesn't allocate and takes a few
+// instructions, so it can be used in the fuzz loop.
+// As with Counter, a histogram must have a single writer.
+class Histogram {
+public:
+	enum : int {
+		SUB_BUCKET_BITS = 4,
+		SUB_BUCKETS     = 1 << SUB_BUCKET_BITS,
+		BUCKETS         = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS,
+	};
+
+	void record(uint64_t value) {
+		m_buckets[bucket_index(value)]++;
+		m_count++;
+		m_sum += value;
+	}
+
+	uint64_t count() const {
+		return m_count;
+	}
+
+	uint64_t sum() const {
+		return m_sum;
+	}
+
+	double mean() const {
+		uint64_t count = m_count;
+		return (count ? (double)m_sum / count : 0);
+	}
+
+	// Get the value below which `p` percent of the recorded values fall.
+	// Returns 0 if the histogram is empty.
+	uint64_t percentile(double p) const {
+		uint64_t count = m_count;
+		if (count == 0)
+			return 0;
+		uint64_t target = (uint64_t)(p / 100 * count + 0.5);
+		if (target == 0)
+			target = 1;
+		uint64_t seen = 0;
+		for (int i = 0; i < BUCKETS; i++) {
+			seen += m_buckets[i];
+			if (seen >= target)
+				return bucket_value(i);
+		}
+		return bucket_value(BUCKETS - 1);
+	}
+
+	uint64_t max() const {
+		for (int i = BUCKETS - 1; i >= 0; i--)
+			if (m_buckets[i])
+				return bucket_value(i);
+		return 0;
+	}
+
+	Histogram& operator+=(const Histogram& other) {
+		for (int i = 0; i < BUCKETS; i++)
+			m_buckets[i] += other.m_buckets[i];
+		m_count += other.m_count;
+		m_sum   += other.m_sum;
+		return *this;
+	}
+
+	// Used to get the values recorded between two snapshots
+	Histogram& operator-=(const Histogram& other) {
+		for (int i = 0; i < BUCKETS; i++)
+			m_buckets[i] -= other.m_buckets[i];
+		m_count -= other.m_count;
+		m_sum   -= other.m_sum;
+		return *this;
+	}
+
+	static int bucket_index(uint64_t value) {
+		if (value < SUB_BUCKETS)
+			return value;
+		int msb   = 63 - __builtin_clzll(value);
+		int shift = msb - SUB_BUCKET_BITS;
+		return (shift + 1) * SUB_BUCKETS + ((value >> shift) & (SUB_BUCKETS - 1));
+	}
+
+	// Middle value of the range of values that fall into bucket `i`
+	static uint64_t bucket_value(int i) {
+		if (i < SUB_BUCKETS)
+			return i;
+		int shift    = i / SUB_BUCKETS - 1;
+		uint64_t sub = i % SUB_BUCKETS;
+		return ((SUB_BUCKETS + sub) << shift) + ((1ULL << shift) >> 1);
+	}
+
+private:
+	Counter m_buckets[BUCKETS];
+	Counter m_count;
+	Counter m_sum;
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef _LIBC_SUBST_H
+#define _LIBC_SUBST_H
+
+#include <string>
+#include <vector>
+#include "common.h"
+
+class Vm;
+
+// Substitution of libc functions where targets spend a good part of their run
+// time without it being interesting to fuzz. Their entries are patched with a
+// jump to a lean replacement in a code page reserved before the kernel starts,
+// so calls from inside libc are replaced too. Functions are substituted in
+// groups:
+//   alloc:  malloc, calloc, realloc and free. Memory is taken from a bump
+//           allocator and never freed, as the heap is restored when the Vm is
+//           reset. Requests bigger than the heap fail, and exhausting it ends
+//           the run with RunEndReason::OutOfMemory.
+//   stdio:  printf, vprintf, puts and putchar do nothing. Only for targets
+//           whose output isn't needed.
+//   locale: setlocale does nothing and returns "C".
+class LibcSubst {
+public:
+	enum Group : unsigned {
+		Alloc  = 1 << 0,
+		Stdio  = 1 << 1,
+		Locale = 1 << 2,
+	};
+
+	// Heap size when it's not given, as a fraction of the Vm memory. The
+	// rest is left to the kernel.
+	static const size_t DEFAULT_HEAP_DIVISOR = 2;
+
+	// Offset in the code page the allocator jumps to when the heap is
+	// exhausted
+	static const vsize_t OUT_OF_MEMORY_OFFSET = 0;
+
+	// Replacement of a function, at `offset` in the code page
+	struct Replacement {
+		const char* name;
+		vsize_t offset;
+	};
+
+	// Parse a list of groups separated by commas
+	static bool parse_groups(const std::string& spec, unsigned& groups);
+
+	// Assemble the replacements of the given groups, to be placed at
+	// LIBC_SUBST_ADDR. The first bytes of the heap hold its current position.
+	static void assemble(unsigned groups, vsize_t heap_size,
+	                     std::vector<uint8_t>& code,
+	                     std::vector<Replacement>& replacements);
+
+	// Disabled substitution
+	LibcSubst();
+
+	// Reserve and write the code page and the heap, and set the out of memory
+	// breakpoint. It must be called before the kernel starts, as it allocates
+	// memory.
+	LibcSubst(Vm& vm, unsigned groups, vsize_t heap_size);
+
+	bool enabled() const;
+
+	// Redirect the functions defined by the binary and its libraries, which
+	// must be already loaded. Returns the number of functions redirected.
+	size_t apply(Vm& vm) const;
+
+private:
+	unsigned m_groups;
+	std::vector<Replacement> m_replacements;
+};
+
+#endif
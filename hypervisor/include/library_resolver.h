@@ -0,0 +1,59 @@
+#ifndef _LIBRARY_RESOLVER_H
+#define _LIBRARY_RESOLVER_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// Resolves the shared libraries needed by an elf the same way the dynamic
+// loader would, without running anything: DT_NEEDED entries are looked up in
+// DT_RPATH, DT_RUNPATH, /etc/ld.so.cache and the default library paths. Paths
+// are the ones the guest sees. If a sysroot is given, they are all looked up
+// inside it, including the loader cache.
+class LibraryResolver {
+public:
+	LibraryResolver(const std::string& sysroot = "");
+
+	// Get every library needed by the elf at `path` in the host, directly or
+	// through other libraries, in the order the loader would load them. The interpreter,
+	// which is loaded separately, is not included. Libraries that can't be
+	// found are reported and left out.
+	std::vector<std::string> resolve(const std::string& path,
+	                                 const std::string& interpreter = "");
+
+	// Get the path in the host of a path in the guest
+	std::string host_path(const std::string& path) const;
+
+private:
+	struct DynamicInfo {
+		std::vector<std::string> needed;
+		std::vector<std::string> rpath;
+		std::vector<std::string> runpath;
+	};
+
+	std::string m_sysroot;
+
+	// Entries of the loader cache, from soname to paths
+	std::unordered_multimap<std::string, std::string> m_cache;
+	bool m_cache_loaded;
+
+	// Read the dynamic section of the elf at given path in the host. Returns
+	// false if it's not an elf the loader could load.
+	bool read_dynamic(const std::string& real_path, DynamicInfo& info) const;
+
+	// Find the path of library `name` needed by `loader`, which was loaded
+	// because of the executable `exe`
+	bool find(const std::string& name,
+	          const std::string& loader, const DynamicInfo& loader_info,
+	          const std::string& exe, const DynamicInfo& exe_info,
+	          std::string& result);
+	bool find_in_dirs(const std::string& name, const std::vector<std::string>& dirs,
+	                  const std::string& loader, std::string& result) const;
+
+	void load_cache();
+
+	// Whether the loader could load the elf at given path in the guest
+	bool is_loadable(const std::string& path) const;
+};
+
+#endif
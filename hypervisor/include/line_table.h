@@ -0,0 +1,72 @@
+#ifndef _LINE_TABLE_H
+#define _LINE_TABLE_H
+
+#include <vector>
+#include <string>
+#include "common.h"
+
+// Decoded DWARF line programs of an elf: rows sorted by address, each one
+// with a file id and a line number, so getting the source of an address is a
+// binary search. The table is stored in a single flat image, which can be
+// saved to a file and later memory-mapped from it without decoding anything.
+class LineTable {
+public:
+	// File id of the rows which mark the end of a sequence. Addresses from
+	// there until the next row don't belong to any line.
+	static const uint32_t END_SEQUENCE;
+
+	struct Row {
+		vaddr_t addr;
+		uint32_t file;
+		uint32_t line;
+	};
+
+	LineTable();
+
+	// Build a table from the rows of every line program, in the order they
+	// appear in each program. `files` are the names of the file ids.
+	LineTable(std::vector<Row> rows, const std::vector<std::string>& files);
+
+	LineTable(const LineTable& other) = delete;
+	LineTable& operator=(const LineTable& other) = delete;
+	~LineTable();
+
+	// Map the table saved at `path`. Returns false if it doesn't exist or it
+	// isn't a valid table, in which case this table is left unchanged.
+	bool load(const std::string& path);
+
+	// Save the table to `path`. Returns whether it succeeded.
+	bool save(const std::string& path) const;
+
+	// Returns the source file and line of `addr`, in the form `file:line`,
+	// or an empty string if it doesn't belong to any line
+	std::string addr_to_source(vaddr_t addr) const;
+
+	size_t size() const;
+
+private:
+	// Layout of the image: header, rows, offset of the name of each file in
+	// the string table, and the string table
+	struct Header {
+		uint64_t magic;
+		uint32_t version;
+		uint32_t n_files;
+		uint64_t n_rows;
+		uint64_t strings_size;
+	};
+
+	// The image, which is either owned by this object or mapped from a file
+	std::vector<uint8_t> m_image;
+	void* m_map;
+	size_t m_map_size;
+
+	const Row* m_rows;
+	size_t m_n_rows;
+	const uint32_t* m_file_offsets;
+	uint32_t m_n_files;
+	const char* m_strings;
+
+	bool set_image(const uint8_t* image, size_t size);
+};
+
+#endif
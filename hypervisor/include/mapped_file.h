@@ -0,0 +1,34 @@
+#ifndef _MAPPED_FILE_H
+#define _MAPPED_FILE_H
+
+#include <string>
+#include <memory>
+#include "common.h"
+
+// Read-only mapping of a file in the host. Only the pages that are actually
+// read are loaded, and they are shared with the page cache instead of being
+// copied into the heap. Mappings are registered by file identity, so opening
+// a file that is already mapped, even through a different path or from
+// another thread, returns the same mapping.
+class MappedFile {
+public:
+	static std::shared_ptr<const MappedFile> open(const std::string& path);
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+
+	const uint8_t* data() const;
+	size_t size() const;
+
+	// Number of files currently mapped
+	static size_t num_mapped();
+
+private:
+	MappedFile(const uint8_t* data, size_t size);
+
+	const uint8_t* m_data;
+	size_t m_size;
+};
+
+#endif
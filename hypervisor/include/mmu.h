@@ -25,6 +25,13 @@ public:
 	static const vaddr_t PHYSMAP_ADDR            = 0xFFFFFF8000000000;
 	static const vaddr_t INTERPRETER_ADDR        = 0x400000000000;
 	static const vaddr_t USER_END_ADDR           = 0x800000000000;
+	static const paddr_t INPUT_SLOT_PADDR        = 0x4000000000; // after memory
+	static const vaddr_t INPUT_SLOT_ADDR         = 0xFFFFFF0000000000;
+	static const vaddr_t STUB_HOOKS_ADDR         = 0x100000; // below elfs
+	static const vsize_t STUB_HOOKS_SIZE         = 0x10000;
+	static const vaddr_t STUB_HOOKS_SHARED_ADDR  = STUB_HOOKS_ADDR + STUB_HOOKS_SIZE;
+	static const vaddr_t LIBC_SUBST_ADDR         = 0x120000;
+	static const vaddr_t LIBC_SUBST_HEAP_ADDR    = 0x300000000000;
 
 	// Normal constructor
 	Mmu(int vm_fd, int vcpu_fd, size_t mem_size);
@@ -43,6 +50,13 @@ public:
 	psize_t size() const;
 	paddr_t next_frame_alloc() const;
 	void disable_allocations();
+	bool can_alloc() const;
+
+	// Set the page table used for translating virtual addresses, given the
+	// value of CR3. It must be updated when the guest switches address space,
+	// so addresses are translated in the context of the current process.
+	void set_cr3(uint64_t cr3);
+	paddr_t ptl4() const;
 
 	// Create a mapping of all physical memory
 	void create_physmap();
@@ -59,13 +73,23 @@ public:
 	// If needed for a range, use PageWalker instead
 	paddr_t get_pte_val(vaddr_t vaddr);
 
-	// Translate a virtual address to a physical address. Same as in `get_pte`
-	// applies here
+	// Translate a virtual address to a physical address. Translations are
+	// cached in the TLB. Same as in `get_pte` applies here if they aren't
 	paddr_t virt_to_phys(vaddr_t vaddr);
 
+	// Invalidate every cached translation. This must be called whenever page
+	// tables may have been modified other than in their last level, such as
+	// when memory is reset. Modifications done through the Mmu flush it
+	// automatically, and guest runs don't need it (see TlbEntry).
+	void flush_tlb();
+
 	// Guest to host address conversion
 	uint8_t* get(vaddr_t guest);
 
+	// Check if the page of `vaddr` is mapped and writable. Unlike the rest
+	// of methods, it doesn't allocate missing page table entries.
+	bool is_writable(vaddr_t vaddr);
+
 	// Allocate given virtual memory region
 	void alloc(vaddr_t start, vsize_t len, uint64_t flags);
 
@@ -93,6 +117,10 @@ public:
 	template <class T>
 	void writep(paddr_t addr, const T& value);
 
+	// Write to physical memory, for users that cache their own translations.
+	// Unlike `writep`, it isn't meant for writing to page tables.
+	void write_memp(paddr_t dst, const void* src, psize_t len);
+
 	// Read a null-terminated string from `addr`
 	std::string read_string(vaddr_t addr);
 
@@ -105,6 +133,25 @@ public:
 	// Load elf into memory
 	void load_elf(const std::vector<segment_t>& segments, ElfType elf_type);
 
+	// Create a memory slot for inputs of up to `size` bytes, outside of guest
+	// memory, and map it read-only in kernel memory at INPUT_SLOT_ADDR. Its
+	// first page holds the input length, and the input starts at the next
+	// one. As it's not part of guest memory, it isn't resetted, and writing
+	// inputs to it doesn't dirty any page.
+	void create_input_slot(size_t size);
+
+	// Whether there's an input slot. Its size may be 0.
+	bool has_input_slot() const;
+
+	// Size of the input slot, or 0 if there isn't one
+	size_t input_slot_size() const;
+
+	// Write an input to the input slot
+	void write_input_slot(const void* data, size_t len);
+
+	// Read the input last written to the input slot
+	std::string read_input_slot() const;
+
 	void dump_memory(psize_t len, const std::string& filename) const;
 
 private:
@@ -119,16 +166,48 @@ private:
 	uint8_t* m_memory;
 	size_t   m_length;
 
-	// Pointer to page table level 4
-	// (at physical address PAGE_TABLE_PADDR)
+	// Pointer to page table level 4 of the current address space. It is at
+	// physical address PAGE_TABLE_PADDR until the guest creates other ones.
 	paddr_t  m_ptl4;
 
+	// Direct-mapped cache of translations, so accesses to guest memory don't
+	// need a page walk each time. Entries cache where the last level entry of
+	// a page is, rather than its value, which is read on every hit. This way
+	// they stay valid when the guest maps, unmaps or changes the permissions
+	// of pages while it runs. It relies on the guest kernel never freeing
+	// page tables nor changing present entries of upper levels, which holds
+	// as it doesn't free page tables of address spaces when they're destroyed
+	// (PageTable.deinit). If that changes, the TLB must be flushed after every
+	// run. Entries are tagged with the page table they come from, as each
+	// process has its own. They are valid only if their generation is the
+	// current one, so flushing is just incrementing it.
+	struct TlbEntry {
+		paddr_t  ptl4;
+		vaddr_t  vpage;
+		paddr_t  pte;
+		uint64_t gen;
+	};
+	static const size_t TLB_SIZE = 64;
+	TlbEntry m_tlb[TLB_SIZE];
+	uint64_t m_tlb_gen;
+
+	// Get the page table entry value of the page of `vaddr`, which must be
+	// mapped, using the TLB
+	paddr_t tlb_pte_val(vaddr_t vaddr);
+
+	// Allocate the memory of the input slot and register it in the vm
+	void add_input_slot_memory(size_t length);
+
 	// True if guest kernel hasn't taken control of the memory yet
 	bool     m_can_alloc;
 
 	// Physical address of the next page allocated
 	paddr_t  m_next_page_alloc;
 
+	// Input slot memory, including the header page
+	uint8_t* m_input_slot;
+	size_t   m_input_slot_length;
+
 #ifdef ENABLE_KVM_DIRTY_LOG_RING
 	size_t m_dirty_ring_i;
 	size_t m_dirty_ring_entries;
@@ -170,6 +249,9 @@ void Mmu::writep(paddr_t addr, const T& value) {
 	ASSERT(addr + sizeof(T) <= m_length, "OOB: 0x%lx", addr);
 	memcpy(m_memory + addr, &value, sizeof(value));
 
+	// This is only used for writing to page tables
+	flush_tlb();
+
 	// Set region as dirty
 	paddr_t p = addr;
 	while (p < addr + sizeof(T)) {
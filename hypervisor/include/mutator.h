@@ -10,9 +10,17 @@ public:
 	static const std::vector<mutation_strat_t> mut_strats;
 	static const std::vector<mutation_strat_t> mut_strats_reduce;
 
+	// Name of each strategy in `mut_strats`
+	static const std::vector<const char*> mut_strats_names;
+
 	Mutator(const std::vector<std::string>& corpus);
 	size_t max_input_size() const;
 	void set_max_input_size(size_t size);
+
+	// Only use the first `size` elements of the corpus for splice mutations.
+	// By default the whole corpus is used.
+	void set_corpus_size(size_t size);
+
 	void mutate_input(std::string& input, Rng& rng, bool minimize);
 
 private:
@@ -21,6 +29,11 @@ private:
 	// Max input size, used in expand mutation
 	size_t m_max_input_size;
 
+	// Number of corpus elements used for splice mutations, or 0 for all
+	size_t m_corpus_size;
+
+	size_t corpus_size() const;
+
 	void mut_shrink(std::string& input, Rng& rng);
 	void mut_expand(std::string& input, Rng& rng);
 	void mut_bit(std::string& input, Rng& rng);
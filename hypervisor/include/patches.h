@@ -0,0 +1,96 @@
+#ifndef _PATCHES_H
+#define _PATCHES_H
+
+#include <string>
+#include <vector>
+#include "common.h"
+
+class Vm;
+
+// Code patches applied to the Vm before forking, to get past checks that
+// mutated inputs almost never satisfy, such as checksums, magic values or
+// integrity checks. Each line of the patches file is in the form:
+//   <function[+offset]|address> <action> [argument]
+// where function is the name of a function symbol and action is one of:
+//   ret <value>           return the value, at the entry of a function
+//   skip-call [value]     remove a call, optionally setting eax to the value
+//   nop <length>          replace the given number of bytes with nops
+//   branch taken          make a conditional jump always jump
+//   branch not-taken      make a conditional jump never jump
+// Empty lines and everything after '#' are ignored.
+class Patches {
+public:
+	struct Patch {
+		enum Action {
+			Return,
+			SkipCall,
+			Nop,
+			Branch,
+		};
+
+		// Symbol, or empty if the address is absolute
+		std::string symbol;
+
+		// Address, or offset from the symbol
+		vaddr_t addr;
+
+		Action action;
+
+		// Returned value, value set by skip-call, number of bytes replaced by
+		// nop, or whether the branch is taken
+		uint64_t value;
+		bool has_value;
+	};
+
+	// No patches
+	Patches();
+
+	// Load patches from file. Errors are fatal.
+	explicit Patches(const std::string& path);
+
+	size_t size() const;
+
+	// Parse a line, which must not be empty. Returns false if it's not valid.
+	static bool parse(const std::string& line, Patch& patch);
+
+	// Get the code that replaces the original code at the address of the
+	// patch. Returns an empty vector if the original instruction isn't
+	// supported by the action.
+	static std::vector<uint8_t> assemble(const Patch& patch,
+	                                     const std::vector<uint8_t>& original);
+
+	// Patch the code of the Vm
+	void apply(Vm& vm) const;
+
+private:
+	std::vector<Patch> m_patches;
+	std::vector<size_t> m_lines;
+};
+
+// Library loaded with --patch-fixup, which fixes inputs before reproducing
+// them on the unpatched Vm, for example updating their checksums. It must
+// export this function, which fixes the input in place and returns its new
+// size, at most `capacity`:
+//   size_t kvm_fuzz_fixup(uint8_t* data, size_t size, size_t capacity);
+class FixupPlugin {
+public:
+	static constexpr const char* SYMBOL = "kvm_fuzz_fixup";
+
+	// Bytes inputs are allowed to grow
+	static const size_t EXTRA_CAPACITY = 64;
+
+	// No fixup
+	FixupPlugin();
+
+	explicit FixupPlugin(const std::string& path);
+
+	bool enabled() const;
+
+	void fixup(std::string& input) const;
+
+private:
+	typedef size_t (*fixup_t)(uint8_t* data, size_t size, size_t capacity);
+	fixup_t m_fixup;
+};
+
+#endif
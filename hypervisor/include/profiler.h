@@ -0,0 +1,92 @@
+#ifndef _PROFILER_H
+#define _PROFILER_H
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <chrono>
+#include "common.h"
+
+class Vm;
+
+// Sampling profiler of the guest. When the kernel is built with
+// -Denable-profiler, its APIC timer handler records the interrupted RIP and
+// the return addresses found following the frame pointer chain into a ring
+// in kernel memory. Samples are collected from the ring before each reset,
+// and aggregated stacks are symbolized lazily when dumped as folded stacks,
+// which can be given to flamegraph.pl.
+class Profiler {
+public:
+	// Keep these the same as in the kernel
+	static const size_t MAX_FRAMES = 32;
+	static const size_t RING_SIZE  = 256;
+
+	// Minimum time between two dumps of the folded stacks to disk
+	static const std::chrono::seconds DUMP_INTERVAL;
+
+	Profiler(Vm& vm);
+	Profiler(Vm& vm, const Profiler& other);
+
+	bool enabled() const;
+
+	// Submitted by the kernel
+	void set_ring_addr(vaddr_t ring_addr);
+
+	// Take a sample every `period` timer ticks. Folded stacks of each runner
+	// will be written to `output_dir`.
+	void enable(size_t period, const std::string& output_dir);
+
+	// Read the samples taken during last run from the ring
+	void collect();
+
+	// Restore the state of the sampler after the Vm memory has been reset
+	void reset();
+
+	// Write the aggregated stacks to `<output_dir>/<id>.folded`. Unless `force`
+	// is set, this does nothing if last dump was less than DUMP_INTERVAL ago.
+	void dump(size_t id, bool force = false);
+
+	// Number of samples taken and number of samples that didn't fit in the
+	// ring and were dropped
+	size_t samples() const;
+	size_t lost_samples() const;
+
+private:
+	// Keep this the same as in the kernel
+	struct Sample {
+		uint64_t len;
+		vaddr_t frames[MAX_FRAMES];
+	};
+
+	struct RingHeader {
+		uint64_t period;
+		uint64_t ticks;
+		uint64_t count;
+	};
+
+	Vm& m_vm;
+	vaddr_t m_ring_addr;
+	size_t m_period;
+	std::string m_output_dir;
+
+	// Timer ticks since the last sample. The kernel keeps this in memory that
+	// gets reset after each run, so we restore it to make the sampling period
+	// span across runs.
+	uint64_t m_ticks;
+
+	size_t m_samples;
+	size_t m_lost_samples;
+
+	// Number of times each stack was sampled. Stacks are stored from the
+	// innermost frame to the outermost one.
+	std::map<std::vector<vaddr_t>, size_t> m_stacks;
+
+	// Cache of symbolized addresses
+	std::unordered_map<vaddr_t, std::string> m_symbols;
+
+	std::chrono::steady_clock::time_point m_last_dump;
+
+	const std::string& symbolize(vaddr_t addr, bool is_ret_addr);
+};
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef _REPLAY_H
+#define _REPLAY_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include "common.h"
+#include "files.h"
+
+// Record and replay of fuzzing sessions. When recording, each thread logs
+// every fuzz case: the corpus element it was mutated from, the corpus size at
+// that moment, the index it was added to the corpus at, the hash of the input
+// and the result of the run. Together with the seed of the rng of each thread,
+// this allows replaying exactly the same stream of fuzz cases, so two builds
+// of the hypervisor or the kernel can be compared running the same inputs.
+class Replay {
+public:
+	enum class Mode {
+		Off,
+		Record,
+		Replay,
+	};
+
+	static const uint32_t NOT_ADDED;
+	static constexpr const char* SESSION_FILENAME = "session";
+
+	struct Case {
+		// Index of the corpus element the input was mutated from
+		uint32_t parent;
+
+		// Size of the corpus when the parent was chosen. Splice mutations only
+		// use these elements.
+		uint32_t corpus_size;
+
+		// Index the input was added to the corpus at, or NOT_ADDED
+		uint32_t corpus_index;
+
+		// Vm::RunEndReason
+		uint32_t result;
+
+		uint64_t input_hash;
+	};
+
+	// Log of a single thread. It's only accessed by its thread.
+	class ThreadLog {
+	public:
+		ThreadLog(Mode mode, const std::string& path);
+
+		// Replay: load the next case, returning false if there are no more
+		bool next();
+
+		// Current case
+		const Case& current() const;
+
+		// Record: set the parent and corpus size of the current case, and
+		// the index it was added to the corpus at
+		void set_parent(size_t parent, size_t corpus_size);
+		void set_corpus_index(size_t corpus_index);
+
+		// Finish current case. When recording it is written to the log, and
+		// when replaying it is compared against the recorded one.
+		void end_case(FileRef input, int result);
+
+		size_t cases() const;
+		size_t input_divergences() const;
+		size_t result_divergences() const;
+
+	private:
+		friend class Replay;
+
+		Mode m_mode;
+		std::ofstream m_os;
+		std::vector<Case> m_cases;
+
+		// Replay: index of the next case. Record: number of cases written.
+		size_t m_next;
+		Case m_current;
+		size_t m_input_divergences;
+		size_t m_result_divergences;
+	};
+
+	Replay();
+
+	// Start recording a session to directory `dir`
+	void record(const std::string& dir, size_t jobs, uint64_t seed,
+	            size_t corpus_size);
+
+	// Load a session from directory `dir`. The number of jobs is set to the
+	// recorded one.
+	void replay(const std::string& dir, uint& jobs);
+
+	Mode mode() const;
+	bool recording() const;
+	bool replaying() const;
+	uint64_t seed() const;
+
+	// Size of the seed corpus when the session was recorded
+	size_t corpus_size() const;
+
+	// Seed of the rng of thread `id`
+	uint64_t thread_seed(size_t id) const;
+
+	ThreadLog& thread(size_t id);
+
+	// Print a summary of the replayed cases and divergences
+	void print_summary(double elapsed) const;
+
+private:
+	Mode m_mode;
+	uint64_t m_seed;
+	size_t m_corpus_size;
+	std::vector<ThreadLog> m_threads;
+};
+
+#endif
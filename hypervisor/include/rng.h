@@ -24,6 +24,21 @@ class Rng {
 			z_state = _rdtsc();
 		}
 
+		// Deterministic rng, used for recording and replaying sessions. The
+		// state is initialised from the seed with SplitMix64.
+		Rng(uint64_t seed){
+			x_state = splitmix64(seed);
+			y_state = splitmix64(seed);
+			z_state = splitmix64(seed);
+		}
+
+		static inline uint64_t splitmix64(uint64_t& state){
+			uint64_t z = (state += 0x9E3779B97F4A7C15);
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+			return z ^ (z >> 31);
+		}
+
 		inline uint64_t rnd(){
 			// RomuTrio
 			uint64_t xp = x_state, yp = y_state, zp = z_state;
@@ -2,107 +2,139 @@
 #define _STATS_H
 
 #include <cstdint>
-#include <atomic>
+#include <string>
+#include <vector>
+#include <fstream>
 #include <x86intrin.h> // _rdtsc()
-
-/* Timetracing:
- *   - 0 means no timetracing
- *   - 1 means timetracing of things that happen once per fuzz case
- *   - 2 means timetracing of things that happen a lot of times per fuzz case.
- */
-#define TIMETRACE 2
+#include "histogram.h"
 
 // Type returned by _rdtsc() for measuring cpu cycles
 typedef unsigned long long cycle_t;
 
+/* Timetracing level:
+ *   - Off means no timetracing
+ *   - Phase means timetracing of things that happen once per fuzz case
+ *   - Fine means timetracing of things that happen a lot of times per fuzz case.
+ * Code doing timetracing is templated over the level, which is selected at
+ * runtime. This way disabled levels are compiled out of the hot path.
+ */
+enum class Timetrace {
+	Off,
+	Phase,
+	Fine,
+};
+
+const char* timetrace_str(Timetrace level);
+
+// Read the timestamp counter if `level` enables timetracing of things that
+// happen once per fuzz case (rdtsc1) or many times per fuzz case (rdtsc2).
+// Otherwise they return 0.
+template <Timetrace level>
+inline cycle_t rdtsc1() {
+	return (level >= Timetrace::Phase ? _rdtsc() : 0);
+}
+
+template <Timetrace level>
+inline cycle_t rdtsc2() {
+	return (level >= Timetrace::Fine ? _rdtsc() : 0);
+}
+
 // STATS
+// Each worker thread has its own Stats, and it's the only one writing to it.
+// Other threads can read it at any moment without locking, or copy it to get
+// a snapshot.
 // TODO join update_cov and report_cov?
-struct Stats {
-	uint64_t cases {0};
-	uint64_t instr {0};
-	uint64_t crashes {0};
-	uint64_t timeouts {0};
-	uint64_t vm_exits {0};
-	uint64_t vm_exits_hc {0};
-	uint64_t vm_exits_debug {0};
-	uint64_t vm_exits_cov {0};
-	cycle_t  total_cycles {0};
-	cycle_t  reset_cycles {0};
-	cycle_t  reset_pages {0};
-	cycle_t  run_cycles {0};
-	cycle_t  vm_exits_cycles {0};
-	cycle_t  kvm_cycles {0};
-	cycle_t  mut_cycles {0};
-	cycle_t  mut1_cycles {0};
-	cycle_t  mut2_cycles {0};
-	cycle_t  set_input_cycles {0};
-	cycle_t  update_cov_cycles {0};
-	cycle_t  report_cov_cycles {0};
-	std::atomic_flag lock = ATOMIC_FLAG_INIT;
-
-	Stats() {};
-
-	Stats(const Stats& other) {
-		cases             = other.cases;
-		instr             = other.instr;
-		crashes           = other.crashes;
-		timeouts          = other.timeouts;
-		vm_exits          = other.vm_exits;
-		vm_exits_hc       = other.vm_exits_hc;
-		vm_exits_debug    = other.vm_exits_debug;
-		vm_exits_cov      = other.vm_exits_cov;
-		total_cycles      = other.total_cycles;
-		reset_cycles      = other.reset_cycles;
-		reset_pages       = other.reset_pages;
-		run_cycles        = other.run_cycles;
-		vm_exits_cycles   = other.vm_exits_cycles;
-		kvm_cycles        = other.kvm_cycles;
-		mut_cycles        = other.mut_cycles;
-		mut1_cycles       = other.mut1_cycles;
-		mut2_cycles       = other.mut2_cycles;
-		set_input_cycles  = other.set_input_cycles;
-		update_cov_cycles = other.update_cov_cycles;
-		report_cov_cycles = other.report_cov_cycles;
-	}
-
-	void update(const Stats& stats){
-		while (lock.test_and_set());
-		cases             += stats.cases;
-		instr             += stats.instr;
-		crashes           += stats.crashes;
-		timeouts          += stats.timeouts;
-		vm_exits          += stats.vm_exits;
-		vm_exits_hc       += stats.vm_exits_hc;
-		vm_exits_debug    += stats.vm_exits_debug;
-		vm_exits_cov      += stats.vm_exits_cov;
-		total_cycles      += stats.total_cycles;
-		reset_cycles      += stats.reset_cycles;
-		reset_pages       += stats.reset_pages;
-		run_cycles        += stats.run_cycles;
-		vm_exits_cycles   += stats.vm_exits_cycles;
-		kvm_cycles        += stats.kvm_cycles;
-		mut_cycles        += stats.mut_cycles;
-		mut1_cycles       += stats.mut1_cycles;
-		mut2_cycles       += stats.mut2_cycles;
-		set_input_cycles  += stats.set_input_cycles;
-		update_cov_cycles += stats.update_cov_cycles;
-		report_cov_cycles += stats.report_cov_cycles;
-		lock.clear();
-	}
+struct alignas(64) Stats {
+	Counter cases;
+	Counter instr;
+	Counter crashes;
+	Counter timeouts;
+	Counter out_of_memory;
+	Counter vm_exits;
+	Counter vm_exits_hc;
+	Counter vm_exits_debug;
+	Counter vm_exits_cov;
+	Counter total_cycles;
+	Counter reset_cycles;
+	Counter reset_pages;
+	Counter run_cycles;
+	Counter vm_exits_cycles;
+	Counter kvm_cycles;
+	Counter mut_cycles;
+	Counter mut1_cycles;
+	Counter mut2_cycles;
+	Counter set_input_cycles;
+	Counter update_cov_cycles;
+	Counter report_cov_cycles;
+
+	// Latency distributions, in cycles. The ones that happen once per fuzz
+	// case are recorded with Timetrace::Phase, and vm exits with
+	// Timetrace::Fine.
+	Histogram mut_latency;
+	Histogram set_input_latency;
+	Histogram run_latency;
+	Histogram reset_latency;
+	Histogram vm_exit_latency;
+
+	Stats& operator+=(const Stats& stats);
+	Stats& operator-=(const Stats& stats);
 };
 
-#if TIMETRACE == 0
-#define rdtsc1() (0)
-#define rdtsc2() (0)
+// Stats of every worker thread. Elements are aligned to a cache line so
+// workers updating their own stats don't false-share. Aggregation is done by
+// the thread printing stats, reading every element without locks.
+class ThreadStats {
+public:
+	ThreadStats(size_t n);
+	ThreadStats(const ThreadStats&) = delete;
+	ThreadStats& operator=(const ThreadStats&) = delete;
+	~ThreadStats();
 
-#elif TIMETRACE == 1
-#define rdtsc1() _rdtsc()
-#define rdtsc2() (0)
+	size_t size() const;
+	Stats& operator[](size_t i);
+	const Stats& operator[](size_t i) const;
 
-#elif TIMETRACE >= 2
-#define rdtsc1() _rdtsc()
-#define rdtsc2() _rdtsc()
-#endif
+	// Get a snapshot of the stats of every thread
+	std::vector<Stats> snapshot() const;
+
+private:
+	Stats* m_stats;
+	size_t m_size;
+};
+
+// Writes stats periodically to the output directory in machine-readable
+// formats: one JSON object per line to `stats.jsonl`, and the latest values
+// in Prometheus text exposition format to `stats.prom`, so it can be scraped
+// with node_exporter's textfile collector.
+class StatsExporter {
+public:
+	static constexpr const char* JSON_FILENAME       = "stats.jsonl";
+	static constexpr const char* PROMETHEUS_FILENAME = "stats.prom";
+
+	// Values which are not part of Stats
+	struct Info {
+		double elapsed_total;
+		double elapsed;
+		uint64_t cov;
+		uint64_t corpus_size;
+		uint64_t unique_crashes;
+	};
 
+	StatsExporter(const std::string& output_dir);
 
-#endif
\ No newline at end of file
+	// Export stats given the snapshots of each thread now and `elapsed`
+	// seconds ago
+	void dump(const Info& info, const std::vector<Stats>& stats,
+	          const std::vector<Stats>& stats_old);
+
+private:
+	std::string m_prometheus_path;
+	std::ofstream m_json;
+
+	void dump_json(const Info& info, const std::vector<Stats>& stats,
+	               const std::vector<Stats>& stats_old);
+	void dump_prometheus(const Info& info, const std::vector<Stats>& stats,
+	                     const std::vector<Stats>& stats_old);
+};
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef _SYMBOL_INDEX_H
+#define _SYMBOL_INDEX_H
+
+#include <vector>
+#include <string>
+#include "common.h"
+
+struct symbol_t;
+
+// Immutable index for finding the symbol an address belongs to. It is built
+// once from the symbols of an elf, with their addresses relative to the load
+// address of the elf, so it remains valid when a PIE binary or a library is
+// relocated. Start addresses are kept in their own sorted array so lookups
+// are a binary search over contiguous memory, and names are interned into a
+// single string table.
+class SymbolIndex {
+public:
+	struct Result {
+		const char* name;
+
+		// Start of the symbol, relative to the load address
+		vaddr_t start;
+
+		// Position of the symbol in the vector the index was built from
+		uint32_t symbol;
+	};
+
+	SymbolIndex();
+
+	// Build the index of `symbols`, whose values are relative to `base`.
+	// Symbols without name or address are left out, and when several of them
+	// start at the same address only one is kept, preferring functions and
+	// global symbols.
+	SymbolIndex(const std::vector<symbol_t>& symbols, vaddr_t base);
+
+	// Get the closest symbol starting at or below `offset`. Sizes are not
+	// taken into account, as some symbols (such as deregister_tm_clones or
+	// do_global_dtors_aux) have a size of 0.
+	bool lookup(vaddr_t offset, Result& result) const;
+
+	size_t size() const;
+
+private:
+	struct Entry {
+		// Offset of the name in the string table
+		uint32_t name;
+		uint32_t symbol;
+	};
+
+	// Sorted start addresses, and the entry corresponding to each of them
+	std::vector<vaddr_t> m_starts;
+	std::vector<Entry> m_entries;
+
+	// Null-terminated names
+	std::string m_names;
+};
+
+#endif
@@ -2,10 +2,23 @@
 #define _TRACING_H
 
 #include <vector>
+#include <string>
+#include <fstream>
+#include <unordered_map>
+#include <chrono>
 #include "common.h"
+#include "histogram.h"
 
 class Vm;
 
+// Syscall tracing (kernel) or basic block tracing (user). When tracing
+// kernel, the kernel measures each syscall itself with rdpmc and appends the
+// measure to a ring in its memory, which is drained when the run ends or when
+// it gets full, so there are no vm exits per syscall. Names of syscalls and
+// symbols are interned into ids shared by every Vm, and each Vm keeps the
+// count and a histogram of the measure of every id. Full traces are only
+// written for one of every `sample_period` runs, in a compact binary format
+// which scripts/convert_traces.py turns into the text files markov.py reads.
 class Tracing {
 public:
 	// Keep this the same as in the kernel
@@ -20,33 +33,106 @@ public:
 		Instructions,
 	};
 
-	struct Measure {
-		std::string name;
-		uint64_t start;
-	};
+	// Keep this the same as in the kernel
+	static const size_t RING_SIZE = 256;
 
+	static const uint32_t NO_ID;
+
+	// Minimum time between two dumps of the aggregated stats to disk
+	static const std::chrono::seconds DUMP_INTERVAL;
+
+	static constexpr const char* NAMES_FILENAME = "names";
 
 	Tracing(Vm& vm, Type type = Type::None, Unit unit = Unit::Cycles);
 	Tracing(Vm& vm, const Tracing& other);
 	void reset(const Tracing& other);
 	void set_type(Type type);
 	void set_type_addr(vaddr_t type_addr);
+	void set_ring_addr(vaddr_t ring_addr);
 	void set_unit(Unit unit);
 	Type type() const;
+
+	// Write aggregated stats of each runner and one of every `sample_period`
+	// full traces to `output_dir`. If `sample_period` is 0, full traces are
+	// never written.
+	void set_output(const std::string& output_dir, size_t sample_period);
+
+	// Finish current measure, returning the current value of the counter
 	size_t trace();
-	void trace_and_prepare(std::string name);
-	void prepare(std::string name);
+
+	// User: finish current measure and start measuring the basic block at
+	// `addr`
+	void trace_and_prepare(vaddr_t addr);
+
+	// Kernel: aggregate the syscalls in the ring and empty it
+	void drain_ring();
+
 	size_t get_tracing_measure();
-	void dump_trace(size_t id = 0);
+
+	// Finish the trace of the last run. It is written to disk if it's
+	// sampled, and aggregated stats are written if last dump was more than
+	// DUMP_INTERVAL ago, or if `force` is set.
+	void dump_trace(size_t id = 0, bool force = false);
+
+	// Intern a name, returning its id
+	static uint32_t intern(const std::string& name);
 
 private:
+	struct Measure {
+		uint32_t id;
+		uint64_t start;
+	};
+
+	struct TraceEntry {
+		uint32_t id;
+		uint64_t measure;
+	};
+
+	// Keep these the same as in the kernel
+	struct SyscallEvent {
+		vaddr_t name;
+		uint64_t start;
+		uint64_t end;
+	};
+
+	struct RingHeader {
+		uint64_t counter;
+		uint64_t count;
+	};
+
 	Vm& m_vm;
 	Type m_type;
 	vaddr_t m_type_addr;
+	vaddr_t m_ring_addr;
 	Unit m_unit;
 	Measure m_measure;
 	size_t m_next_trace_id;
-	std::vector<std::pair<std::string, size_t>> m_trace;
+	std::vector<TraceEntry> m_trace;
+
+	// Id of the name associated to an address, which is the address of the
+	// basic block when tracing user, or the address of the syscall name when
+	// tracing kernel
+	std::unordered_map<vaddr_t, uint32_t> m_ids;
+	uint32_t m_exit_group_id;
+
+	// Histogram of the measures of each id
+	std::vector<Histogram> m_histograms;
+
+	std::string m_output_dir;
+	size_t m_sample_period;
+	std::ofstream m_samples;
+
+	// Number of names in the names file last time this runner wrote it
+	size_t m_names_written;
+
+	std::chrono::steady_clock::time_point m_last_dump;
+
+	uint32_t addr_id(vaddr_t addr);
+	void add_measure(uint32_t id, uint64_t measure);
+	void write_ring_counter();
+	void write_names(size_t id);
+	void write_sample(size_t id);
+	void write_stats(size_t id);
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,84 @@
+#ifndef _UNWIND_TABLE_H
+#define _UNWIND_TABLE_H
+
+#include <vector>
+#include "common.h"
+#include "elf_debug.h"
+
+class Mmu;
+
+// Call frame information of an elf precompiled into a flat table, so getting
+// the previous frame doesn't need to interpret DWARF CFI instructions. Each
+// row covers from its address until the next row, and has the rules for
+// the CFA, the return address and the callee-saved registers, which are
+// the only ones needed for unwinding. Rows with rules that can't be
+// expressed this way (such as DWARF expressions) are marked as Fallback,
+// and the caller must interpret the CFI itself.
+class UnwindTable {
+public:
+	enum class Kind : uint8_t {
+		// No information for this address. Marks the end of a FDE.
+		NoInfo,
+
+		// CFA is cfa_reg + cfa_offset, and the return address and saved
+		// registers are stored at CFA + their offset
+		Rules,
+
+		// Return address is undefined: this is the outermost frame
+		Outermost,
+
+		// Rules not supported by this table
+		Fallback,
+	};
+
+	// Callee-saved registers with a saved_offsets entry
+	static const size_t N_SAVED_REGS = 6;
+	static const DwarfReg SAVED_REGS[N_SAVED_REGS];
+
+	struct Row {
+		vaddr_t addr;
+		int32_t cfa_offset;
+		uint8_t cfa_reg;
+		Kind kind;
+		int16_t ra_offset;
+
+		// Offset from the CFA where each of SAVED_REGS is stored, or 0 if it
+		// keeps its value
+		int16_t saved_offsets[N_SAVED_REGS];
+	};
+
+	UnwindTable();
+
+	// Build a table from the rows of every FDE
+	UnwindTable(std::vector<Row> rows);
+
+	// Get the row starting at `addr` given the rules libdwarf computed for it
+	static Row make_row(vaddr_t addr, const Dwarf_Regtable3& regtable);
+
+	// Get the row of `pc`, or nullptr if there isn't any
+	const Row* find(vaddr_t pc) const;
+
+	size_t size() const;
+
+private:
+	std::vector<Row> m_rows;
+};
+
+// Reader of guest stack words for unwinding. Consecutive frames are usually
+// in the same page, so it keeps the translation of the last page instead of
+// doing a page walk for each read.
+class StackReader {
+public:
+	StackReader(Mmu& mmu);
+
+	vsize_t read(vaddr_t addr);
+
+	Mmu& mmu();
+
+private:
+	Mmu& m_mmu;
+	vaddr_t m_page;
+	const uint8_t* m_page_data;
+};
+
+#endif
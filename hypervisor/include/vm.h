@@ -13,6 +13,10 @@
 #include "files.h"
 #include "elfs.h"
 #include "tracing.h"
+#include "profiler.h"
+#include "exit_recorder.h"
+#include "console.h"
+#include "displaced_inst.h"
 #ifdef ENABLE_COVERAGE_INTEL_PT
 #include <libxdc.h>
 #endif
@@ -22,11 +26,14 @@ void init_kvm();
 class Vm {
 public:
 	Vm(vsize_t mem_size, const std::string& kernel_path,
-	   const std::string& binary_path, const std::vector<std::string>& argv);
+	   const std::string& binary_path, const std::vector<std::string>& argv,
+	   const std::string& sysroot = "");
 
 	// Copy constructor: creates a copy of `other` and allows using method reset
 	Vm(const Vm& other);
 
+	~Vm();
+
 	kvm_regs& regs();
 	kvm_regs regs() const;
 	Mmu& mmu();
@@ -34,11 +41,23 @@ public:
 	psize_t memsize() const;
 	FaultInfo fault() const;
 	Tracing& tracing();
+	Profiler& profiler();
+	ExitRecorder& exit_recorder();
+	Console& console();
+	const Elfs& elfs() const;
 	uint64_t get_instructions_executed_and_reset();
 
 	void setup_coverage();
 	const Coverage& coverage() const;
 
+	// Set a coverage breakpoint at a basic block, as setup_coverage does for
+	// every one of them with breakpoints-based coverage
+	void add_basic_block(vaddr_t bb);
+
+	// Basic blocks of the binary read by setup_coverage, whether they have
+	// been covered or not
+	const std::vector<vaddr_t>& basic_blocks() const;
+
 	void reset_coverage();
 
 	// Reset Vm state to `other`, given that current Vm has been constructed
@@ -57,11 +76,18 @@ public:
 		Crash,
 		// Timeout
 		Timeout,
+		// Memory managed by the hypervisor in the guest ran out, such as the
+		// heap of libc substitution
+		OutOfMemory,
 		Unknown,
 	};
 	static const char* reason_str(RunEndReason reason);
 
-	// Run the Vm
+	static const char* hypercall_str(uint64_t hc);
+
+	// Run the Vm. The timetracing level is a template parameter so the
+	// measuring is compiled out when disabled.
+	template <Timetrace timetrace = Timetrace::Off>
 	RunEndReason run(Stats& stats);
 
 	// Run the Vm until a given address
@@ -75,13 +101,37 @@ public:
 	void set_breakpoint(vaddr_t addr);
 	void remove_breakpoint(vaddr_t addr);
 
+	// Set a breakpoint which ends the run with RunEndReason::OutOfMemory,
+	// where guest code managed by the hypervisor jumps when it runs out of
+	// memory
+	void set_out_of_memory_breakpoint(vaddr_t addr);
+
 	// Set and remove hooks. They will be executed at given address.
 	typedef void (*hook_handler_t)(Vm& vm);
 	void set_hook(vaddr_t addr, hook_handler_t hook_handler);
 	void remove_hook(vaddr_t addr);
 
+	// Set and remove stub hooks, whose handler is native code that runs in the
+	// guest instead of in the hypervisor, so they don't cause any vm exit. The
+	// code at given user address is patched with a jump to a trampoline, which
+	// calls the stub with the registers the guest has at that point. The stub
+	// must preserve every register it doesn't mean to modify and return with
+	// `ret`. It is placed at an arbitrary address, so it must be position
+	// independent, and it can communicate with the hypervisor through the
+	// page at Mmu::STUB_HOOKS_SHARED_ADDR. The first one must be set before
+	// the vm starts running.
+	void set_stub_hook(vaddr_t addr, const std::vector<uint8_t>& stub);
+	void remove_stub_hook(vaddr_t addr);
+
 	void set_breakpoints_dirty(bool dirty);
 
+	// Read code from guest memory as it is without breakpoints
+	std::vector<uint8_t> read_code(vaddr_t addr, vsize_t len);
+
+	// Overwrite code in guest memory. Coverage breakpoints in the range are
+	// dropped, as the basic blocks they mark are gone.
+	void patch_code(vaddr_t addr, const std::vector<uint8_t>& code);
+
 	enum class CheckCopied {
 		Yes,
 		No,
@@ -98,7 +148,7 @@ public:
 		CheckCopied check = CheckCopied::No
 	);
 
-	// Same as `set_shared_file`, but content is read from given filename.
+	// Same as `set_shared_file`, but content is mapped from given filename.
 	void read_and_set_shared_file(
 		const std::string& filename,
 		CheckCopied check = CheckCopied::No
@@ -113,6 +163,16 @@ public:
 		CheckCopied check = CheckCopied::No
 	);
 
+	// Provide the file "input" through a memory slot shared with the guest
+	// instead of a memory-loaded file, for inputs of up to `size` bytes. It
+	// must be called before the kernel starts, and the file "input" must not
+	// be set. Copies of this Vm get their own slot.
+	void create_input_slot(size_t size);
+
+	// Set the content of the file "input" provided by the input slot. The
+	// kernel reads it directly from there, so it's just a copy to the slot.
+	void set_input(FileRef input);
+
 	// Reset the timer inside the VM
 	void reset_timer();
 
@@ -140,6 +200,7 @@ private:
 			RunEnd = 1 << 0,
 			Coverage = 1 << 1,
 			Hook = 1 << 2,
+			OutOfMemory = 1 << 3,
 		};
 
 		// This is an OR of one or more Types
@@ -168,6 +229,7 @@ private:
 	FileRefsByPath m_files;
 
 	Coverage   m_coverage;
+	std::vector<vaddr_t> m_basic_blocks;
 
 	Mmu  m_mmu;
 	bool m_running;
@@ -179,6 +241,22 @@ private:
 	// Hook handlers indexed by address
 	std::unordered_map<vaddr_t, hook_handler_t> m_hook_handlers;
 
+	// Instructions displaced by hooks and user tracing breakpoints, decoded
+	// the first time they are needed
+	std::unordered_map<vaddr_t, DisplacedInst> m_displaced_insts;
+
+	// Code patched by each stub hook as it was in memory, and the coverage
+	// breakpoint it replaced, whose type is 0 if there wasn't any
+	struct StubHook {
+		std::vector<uint8_t> code;
+		Breakpoint breakpoint;
+	};
+	std::unordered_map<vaddr_t, StubHook> m_stub_hooks;
+
+	// Bytes used of the stub hooks region, which is allocated when the first
+	// stub hook is set
+	vsize_t m_stub_hooks_size;
+
 	// Whether setting or removing a breakpoint should dirty memory
 	bool m_breakpoints_dirty;
 
@@ -197,10 +275,20 @@ private:
 	// Syscall tracing
 	Tracing m_tracing;
 
+	// Sampling profiler
+	Profiler m_profiler;
+
+	// Record of the last vm exits
+	ExitRecorder m_exit_recorder;
+
+	// Guest output
+	Console m_console;
+
 	int create_vm();
 	void setup_kvm();
 	void load_elfs();
 #ifdef ENABLE_COVERAGE_INTEL_PT
+	template <Timetrace timetrace>
 	void update_coverage(Stats& stats);
 	void* fetch_page(uint64_t page, bool* success);
 #endif
@@ -212,7 +300,17 @@ private:
 	bool try_remove_breakpoint(vaddr_t addr, Breakpoint::Type type);
 	uint8_t set_breakpoint_to_memory(vaddr_t addr);
 	void remove_breakpoint_from_memory(vaddr_t addr, uint8_t original_byte);
-	void handle_breakpoint(RunEndReason& reason);
+	void handle_breakpoint(RunEndReason& reason, Stats& stats);
+
+	// Decode the instruction at `addr`, ignoring breakpoints
+	DisplacedInst decode_displaced(vaddr_t addr);
+
+	// Try to execute the instruction displaced by the breakpoint we are
+	// stopped at by emulating it, instead of single stepping it
+	bool emulate_displaced(vaddr_t addr, RunEndReason& reason);
+
+	// Write code to guest memory, dirtying it only if breakpoints do
+	void write_code(vaddr_t addr, const uint8_t* code, vsize_t len);
 	void maybe_write_file_to_guest(
 		const std::string& filename,
 		const GuestFile& file,
@@ -223,7 +321,7 @@ private:
 	void vm_err(const std::string& err);
 
 	void handle_hypercall(RunEndReason&);
-	void do_hc_print(vaddr_t msg_addr);
+	void do_hc_flush_console(vaddr_t ring_addr);
 	void do_hc_get_mem_info(vaddr_t mem_info_addr);
 	vaddr_t do_hc_get_kernel_brk();
 	void do_hc_get_info(vaddr_t info_addr);
@@ -232,12 +330,13 @@ private:
 	                                vaddr_t length_addr);
 	void do_hc_submit_timeout_pointers(vaddr_t timer_addr, vaddr_t timeout_addr);
 	void do_hc_submit_tracing_type_pointer(vaddr_t tracing_type_addr);
+	void do_hc_submit_profiler_ring_pointer(vaddr_t ring_addr);
 	void do_hc_print_stacktrace(vaddr_t stacktrace_regs_addr);
 	void do_hc_load_library(vaddr_t filename_ptr, vsize_t filename_len,
 	                        vaddr_t load_addr);
 	void do_hc_end_run(RunEndReason reason, vaddr_t info_addr);
-	void do_hc_notify_syscall_start(vaddr_t syscall_name_addr);
-	void do_hc_notify_syscall_end();
+	void do_hc_submit_tracing_ring_pointer(vaddr_t ring_addr);
+	void do_hc_flush_tracing_ring();
 
 	/* void handle_syscall();
 	*/
@@ -60,10 +60,63 @@ void print_usage() {
 	"  -o, --output dir          Output folder (corpus, crashes, etc) (default: ./out)\n"
 	"  -f, --file path           Memory loaded files for the target. Set once for\n"
 	"                            each file: -f file1 -f file2\n"
+	"      --sysroot dir         Look up the interpreter and libraries of the target\n"
+	"                            inside dir instead of /\n"
+	"      --harness symbol      Start runs at the entry of given function, writing\n"
+	"                            each input to the buffer it receives instead of\n"
+	"                            using the input file. Runs end when it returns\n"
+	"      --harness-args spec   Argument registers of the harness function, as\n"
+	"                            ptr,len[,size], where size can also be a number.\n"
+	"                            Without size, the buffer is as big as the length\n"
+	"                            it has when reached (default: rdi,rsi)\n"
+	"      --end-at-return       End runs when the function where they start returns,\n"
+	"                            skipping the teardown of the target\n"
+	"      --end-symbol symbol   End runs when reaching given function. Set once for\n"
+	"                            each function: --end-symbol f1 --end-symbol f2\n"
 	"  -s, --single-run [=path]  Perform a single run, optionally specifying an\n"
 	"                            input file\n"
 	"  -T, --tracing type        Enable syscall tracing. Type can be kernel or user\n"
 	"      --tracing-unit unit   Tracing unit. It can be instructions or cycles (default cycles)\n"
+	"      --tracing-sample n    Write the full trace of one of every n runs to\n"
+	"                            output/traces. By default only the count and\n"
+	"                            histogram of each syscall or symbol are written\n"
+	"      --timetrace level     Measure time spent in each part of the fuzz loop.\n"
+	"                            Level can be off, phase (once per fuzz case) or\n"
+	"                            fine (also every vm exit) (default: off)\n"
+	"      --profile ticks       Sample the guest every given number of timer ticks\n"
+	"                            and write folded stacks to output/profile. Requires\n"
+	"                            a kernel built with -Denable-profiler\n"
+	"      --exit-recorder n     Record the last n vm exits and the cost of each exit\n"
+	"                            reason, hypercall and breakpoint. They are written to\n"
+	"                            output/exits when receiving SIGUSR1\n"
+	"      --slow-case us        With --exit-recorder, also dump vm exits when a run\n"
+	"                            takes longer than given microseconds\n"
+	"      --output-limit bytes  Maximum guest output printed per second by each\n"
+	"                            thread. Output over the limit is dropped\n"
+	"      --capture-output      Save the guest output of each unique crash to\n"
+	"                            output/crashes_output\n"
+	"      --coverage-report secs\n"
+	"                            Write the covered functions and source lines to\n"
+	"                            output/coverage as lcov and JSON every given number\n"
+	"                            of seconds. Requires breakpoints coverage\n"
+	"      --patches path        Patch the target before fuzzing, as described in the\n"
+	"                            given file. Crashes are verified on the unpatched\n"
+	"                            target, and saved to output/crashes_patched if they\n"
+	"                            don't reproduce\n"
+	"      --patch-fixup lib     Library exporting kvm_fuzz_fixup, which fixes\n"
+	"                            crashing inputs before verifying them\n"
+	"      --libc-subst groups   Replace libc functions with lean versions. Groups\n"
+	"                            are separated by commas: alloc (bump allocator),\n"
+	"                            stdio (printf and puts do nothing) and locale\n"
+	"      --libc-heap size      Heap of the bump allocator, optionally followed by\n"
+	"                            K, M, or G. It's taken from the memory limit, and\n"
+	"                            runs which exhaust it end as out of memory\n"
+	"                            (default: half of the memory limit)\n"
+	"      --record              Record the session to output/replay, so it can be\n"
+	"                            replayed with --replay\n"
+	"      --seed n              Seed used with --record (default: random)\n"
+	"      --replay dir          Run again the fuzz cases of a recorded session,\n"
+	"                            and print the time it took\n"
 	"  -h, --help                Print usage\n"
 	, Args::DEFAULT_NUM_THREADS);
 }
@@ -72,6 +125,26 @@ enum LongOptions {
 	MinimizeCorpus = 0x100,
 	MinimizeCrashes,
 	TracingUnit,
+	TracingSample,
+	TimetraceLevel,
+	Profile,
+	ExitRecorderSize,
+	SlowCase,
+	OutputLimit,
+	CaptureOutput,
+	Record,
+	Seed,
+	ReplayDir,
+	Sysroot,
+	HarnessSymbol,
+	HarnessArgs,
+	CoverageReport,
+	PatchesPath,
+	PatchFixupPath,
+	LibcSubstGroups,
+	LibcHeap,
+	EndAtReturn,
+	EndSymbol,
 };
 
 bool Args::parse(int argc, char** argv) {
@@ -85,14 +158,35 @@ bool Args::parse(int argc, char** argv) {
 		{"input", required_argument, nullptr, 'i'},
 		{"output", required_argument, nullptr, 'o'},
 		{"file", required_argument, nullptr, 'f'},
+		{"sysroot", required_argument, nullptr, LongOptions::Sysroot},
+		{"harness", required_argument, nullptr, LongOptions::HarnessSymbol},
+		{"harness-args", required_argument, nullptr, LongOptions::HarnessArgs},
+		{"end-at-return", no_argument, nullptr, LongOptions::EndAtReturn},
+		{"end-symbol", required_argument, nullptr, LongOptions::EndSymbol},
 		{"single-run", optional_argument, nullptr, 's'},
 		{"tracing", required_argument, nullptr, 'T'},
 		{"tracing-unit", required_argument, nullptr, LongOptions::TracingUnit},
+		{"tracing-sample", required_argument, nullptr, LongOptions::TracingSample},
+		{"timetrace", required_argument, nullptr, LongOptions::TimetraceLevel},
+		{"profile", required_argument, nullptr, LongOptions::Profile},
+		{"exit-recorder", required_argument, nullptr, LongOptions::ExitRecorderSize},
+		{"slow-case", required_argument, nullptr, LongOptions::SlowCase},
+		{"output-limit", required_argument, nullptr, LongOptions::OutputLimit},
+		{"capture-output", no_argument, nullptr, LongOptions::CaptureOutput},
+		{"coverage-report", required_argument, nullptr, LongOptions::CoverageReport},
+		{"patches", required_argument, nullptr, LongOptions::PatchesPath},
+		{"patch-fixup", required_argument, nullptr, LongOptions::PatchFixupPath},
+		{"libc-subst", required_argument, nullptr, LongOptions::LibcSubstGroups},
+		{"libc-heap", required_argument, nullptr, LongOptions::LibcHeap},
+		{"record", no_argument, nullptr, LongOptions::Record},
+		{"seed", required_argument, nullptr, LongOptions::Seed},
+		{"replay", required_argument, nullptr, LongOptions::ReplayDir},
 		{"help", no_argument, nullptr, 'h'},
 		{0, 0, 0, 0},
 	};
 
 	int opt;
+	bool harness_args = false;
 	while ((opt = getopt_long(argc, argv, "j:m:t:k:i:o:f:s::T:h", long_options, nullptr)) > 0) {
 		switch (opt) {
 			case LongOptions::MinimizeCorpus:
@@ -162,6 +256,121 @@ bool Args::parse(int argc, char** argv) {
 					return false;
 				}
 				break;
+			case LongOptions::TracingSample:
+				if ((sscanf(optarg, "%lu", &tracing_sample) < 1) || (tracing_sample == 0)) {
+					printf("Option --tracing-sample must be followed by a number greater than 0.\n\n");
+					print_usage();
+					return false;
+				}
+				break;
+			case LongOptions::TimetraceLevel:
+				if (!strcmp(optarg, "off"))
+					timetrace = Timetrace::Off;
+				else if (!strcmp(optarg, "phase"))
+					timetrace = Timetrace::Phase;
+				else if (!strcmp(optarg, "fine"))
+					timetrace = Timetrace::Fine;
+				else {
+					printf("Option --timetrace must be followed by 'off', 'phase' or 'fine'\n\n");
+					print_usage();
+					return false;
+				}
+				break;
+			case LongOptions::Profile:
+				if ((sscanf(optarg, "%lu", &profile_period) < 1) || (profile_period == 0)) {
+					printf("Option --profile must be followed by a number greater than 0.\n\n");
+					print_usage();
+					return false;
+				}
+				break;
+			case LongOptions::ExitRecorderSize:
+				if ((sscanf(optarg, "%lu", &exit_recorder_size) < 1) || (exit_recorder_size == 0)) {
+					printf("Option --exit-recorder must be followed by a number greater than 0.\n\n");
+					print_usage();
+					return false;
+				}
+				break;
+			case LongOptions::SlowCase:
+				if ((sscanf(optarg, "%lu", &slow_case_us) < 1) || (slow_case_us == 0)) {
+					printf("Option --slow-case must be followed by a number greater than 0.\n\n");
+					print_usage();
+					return false;
+				}
+				break;
+			case LongOptions::OutputLimit:
+				if ((sscanf(optarg, "%lu", &output_limit) < 1) || (output_limit == 0)) {
+					printf("Option --output-limit must be followed by a number greater than 0.\n\n");
+					print_usage();
+					return false;
+				}
+				break;
+			case LongOptions::CaptureOutput:
+				capture_output = true;
+				break;
+			case LongOptions::CoverageReport:
+				if ((sscanf(optarg, "%lu", &coverage_report) < 1) || (coverage_report == 0)) {
+					printf("Option --coverage-report must be followed by a number greater than 0.\n\n");
+					print_usage();
+					return false;
+				}
+				break;
+			case LongOptions::PatchesPath:
+				patches_path = optarg;
+				break;
+			case LongOptions::PatchFixupPath:
+				patch_fixup_path = optarg;
+				break;
+			case LongOptions::LibcSubstGroups:
+				if (!LibcSubst::parse_groups(optarg, libc_subst)) {
+					printf("Option --libc-subst must be followed by a list of "
+					       "alloc, stdio or locale separated by commas.\n\n");
+					print_usage();
+					return false;
+				}
+				break;
+			case LongOptions::LibcHeap:
+				if (!parse_memory(optarg, libc_heap) || libc_heap == 0) {
+					printf("Option --libc-heap must be followed by a number, "
+					       "optionally followed by K, M, or G.\n\n");
+					print_usage();
+					return false;
+				}
+				break;
+			case LongOptions::Record:
+				record = true;
+				break;
+			case LongOptions::Seed:
+				if ((sscanf(optarg, "%lu", &seed) < 1) || (seed == 0)) {
+					printf("Option --seed must be followed by a number greater than 0.\n\n");
+					print_usage();
+					return false;
+				}
+				break;
+			case LongOptions::ReplayDir:
+				replay_dir = optarg;
+				break;
+			case LongOptions::Sysroot:
+				sysroot = optarg;
+				break;
+			case LongOptions::HarnessSymbol:
+				harness = optarg;
+				break;
+			case LongOptions::EndAtReturn:
+				end_at_return = true;
+				break;
+			case LongOptions::EndSymbol:
+				end_symbols.push_back(optarg);
+				break;
+			case LongOptions::HarnessArgs:
+				harness_args = true;
+				if (!Harness::parse_layout(optarg, harness_layout)) {
+					printf("Option --harness-args must be followed by ptr,len[,size], "
+					       "where each of them is one of rdi, rsi, rdx, rcx, r8 or r9, "
+					       "and size can also be a number greater than 0.\n\n");
+					print_usage();
+					return false;
+				}
+				break;
 			case 'h':
 			case '?':
 			default:
@@ -190,6 +399,57 @@ bool Args::parse(int argc, char** argv) {
 		return false;
 	}
 
+	if (record && !replay_dir.empty()) {
+		printf("You can't specify both --record and --replay.\n\n");
+		print_usage();
+		return false;
+	}
+
+	if ((record || !replay_dir.empty()) &&
+	    (single_run || minimize_corpus || minimize_crashes)) {
+		printf("Options --record and --replay are only available when fuzzing.\n\n");
+		print_usage();
+		return false;
+	}
+
+	if (harness_args && harness.empty()) {
+		printf("Option --harness-args requires --harness.\n\n");
+		print_usage();
+		return false;
+	}
+
+	if (end_at_return && !harness.empty()) {
+		printf("Option --end-at-return is implied by --harness.\n\n");
+		print_usage();
+		return false;
+	}
+
+	if (!patch_fixup_path.empty() && patches_path.empty()) {
+		printf("Option --patch-fixup requires --patches.\n\n");
+		print_usage();
+		return false;
+	}
+
+	if (!libc_heap)
+		libc_heap = memory / LibcSubst::DEFAULT_HEAP_DIVISOR;
+	if (libc_heap >= memory) {
+		printf("Option --libc-heap must be smaller than the memory limit.\n\n");
+		print_usage();
+		return false;
+	}
+
+	if ((libc_subst & LibcSubst::Group::Stdio) && capture_output) {
+		printf("Option --capture-output can't be used when substituting stdio.\n\n");
+		print_usage();
+		return false;
+	}
+
+	if (seed && !record) {
+		printf("Option --seed requires --record.\n\n");
+		print_usage();
+		return false;
+	}
+
 #ifdef ENABLE_COVERAGE_INTEL_PT
 	if (tracing_type == Tracing::Type::User) {
 		printf("Tracing user is not available with Intel PT.\n");
@@ -197,6 +457,13 @@ bool Args::parse(int argc, char** argv) {
 	}
 #endif
 
+#ifndef ENABLE_COVERAGE_BREAKPOINTS
+	if (coverage_report) {
+		printf("Coverage report is only available with breakpoints coverage.\n");
+		return false;
+	}
+#endif
+
 #ifndef ENABLE_COVERAGE
 	if (tracing_type != Tracing::Type::None) {
 		printf("Tracing enabled but coverage is disabled.\n");
@@ -0,0 +1,101 @@
+#include <cstdio>
+#include "console.h"
+#include "vm.h"
+
+using namespace std;
+
+const size_t Console::RING_SIZE;
+const size_t Console::MAX_CAPTURE_SIZE;
+
+static const char* PREFIX = "[KERNEL] ";
+
+Console::Console(Vm& vm)
+	: m_vm(vm)
+	, m_ring_addr(0)
+	, m_rate_limit(0)
+	, m_capture(false)
+	, m_line_start(true)
+	, m_window_start(chrono::steady_clock::now())
+	, m_window_bytes(0)
+	, m_dropped_bytes(0)
+{}
+
+Console::Console(Vm& vm, const Console& other)
+	: m_vm(vm)
+	, m_ring_addr(other.m_ring_addr)
+	, m_rate_limit(other.m_rate_limit)
+	, m_capture(other.m_capture)
+	, m_line_start(true)
+	, m_window_start(chrono::steady_clock::now())
+	, m_window_bytes(0)
+	, m_dropped_bytes(0)
+{}
+
+void Console::set_ring_addr(vaddr_t ring_addr) {
+	m_ring_addr = ring_addr;
+}
+
+void Console::set_rate_limit(size_t bytes_per_sec) {
+	m_rate_limit = bytes_per_sec;
+}
+
+void Console::set_capture(bool capture) {
+	m_capture = capture;
+}
+
+bool Console::capturing() const {
+	return m_capture;
+}
+
+const string& Console::captured() const {
+	return m_captured;
+}
+
+void Console::reset() {
+	m_captured.clear();
+}
+
+void Console::drain() {
+	if (!m_ring_addr)
+		return;
+	uint64_t len = m_vm.mmu().read<uint64_t>(m_ring_addr + offsetof(RingHeader, len));
+	if (len == 0)
+		return;
+	ASSERT(len <= RING_SIZE, "console ring len: %lu", len);
+
+	char data[RING_SIZE];
+	m_vm.mmu().read_mem(data, m_ring_addr + sizeof(RingHeader), len);
+	m_vm.mmu().write<uint64_t>(m_ring_addr + offsetof(RingHeader, len), 0);
+
+	if (m_capture && m_captured.size() < MAX_CAPTURE_SIZE)
+		m_captured.append(data, min<size_t>(len, MAX_CAPTURE_SIZE - m_captured.size()));
+
+	if (m_rate_limit) {
+		auto now = chrono::steady_clock::now();
+		if (now - m_window_start >= chrono::seconds(1)) {
+			if (m_dropped_bytes)
+				printf("%s%lu bytes of output dropped\n", PREFIX, m_dropped_bytes);
+			m_window_start = now;
+			m_window_bytes = 0;
+			m_dropped_bytes = 0;
+		}
+		size_t allowed = m_rate_limit - min(m_window_bytes, m_rate_limit);
+		m_dropped_bytes += len - min<size_t>(len, allowed);
+		len = min<size_t>(len, allowed);
+		m_window_bytes += len;
+	}
+	print(data, len);
+}
+
+void Console::print(const char* data, size_t len) {
+	// Add prefix to every line and print it with a single call, so lines
+	// of different runners aren't mixed
+	string out;
+	for (size_t i = 0; i < len; i++) {
+		if (m_line_start)
+			out += PREFIX;
+		out += data[i];
+		m_line_start = (data[i] == '\n');
+	}
+	fwrite(out.data(), 1, out.size(), stdout);
+}
@@ -13,6 +13,8 @@ Corpus::Corpus(int nthreads, const string& input_dir, const string& output_dir)
 	: m_input_dir(input_dir)
 	, m_output_dir_corpus(output_dir + "/" + CORPUS_DIR)
 	, m_output_dir_crashes(output_dir + "/" + CRASHES_DIR)
+	, m_output_dir_crashes_output(output_dir + "/" + CRASHES_OUT_DIR)
+	, m_output_dir_crashes_patched(output_dir + "/" + CRASHES_PATCHED_DIR)
 	, m_output_dir_min_corpus(output_dir + "/" + MIN_CORPUS_DIR)
 	, m_output_dir_min_crashes(output_dir + "/" + MIN_CRASHES_DIR)
 	, m_lock_corpus(false)
@@ -21,6 +23,7 @@ Corpus::Corpus(int nthreads, const string& input_dir, const string& output_dir)
 	, m_mutated_inputs_indexes(nthreads)
 	, m_mode(Mode::Unknown)
 	, m_mutator(m_corpus)
+	, m_replay(nullptr)
 {
 	// Reuse corpus as input
 	if (m_input_dir == "-")
@@ -101,6 +104,12 @@ size_t Corpus::coverage() const {
 	return m_recorded_coverage.count();
 }
 
+#ifdef ENABLE_COVERAGE_BREAKPOINTS
+size_t Corpus::new_blocks(size_t from, vector<vaddr_t>& blocks) {
+	return m_recorded_coverage.new_blocks(from, blocks);
+}
+#endif
+
 string Corpus::seed_filename(size_t i) const {
 	ASSERT(i < m_seeds_filenames.size(), "OOB i: %lu", i);
 	return m_seeds_filenames[i];
@@ -133,10 +142,14 @@ void Corpus::write_crash_file(size_t i, const FaultInfo& fault) {
 	utils::write_file(m_output_dir_crashes + "/" + fault.filename(), m_corpus[i]);
 }
 
-void Corpus::write_crash_file(int id, const FaultInfo& fault) {
+void Corpus::write_crash_file(const string& input, const FaultInfo& fault) {
 	ASSERT(m_mode == Mode::Normal, "mode %d", m_mode);
-	utils::write_file(m_output_dir_crashes + "/" + fault.filename(),
-	                  m_mutated_inputs[id]);
+	utils::write_file(m_output_dir_crashes + "/" + fault.filename(), input);
+}
+
+void Corpus::write_crash_output_file(const FaultInfo& fault, const string& output) {
+	ASSERT(m_mode == Mode::Normal, "mode %d", m_mode);
+	utils::write_file(m_output_dir_crashes_output + "/" + fault.filename(), output);
 }
 
 void Corpus::write_min_corpus_file(size_t i) {
@@ -164,6 +177,8 @@ void Corpus::set_mode_normal(const Coverage& total_coverage) {
 	// current files with same content.
 	utils::create_folder(m_output_dir_corpus);
 	utils::create_folder(m_output_dir_crashes);
+	utils::create_folder(m_output_dir_crashes_output);
+	utils::create_folder(m_output_dir_crashes_patched);
 	if (m_output_dir_corpus != m_input_dir) {
 		for (size_t i = 0; i < m_corpus.size(); i++) {
 			write_corpus_file(i);
@@ -214,32 +229,72 @@ void Corpus::set_mode_crashes_min(const vector<FaultInfo>& faults) {
 	}
 }
 
+void Corpus::set_replay(Replay& replay) {
+	m_replay = &replay;
+}
+
+void Corpus::lock_corpus_with_size(size_t size) {
+	while (true) {
+		while (m_lock_corpus.test_and_set());
+		if (m_corpus.size() >= size)
+			return;
+		m_lock_corpus.clear();
+		_mm_pause();
+	}
+}
+
+template <Timetrace timetrace>
 FileRef Corpus::get_new_input(int id, Rng& rng, Stats& stats){
 	// Copy a random input to slot `id`, mutate it and return a
 	// constant reference to it
 	ASSERT(m_mode != Mode::Unknown, "mode not set");
-	cycle_t cycles = rdtsc2();
-	while (m_lock_corpus.test_and_set());
-	size_t i = rng.rnd(0, m_corpus.size() - 1);
+	cycle_t cycles = rdtsc2<timetrace>();
+	size_t i, corpus_size;
+	if (m_replay && m_replay->replaying()) {
+		// Take the same input as the recorded case, once the corpus is as
+		// big as it was. The rng is still used so its state doesn't diverge.
+		const Replay::Case& c = m_replay->thread(id).current();
+		corpus_size = c.corpus_size;
+		lock_corpus_with_size(corpus_size);
+		rng.rnd(0, corpus_size - 1);
+		i = c.parent;
+	} else {
+		while (m_lock_corpus.test_and_set());
+		corpus_size = m_corpus.size();
+		i = rng.rnd(0, corpus_size - 1);
+	}
 	m_mutated_inputs[id] = m_corpus[i];
 	m_mutated_inputs_indexes[id] = i;
 	m_lock_corpus.clear();
-	stats.mut1_cycles += rdtsc2() - cycles;
-
-	cycles = rdtsc2();
-	mutate_input(id, rng);
-	stats.mut2_cycles += rdtsc2() - cycles;
+	if (m_replay && m_replay->recording())
+		m_replay->thread(id).set_parent(i, corpus_size);
+	if (timetrace >= Timetrace::Fine)
+		stats.mut1_cycles += rdtsc2<timetrace>() - cycles;
+
+	cycles = rdtsc2<timetrace>();
+	mutate_input(id, rng, corpus_size);
+	if (timetrace >= Timetrace::Fine)
+		stats.mut2_cycles += rdtsc2<timetrace>() - cycles;
 	return FileRef::from_string(m_mutated_inputs[id]);
 }
 
+template FileRef Corpus::get_new_input<Timetrace::Off>(int, Rng&, Stats&);
+template FileRef Corpus::get_new_input<Timetrace::Phase>(int, Rng&, Stats&);
+template FileRef Corpus::get_new_input<Timetrace::Fine>(int, Rng&, Stats&);
+
 void Corpus::report_crash(int id, Vm& vm) {
 	ASSERT(m_mode != Mode::Unknown, "mode not set");
 
-	const FaultInfo& fault = vm.fault();
 	if (m_mode == Mode::CrashesMinimization) {
-		handle_crash_crashes_min(id, fault);
+		handle_crash_crashes_min(id, vm.fault());
 		return;
 	}
+	report_crash(vm, m_mutated_inputs[id]);
+}
+
+void Corpus::report_crash(Vm& vm, const string& input) {
+	ASSERT(m_mode != Mode::Unknown, "mode not set");
+	const FaultInfo& fault = vm.fault();
 
 	// Try to insert fault information into our set
 	while (m_lock_crashes.test_and_set());
@@ -254,11 +309,29 @@ void Corpus::report_crash(int id, Vm& vm) {
 		// but we don't want to write to other directories.
 		if (m_mode != Mode::CorpusMinimization) {
 			//add_input(m_mutated_inputs[id]);
-			write_crash_file(id, fault);
+			write_crash_file(input, fault);
+			if (vm.console().capturing())
+				write_crash_output_file(fault, vm.console().captured());
 		}
 	}
 }
 
+void Corpus::report_patched_crash(int id, Vm& vm) {
+	ASSERT(m_mode == Mode::Normal, "mode %d", m_mode);
+	const FaultInfo& fault = vm.fault();
+	while (m_lock_crashes.test_and_set());
+	bool inserted = m_crashes_patched.insert(fault).second;
+	m_lock_crashes.clear();
+
+	if (inserted) {
+		printf("Crash only happens with patches applied, saving it to %s\n",
+		       m_output_dir_crashes_patched.c_str());
+		vm.print_fault_info();
+		utils::write_file(m_output_dir_crashes_patched + "/" + fault.filename(),
+		                  m_mutated_inputs[id]);
+	}
+}
+
 void Corpus::handle_crash_crashes_min(int id, const FaultInfo& fault) {
 	// If the fault is the same as the one we're trying to minimize and
 	// the size of the mutated input is lower than current input size,
@@ -284,9 +357,18 @@ void Corpus::report_coverage(int id, const Coverage& cov) {
 			handle_cov_corpus_min(id, cov);
 			break;
 		case Mode::Normal:
-			if (m_recorded_coverage.add(cov)) {
+			if (m_replay && m_replay->replaying()) {
+				// Add the input only if it was added when recording, and at
+				// the same index
+				m_recorded_coverage.add(cov);
+				size_t index = m_replay->thread(id).current().corpus_index;
+				if (index != Replay::NOT_ADDED)
+					add_input(m_mutated_inputs[id], index);
+			} else if (m_recorded_coverage.add(cov)) {
 				// There was new coverage
-				add_input(m_mutated_inputs[id]);
+				size_t index = add_input(m_mutated_inputs[id]);
+				if (m_replay && m_replay->recording())
+					m_replay->thread(id).set_corpus_index(index);
 			}
 			break;
 		case Mode::Unknown:
@@ -355,16 +437,26 @@ void Corpus::minimize() {
 }
 
 
-void Corpus::add_input(const string& new_input){
+size_t Corpus::add_input(const string& new_input, size_t index){
 	ASSERT(m_mode == Mode::Normal, "adding input to corpus in mode %d", m_mode);
-	while (m_lock_corpus.test_and_set());
+	if (index == Replay::NOT_ADDED)
+		while (m_lock_corpus.test_and_set());
+	else
+		lock_corpus_with_size(index);
 	size_t i = m_corpus.size();
+	ASSERT(index == Replay::NOT_ADDED || i == index, "adding input at %lu, "
+	       "expected %lu", i, index);
 	m_corpus.push_back(new_input);
 	m_lock_corpus.clear();
 	write_corpus_file(i);
+	return i;
 }
 
-void Corpus::mutate_input(int id, Rng& rng){
+void Corpus::mutate_input(int id, Rng& rng, size_t corpus_size){
+	// Mutator is a reference to the corpus and a few sizes, so it's cheap to
+	// copy one with the corpus size this input was taken with
+	Mutator mutator(m_mutator);
+	mutator.set_corpus_size(corpus_size);
 	string& input = m_mutated_inputs[id];
-	m_mutator.mutate_input(input, rng, m_mode != Mode::Normal);
+	mutator.mutate_input(input, rng, m_mode != Mode::Normal);
 }
@@ -0,0 +1,204 @@
+#include <fstream>
+#include "coverage_exporter.h"
+#include "elfs.h"
+#include "utils.h"
+
+using namespace std;
+
+// Write a JSON string, escaping what needs to be escaped
+static void json_string(ostream& os, const string& s) {
+	os << '"';
+	for (char c : s) {
+		if (c == '"' || c == '\\')
+			os << '\\' << c;
+		else if ((unsigned char)c < 0x20)
+			os << "\\u00" << "0123456789abcdef"[c >> 4] << "0123456789abcdef"[c & 0xF];
+		else
+			os << c;
+	}
+	os << '"';
+}
+
+// Open a temporary file for `path`, call `write` on it and rename it to
+// `path`, so readers never see a partially written report
+template <class Writer>
+static void write_file(const string& path, Writer write) {
+	string tmp_path = path + ".tmp";
+	ofstream os(tmp_path);
+	ERROR_ON(!os.good(), "opening %s", tmp_path.c_str());
+	write(os);
+	os.close();
+	ERROR_ON(!os.good(), "writing %s", tmp_path.c_str());
+	ERROR_ON(rename(tmp_path.c_str(), path.c_str()) == -1,
+	         "renaming %s to %s", tmp_path.c_str(), path.c_str());
+}
+
+CoverageExporter::CoverageExporter(const Elfs& elfs,
+                                   const vector<vaddr_t>& basic_blocks,
+                                   const string& output_dir)
+	: m_elfs(elfs)
+	, m_lcov_path(output_dir + "/" + LCOV_FILENAME)
+	, m_json_path(output_dir + "/" + JSON_FILENAME)
+	, m_blocks(0)
+	, m_unknown_blocks(0)
+{
+	utils::create_folder(output_dir);
+
+	// Known lines and functions start with no blocks covered
+	size_t* line_blocks;
+	Function* function;
+	for (vaddr_t block : basic_blocks)
+		locate(block, line_blocks, function);
+}
+
+size_t CoverageExporter::blocks() const {
+	return m_blocks;
+}
+
+size_t CoverageExporter::unknown_blocks() const {
+	return m_unknown_blocks;
+}
+
+void CoverageExporter::add(const vector<vaddr_t>& blocks) {
+	for (vaddr_t block : blocks)
+		add(block);
+}
+
+void CoverageExporter::locate(vaddr_t block, size_t*& line_blocks,
+                              Function*& function)
+{
+	line_blocks = nullptr;
+	function = nullptr;
+	const ElfParser* elf = m_elfs.elf_with_addr(block);
+	if (!elf)
+		return;
+
+	// Source is in the form `file:line`
+	string file;
+	size_t line = 0;
+	string source = elf->addr_to_source(block);
+	size_t colon = source.rfind(':');
+	if (colon != string::npos) {
+		file = source.substr(0, colon);
+		line = strtoul(source.c_str() + colon + 1, nullptr, 10);
+		line_blocks = &m_lines[file][line];
+	}
+
+	const char* name;
+	vsize_t offset;
+	if (!elf->addr_to_symbol_name(block, name, offset))
+		return;
+	vaddr_t start = block - offset;
+	auto it = m_functions.find(start);
+	if (it == m_functions.end()) {
+		it = m_functions.insert({start, {name, elf->path(), file, line, 0}}).first;
+	} else if (!file.empty()) {
+		Function& known = it->second;
+		if (known.file.empty())
+			known.file = file;
+		if (known.file == file && (known.line == 0 || line < known.line))
+			known.line = line;
+	}
+	function = &it->second;
+}
+
+void CoverageExporter::add(vaddr_t block) {
+	m_blocks++;
+	size_t* line_blocks;
+	Function* function;
+	locate(block, line_blocks, function);
+	if (line_blocks)
+		(*line_blocks)++;
+	else
+		m_unknown_blocks++;
+	if (function)
+		function->blocks++;
+}
+
+void CoverageExporter::dump() const {
+	dump_lcov();
+	dump_json();
+}
+
+void CoverageExporter::dump_lcov() const {
+	// lcov wants the functions of each source file in its record, identified
+	// by name. Functions with the same name in the same file come from
+	// different elfs built from the same source, so they are merged.
+	struct FileFunction {
+		size_t line;
+		size_t blocks;
+	};
+	map<string, map<string, FileFunction>> functions;
+	for (const auto& it : m_functions) {
+		const Function& function = it.second;
+		if (function.file.empty())
+			continue;
+		auto inserted = functions[function.file].insert({function.name,
+		                                                 {function.line, 0}});
+		FileFunction& file_function = inserted.first->second;
+		file_function.line = min(file_function.line, function.line);
+		file_function.blocks += function.blocks;
+	}
+
+	write_file(m_lcov_path, [&](ostream& os) {
+		os << "TN:\n";
+		for (const auto& file : m_lines) {
+			os << "SF:" << file.first << "\n";
+			const auto& file_functions = functions[file.first];
+			size_t functions_hit = 0;
+			for (const auto& function : file_functions)
+				os << "FN:" << function.second.line << "," << function.first << "\n";
+			for (const auto& function : file_functions) {
+				os << "FNDA:" << function.second.blocks << "," << function.first << "\n";
+				functions_hit += (function.second.blocks != 0);
+			}
+			os << "FNF:" << file_functions.size() << "\n"
+			   << "FNH:" << functions_hit << "\n";
+			size_t lines_hit = 0;
+			for (const auto& line : file.second) {
+				os << "DA:" << line.first << "," << line.second << "\n";
+				lines_hit += (line.second != 0);
+			}
+			os << "LF:" << file.second.size() << "\n"
+			   << "LH:" << lines_hit << "\n"
+			   << "end_of_record\n";
+		}
+	});
+}
+
+void CoverageExporter::dump_json() const {
+	write_file(m_json_path, [&](ostream& os) {
+		os << "{\"blocks\":" << m_blocks
+		   << ",\"unknown_blocks\":" << m_unknown_blocks
+		   << ",\"files\":{";
+		bool first = true;
+		for (const auto& file : m_lines) {
+			os << (first ? "" : ",");
+			json_string(os, file.first);
+			os << ":{";
+			bool first_line = true;
+			for (const auto& line : file.second) {
+				os << (first_line ? "" : ",") << "\"" << line.first << "\":" << line.second;
+				first_line = false;
+			}
+			os << "}";
+			first = false;
+		}
+		// Names of functions may be repeated, so they are a list
+		os << "},\"functions\":[";
+		first = true;
+		for (const auto& it : m_functions) {
+			const Function& function = it.second;
+			os << (first ? "" : ",") << "{\"name\":";
+			json_string(os, function.name);
+			os << ",\"elf\":";
+			json_string(os, function.elf);
+			os << ",\"file\":";
+			json_string(os, function.file);
+			os << ",\"line\":" << function.line
+			   << ",\"blocks\":" << function.blocks << "}";
+			first = false;
+		}
+		os << "]}\n";
+	});
+}
@@ -0,0 +1,291 @@
+#include <cstring>
+#include "displaced_inst.h"
+#include "mmu.h"
+
+// General purpose registers in the order they are encoded
+static __u64 kvm_regs::* const REGS[] = {
+	&kvm_regs::rax, &kvm_regs::rcx, &kvm_regs::rdx, &kvm_regs::rbx,
+	&kvm_regs::rsp, &kvm_regs::rbp, &kvm_regs::rsi, &kvm_regs::rdi,
+	&kvm_regs::r8,  &kvm_regs::r9,  &kvm_regs::r10, &kvm_regs::r11,
+	&kvm_regs::r12, &kvm_regs::r13, &kvm_regs::r14, &kvm_regs::r15,
+};
+
+// Arithmetic flags in rflags
+static const uint64_t FLAG_CF = 1 << 0;
+static const uint64_t FLAG_PF = 1 << 2;
+static const uint64_t FLAG_AF = 1 << 4;
+static const uint64_t FLAG_ZF = 1 << 6;
+static const uint64_t FLAG_SF = 1 << 7;
+static const uint64_t FLAG_OF = 1 << 11;
+static const uint64_t ARITH_FLAGS = FLAG_CF | FLAG_PF | FLAG_AF | FLAG_ZF |
+                                    FLAG_SF | FLAG_OF;
+
+DisplacedInst::DisplacedInst()
+	: m_op(Op::None)
+	, m_len(0)
+	, m_dst(NO_REG)
+	, m_src(NO_REG)
+	, m_base(NO_REG)
+	, m_index(NO_REG)
+	, m_scale(0)
+	, m_rip_relative(false)
+	, m_disp(0)
+	, m_imm(0)
+{}
+
+bool DisplacedInst::emulable() const {
+	return m_op != Op::None;
+}
+
+size_t DisplacedInst::length() const {
+	return m_len;
+}
+
+bool DisplacedInst::decode_modrm(const uint8_t* code, size_t len, size_t& i,
+                                 uint8_t rex, uint8_t& mod, uint8_t& reg,
+                                 uint8_t& rm)
+{
+	if (i >= len)
+		return false;
+	uint8_t modrm = code[i++];
+	mod = modrm >> 6;
+	reg = ((modrm >> 3) & 7) | ((rex & 4) << 1);
+	rm  = (modrm & 7) | ((rex & 1) << 3);
+	if (mod == 3)
+		return true;
+
+	// Memory operand
+	size_t disp_size = (mod == 1 ? 1 : (mod == 2 ? 4 : 0));
+	m_base  = rm;
+	m_index = NO_REG;
+	m_scale = 1;
+	if ((modrm & 7) == 4) {
+		// SIB byte. Index 4 without REX.X means no index, and base 5 without
+		// displacement means no base and a 32 bits displacement.
+		if (i >= len)
+			return false;
+		uint8_t sib = code[i++];
+		m_scale = 1 << (sib >> 6);
+		m_index = ((sib >> 3) & 7) | ((rex & 2) << 2);
+		if (m_index == 4)
+			m_index = NO_REG;
+		m_base = (sib & 7) | ((rex & 1) << 3);
+		if ((sib & 7) == 5 && mod == 0) {
+			m_base = NO_REG;
+			disp_size = 4;
+		}
+	} else if ((modrm & 7) == 5 && mod == 0) {
+		m_base = NO_REG;
+		m_rip_relative = true;
+		disp_size = 4;
+	}
+
+	if (i + disp_size > len)
+		return false;
+	if (disp_size == 1) {
+		m_disp = (int8_t)code[i];
+	} else if (disp_size == 4) {
+		int32_t disp;
+		memcpy(&disp, code + i, sizeof(disp));
+		m_disp = disp;
+	}
+	i += disp_size;
+	return true;
+}
+
+DisplacedInst DisplacedInst::decode(const uint8_t* code, size_t len) {
+	DisplacedInst inst, none;
+	static const uint8_t endbr64[] = {0xF3, 0x0F, 0x1E, 0xFA};
+	if (len >= sizeof(endbr64) && !memcmp(code, endbr64, sizeof(endbr64))) {
+		inst.m_op  = Op::Nop;
+		inst.m_len = sizeof(endbr64);
+		return inst;
+	}
+
+	// Operand size prefixes are only accepted for nops, and REX must be right
+	// before the opcode
+	size_t i = 0;
+	bool opsize = false;
+	while (i < len && code[i] == 0x66) {
+		opsize = true;
+		i++;
+	}
+	uint8_t rex = 0;
+	if (i < len && (code[i] & 0xF0) == 0x40)
+		rex = code[i++];
+	if (i >= len)
+		return none;
+	bool rex_w = rex & 8;
+	uint8_t opcode = code[i++];
+	uint8_t mod, reg, rm;
+
+	switch (opcode) {
+		case 0x90:
+			// xchg r8, rax with REX.B
+			if (rex & 1)
+				return none;
+			inst.m_op = Op::Nop;
+			break;
+
+		case 0x0F:
+			// Multi-byte nop: 0F 1F /0
+			if (i >= len || code[i++] != 0x1F)
+				return none;
+			if (!inst.decode_modrm(code, len, i, rex, mod, reg, rm) || (reg & 7) != 0)
+				return none;
+			inst.m_op = Op::Nop;
+			break;
+
+		case 0x50: case 0x51: case 0x52: case 0x53:
+		case 0x54: case 0x55: case 0x56: case 0x57:
+			if (opsize)
+				return none;
+			inst.m_op  = Op::Push;
+			inst.m_src = (opcode & 7) | ((rex & 1) << 3);
+			break;
+
+		case 0x89:
+		case 0x8B:
+			// Register to register only
+			if (opsize || !inst.decode_modrm(code, len, i, rex, mod, reg, rm) || mod != 3)
+				return none;
+			inst.m_op  = (rex_w ? Op::Mov : Op::Mov32);
+			inst.m_dst = (opcode == 0x89 ? rm : reg);
+			inst.m_src = (opcode == 0x89 ? reg : rm);
+			break;
+
+		case 0x8D:
+			if (opsize || !rex_w || !inst.decode_modrm(code, len, i, rex, mod, reg, rm) || mod == 3)
+				return none;
+			inst.m_op  = Op::Lea;
+			inst.m_dst = reg;
+			break;
+
+		case 0x81:
+		case 0x83: {
+			// Add or sub of an immediate to a register
+			if (opsize || !rex_w || !inst.decode_modrm(code, len, i, rex, mod, reg, rm) || mod != 3)
+				return none;
+			if ((reg & 7) == 0)
+				inst.m_op = Op::Add;
+			else if ((reg & 7) == 5)
+				inst.m_op = Op::Sub;
+			else
+				return none;
+			inst.m_dst = rm;
+			size_t imm_size = (opcode == 0x83 ? 1 : 4);
+			if (i + imm_size > len)
+				return none;
+			if (imm_size == 1) {
+				inst.m_imm = (int8_t)code[i];
+			} else {
+				int32_t imm;
+				memcpy(&imm, code + i, sizeof(imm));
+				inst.m_imm = imm;
+			}
+			i += imm_size;
+			break;
+		}
+
+		default:
+			return none;
+	}
+
+	ASSERT(i <= MAX_LEN, "decoded instruction too long: %lu", i);
+	inst.m_len = i;
+	return inst;
+}
+
+static bool parity(uint8_t val) {
+	return !(__builtin_popcount(val) & 1);
+}
+
+// Set arithmetic flags the way `a + b` or `a - b` do, given their result
+static void update_flags(__u64& rflags, uint64_t a, uint64_t b,
+                         uint64_t result, bool sub)
+{
+	rflags &= ~ARITH_FLAGS;
+	if (sub ? a < b : result < a)
+		rflags |= FLAG_CF;
+	if (parity(result))
+		rflags |= FLAG_PF;
+	if ((a ^ b ^ result) & 0x10)
+		rflags |= FLAG_AF;
+	if (result == 0)
+		rflags |= FLAG_ZF;
+	if (result >> 63)
+		rflags |= FLAG_SF;
+	uint64_t overflow = (sub ? (a ^ b) : ~(a ^ b)) & (a ^ result);
+	if (overflow >> 63)
+		rflags |= FLAG_OF;
+}
+
+bool DisplacedInst::emulate(kvm_regs& regs, Mmu& mmu) const {
+	vaddr_t next_rip = regs.rip + m_len;
+	switch (m_op) {
+		case Op::None:
+			return false;
+
+		case Op::Nop:
+			break;
+
+		case Op::Push: {
+			// Leave it to the guest if it would fault
+			vaddr_t rsp = regs.rsp - sizeof(uint64_t);
+			if (!mmu.is_writable(rsp) || !mmu.is_writable(rsp + sizeof(uint64_t) - 1))
+				return false;
+			mmu.write<uint64_t>(rsp, regs.*REGS[m_src]);
+			regs.rsp = rsp;
+			break;
+		}
+
+		case Op::Mov:
+			regs.*REGS[m_dst] = regs.*REGS[m_src];
+			break;
+
+		case Op::Mov32:
+			regs.*REGS[m_dst] = (uint32_t)(regs.*REGS[m_src]);
+			break;
+
+		case Op::Lea: {
+			uint64_t addr = m_disp;
+			if (m_rip_relative)
+				addr += next_rip;
+			if (m_base != NO_REG)
+				addr += regs.*REGS[m_base];
+			if (m_index != NO_REG)
+				addr += regs.*REGS[m_index] * m_scale;
+			regs.*REGS[m_dst] = addr;
+			break;
+		}
+
+		case Op::Add:
+		case Op::Sub: {
+			uint64_t a = regs.*REGS[m_dst], b = m_imm;
+			uint64_t result = (m_op == Op::Add ? a + b : a - b);
+			update_flags(regs.rflags, a, b, result, m_op == Op::Sub);
+			regs.*REGS[m_dst] = result;
+			break;
+		}
+	}
+	regs.rip = next_rip;
+	return true;
+}
+
+void DisplacedInst::relocate(const uint8_t* code, vaddr_t addr,
+                             std::vector<uint8_t>& out) const
+{
+	ASSERT(emulable(), "relocating not decoded instruction at 0x%lx", addr);
+	if (m_op != Op::Lea || !m_rip_relative) {
+		out.insert(out.end(), code, code + m_len);
+		return;
+	}
+
+	// The target of a rip relative lea may be too far from the new address,
+	// so turn it into a mov of the absolute address: REX.W B8+r imm64
+	uint64_t target = addr + m_len + m_disp;
+	out.push_back(0x48 | (m_dst >> 3));
+	out.push_back(0xB8 | (m_dst & 7));
+	for (size_t i = 0; i < sizeof(target); i++)
+		out.push_back(target >> (i*8));
+}
@@ -1,8 +1,12 @@
 #include <libelf.h>
 #include <iostream>
+#include <mutex>
+#include <unordered_map>
 #include <libdwarf/dwarf.h>
-#include "mmu.h"
 #include "elf_debug.h"
+#include "line_table.h"
+#include "unwind_table.h"
+#include "utils.h"
 #include "common.h"
 
 using namespace std;
@@ -10,16 +14,27 @@ using namespace std;
 // If this errmsg produces "Dwarf_Error is NULL", that's because ret is DW_DLV_NO_ENTRY
 #define DWARF_CHECK(ret, err) ASSERT(ret == DW_DLV_OK, "%s", dwarf_errmsg(err))
 
+// Elfs are shared by every thread, so only one of them builds the tables
+static mutex build_mutex;
+
+constexpr const char* ElfDebug::LINE_TABLES_DIR;
+
 ElfDebug::ElfDebug()
-	: m_elf(nullptr)
+	: m_data(nullptr)
+	, m_size(0)
+	, m_elf(nullptr)
 	, m_dwarf(nullptr)
 	, m_cie_data(nullptr)
 	, m_fde_data(nullptr)
 	, m_cie_count(0)
 	, m_fde_count(0)
+	, m_lines(nullptr)
+	, m_unwind(nullptr)
 {}
 
 ElfDebug::ElfDebug(const uint8_t* data, size_t size) : ElfDebug() {
+	m_data = data;
+	m_size = size;
 	m_elf = elf_memory((char*)data, size);
 	ASSERT(m_elf, "error reading elf from memory");
 
@@ -45,6 +60,8 @@ ElfDebug::ElfDebug(ElfDebug&& other) : ElfDebug() {
 }
 
 ElfDebug::~ElfDebug() {
+	delete m_lines.load();
+	delete m_unwind.load();
 	if (m_cie_data)
 		dwarf_fde_cie_list_dealloc(m_dwarf, m_cie_data, m_cie_count,
 		                           m_fde_data, m_fde_count);
@@ -55,12 +72,16 @@ ElfDebug::~ElfDebug() {
 }
 
 void swap(ElfDebug& first, ElfDebug& second) {
+	swap(first.m_data, second.m_data);
+	swap(first.m_size, second.m_size);
 	swap(first.m_elf, second.m_elf);
 	swap(first.m_dwarf, second.m_dwarf);
 	swap(first.m_cie_data, second.m_cie_data);
 	swap(first.m_cie_count, second.m_cie_count);
 	swap(first.m_fde_data, second.m_fde_data);
 	swap(first.m_fde_count, second.m_fde_count);
+	first.m_lines = second.m_lines.exchange(first.m_lines);
+	first.m_unwind = second.m_unwind.exchange(first.m_unwind);
 }
 
 ElfDebug& ElfDebug::operator=(ElfDebug&& other) {
@@ -76,7 +97,27 @@ bool ElfDebug::has_frames() const {
 	return m_cie_data != nullptr;
 }
 
-bool ElfDebug::next_frame(vaddr_t regs[DwarfReg::MAX], Mmu& mmu) const {
+bool ElfDebug::next_frame(vaddr_t regs[DwarfReg::MAX], StackReader& stack) const {
+	if (!has_frames())
+		return false;
+
+	// Same as below, substract one from the return address
+	const UnwindTable::Row* row = unwind().find(regs[DwarfReg::ReturnAddress]-1);
+	if (!row || row->kind == UnwindTable::Kind::Outermost)
+		return false;
+	if (row->kind == UnwindTable::Kind::Fallback)
+		return next_frame_cfi(regs, stack);
+
+	vaddr_t cfa = regs[row->cfa_reg] + row->cfa_offset;
+	for (size_t i = 0; i < UnwindTable::N_SAVED_REGS; i++)
+		if (row->saved_offsets[i])
+			regs[UnwindTable::SAVED_REGS[i]] = stack.read(cfa + row->saved_offsets[i]);
+	regs[DwarfReg::ReturnAddress] = stack.read(cfa + row->ra_offset);
+	regs[DwarfReg::Rsp] = cfa;
+	return true;
+}
+
+bool ElfDebug::next_frame_cfi(vaddr_t regs[DwarfReg::MAX], StackReader& stack) const {
 	if (!has_frames())
 		return false;
 
@@ -123,7 +164,7 @@ bool ElfDebug::next_frame(vaddr_t regs[DwarfReg::MAX], Mmu& mmu) const {
 			if (rule.dw_offset_relevant) {
 				// Value is stored at the address CFA + N
 				addr = regs[DwarfReg::Rsp] + rule.dw_offset_or_block_len;
-				value = mmu.read<vsize_t>(addr);
+				value = stack.read(addr);
 			} else {
 				// Value is the value of the register dw_regnum
 				ASSERT(rule.dw_regnum < DwarfReg::MAX, "oob reg %d",
@@ -167,6 +208,70 @@ bool ElfDebug::get_current_frame_regs_info(vaddr_t instruction_pointer,
 }
 
 
+const UnwindTable& ElfDebug::unwind() const {
+	UnwindTable* unwind = m_unwind.load(memory_order_acquire);
+	if (unwind)
+		return *unwind;
+
+	lock_guard<mutex> lock(build_mutex);
+	unwind = m_unwind.load(memory_order_relaxed);
+	if (!unwind) {
+		unwind = build_unwind_table();
+		m_unwind.store(unwind, memory_order_release);
+	}
+	return *unwind;
+}
+
+UnwindTable* ElfDebug::build_unwind_table() const {
+	vector<UnwindTable::Row> rows;
+	vector<Dwarf_Regtable_Entry3_s> rules(DW_REG_TABLE_SIZE);
+	Dwarf_Regtable3 regtable;
+	regtable.rt3_reg_table_size = DW_REG_TABLE_SIZE;
+	regtable.rt3_rules = rules.data();
+
+	Dwarf_Error err = nullptr;
+	for (Dwarf_Signed i = 0; i < m_fde_count; i++) {
+		Dwarf_Fde fde = m_fde_data[i];
+		Dwarf_Addr low_pc;
+		Dwarf_Unsigned length;
+		if (dwarf_get_fde_range(fde, &low_pc, &length, nullptr, nullptr, nullptr,
+		                        nullptr, nullptr, &err) != DW_DLV_OK)
+			continue;
+
+		// FDEs of functions discarded by the linker start at 0
+		if (low_pc == 0 || length == 0)
+			continue;
+
+		// Get the rules of each row of the FDE, and mark its end
+		Dwarf_Addr pc = low_pc, end = low_pc + length;
+		while (pc < end) {
+			Dwarf_Addr row_pc;
+			if (dwarf_get_fde_info_for_all_regs3(fde, pc, &regtable, &row_pc,
+			                                     &err) != DW_DLV_OK)
+				break;
+			rows.push_back(UnwindTable::make_row(pc, regtable));
+
+			Dwarf_Small value_type;
+			Dwarf_Signed offset_relevant, regnum, offset;
+			Dwarf_Ptr block;
+			Dwarf_Bool has_more_rows;
+			Dwarf_Addr next_pc;
+			if (dwarf_get_fde_info_for_cfa_reg3_b(fde, pc, &value_type,
+				&offset_relevant, &regnum, &offset, &block, &row_pc,
+				&has_more_rows, &next_pc, &err) != DW_DLV_OK ||
+				!has_more_rows || next_pc <= pc)
+				break;
+			pc = next_pc;
+		}
+		UnwindTable::Row row_end = {};
+		row_end.addr = end;
+		row_end.kind = UnwindTable::Kind::NoInfo;
+		rows.push_back(row_end);
+	}
+
+	return new UnwindTable(move(rows));
+}
+
 // cu: compilation unit
 // die: debugging information entry
 
@@ -200,157 +305,113 @@ bool get_die_limits(Dwarf_Die die, Dwarf_Addr* low_pc, Dwarf_Addr* high_pc) {
 }
 
 string ElfDebug::addr_to_source(vaddr_t pc) const {
-	string result;
 	if (!has())
-		return result;
+		return "";
+	return lines().addr_to_source(pc);
+}
 
-	bool found = false;
+const LineTable& ElfDebug::lines() const {
+	LineTable* lines = m_lines.load(memory_order_acquire);
+	if (lines)
+		return *lines;
+
+	lock_guard<mutex> lock(build_mutex);
+	lines = m_lines.load(memory_order_relaxed);
+	if (lines)
+		return *lines;
+
+	// Attempt to load it from the cache, keyed by the md5 of the elf.
+	// Otherwise build it and save it for the next time.
+	string path = string(LINE_TABLES_DIR) + "/" + utils::md5(m_data, m_size) + ".bin";
+	lines = new LineTable;
+	if (!lines->load(path)) {
+		delete lines;
+		lines = build_line_table();
+		utils::create_folder(LINE_TABLES_DIR);
+		if (!lines->save(path))
+			printf("Warning: couldn't save line table to %s\n", path.c_str());
+	}
+	m_lines.store(lines, memory_order_release);
+	return *lines;
+}
+
+LineTable* ElfDebug::build_line_table() const {
+	vector<LineTable::Row> rows;
+	vector<string> files;
+	unordered_map<string, uint32_t> file_ids;
 	Dwarf_Error err = nullptr;
 
-	// Iterate compilation unit headers
+	// Iterate compilation unit headers until the end, which also leaves
+	// libdwarf ready to iterate them again
 	while (dwarf_next_cu_header_d(
 		m_dwarf, is_info, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,
 		nullptr, nullptr, nullptr, nullptr, &err
-	) == DW_DLV_OK && !found) {
-		// Get the cu die
+	) == DW_DLV_OK) {
+		// Get the cu die and its line program
 		Dwarf_Die cu_die = 0;
 		if (dwarf_siblingof_b(m_dwarf, 0, is_info, &cu_die, nullptr) != DW_DLV_OK)
 			continue;
 
-		// Check if pc belongs to this cu, and get the source string in that case
-		if (die_has_pc(cu_die, pc)) {
-			result = get_source_str_cu_die(cu_die, pc);
-			found = true;
+		Dwarf_Unsigned version;
+		Dwarf_Small table_count;
+		Dwarf_Line_Context ctxt;
+		if (dwarf_srclines_b(cu_die, &version, &table_count, &ctxt, &err) != DW_DLV_OK) {
+			dwarf_dealloc(m_dwarf, cu_die, DW_DLA_DIE);
+			continue;
 		}
 
-		dwarf_dealloc(m_dwarf, cu_die, DW_DLA_DIE);
-	}
-
-	// Reset state
-	while (dwarf_next_cu_header_d(
-		m_dwarf, is_info, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,
-		nullptr, nullptr, nullptr, nullptr, &err
-	) == DW_DLV_OK) {}
-	return result;
-}
-
-bool ElfDebug::die_has_pc(Dwarf_Die die, Dwarf_Addr pc) const {
-	ASSERT(has(), "die_has_pc without dwarf");
-
-	// Attempt to get limits with highpc, lowpc
-	Dwarf_Addr low_pc = DW_DLV_BADADDR, high_pc = DW_DLV_BADADDR;
-	if (get_die_limits(die, &low_pc, &high_pc)) {
-		return low_pc <= pc && pc < high_pc;
-	}
-
-	// We might have gotten the low_pc despite having failed later with the
-	// high_pc. Check if DW_AT_ranges attribute is present and search for the
-	// PC in the returned ranges list.
-	// I have no idea what's going on here
-	bool result = false;
-	Dwarf_Attribute attr;
-	if (dwarf_attr(die, DW_AT_ranges, &attr, NULL) != DW_DLV_OK)
-		return result;
-
-	Dwarf_Unsigned offset;
-	if (dwarf_global_formref(attr, &offset, NULL) == DW_DLV_OK) {
-		Dwarf_Signed count = 0;
-		Dwarf_Ranges *ranges = 0;
-		Dwarf_Addr baseaddr = (low_pc != DW_DLV_BADADDR ? low_pc : 0);
-		if (dwarf_get_ranges_a(m_dwarf, offset, die, &ranges, &count, NULL, NULL) == DW_DLV_OK) {
-			for (int i = 0; i < count; i++) {
-				Dwarf_Ranges *cur = ranges + i;
-				if (cur->dwr_type == DW_RANGES_ENTRY) {
-					Dwarf_Addr rng_lowpc, rng_highpc;
-					rng_lowpc = baseaddr + cur->dwr_addr1;
-					rng_highpc = baseaddr + cur->dwr_addr2;
-					if (pc >= rng_lowpc && pc < rng_highpc) {
-						result = true;
-						break;
-					}
-				} else if (cur->dwr_type == DW_RANGES_ADDRESS_SELECTION) {
-					baseaddr = cur->dwr_addr2;
-				} else {  // DW_RANGES_END
-					baseaddr = low_pc;
+		if (table_count == 1) {
+			Dwarf_Line* linebuf = 0;
+			Dwarf_Signed linecount = 0;
+			dwarf_srclines_from_linecontext(ctxt, &linebuf, &linecount, nullptr);
+			bool new_sequence = true, skip_sequence = false;
+			for (Dwarf_Signed i = 0; i < linecount; i++) {
+				Dwarf_Line line = linebuf[i];
+				Dwarf_Addr lineaddr;
+				Dwarf_Bool is_lne;
+				if (dwarf_lineaddr(line, &lineaddr, nullptr) != DW_DLV_OK ||
+				    dwarf_lineendsequence(line, &is_lne, nullptr) != DW_DLV_OK)
+					continue;
+
+				// Sequences of functions discarded by the linker start at 0
+				if (new_sequence)
+					skip_sequence = (lineaddr == 0);
+				new_sequence = is_lne;
+				if (skip_sequence)
+					continue;
+
+				if (is_lne) {
+					rows.push_back({lineaddr, LineTable::END_SEQUENCE, 0});
+					continue;
 				}
-			}
-			dwarf_ranges_dealloc(m_dwarf, ranges, count);
-		}
-	}
-	dwarf_dealloc(m_dwarf, attr, DW_DLA_ATTR);
-	return result;
-}
-
-
-string ElfDebug::get_source_str_cu_die(Dwarf_Die cu_die, Dwarf_Addr pc) const {
-	string result;
-	Dwarf_Unsigned version;
-	Dwarf_Small table_count;
-	Dwarf_Line_Context ctxt;
-	Dwarf_Error err = nullptr;
 
-	int ret = dwarf_srclines_b(cu_die, &version, &table_count, &ctxt, &err);
-	// DWARF_CHECK(ret, err);
-	if (ret != DW_DLV_OK)
-		return result;
-
-	if (table_count == 1) {
-		Dwarf_Line *linebuf = 0;
-		Dwarf_Signed linecount = 0;
-		dwarf_srclines_from_linecontext(ctxt, &linebuf, &linecount, NULL);
-		Dwarf_Addr prev_lineaddr;
-		Dwarf_Line prev_line = 0;
-		for (int i = 0; i < linecount; i++) {
-			Dwarf_Line line = linebuf[i];
-			Dwarf_Addr lineaddr;
-			dwarf_lineaddr(line, &lineaddr, NULL);
-			if (pc == lineaddr) {
-				/* Print the last line entry containing current pc. */
-				Dwarf_Line last_pc_line = line;
-				for (int j = i + 1; j < linecount; j++) {
-					Dwarf_Line j_line = linebuf[j];
-					dwarf_lineaddr(j_line, &lineaddr, NULL);
-					if (pc == lineaddr) {
-						last_pc_line = j_line;
-					}
+				// Get source file id and line number
+				char* src_file;
+				if (dwarf_linesrc(line, &src_file, nullptr) != DW_DLV_OK)
+					continue;
+				string file(src_file);
+				dwarf_dealloc(m_dwarf, src_file, DW_DLA_STRING);
+				auto it = file_ids.find(file);
+				uint32_t file_id;
+				if (it != file_ids.end()) {
+					file_id = it->second;
+				} else {
+					file_id = files.size();
+					files.push_back(file);
+					file_ids[file] = file_id;
 				}
-				result = get_source_str_from_line(last_pc_line);
-				break;
-			} else if (prev_line && pc > prev_lineaddr && pc < lineaddr) {
-				result = get_source_str_from_line(prev_line);
-				break;
-			}
-			Dwarf_Bool is_lne;
-			dwarf_lineendsequence(line, &is_lne, NULL);
-			if (is_lne) {
-				prev_line = 0;
-			} else {
-				prev_lineaddr = lineaddr;
-				prev_line = line;
+				Dwarf_Unsigned lineno;
+				if (dwarf_lineno(line, &lineno, nullptr) != DW_DLV_OK)
+					lineno = 0;
+				rows.push_back({lineaddr, file_id, (uint32_t)lineno});
 			}
 		}
-	}
 
-	dwarf_srclines_dealloc_b(ctxt);
-	return result;
-}
+		dwarf_srclines_dealloc_b(ctxt);
+		dwarf_dealloc(m_dwarf, cu_die, DW_DLA_DIE);
+	}
 
-string ElfDebug::get_source_str_from_line(Dwarf_Line line) const {
-	string result_src;
-	if (!line)
-		return result_src;
-
-	// Get source file and line number
-	char *src_file;
-	Dwarf_Unsigned lineno;
-	if (dwarf_linesrc(line, &src_file, NULL) != DW_DLV_OK)
-		return result_src;
-
-	result_src = string(src_file);
-	bool has_lineno = (dwarf_lineno(line, &lineno, NULL) == DW_DLV_OK);
-	string result_lineno = (has_lineno ? to_string(lineno) : "unk");
-	dwarf_dealloc(m_dwarf, src_file, DW_DLA_STRING);
-	return result_src + ":" + result_lineno;
+	return new LineTable(move(rows), files);
 }
 
 // Currently we are using ELF symbols for this, instead of DWARF info.
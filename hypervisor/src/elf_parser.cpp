@@ -1,12 +1,10 @@
 #include <unistd.h>
-#include <sys/fcntl.h>
-#include <sys/stat.h>
-#include <sys/mman.h>
 #include <limits>
 #include <iomanip>
 #include <sstream>
 #include <algorithm>
 #include "elf_parser.h"
+#include "unwind_table.h"
 #include "utils.h"
 
 #define PAGE_CEIL(addr) (((addr) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
@@ -14,8 +12,7 @@
 using namespace std;
 
 ElfParser::ElfParser(const string& elf_path)
-	: m_owns_data(true)
-	, m_data(nullptr)
+	: m_data(nullptr)
 	, m_path(elf_path)
 	, m_debug_elf(nullptr)
 {
@@ -27,8 +24,7 @@ ElfParser::ElfParser(const string& elf_path)
 }
 
 ElfParser::ElfParser(const string& elf_path, const uint8_t* data, size_t size)
-	: m_owns_data(false)
-	, m_data(data)
+	: m_data(data)
 	, m_size(size)
 	, m_path(elf_path)
 	, m_debug_elf(nullptr)
@@ -37,7 +33,8 @@ ElfParser::ElfParser(const string& elf_path, const uint8_t* data, size_t size)
 }
 
 ElfParser::ElfParser(const ElfParser& other)
-	: m_owns_data(other.m_owns_data)
+	: m_file(other.m_file)
+	, m_data(other.m_data)
 	, m_size(other.m_size)
 	, m_load_addr(other.m_load_addr)
 	, m_initial_brk(other.m_initial_brk)
@@ -49,13 +46,9 @@ ElfParser::ElfParser(const ElfParser& other)
 	, m_sections(other.m_sections)
 	, m_segments(other.m_segments)
 	, m_symbols(other.m_symbols)
+	, m_symbol_index(other.m_symbol_index)
 	, m_debug_elf(other.m_debug_elf ? new ElfParser(*other.m_debug_elf) : nullptr)
 {
-	if (other.m_owns_data)
-		load_file();
-	else
-		m_data = other.m_data;
-
 	m_debug = ElfDebug(m_data, m_size);
 }
 
@@ -64,14 +57,12 @@ ElfParser::ElfParser(ElfParser&& other) : ElfParser() {
 }
 
 ElfParser::~ElfParser() {
-	if (m_data && m_owns_data)
-		ERROR_ON(munmap((void*)m_data, m_size) != 0, "munmap");
 	if (m_debug_elf)
 		delete m_debug_elf;
 }
 
 void swap(ElfParser& first, ElfParser& second) {
-	swap(first.m_owns_data, second.m_owns_data);
+	swap(first.m_file, second.m_file);
 	swap(first.m_data, second.m_data);
 	swap(first.m_size, second.m_size);
 	swap(first.m_load_addr, second.m_load_addr);
@@ -84,6 +75,7 @@ void swap(ElfParser& first, ElfParser& second) {
 	swap(first.m_sections, second.m_sections);
 	swap(first.m_segments, second.m_segments);
 	swap(first.m_symbols, second.m_symbols);
+	swap(first.m_symbol_index, second.m_symbol_index);
 	swap(first.m_debug, second.m_debug);
 	swap(first.m_debug_elf, second.m_debug_elf);
 }
@@ -94,18 +86,9 @@ ElfParser& ElfParser::operator=(ElfParser other) {
 }
 
 void ElfParser::load_file() {
-	const char* cpath = m_path.c_str();
-
-	// Load file into memory
-	struct stat st;
-	int fd = open(cpath, O_RDONLY);
-	ERROR_ON(fd < 0, "elf %s: open", cpath);
-	ERROR_ON(fstat(fd, &st) < 0, "elf %s: fstat", cpath);
-	m_size = st.st_size;
-
-	m_data = (uint8_t*)mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
-	ERROR_ON(m_data == MAP_FAILED, "elf %s: mmap", cpath);
-	close(fd);
+	m_file = MappedFile::open(m_path);
+	m_data = m_file->data();
+	m_size = m_file->size();
 }
 
 void ElfParser::init() {
@@ -276,13 +259,6 @@ void ElfParser::init() {
 		}
 	}
 
-	// Sort symbols by address, from higher to lower. This is taken advantage
-	// of in addr_to_symbol.
-	sort(m_symbols.begin(), m_symbols.end(), [](const symbol_t& s1, const symbol_t& s2) {
-		return s1.value > s2.value;
-	});
-
-
 	m_debug = ElfDebug(m_data, m_size);
 
 	// Load debug elf if it was specified and it exists
@@ -299,8 +275,11 @@ void ElfParser::init() {
 			m_symbols.insert(m_symbols.end(), m_debug_elf->m_symbols.begin(),
 			                 m_debug_elf->m_symbols.end());
 			m_debug_elf->m_symbols.clear();
+			m_debug_elf->m_symbol_index = SymbolIndex();
 		}
 	}
+
+	m_symbol_index = SymbolIndex(m_symbols, m_load_addr);
 }
 
 bool ElfParser::has_data() const {
@@ -378,19 +357,19 @@ vector<section_t> ElfParser::sections() const {
 	return m_sections;
 }
 
-vector<symbol_t> ElfParser::symbols() const {
+const vector<symbol_t>& ElfParser::symbols() const {
 	return m_symbols;
 }
 
 pair<vaddr_t, vaddr_t> ElfParser::section_limits(const string& name) const {
-	for (const section_t& section : sections())
+	for (const section_t& section : m_sections)
 		if (section.name == name)
 			return { section.addr, section.addr + section.size };
 	ASSERT(false, "not found section: %s", name.c_str());
 }
 
 pair<vaddr_t, vaddr_t> ElfParser::symbol_limits(const string& name) const {
-	for (const symbol_t& symbol : symbols())
+	for (const symbol_t& symbol : m_symbols)
 		if (symbol.name == name)
 			return { symbol.value, symbol.value + symbol.size };
 	ASSERT(false, "not found symbol: %s", name.c_str());
@@ -400,28 +379,6 @@ string ElfParser::md5() const {
 	return utils::md5(m_data, m_size);
 }
 
-vector<string> ElfParser::get_dependencies() const {
-	vector<string> result;
-
-	// Run ldd and parse its output
-	string ldd_result = utils::exec_cmd("ldd " + m_path + " 2>&1");
-	vector<string> lines = utils::split_string(ldd_result, "\n");
-	for (const string& line : lines) {
-		size_t pos1 = line.find("=> ");
-		if (pos1 == string::npos)
-			continue;
-		pos1 += 3;
-		if (line.substr(pos1) == "not found")
-			continue;
-		size_t pos2 = line.find(" ", pos1); // assume path doesn't have spaces :')
-		if (pos2 == string::npos)
-			continue;
-		result.push_back(line.substr(pos1, pos2-pos1));
-	}
-
-	return result;
-}
-
 vaddr_t ElfParser::resolve_symbol(const string& symbol_name) const {
 	for (const symbol_t& symbol : m_symbols)
 		if (symbol.name == symbol_name)
@@ -430,27 +387,30 @@ vaddr_t ElfParser::resolve_symbol(const string& symbol_name) const {
 }
 
 bool ElfParser::addr_to_symbol(vaddr_t addr, symbol_t& result) const {
-	// Here we take advantage of symbols being sorted by address from higher to
-	// lower. So we take the symbol that is closest to the address. This appears
-	// to work better than just checking if addr is in the symbol range
-	// (symbol.value, symbol.value + symbol.size), because some symbols (such as
-	// deregister_tm_clones or do_global_dtors_aux) seem to have a size of 0.
-	for (const symbol_t& symbol : symbols()) {
-		if (addr >= symbol.value) {
-			result = symbol;
-			return true;
-		}
-	}
-	return false;
+	SymbolIndex::Result symbol;
+	if (addr < m_load_addr || !m_symbol_index.lookup(addr - m_load_addr, symbol))
+		return false;
+	result = m_symbols[symbol.symbol];
+	return true;
+}
+
+bool ElfParser::addr_to_symbol_name(vaddr_t addr, const char*& name,
+                                    vsize_t& offset) const
+{
+	SymbolIndex::Result symbol;
+	if (addr < m_load_addr || !m_symbol_index.lookup(addr - m_load_addr, symbol))
+		return false;
+	name = symbol.name;
+	offset = addr - m_load_addr - symbol.start;
+	return true;
 }
 
 string ElfParser::addr_to_symbol_str(vaddr_t pc) const {
 	string result;
-	symbol_t symbol;
-	if (addr_to_symbol(pc, symbol)) {
-		size_t offset = pc - symbol.value;
-		result = symbol.name + " + 0x" + utils::to_hex(offset);
-	}
+	const char* name;
+	vsize_t offset;
+	if (addr_to_symbol_name(pc, name, offset))
+		result = string(name) + " + 0x" + utils::to_hex(offset);
 	return result;
 }
 
@@ -519,6 +479,7 @@ vector<vaddr_t> ElfParser::get_stacktrace(const kvm_regs& kregs, size_t num_fram
 
 	// Get limits
 	auto limits = section_limits(".text");
+	StackReader stack(mmu);
 
 	// Loop over stack frames until we're out of limits. For PIE binaries we
 	// have to take into account the address the elf is loaded at. ElfDebug
@@ -533,7 +494,7 @@ vector<vaddr_t> ElfParser::get_stacktrace(const kvm_regs& kregs, size_t num_fram
 			regs[DwarfReg::ReturnAddress] -= m_load_addr;
 	} while (
 		++i < num_frames &&
-		m_debug.next_frame(regs, mmu) &&
+		m_debug.next_frame(regs, stack) &&
 		regs[DwarfReg::ReturnAddress] >= limits.first &&
 		regs[DwarfReg::ReturnAddress] < limits.second
 	);
@@ -562,6 +523,7 @@ vector<pair<vaddr_t, const ElfParser*>> ElfParser::get_stacktrace(
 
 	// For each frame, get the elf it belongs to and use its DWARF info to
 	// get the next frame.
+	StackReader stack(mmu);
 	size_t i = 0;
 	const ElfParser* elf = nullptr;
 	do {
@@ -573,7 +535,7 @@ vector<pair<vaddr_t, const ElfParser*>> ElfParser::get_stacktrace(
 			regs[DwarfReg::ReturnAddress] -= elf->load_addr();
 	} while (
 		++i < num_frames &&
-		elf->m_debug.next_frame(regs, mmu)
+		elf->m_debug.next_frame(regs, stack)
 	);
 
 	return stacktrace;
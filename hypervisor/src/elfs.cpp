@@ -1,5 +1,8 @@
 #include <iostream>
+#include <algorithm>
+#include <limits>
 #include "elfs.h"
+#include "library_resolver.h"
 
 using namespace std;
 
@@ -7,8 +10,11 @@ Elfs::Elfs()
 	: m_interpreter(nullptr)
 {}
 
-Elfs::Elfs(const string& binary_path, const string& kernel_path) : Elfs() {
-	init(binary_path, kernel_path);
+Elfs::Elfs(const string& binary_path, const string& kernel_path,
+           const string& sysroot)
+	: Elfs()
+{
+	init(binary_path, kernel_path, sysroot);
 }
 
 Elfs::~Elfs() {
@@ -16,21 +22,26 @@ Elfs::~Elfs() {
 		delete m_interpreter;
 }
 
-void Elfs::init(const string& binary_path, const string& kernel_path) {
+void Elfs::init(const string& binary_path, const string& kernel_path,
+                const string& sysroot)
+{
 	if (m_interpreter) {
 		delete m_interpreter;
 		m_interpreter = nullptr;
 		m_libraries.clear();
 	}
 
+	m_sysroot = sysroot;
 	m_elf = ElfParser(binary_path);
 	m_kernel = ElfParser(kernel_path);
 	if (!m_elf.interpreter().empty()) {
-		m_interpreter = new ElfParser(m_elf.interpreter());
+		LibraryResolver resolver(m_sysroot);
+		m_interpreter = new ElfParser(resolver.host_path(m_elf.interpreter()));
 		ASSERT(m_interpreter->is_pie(), "interpreter not PIE");
 	}
 	ASSERT(!m_kernel.is_pie(), "Kernel is PIE");
 	ASSERT(m_kernel.interpreter().empty(), "Kernel is dynamically linked");
+	update_modules();
 }
 
 ElfParser& Elfs::elf() {
@@ -45,6 +56,10 @@ ElfParser* Elfs::interpreter() {
 	return m_interpreter;
 }
 
+const string& Elfs::sysroot() const {
+	return m_sysroot;
+}
+
 std::vector<const ElfParser*> Elfs::all_elfs() const {
 	std::vector<const ElfParser*> elfs = {&m_elf, &m_kernel};
 	if (m_interpreter)
@@ -64,10 +79,61 @@ std::vector<const ElfParser*> Elfs::target_elfs() const {
 	return elfs;
 }
 
+const ElfParser* Elfs::elf_with_addr(vaddr_t addr) const {
+	auto it = upper_bound(m_modules.begin(), m_modules.end(), addr,
+		[](vaddr_t addr, const Module& module) {
+			return addr < module.start;
+		}
+	);
+	if (it == m_modules.begin())
+		return nullptr;
+	--it;
+	return (addr < it->end ? it->elf : nullptr);
+}
+
+string Elfs::addr_to_symbol_str(vaddr_t addr) const {
+	const ElfParser* elf = elf_with_addr(addr);
+	return (elf ? elf->addr_to_symbol_str(addr) : "");
+}
+
+vaddr_t Elfs::resolve_symbol(const string& symbol_name) const {
+	// Skip undefined symbols, which importing elfs have too, and data
+	// symbols with the same name, such as a variable called like a function
+	for (const ElfParser* elf : target_elfs())
+		for (const symbol_t& symbol : elf->symbols())
+			if (symbol.name == symbol_name && symbol.shndx != SHN_UNDEF &&
+			    (symbol.type == STT_FUNC || symbol.type == STT_GNU_IFUNC))
+				return symbol.value;
+	return 0;
+}
+
+void Elfs::update_modules() {
+	m_modules.clear();
+	for (const ElfParser* elf : all_elfs()) {
+		// PIE elfs that haven't been given a load address aren't loaded yet
+		if (!elf->has_data() || (elf->is_pie() && !elf->load_addr()))
+			continue;
+
+		Module module = { numeric_limits<vaddr_t>::max(), 0, elf };
+		for (const segment_t& segment : elf->segments()) {
+			if (segment.type != PT_LOAD || !(segment.flags & PF_X))
+				continue;
+			module.start = min(module.start, segment.vaddr);
+			module.end = max(module.end, segment.vaddr + segment.memsize);
+		}
+		if (module.start < module.end)
+			m_modules.push_back(module);
+	}
+	sort(m_modules.begin(), m_modules.end(), [](const Module& m1, const Module& m2) {
+		return m1.start < m2.start;
+	});
+}
+
 void Elfs::add_library(const string& filename, FileRef content) {
 	ASSERT(!m_libraries.count(filename), "library added twice %s", filename.c_str());
 	ElfParser library(filename, (const uint8_t*)content.ptr, content.length);
 	m_libraries[filename] = move(library);
+	update_modules();
 }
 
 void Elfs::set_library_load_addr(const string& filename, vaddr_t load_addr) {
@@ -83,5 +149,6 @@ void Elfs::set_library_load_addr(const string& filename, vaddr_t load_addr) {
 	if (!library.load_addr()) {
 		library.set_load_addr(load_addr);
 		printf("Guest loaded library %s at 0x%lx\n", filename.c_str(), load_addr);
+		update_modules();
 	}
 }
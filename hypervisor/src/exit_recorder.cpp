@@ -0,0 +1,206 @@
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include "exit_recorder.h"
+#include "vm.h"
+#include "utils.h"
+
+using namespace std;
+
+const chrono::seconds ExitRecorder::SLOW_DUMP_INTERVAL(1);
+atomic<unsigned int> ExitRecorder::s_dump_requests(0);
+
+static const char* exit_reason_str(uint32_t exit_reason) {
+	switch (exit_reason) {
+		case KVM_EXIT_IO:
+			return "IO";
+		case KVM_EXIT_DEBUG:
+			return "DEBUG";
+		case KVM_EXIT_HLT:
+			return "HLT";
+		case KVM_EXIT_SHUTDOWN:
+			return "SHUTDOWN";
+		case KVM_EXIT_FAIL_ENTRY:
+			return "FAIL_ENTRY";
+		case KVM_EXIT_INTERNAL_ERROR:
+			return "INTERNAL_ERROR";
+		case KVM_EXIT_VMX_PT_TOPA_MAIN_FULL:
+			return "VMX_PT_TOPA_MAIN_FULL";
+		default:
+			return "UNKNOWN";
+	}
+}
+
+ExitRecorder::ExitRecorder(Vm& vm)
+	: m_vm(vm)
+	, m_slow_threshold(0)
+	, m_dump_requests(s_dump_requests)
+	, m_next(0)
+	, m_total_exits(0)
+{}
+
+ExitRecorder::ExitRecorder(Vm& vm, const ExitRecorder& other)
+	: m_vm(vm)
+	, m_output_dir(other.m_output_dir)
+	, m_slow_threshold(other.m_slow_threshold)
+	, m_dump_requests(s_dump_requests)
+	, m_ring(other.m_ring.size())
+	, m_next(0)
+	, m_total_exits(0)
+{}
+
+bool ExitRecorder::enabled() const {
+	return !m_ring.empty();
+}
+
+void ExitRecorder::enable(size_t size, const string& output_dir,
+                          chrono::microseconds slow_threshold)
+{
+	ASSERT(size, "exit recorder size can't be 0");
+	m_ring.resize(size);
+	m_output_dir = output_dir;
+	m_slow_threshold = slow_threshold;
+	utils::create_folder(m_output_dir);
+}
+
+ExitRecorder::Entry ExitRecorder::begin_exit(const kvm_run* vcpu_run,
+                                             const kvm_regs& regs,
+                                             cycle_t entry_cycles) const
+{
+	cycle_t now = _rdtsc();
+	Entry entry;
+	entry.exit_reason = vcpu_run->exit_reason;
+	if (entry.exit_reason == KVM_EXIT_IO)
+		entry.detail = regs.rax;
+	else if (entry.exit_reason == KVM_EXIT_DEBUG)
+		entry.detail = vcpu_run->debug.arch.exception;
+	else
+		entry.detail = 0;
+	entry.rip = regs.rip;
+	entry.guest_cycles = now - entry_cycles;
+
+	// Store when handling started until end_exit
+	entry.handle_cycles = now;
+	return entry;
+}
+
+void ExitRecorder::end_exit(Entry& entry) {
+	entry.handle_cycles = _rdtsc() - entry.handle_cycles;
+	m_ring[m_next] = entry;
+	m_next = (m_next + 1) % m_ring.size();
+	m_total_exits++;
+
+	cycle_t cost = entry.guest_cycles + entry.handle_cycles;
+	Cost& reason_cost = m_exit_reasons_cost[entry.exit_reason];
+	reason_cost.count++;
+	reason_cost.cycles += cost;
+
+	if (entry.exit_reason == KVM_EXIT_IO) {
+		if (entry.detail >= m_hypercalls_cost.size())
+			m_hypercalls_cost.resize(entry.detail + 1);
+		m_hypercalls_cost[entry.detail].count++;
+		m_hypercalls_cost[entry.detail].cycles += cost;
+	} else if (entry.exit_reason == KVM_EXIT_DEBUG) {
+		Cost& bp_cost = m_breakpoints_cost[entry.rip];
+		bp_cost.count++;
+		bp_cost.cycles += cost;
+	}
+}
+
+void ExitRecorder::request_dump() {
+	s_dump_requests++;
+}
+
+void ExitRecorder::check_dump(size_t id, chrono::microseconds run_time) {
+	unsigned int dump_requests = s_dump_requests;
+	if (dump_requests != m_dump_requests) {
+		m_dump_requests = dump_requests;
+		dump(id, "requested by signal");
+		return;
+	}
+
+	if (m_slow_threshold.count() && run_time > m_slow_threshold) {
+		auto now = chrono::steady_clock::now();
+		if (now - m_last_slow_dump < SLOW_DUMP_INTERVAL)
+			return;
+		m_last_slow_dump = now;
+		dump(id, "slow run: " + to_string(run_time.count()) + "us");
+	}
+}
+
+static void write_cost(ostream& os, const ExitRecorder::Cost& cost) {
+	os << setw(12) << cost.count << setw(16) << cost.cycles
+	   << setw(12) << cost.cycles / max<uint64_t>(cost.count, 1);
+}
+
+void ExitRecorder::dump(size_t id, const string& why) {
+	if (!enabled())
+		return;
+
+	string filename = m_output_dir + "/" + to_string(id) + ".txt";
+	ofstream os(filename);
+	ERROR_ON(!os.good(), "opening %s", filename.c_str());
+	os << "Reason: " << why << endl;
+	os << "Total exits: " << m_total_exits << endl << endl;
+
+	// Ring, from oldest to newest exit
+	size_t n = min<uint64_t>(m_total_exits, m_ring.size());
+	os << "Last " << n << " exits:" << endl;
+	os << left << setw(24) << "reason" << setw(28) << "detail" << setw(20) << "rip"
+	   << right << setw(14) << "guest cycles" << setw(14) << "handle cycles" << endl;
+	size_t start = (m_total_exits > m_ring.size() ? m_next : 0);
+	for (size_t i = 0; i < n; i++) {
+		const Entry& entry = m_ring[(start + i) % m_ring.size()];
+		string detail;
+		if (entry.exit_reason == KVM_EXIT_IO)
+			detail = "hc " + to_string(entry.detail) + " (" +
+			         Vm::hypercall_str(entry.detail) + ")";
+		else if (entry.exit_reason == KVM_EXIT_DEBUG)
+			detail = "exception " + to_string(entry.detail);
+		os << left << setw(24) << exit_reason_str(entry.exit_reason)
+		   << setw(28) << detail << "0x" << setw(18) << hex << entry.rip << dec
+		   << right << setw(14) << entry.guest_cycles
+		   << setw(14) << entry.handle_cycles << endl;
+	}
+	os << endl;
+
+	os << left << setw(24) << "Exit reason" << right << setw(12) << "count"
+	   << setw(16) << "cycles" << setw(12) << "avg" << endl;
+	for (const auto& it : m_exit_reasons_cost) {
+		os << left << setw(24) << exit_reason_str(it.first) << right;
+		write_cost(os, it.second);
+		os << endl;
+	}
+	os << endl;
+
+	os << left << setw(24) << "Hypercall" << right << setw(12) << "count"
+	   << setw(16) << "cycles" << setw(12) << "avg" << endl;
+	for (size_t i = 0; i < m_hypercalls_cost.size(); i++) {
+		if (!m_hypercalls_cost[i].count)
+			continue;
+		os << left << setw(24) << Vm::hypercall_str(i) << right;
+		write_cost(os, m_hypercalls_cost[i]);
+		os << endl;
+	}
+	os << endl;
+
+	// Breakpoints sorted by total cost
+	vector<pair<vaddr_t, Cost>> breakpoints(m_breakpoints_cost.begin(),
+	                                        m_breakpoints_cost.end());
+	sort(breakpoints.begin(), breakpoints.end(),
+		[](const pair<vaddr_t, Cost>& a, const pair<vaddr_t, Cost>& b) {
+			return a.second.cycles > b.second.cycles;
+		}
+	);
+	os << left << setw(20) << "Breakpoint" << right << setw(12) << "count"
+	   << setw(16) << "cycles" << setw(12) << "avg" << "  symbol" << endl;
+	for (const auto& it : breakpoints) {
+		string symbol = m_vm.elfs().addr_to_symbol_str(it.first);
+		os << "0x" << left << setw(18) << hex << it.first << dec << right;
+		write_cost(os, it.second);
+		os << "  " << symbol << endl;
+	}
+
+	printf("Runner %lu: vm exits dumped to %s (%s)\n", id, filename.c_str(),
+	       why.c_str());
+}
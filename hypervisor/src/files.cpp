@@ -1,6 +1,5 @@
 #include "files.h"
 #include "common.h"
-#include "utils.h"
 
 using namespace std;
 
@@ -36,10 +35,21 @@ GuestFile SharedFiles::set_file(const string& path, string content) {
 	// file contents and set a reference to it.
 	string& content_ref = m_file_contents[path];
 	content_ref = move(content);
+	m_mapped_files.erase(path);
 	return FileRefsByPath::set_file(path, FileRef::from_string(content_ref));
 }
 
 GuestFile SharedFiles::set_file(const string& path) {
-	return set_file(path, utils::read_file(path));
+	return map_file(path);
+}
+
+GuestFile SharedFiles::map_file(const string& path, const string& host_path) {
+	shared_ptr<const MappedFile>& file = m_mapped_files[path];
+	file = MappedFile::open(host_path.empty() ? path : host_path);
+	m_file_contents.erase(path);
+	return FileRefsByPath::set_file(path, {
+		.ptr = file->data(),
+		.length = file->size(),
+	});
 }
 
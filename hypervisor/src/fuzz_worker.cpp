@@ -0,0 +1,185 @@
+#include <chrono>
+#include <memory>
+#include "fuzz_worker.h"
+#include "vm.h"
+#include "corpus.h"
+#include "harness.h"
+#include "patches.h"
+#include "replay.h"
+
+using namespace std;
+
+void set_input(Vm& vm, const Harness& harness, FileRef input) {
+	// If our target receives the input in a buffer, write it directly to the
+	// guest memory instead of using memory-loaded files
+	if (harness.enabled()) {
+		harness.set_input(vm, input);
+		return;
+	}
+
+	// Otherwise, write it to the input slot, which the guest reads as the
+	// file "input"
+	vm.set_input(input);
+}
+
+void verify_crash(int id, Vm& runner, const Vm& unpatched,
+                  unique_ptr<Vm>& verifier, const Harness& harness,
+                  const FixupPlugin& fixup, Corpus& corpus, FileRef input)
+{
+	if (!verifier)
+		verifier.reset(new Vm(unpatched));
+
+	// Its stats aren't accounted
+	Stats verifier_stats;
+	string fixed_input((const char*)input.ptr, input.length);
+	fixup.fixup(fixed_input);
+	set_input(*verifier, harness, FileRef::from_string(fixed_input));
+	Vm::RunEndReason reason = verifier->run(verifier_stats);
+	if (reason == Vm::RunEndReason::Crash)
+		corpus.report_crash(*verifier, fixed_input);
+	else
+		corpus.report_patched_crash(id, runner);
+	verifier->reset_coverage();
+	verifier->reset(unpatched, verifier_stats);
+}
+
+template <Timetrace timetrace>
+static void worker(int id, const Vm& base, const Vm* unpatched,
+                   const Harness& harness, const FixupPlugin& fixup,
+                   Corpus& corpus, Replay& replay, Stats& stats,
+                   const atomic<bool>& stop)
+{
+	// The vm we'll be running
+	Vm runner(base);
+
+	// The vm crashes are verified on, if the base vm is patched
+	unique_ptr<Vm> verifier;
+
+	// Custom RNG: avoids locks and it's simpler. It's seeded when recording
+	// or replaying, so the same mutations are performed.
+	Rng rng = (replay.mode() == Replay::Mode::Off ? Rng()
+	                                              : Rng(replay.thread_seed(id)));
+
+	// Timetracing. Stats belong to this thread, so we can update them directly
+	// and the stats thread will read them without locking. Counters are atomic,
+	// so adding the 0 measured by disabled levels isn't optimized out and
+	// must be guarded too.
+	cycle_t cycles, cycles_prev = _rdtsc(), cycles_now;
+
+	Vm::RunEndReason reason;
+
+	// Run time, only measured if we are recording vm exits
+	bool record_exits = runner.exit_recorder().enabled();
+	chrono::steady_clock::time_point run_start;
+
+	while (!stop.load(memory_order_relaxed)) {
+		// When replaying, finish once every recorded case has been run
+		if (replay.replaying() && !replay.thread(id).next())
+			break;
+
+		// Get new input
+		cycles = rdtsc1<timetrace>();
+		FileRef input = corpus.get_new_input<timetrace>(id, rng, stats);
+		cycles = rdtsc1<timetrace>() - cycles;
+		if (timetrace >= Timetrace::Phase) {
+			stats.mut_cycles += cycles;
+			stats.mut_latency.record(cycles);
+		}
+
+		// Update input
+		cycles = rdtsc1<timetrace>();
+		set_input(runner, harness, input);
+		cycles = rdtsc1<timetrace>() - cycles;
+		if (timetrace >= Timetrace::Phase) {
+			stats.set_input_cycles += cycles;
+			stats.set_input_latency.record(cycles);
+		}
+
+		// Perform run
+		if (record_exits)
+			run_start = chrono::steady_clock::now();
+		cycles = rdtsc1<timetrace>();
+		reason = runner.run<timetrace>(stats);
+		stats.instr += runner.get_instructions_executed_and_reset();
+		cycles = rdtsc1<timetrace>() - cycles;
+		if (timetrace >= Timetrace::Phase) {
+			stats.run_cycles += cycles;
+			stats.run_latency.record(cycles);
+		}
+		stats.cases++;
+
+		// Dump vm exits if they were requested or the run was too slow
+		if (record_exits) {
+			runner.exit_recorder().check_dump(id,
+				chrono::duration_cast<chrono::microseconds>(
+					chrono::steady_clock::now() - run_start));
+		}
+
+		// Check RunEndReason
+		switch (reason) {
+			case Vm::RunEndReason::Breakpoint:
+			case Vm::RunEndReason::Exit:
+				break;
+			case Vm::RunEndReason::Timeout:
+				stats.timeouts++;
+				break;
+			case Vm::RunEndReason::OutOfMemory:
+				stats.out_of_memory++;
+				break;
+			case Vm::RunEndReason::Crash:
+				stats.crashes++;
+				if (unpatched)
+					verify_crash(id, runner, *unpatched, verifier, harness,
+					             fixup, corpus, input);
+				else
+					corpus.report_crash(id, runner);
+				break;
+			default:
+				die("unexpected RunEndReason: %s\n", Vm::reason_str(reason));
+		}
+
+		// Report coverage
+		cycles = rdtsc1<timetrace>();
+		corpus.report_coverage(id, runner.coverage());
+		runner.reset_coverage();
+		if (timetrace >= Timetrace::Phase)
+			stats.report_cov_cycles += rdtsc1<timetrace>() - cycles;
+
+		if (replay.mode() != Replay::Mode::Off)
+			replay.thread(id).end_case(input, (int)reason);
+
+		// Aggregate trace of syscalls, and dump it if it's sampled
+		runner.tracing().dump_trace(id);
+
+		// Dump profiler samples from time to time
+		runner.profiler().dump(id);
+
+		// Reset vm
+		cycles = rdtsc1<timetrace>();
+		runner.reset(base, stats);
+		cycles = rdtsc1<timetrace>() - cycles;
+		if (timetrace >= Timetrace::Phase) {
+			stats.reset_cycles += cycles;
+			stats.reset_latency.record(cycles);
+		}
+
+		cycles_now = _rdtsc();
+		stats.total_cycles += cycles_now - cycles_prev;
+		cycles_prev = cycles_now;
+
+		dbgprintf("run ended!\n\n");
+	}
+}
+
+worker_t get_worker(Timetrace timetrace) {
+	switch (timetrace) {
+		case Timetrace::Off:
+			return worker<Timetrace::Off>;
+		case Timetrace::Phase:
+			return worker<Timetrace::Phase>;
+		case Timetrace::Fine:
+			return worker<Timetrace::Fine>;
+		default:
+			die("unknown timetrace level: %d\n", (int)timetrace);
+	}
+}
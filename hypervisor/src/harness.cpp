@@ -0,0 +1,149 @@
+#include <sstream>
+#include "harness.h"
+#include "vm.h"
+
+using namespace std;
+
+const Harness::Layout Harness::DEFAULT_LAYOUT = {
+	.ptr      = &kvm_regs::rdi,
+	.len      = &kvm_regs::rsi,
+	.size     = nullptr,
+	.max_size = 0,
+};
+
+static bool parse_reg(const string& name, Harness::Reg& reg) {
+	static const struct {
+		const char* name;
+		Harness::Reg reg;
+	} regs[] = {
+		{"rdi", &kvm_regs::rdi},
+		{"rsi", &kvm_regs::rsi},
+		{"rdx", &kvm_regs::rdx},
+		{"rcx", &kvm_regs::rcx},
+		{"r8",  &kvm_regs::r8},
+		{"r9",  &kvm_regs::r9},
+	};
+	for (const auto& entry : regs) {
+		if (name == entry.name) {
+			reg = entry.reg;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Harness::parse_layout(const string& spec, Layout& layout) {
+	vector<string> parts;
+	istringstream ss(spec);
+	string part;
+	while (getline(ss, part, ','))
+		parts.push_back(part);
+	if (parts.size() != 2 && parts.size() != 3)
+		return false;
+
+	layout = {
+		.ptr      = nullptr,
+		.len      = nullptr,
+		.size     = nullptr,
+		.max_size = 0,
+	};
+	if (!parse_reg(parts[0], layout.ptr) || !parse_reg(parts[1], layout.len))
+		return false;
+	if (layout.ptr == layout.len)
+		return false;
+	if (parts.size() == 3 && !parse_reg(parts[2], layout.size)) {
+		// Not a register, it must be a fixed size
+		char* end;
+		layout.max_size = strtoul(parts[2].c_str(), &end, 0);
+		if (parts[2].empty() || *end || layout.max_size == 0)
+			return false;
+	}
+	return true;
+}
+
+Harness::Harness()
+	: m_layout(DEFAULT_LAYOUT)
+	, m_buffer(0)
+	, m_capacity(0)
+	, m_return_addr(0)
+{}
+
+Harness::Harness(Vm& vm, const Layout& layout, size_t max_input_size)
+	: m_layout(layout)
+{
+	const kvm_regs& regs = vm.regs();
+	m_buffer = regs.*layout.ptr;
+	// Unless the size of the buffer is given, it's only known to be as big as
+	// the input the function was reached with
+	if (layout.size)
+		m_capacity = min(max_input_size, (size_t)(regs.*layout.size));
+	else if (layout.max_size)
+		m_capacity = layout.max_size;
+	else
+		m_capacity = min(max_input_size, (size_t)(regs.*layout.len));
+	ASSERT(m_buffer, "harness buffer is null");
+	ASSERT(m_capacity, "harness buffer has size 0, its size can be given with "
+	       "--harness-args");
+
+	// Translate the buffer once, making sure it's writable
+	for (vaddr_t page = m_buffer & PTL1_MASK; page < m_buffer + m_capacity;
+	     page += PAGE_SIZE)
+	{
+		ASSERT(PHYS_FLAGS(vm.mmu().get_pte_val(page)) & PDE64_RW,
+		       "harness buffer page 0x%lx is not writable", page);
+		m_pages.push_back(vm.mmu().virt_to_phys(page));
+	}
+
+	m_return_addr = vm.mmu().read<vaddr_t>(regs.rsp);
+}
+
+bool Harness::enabled() const {
+	return m_buffer != 0;
+}
+
+vaddr_t Harness::return_addr() const {
+	return m_return_addr;
+}
+
+size_t Harness::capacity() const {
+	return m_capacity;
+}
+
+void Harness::set_input(Vm& vm, FileRef input) const {
+	size_t len = min(input.length, m_capacity);
+	size_t offset = 0;
+	size_t page_offset = PAGE_OFFSET(m_buffer);
+	for (size_t i = 0; offset < len; i++) {
+		size_t size = min(PAGE_SIZE - page_offset, len - offset);
+		vm.mmu().write_memp(m_pages[i] + page_offset,
+		                    (const uint8_t*)input.ptr + offset, size);
+		offset += size;
+		page_offset = 0;
+	}
+	vm.regs().*m_layout.len = len;
+}
+
+bool get_end_addrs(Vm& vm, const Harness& harness, bool at_return,
+                   const vector<string>& end_symbols, set<vaddr_t>& end_addrs)
+{
+	end_addrs.clear();
+	vaddr_t exit_addr = vm.elfs().resolve_symbol("exit");
+	if (exit_addr)
+		end_addrs.insert(exit_addr);
+	if (at_return) {
+		if (vm.regs().rip == vm.elf().entry())
+			return false;
+		vaddr_t return_addr = vm.mmu().read<vaddr_t>(vm.regs().rsp);
+		end_addrs.insert(return_addr);
+		printf("Ending runs at return to 0x%lx\n", return_addr);
+	}
+	for (const string& symbol : end_symbols) {
+		vaddr_t end_addr = vm.elfs().resolve_symbol(symbol);
+		ASSERT(end_addr, "end symbol '%s' not found or not a function",
+		       symbol.c_str());
+		end_addrs.insert(end_addr);
+	}
+	if (harness.enabled())
+		end_addrs.erase(harness.return_addr());
+	return true;
+}
@@ -10,7 +10,7 @@ using namespace std;
 // Keep this the same as in the kernel
 enum Hypercall : size_t {
 	Test,
-	Print,
+	FlushConsole,
 	GetMemInfo,
 	GetKernelBrk,
 	GetInfo,
@@ -21,10 +21,23 @@ enum Hypercall : size_t {
 	PrintStacktrace,
 	LoadLibrary,
 	EndRun,
-	NotifySyscallStart,
-	NotifySyscallEnd,
+	SubmitTracingRingPointer,
+	FlushTracingRing,
+	SubmitProfilerRingPointer,
 };
 
+const char* Vm::hypercall_str(uint64_t hc) {
+	constexpr const char* hypercall_strs[] = {
+		"Test", "FlushConsole", "GetMemInfo", "GetKernelBrk", "GetInfo", "GetFileInfo",
+		"SubmitFilePointers", "SubmitTimeoutPointers", "SubmitTracingTypePointer",
+		"PrintStacktrace", "LoadLibrary", "EndRun", "SubmitTracingRingPointer",
+		"FlushTracingRing", "SubmitProfilerRingPointer",
+	};
+	if (hc >= sizeof(hypercall_strs)/sizeof(*hypercall_strs))
+		return "Unknown";
+	return hypercall_strs[hc];
+}
+
 // Keep this the same as in the kernel
 struct StacktraceRegs {
 	vaddr_t rsp;
@@ -32,9 +45,9 @@ struct StacktraceRegs {
 	vaddr_t rip;
 };
 
-void Vm::do_hc_print(vaddr_t msg_addr) {
-	string msg = m_mmu.read_string(msg_addr);
-	cout << "[KERNEL] " << msg;
+void Vm::do_hc_flush_console(vaddr_t ring_addr) {
+	m_console.set_ring_addr(ring_addr);
+	m_console.drain();
 }
 
 // Keep this the same as in the kernel
@@ -72,6 +85,8 @@ struct VmInfo {
 	vaddr_t interp_start;
 	vaddr_t interp_end;
 	phinfo_t phinfo;
+	vaddr_t input_slot_addr;
+	vsize_t input_slot_size;
 };
 
 void Vm::do_hc_get_info(vaddr_t info_addr) {
@@ -88,6 +103,8 @@ void Vm::do_hc_get_info(vaddr_t info_addr) {
 	info.interp_start  = (interpreter ? interpreter->load_addr() : 0);
 	info.interp_end    = (interpreter ? info.interp_start + interpreter->size() : 0);
 	info.phinfo        = elf.phinfo();
+	info.input_slot_addr = (m_mmu.has_input_slot() ? Mmu::INPUT_SLOT_ADDR : 0);
+	info.input_slot_size = m_mmu.input_slot_size();
 
 	m_mmu.write(info_addr, info);
 }
@@ -138,11 +155,17 @@ void Vm::do_hc_submit_tracing_type_pointer(vaddr_t tracing_type_addr) {
 	m_tracing.set_type_addr(tracing_type_addr);
 }
 
+void Vm::do_hc_submit_profiler_ring_pointer(vaddr_t ring_addr) {
+	m_profiler.set_ring_addr(ring_addr);
+}
+
 void Vm::do_hc_print_stacktrace(vaddr_t stacktrace_regs_addr) {
 	// For now we set just rsp, rip and rbp, which seem to be the only
 	// ones needed in most situations, and initialize the others to 0.
 	// If print_stacktrace fails, we may need to request more registers
 	// from guest.
+	// Print pending guest output first, which usually explains the stacktrace
+	m_console.drain();
 	StacktraceRegs stacktrace_regs = m_mmu.read<StacktraceRegs>(stacktrace_regs_addr);
 	kvm_regs regs = {
 		.rsp = stacktrace_regs.rsp,
@@ -169,16 +192,14 @@ void Vm::do_hc_end_run(RunEndReason reason, vaddr_t info_addr) {
 		tracing_add_addr(m_regs->rip);
 }
 
-void Vm::do_hc_notify_syscall_start(vaddr_t syscall_name_addr) {
-	ASSERT(m_tracing.type() == Tracing::Type::Kernel, "hc_notify_syscall_start "
-	       "but we are not tracing kernel");
-	m_tracing.prepare(m_mmu.read_string(syscall_name_addr));
+void Vm::do_hc_submit_tracing_ring_pointer(vaddr_t ring_addr) {
+	m_tracing.set_ring_addr(ring_addr);
 }
 
-void Vm::do_hc_notify_syscall_end() {
-	ASSERT(m_tracing.type() == Tracing::Type::Kernel, "hc_notify_syscall_end "
+void Vm::do_hc_flush_tracing_ring() {
+	ASSERT(m_tracing.type() == Tracing::Type::Kernel, "hc_flush_tracing_ring "
 	       "but we are not tracing kernel");
-	m_tracing.trace();
+	m_tracing.drain_ring();
 }
 
 void Vm::handle_hypercall(RunEndReason& reason) {
@@ -186,8 +207,8 @@ void Vm::handle_hypercall(RunEndReason& reason) {
 	switch (m_regs->rax) {
 		case Hypercall::Test:
 			die("Hypercall test, arg=0x%llx\n", m_regs->rdi);
-		case Hypercall::Print:
-			do_hc_print(m_regs->rdi);
+		case Hypercall::FlushConsole:
+			do_hc_flush_console(m_regs->rdi);
 			break;
 		case Hypercall::GetMemInfo:
 			do_hc_get_mem_info(m_regs->rdi);
@@ -220,11 +241,14 @@ void Vm::handle_hypercall(RunEndReason& reason) {
 			reason = (RunEndReason)m_regs->rdi;
 			do_hc_end_run(reason, m_regs->rsi);
 			break;
-		case Hypercall::NotifySyscallStart:
-			do_hc_notify_syscall_start(m_regs->rdi);
+		case Hypercall::SubmitTracingRingPointer:
+			do_hc_submit_tracing_ring_pointer(m_regs->rdi);
+			break;
+		case Hypercall::FlushTracingRing:
+			do_hc_flush_tracing_ring();
 			break;
-		case Hypercall::NotifySyscallEnd:
-			do_hc_notify_syscall_end();
+		case Hypercall::SubmitProfilerRingPointer:
+			do_hc_submit_profiler_ring_pointer(m_regs->rdi);
 			break;
 		default:
 			ASSERT(false, "unknown hypercall: %llu", m_regs->rax);
@@ -0,0 +1,250 @@
+#include <sstream>
+#include <unordered_set>
+#include "libc_subst.h"
+#include "code_builder.h"
+#include "vm.h"
+
+using namespace std;
+
+// Append a short jump whose target is set later with `bind`, returning the
+// offset it's relative to
+static size_t jump8(vector<uint8_t>& code, uint8_t opcode) {
+	code.insert(code.end(), {opcode, 0});
+	return code.size();
+}
+
+// Set the target of a short jump to the end of the code
+static void bind(vector<uint8_t>& code, size_t jump) {
+	size_t rel = code.size() - jump;
+	ASSERT(rel <= 0x7F, "short jump too far: %lu", rel);
+	code[jump - 1] = rel;
+}
+
+// Append a call, jmp or jcc rel32 to `target`, an offset in the code
+static void jump32(vector<uint8_t>& code, initializer_list<uint8_t> opcode,
+                   size_t target)
+{
+	code.insert(code.end(), opcode);
+	append<int32_t>(code, target - (code.size() + sizeof(int32_t)));
+}
+
+// Start assembling a replacement of the given functions
+static void begin(vector<uint8_t>& code, vector<LibcSubst::Replacement>& replacements,
+                  initializer_list<const char*> names)
+{
+	for (const char* name : names)
+		replacements.push_back({name, code.size()});
+}
+
+bool LibcSubst::parse_groups(const string& spec, unsigned& groups) {
+	groups = 0;
+	istringstream ss(spec);
+	string group;
+	while (getline(ss, group, ',')) {
+		if (group == "alloc")
+			groups |= Group::Alloc;
+		else if (group == "stdio")
+			groups |= Group::Stdio;
+		else if (group == "locale")
+			groups |= Group::Locale;
+		else
+			return false;
+	}
+	return groups != 0;
+}
+
+void LibcSubst::assemble(unsigned groups, vsize_t heap_size,
+                         vector<uint8_t>& code, vector<Replacement>& replacements)
+{
+	const vaddr_t heap_addr = Mmu::LIBC_SUBST_HEAP_ADDR;
+	const vaddr_t heap_end  = heap_addr + heap_size;
+	size_t jump;
+	code.clear();
+	replacements.clear();
+
+	if (groups & Group::Alloc) {
+		// The hypervisor sets a breakpoint here that ends the run, so
+		// running out of heap isn't mistaken for the target mishandling a
+		// failed allocation. Without it, it returns null.
+		ASSERT(code.size() == OUT_OF_MEMORY_OFFSET, "out of memory trap at %lu",
+		       code.size());
+		code.insert(code.end(), {0x31, 0xC0, 0xC3});           // xor eax, eax; ret
+
+		// Each chunk is preceded by 16 bytes holding its size, so realloc
+		// knows how much to copy
+		size_t malloc_offset = code.size();
+		begin(code, replacements, {"malloc"});
+		code.insert(code.end(), {0x48, 0xB9});                 // movabs rcx, heap_addr
+		append<uint64_t>(code, heap_addr);
+		code.insert(code.end(), {0x48, 0xBE});                 // movabs rsi, heap_size
+		append<uint64_t>(code, heap_size);
+		code.insert(code.end(), {0x48, 0x39, 0xF7});           // cmp rdi, rsi
+		size_t overflow = jump8(code, 0x77);                   // ja too_big
+		code.insert(code.end(), {
+			0x48, 0x8B, 0x01,                                  // mov rax, [rcx]
+			0x48, 0x8D, 0x54, 0x38, 0x1F,                      // lea rdx, [rax+rdi+0x1f]
+			0x48, 0x83, 0xE2, 0xF0,                            // and rdx, -16
+		});
+		code.insert(code.end(), {0x48, 0xBE});                 // movabs rsi, heap_end
+		append<uint64_t>(code, heap_end);
+		code.insert(code.end(), {0x48, 0x39, 0xF2});           // cmp rdx, rsi
+		jump32(code, {0x0F, 0x87}, OUT_OF_MEMORY_OFFSET);      // ja out_of_memory
+		code.insert(code.end(), {
+			0x48, 0x89, 0x11,                                  // mov [rcx], rdx
+			0x48, 0x89, 0x38,                                  // mov [rax], rdi
+			0x48, 0x83, 0xC0, 0x10,                            // add rax, 16
+			0xC3,                                              // ret
+		});
+
+		// Requests bigger than the whole heap fail as they would with libc
+		bind(code, overflow);
+		code.insert(code.end(), {0x31, 0xC0, 0xC3});           // xor eax, eax; ret
+
+		begin(code, replacements, {"free"});
+		code.push_back(0xC3);                                  // ret
+
+		// Memory from the bump allocator is always zeroed, as it's never
+		// reused until the Vm is reset
+		begin(code, replacements, {"calloc"});
+		code.insert(code.end(), {
+			0x48, 0x89, 0xF8,                                  // mov rax, rdi
+			0x48, 0xF7, 0xE6,                                  // mul rsi
+		});
+		overflow = jump8(code, 0x72);                          // jc fail
+		code.insert(code.end(), {0x48, 0x89, 0xC7});           // mov rdi, rax
+		jump32(code, {0xE9}, malloc_offset);                   // jmp malloc
+		bind(code, overflow);
+		code.insert(code.end(), {0x31, 0xC0, 0xC3});           // xor eax, eax; ret
+
+		// Chunks allocated by libc before substituting are also accepted.
+		// Their usable size is taken from their header.
+		begin(code, replacements, {"realloc"});
+		code.insert(code.end(), {0x48, 0x85, 0xFF});           // test rdi, rdi
+		jump = jump8(code, 0x75);                              // jnz have_ptr
+		code.insert(code.end(), {0x48, 0x89, 0xF7});           // mov rdi, rsi
+		jump32(code, {0xE9}, malloc_offset);                   // jmp malloc
+		bind(code, jump);
+		code.insert(code.end(), {0x48, 0xB8});                 // movabs rax, heap_addr
+		append<uint64_t>(code, heap_addr);
+		code.insert(code.end(), {0x48, 0x39, 0xC7});           // cmp rdi, rax
+		size_t foreign_below = jump8(code, 0x72);              // jb foreign
+		code.insert(code.end(), {0x48, 0xB8});                 // movabs rax, heap_end
+		append<uint64_t>(code, heap_end);
+		code.insert(code.end(), {0x48, 0x39, 0xC7});           // cmp rdi, rax
+		size_t foreign_above = jump8(code, 0x73);              // jae foreign
+		code.insert(code.end(), {0x48, 0x8B, 0x57, 0xF0});     // mov rdx, [rdi-16]
+		size_t got_size = jump8(code, 0xEB);                   // jmp got_size
+		bind(code, foreign_below);
+		bind(code, foreign_above);
+		code.insert(code.end(), {
+			0x48, 0x8B, 0x57, 0xF8,                            // mov rdx, [rdi-8]
+			0x48, 0x89, 0xD0,                                  // mov rax, rdx
+			0x48, 0x83, 0xE2, 0xF8,                            // and rdx, -8
+			0x48, 0x83, 0xEA, 0x08,                            // sub rdx, 8
+			0xA8, 0x02,                                        // test al, IS_MMAPPED
+		});
+		jump = jump8(code, 0x74);                              // jz got_size
+		code.insert(code.end(), {0x48, 0x83, 0xEA, 0x08});     // sub rdx, 8
+		bind(code, jump);
+		bind(code, got_size);
+		code.insert(code.end(), {
+			0x48, 0x39, 0xF2,                                  // cmp rdx, rsi
+			0x48, 0x0F, 0x47, 0xD6,                            // cmova rdx, rsi
+			0x57,                                              // push rdi
+			0x52,                                              // push rdx
+			0x48, 0x89, 0xF7,                                  // mov rdi, rsi
+		});
+		jump32(code, {0xE8}, malloc_offset);                   // call malloc
+		code.insert(code.end(), {
+			0x59,                                              // pop rcx
+			0x5E,                                              // pop rsi
+			0x48, 0x85, 0xC0,                                  // test rax, rax
+		});
+		jump = jump8(code, 0x74);                              // jz done
+		code.insert(code.end(), {
+			0x48, 0x89, 0xC7,                                  // mov rdi, rax
+			0x48, 0x89, 0xC2,                                  // mov rdx, rax
+			0xF3, 0xA4,                                        // rep movsb
+			0x48, 0x89, 0xD0,                                  // mov rax, rdx
+		});
+		bind(code, jump);
+		code.push_back(0xC3);                                  // ret
+	}
+
+	if (groups & Group::Stdio) {
+		begin(code, replacements, {"printf", "vprintf", "__printf_chk",
+		                           "__vprintf_chk", "puts"});
+		code.insert(code.end(), {0x31, 0xC0, 0xC3});           // xor eax, eax; ret
+
+		begin(code, replacements, {"putchar"});
+		code.insert(code.end(), {
+			0x40, 0x0F, 0xB6, 0xC7,                            // movzx eax, dil
+			0xC3,                                              // ret
+		});
+	}
+
+	if (groups & Group::Locale) {
+		begin(code, replacements, {"setlocale"});
+		code.insert(code.end(), {
+			0x48, 0x8D, 0x05, 0x01, 0x00, 0x00, 0x00,          // lea rax, [rip+1]
+			0xC3,                                              // ret
+			'C', '\0',
+		});
+	}
+
+	ASSERT(code.size() <= PAGE_SIZE, "libc substitution code too big: %lu",
+	       code.size());
+}
+
+LibcSubst::LibcSubst()
+	: m_groups(0)
+{}
+
+LibcSubst::LibcSubst(Vm& vm, unsigned groups, vsize_t heap_size)
+	: m_groups(groups)
+{
+	vector<uint8_t> code;
+	assemble(groups, heap_size, code, m_replacements);
+	Mmu& mmu = vm.mmu();
+	mmu.alloc(Mmu::LIBC_SUBST_ADDR, PAGE_SIZE, PDE64_USER);
+	mmu.write_mem(Mmu::LIBC_SUBST_ADDR, code.data(), code.size(), CheckPerms::No);
+	if (groups & Group::Alloc) {
+		// The first chunk starts after the heap position
+		ASSERT(heap_size > 16, "libc substitution heap too small: %lu", heap_size);
+		mmu.alloc(Mmu::LIBC_SUBST_HEAP_ADDR, heap_size,
+		          PDE64_USER | PDE64_RW | PDE64_NX);
+		mmu.write<vaddr_t>(Mmu::LIBC_SUBST_HEAP_ADDR, Mmu::LIBC_SUBST_HEAP_ADDR + 16);
+		vm.set_out_of_memory_breakpoint(Mmu::LIBC_SUBST_ADDR + OUT_OF_MEMORY_OFFSET);
+	}
+}
+
+bool LibcSubst::enabled() const {
+	return m_groups != 0;
+}
+
+size_t LibcSubst::apply(Vm& vm) const {
+	// Aliases such as __libc_malloc share the address, and the same symbol
+	// may be both in the symbol table and the dynamic symbol table
+	unordered_set<vaddr_t> redirected;
+	for (const Replacement& replacement : m_replacements) {
+		vaddr_t target = Mmu::LIBC_SUBST_ADDR + replacement.offset;
+		for (const ElfParser* elf : vm.elfs().target_elfs()) {
+			for (const symbol_t& symbol : elf->symbols()) {
+				if (symbol.name != replacement.name || symbol.type != STT_FUNC ||
+				    symbol.shndx == SHN_UNDEF || redirected.count(symbol.value))
+					continue;
+
+				vector<uint8_t> jmp;
+				append_jmp(jmp, symbol.value, target);
+				if (symbol.size < jmp.size()) {
+					printf("Not substituting %s in %s: too small\n",
+					       replacement.name, elf->path().c_str());
+					continue;
+				}
+				vm.patch_code(symbol.value, jmp);
+				redirected.insert(symbol.value);
+			}
+		}
+	}
+	return redirected.size();
+}
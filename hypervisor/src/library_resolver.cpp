@@ -0,0 +1,340 @@
+#include <unistd.h>
+#include <sys/fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fstream>
+#include <cstring>
+#include <deque>
+#include <unordered_set>
+#include "library_resolver.h"
+#include "elf_parser.h"
+#include "utils.h"
+
+using namespace std;
+
+// Directories searched after everything else
+static const vector<string> DEFAULT_DIRS = {
+	"/lib/x86_64-linux-gnu", "/usr/lib/x86_64-linux-gnu",
+	"/lib64", "/usr/lib64", "/lib", "/usr/lib",
+};
+
+static const char* LD_SO_CACHE = "/etc/ld.so.cache";
+
+// Keep these the same as in glibc's ldconfig
+static const char CACHE_MAGIC_OLD[] = "ld.so-1.7.0";
+static const char CACHE_MAGIC_NEW[] = "glibc-ld.so.cache1.1";
+
+struct cache_entry_old {
+	int32_t flags;
+	uint32_t key;
+	uint32_t value;
+};
+
+struct cache_header_new {
+	char magic[sizeof(CACHE_MAGIC_NEW) - 1];
+	uint32_t nlibs;
+	uint32_t len_strings;
+	uint8_t flags;
+	uint8_t padding[3];
+	uint32_t extension_offset;
+	uint32_t unused[3];
+};
+
+struct cache_entry_new {
+	int32_t flags;
+	uint32_t key;
+	uint32_t value;
+	uint32_t osversion;
+	uint64_t hwcap;
+};
+
+static const int32_t CACHE_FLAG_TYPE_MASK = 0x00ff;
+static const int32_t CACHE_FLAG_ELF_LIBC6 = 0x0003;
+static const int32_t CACHE_FLAG_ARCH_MASK = 0xff00;
+static const int32_t CACHE_FLAG_X8664_LIB64 = 0x0300;
+
+static string dirname(const string& path) {
+	size_t pos = path.rfind('/');
+	if (pos == string::npos)
+		return ".";
+	return (pos == 0 ? "/" : path.substr(0, pos));
+}
+
+static string basename(const string& path) {
+	size_t pos = path.rfind('/');
+	return (pos == string::npos ? path : path.substr(pos + 1));
+}
+
+// Get the string at `offset` of a mapped file, or an empty string if it's out
+// of bounds or not terminated
+static string file_string(const uint8_t* data, size_t size, size_t offset) {
+	if (offset >= size)
+		return "";
+	const char* s = (const char*)data + offset;
+	size_t len = strnlen(s, size - offset);
+	return (len == size - offset ? "" : string(s, len));
+}
+
+LibraryResolver::LibraryResolver(const string& sysroot)
+	: m_sysroot(sysroot)
+	, m_cache_loaded(false)
+{
+	// Remove trailing slashes, as every path we append starts with one
+	while (!m_sysroot.empty() && m_sysroot.back() == '/')
+		m_sysroot.pop_back();
+}
+
+string LibraryResolver::host_path(const string& path) const {
+	if (m_sysroot.empty() || path.empty() || path[0] != '/')
+		return path;
+	return m_sysroot + path;
+}
+
+bool LibraryResolver::read_dynamic(const string& real_path, DynamicInfo& info) const {
+	int fd = open(real_path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+	    (size_t)st.st_size < sizeof(Elf_Ehdr)) {
+		close(fd);
+		return false;
+	}
+	size_t size = st.st_size;
+	void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return false;
+	const uint8_t* data = (const uint8_t*)map;
+
+	// Check it's an elf the loader would load in our architecture. Any other
+	// library with the same name is skipped, as the loader does.
+	bool ok = false;
+	Elf_Ehdr ehdr;
+	memcpy(&ehdr, data, sizeof(ehdr));
+	size_t phdrs_end = ehdr.e_phoff + (size_t)ehdr.e_phnum*sizeof(Elf_Phdr);
+	if (memcmp(ehdr.e_ident, ELFMAG, SELFMAG) == 0 &&
+	    ehdr.e_ident[EI_CLASS] == ELFCLASS && ehdr.e_machine == EM &&
+	    (ehdr.e_type == ET_DYN || ehdr.e_type == ET_EXEC) &&
+	    ehdr.e_phentsize == sizeof(Elf_Phdr) && phdrs_end <= size)
+	{
+		ok = true;
+		const Elf_Phdr* phdrs = (const Elf_Phdr*)(data + ehdr.e_phoff);
+		const Elf_Phdr* dynamic = nullptr;
+		for (size_t i = 0; i < ehdr.e_phnum; i++)
+			if (phdrs[i].p_type == PT_DYNAMIC)
+				dynamic = &phdrs[i];
+
+		// Static elfs don't have dynamic segment
+		if (dynamic && dynamic->p_offset + dynamic->p_filesz <= size) {
+			const Elf64_Dyn* dyns = (const Elf64_Dyn*)(data + dynamic->p_offset);
+			size_t n_dyns = dynamic->p_filesz / sizeof(Elf64_Dyn);
+			vaddr_t strtab = 0;
+			vector<size_t> needed, rpath, runpath;
+			for (size_t i = 0; i < n_dyns && dyns[i].d_tag != DT_NULL; i++) {
+				switch (dyns[i].d_tag) {
+					case DT_NEEDED:
+						needed.push_back(dyns[i].d_un.d_val);
+						break;
+					case DT_RPATH:
+						rpath.push_back(dyns[i].d_un.d_val);
+						break;
+					case DT_RUNPATH:
+						runpath.push_back(dyns[i].d_un.d_val);
+						break;
+					case DT_STRTAB:
+						strtab = dyns[i].d_un.d_ptr;
+						break;
+				}
+			}
+
+			// DT_STRTAB is a virtual address. Get its offset in the file.
+			size_t strtab_offset = 0;
+			bool found_strtab = false;
+			for (size_t i = 0; i < ehdr.e_phnum && !found_strtab; i++) {
+				const Elf_Phdr& phdr = phdrs[i];
+				if (phdr.p_type == PT_LOAD && phdr.p_vaddr <= strtab &&
+				    strtab < phdr.p_vaddr + phdr.p_filesz)
+				{
+					strtab_offset = strtab - phdr.p_vaddr + phdr.p_offset;
+					found_strtab = true;
+				}
+			}
+
+			if (found_strtab) {
+				for (size_t offset : needed) {
+					string name = file_string(data, size, strtab_offset + offset);
+					if (!name.empty())
+						info.needed.push_back(name);
+				}
+				for (size_t offset : rpath)
+					for (const string& dir : utils::split_string(
+					     file_string(data, size, strtab_offset + offset), ":"))
+						info.rpath.push_back(dir);
+				for (size_t offset : runpath)
+					for (const string& dir : utils::split_string(
+					     file_string(data, size, strtab_offset + offset), ":"))
+						info.runpath.push_back(dir);
+			}
+		}
+	}
+
+	munmap(map, size);
+	return ok;
+}
+
+bool LibraryResolver::is_loadable(const string& path) const {
+	DynamicInfo info;
+	return read_dynamic(host_path(path), info);
+}
+
+void LibraryResolver::load_cache() {
+	m_cache_loaded = true;
+	ifstream ifs(host_path(LD_SO_CACHE), ios::binary);
+	if (!ifs.good())
+		return;
+	string content((istreambuf_iterator<char>(ifs)), istreambuf_iterator<char>());
+	const uint8_t* data = (const uint8_t*)content.data();
+	size_t size = content.size();
+
+	// The old format may be followed by the new one, which is what we use.
+	// Strings offsets are relative to the start of the new format header.
+	size_t offset = 0;
+	size_t old_header_size = sizeof(CACHE_MAGIC_OLD) - 1 + 1 + sizeof(uint32_t);
+	if (size >= old_header_size &&
+	    memcmp(data, CACHE_MAGIC_OLD, sizeof(CACHE_MAGIC_OLD) - 1) == 0)
+	{
+		uint32_t nlibs;
+		memcpy(&nlibs, data + old_header_size - sizeof(uint32_t), sizeof(nlibs));
+		offset = old_header_size + (size_t)nlibs*sizeof(cache_entry_old);
+		offset = (offset + alignof(cache_entry_new) - 1) & ~(alignof(cache_entry_new) - 1);
+	}
+
+	cache_header_new header;
+	if (offset + sizeof(header) > size)
+		return;
+	memcpy(&header, data + offset, sizeof(header));
+	if (memcmp(header.magic, CACHE_MAGIC_NEW, sizeof(header.magic)) != 0)
+		return;
+	const uint8_t* cache = data + offset;
+	size_t cache_size = size - offset;
+	if (sizeof(header) + (size_t)header.nlibs*sizeof(cache_entry_new) > cache_size)
+		return;
+
+	for (size_t i = 0; i < header.nlibs; i++) {
+		cache_entry_new entry;
+		memcpy(&entry, cache + sizeof(header) + i*sizeof(entry), sizeof(entry));
+		if ((entry.flags & CACHE_FLAG_TYPE_MASK) != CACHE_FLAG_ELF_LIBC6 ||
+		    (entry.flags & CACHE_FLAG_ARCH_MASK) != CACHE_FLAG_X8664_LIB64)
+			continue;
+		string key = file_string(cache, cache_size, entry.key);
+		string value = file_string(cache, cache_size, entry.value);
+		if (!key.empty() && !value.empty())
+			m_cache.insert({key, value});
+	}
+}
+
+bool LibraryResolver::find_in_dirs(const string& name, const vector<string>& dirs,
+                                   const string& loader, string& result) const
+{
+	for (string dir : dirs) {
+		// Substitute $ORIGIN with the directory of the loader. Other dynamic
+		// string tokens aren't supported.
+		for (const char* token : {"${ORIGIN}", "$ORIGIN"}) {
+			size_t pos;
+			while ((pos = dir.find(token)) != string::npos)
+				dir.replace(pos, strlen(token), dirname(loader));
+		}
+		if (dir.empty() || dir.find('$') != string::npos)
+			continue;
+
+		string path = dir + "/" + name;
+		if (is_loadable(path)) {
+			result = path;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool LibraryResolver::find(const string& name,
+                           const string& loader, const DynamicInfo& loader_info,
+                           const string& exe, const DynamicInfo& exe_info,
+                           string& result)
+{
+	// Names with a slash are paths
+	if (name.find('/') != string::npos) {
+		result = name;
+		return is_loadable(name);
+	}
+
+	// DT_RPATH is only used if there's no DT_RUNPATH. We only look at the
+	// ones of the loader and the executable, instead of the whole chain.
+	if (loader_info.runpath.empty()) {
+		if (find_in_dirs(name, loader_info.rpath, loader, result))
+			return true;
+		if (exe_info.runpath.empty() && loader != exe &&
+		    find_in_dirs(name, exe_info.rpath, exe, result))
+			return true;
+	}
+
+	if (find_in_dirs(name, loader_info.runpath, loader, result))
+		return true;
+
+	if (!m_cache_loaded)
+		load_cache();
+	auto range = m_cache.equal_range(name);
+	for (auto it = range.first; it != range.second; ++it) {
+		if (is_loadable(it->second)) {
+			result = it->second;
+			return true;
+		}
+	}
+
+	return find_in_dirs(name, DEFAULT_DIRS, loader, result);
+}
+
+vector<string> LibraryResolver::resolve(const string& path, const string& interpreter) {
+	vector<string> result;
+	DynamicInfo exe_info;
+	if (!read_dynamic(path, exe_info))
+		return result;
+
+	// The executable is given with its path in the host. If it's inside the
+	// sysroot, get its path in the guest for $ORIGIN.
+	string exe = path;
+	if (!m_sysroot.empty() && exe.compare(0, m_sysroot.size() + 1, m_sysroot + "/") == 0)
+		exe = exe.substr(m_sysroot.size());
+
+	// Breadth-first, as the loader does. Each name is only loaded once.
+	unordered_set<string> names, paths;
+	deque<pair<string, DynamicInfo>> queue;
+	queue.push_back({exe, exe_info});
+	while (!queue.empty()) {
+		string loader = queue.front().first;
+		DynamicInfo loader_info = move(queue.front().second);
+		queue.pop_front();
+
+		for (const string& name : loader_info.needed) {
+			if (names.count(name) || (!interpreter.empty() && name == basename(interpreter)))
+				continue;
+			names.insert(name);
+
+			string library;
+			if (!find(name, loader, loader_info, exe, exe_info, library)) {
+				printf("Warning: library %s needed by %s not found\n",
+				       name.c_str(), loader.c_str());
+				continue;
+			}
+			if (library == interpreter || paths.count(library))
+				continue;
+			paths.insert(library);
+			result.push_back(library);
+
+			DynamicInfo library_info;
+			read_dynamic(host_path(library), library_info);
+			queue.push_back({library, move(library_info)});
+		}
+	}
+	return result;
+}
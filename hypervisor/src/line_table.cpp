@@ -0,0 +1,173 @@
+#include <unistd.h>
+#include <sys/fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+#include "line_table.h"
+
+using namespace std;
+
+const uint32_t LineTable::END_SEQUENCE = 0xFFFFFFFF;
+
+// Bump the version when changing the layout of the image
+static const uint64_t MAGIC = 0x454c4241544e494c; // LINTABLE
+static const uint32_t VERSION = 1;
+
+LineTable::LineTable()
+	: m_map(nullptr)
+	, m_map_size(0)
+	, m_rows(nullptr)
+	, m_n_rows(0)
+	, m_file_offsets(nullptr)
+	, m_n_files(0)
+	, m_strings(nullptr)
+{}
+
+LineTable::LineTable(vector<Row> rows, const vector<string>& files)
+	: LineTable()
+{
+	// Sort rows by address, keeping the order of rows with the same address.
+	// If a sequence ends at the same address another one begins, the end of
+	// the first one must go before.
+	stable_sort(rows.begin(), rows.end(), [](const Row& r1, const Row& r2) {
+		if (r1.addr != r2.addr)
+			return r1.addr < r2.addr;
+		return (r1.file == END_SEQUENCE && r2.file != END_SEQUENCE);
+	});
+
+	string strings;
+	vector<uint32_t> file_offsets;
+	for (const string& file : files) {
+		file_offsets.push_back(strings.size());
+		strings.append(file);
+		strings.push_back('\0');
+	}
+
+	Header header = {
+		.magic        = MAGIC,
+		.version      = VERSION,
+		.n_files      = (uint32_t)files.size(),
+		.n_rows       = rows.size(),
+		.strings_size = strings.size(),
+	};
+	size_t rows_size = rows.size()*sizeof(Row);
+	size_t offsets_size = file_offsets.size()*sizeof(uint32_t);
+	m_image.resize(sizeof(header) + rows_size + offsets_size + strings.size());
+	uint8_t* p = m_image.data();
+	memcpy(p, &header, sizeof(header));
+	p += sizeof(header);
+	memcpy(p, rows.data(), rows_size);
+	p += rows_size;
+	memcpy(p, file_offsets.data(), offsets_size);
+	p += offsets_size;
+	memcpy(p, strings.data(), strings.size());
+
+	ASSERT(set_image(m_image.data(), m_image.size()), "built invalid line table");
+}
+
+LineTable::~LineTable() {
+	if (m_map)
+		ERROR_ON(munmap(m_map, m_map_size) != 0, "munmap");
+}
+
+bool LineTable::set_image(const uint8_t* image, size_t size) {
+	Header header;
+	if (size < sizeof(header))
+		return false;
+	memcpy(&header, image, sizeof(header));
+	if (header.magic != MAGIC || header.version != VERSION)
+		return false;
+
+	size_t rows_size = header.n_rows*sizeof(Row);
+	size_t offsets_size = (size_t)header.n_files*sizeof(uint32_t);
+	if (sizeof(header) + rows_size + offsets_size + header.strings_size != size)
+		return false;
+
+	const uint8_t* p = image + sizeof(header);
+	const Row* rows = (const Row*)p;
+	p += rows_size;
+	const uint32_t* file_offsets = (const uint32_t*)p;
+	p += offsets_size;
+	const char* strings = (const char*)p;
+
+	// Make sure every name is inside the string table and terminated
+	if (header.strings_size && strings[header.strings_size-1] != '\0')
+		return false;
+	for (uint32_t i = 0; i < header.n_files; i++)
+		if (file_offsets[i] >= header.strings_size)
+			return false;
+
+	m_rows = rows;
+	m_n_rows = header.n_rows;
+	m_file_offsets = file_offsets;
+	m_n_files = header.n_files;
+	m_strings = strings;
+	return true;
+}
+
+bool LineTable::load(const string& path) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+	void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return false;
+
+	if (!set_image((const uint8_t*)map, st.st_size)) {
+		munmap(map, st.st_size);
+		return false;
+	}
+	if (m_map)
+		munmap(m_map, m_map_size);
+	m_image.clear();
+	m_map = map;
+	m_map_size = st.st_size;
+	return true;
+}
+
+bool LineTable::save(const string& path) const {
+	// Other processes may be saving or loading it at the same time, so write
+	// to a temporary file and rename it
+	string tmp_path = path + "." + to_string(getpid()) + ".tmp";
+	ofstream out(tmp_path, ios::binary | ios::trunc);
+	if (!out.good())
+		return false;
+	const char* image = (m_map ? (const char*)m_map : (const char*)m_image.data());
+	size_t size = (m_map ? m_map_size : m_image.size());
+	out.write(image, size);
+	out.close();
+	if (!out.good() || rename(tmp_path.c_str(), path.c_str()) != 0) {
+		unlink(tmp_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+string LineTable::addr_to_source(vaddr_t addr) const {
+	string result;
+	const Row* end = m_rows + m_n_rows;
+	const Row* it = upper_bound(m_rows, end, addr, [](vaddr_t addr, const Row& row) {
+		return addr < row.addr;
+	});
+	if (it == m_rows)
+		return result;
+
+	// We got the last row with address lower or equal than `addr`
+	const Row& row = *(it - 1);
+	if (row.file == END_SEQUENCE || row.file >= m_n_files)
+		return result;
+	result = string(m_strings + m_file_offsets[row.file]) + ":" + to_string(row.line);
+	return result;
+}
+
+size_t LineTable::size() const {
+	return m_n_rows;
+}
@@ -2,28 +2,49 @@
 #include <fstream>
 #include <thread>
 #include <cstring>
+#include <csignal>
+#include <memory>
+#include <set>
 #include "vm.h"
 #include "corpus.h"
 #include "args.h"
+#include "harness.h"
+#include "coverage_exporter.h"
+#include "patches.h"
+#include "libc_subst.h"
+#include "fuzz_worker.h"
 #include "utils.h"
 
 using namespace std;
 
-void print_stats(const Stats& stats, const Corpus& corpus, size_t jobs) {
+void print_stats(const ThreadStats& thread_stats, const Corpus& corpus,
+                 const string& output_dir, Timetrace timetrace,
+                 double subst_reduction)
+{
 	const chrono::milliseconds REFRESH_TIME {1000};
 	chrono::duration<double> elapsed, elapsed_total, no_new_cov_time;
 	chrono::steady_clock::time_point start = chrono::steady_clock::now(),
 		new_cov_last_time = start;
 	uint64_t cycles_elapsed, cases_elapsed, cases, cov, cov_old = 0, corpus_n,
-	         crashes, unique_crashes, timeouts;
+	         crashes, unique_crashes, timeouts, out_of_memory;
 	double mips, fcps, fcps_per_thread, run_time, reset_time, vm_exits_time,
 	       corpus_mem, kvm_time, mut_time, mut1_time, mut2_time, set_input_time,
 	       reset_pages, vm_exits, vm_exits_hc, update_cov_time, report_cov_time,
 	       vm_exits_debug, vm_exits_cov;
+	size_t jobs = thread_stats.size();
+	vector<Stats> snapshot, snapshot_old = thread_stats.snapshot();
+	Stats stats, stats_old;
+	StatsExporter exporter(output_dir);
 	ofstream os("stats.txt");
 	while (true) {
-		Stats stats_old = stats;
 		this_thread::sleep_for(REFRESH_TIME);
+		snapshot        = thread_stats.snapshot();
+		stats           = Stats();
+		stats_old       = Stats();
+		for (size_t i = 0; i < jobs; i++) {
+			stats     += snapshot[i];
+			stats_old += snapshot_old[i];
+		}
 		auto now        = chrono::steady_clock::now();
 		elapsed         = now - start - elapsed_total;
 		elapsed_total   = now - start;
@@ -36,6 +57,7 @@ void print_stats(const Stats& stats, const Corpus& corpus, size_t jobs) {
 		crashes         = stats.crashes;
 		unique_crashes  = corpus.unique_crashes();
 		timeouts        = stats.timeouts;
+		out_of_memory   = stats.out_of_memory;
 		fcps            = (double)cases_elapsed / elapsed.count();
 		fcps_per_thread = fcps / jobs;
 		mips            = (double)(stats.instr - stats_old.instr) / (elapsed.count() * 1000000);
@@ -83,7 +105,8 @@ void print_stats(const Stats& stats, const Corpus& corpus, size_t jobs) {
 		snprintf(cov_str, sizeof(cov_str), "%s", "disabled");
 #endif
 
-		printf(TITLE("%-48s %s\n"), "Fuzzing stats", "Timetrace stats");
+		printf(TITLE("%-48s %s (%s)\n"), "Fuzzing stats", "Timetrace stats",
+		       timetrace_str(timetrace));
 		printf(BOLD("   Time: ") "%-11s"   BOLD("    Corpus: ") "%-19s"  BOLD("  Inside VM: ")  "%5.2f%"     BOLD("        Set input: ") "%5.2f%\n",
 		       utils::secs_to_str(elapsed_total.count()).c_str(), corpus_str, kvm_time, set_input_time);
 		printf(BOLD("  Cases: ") "%-11lu"  BOLD("   Crashes: ") "%s%-19s%s"  BOLD("      Reset: ") "%5.2f%"  BOLD("       Report cov: ") "%5.2f%\n",
@@ -94,6 +117,11 @@ void print_stats(const Stats& stats, const Corpus& corpus, size_t jobs) {
 		       mips, timeouts, mut_time, vm_exits_time);
 		printf(BOLD("   Fcps: ") "%-42s"                                 BOLD("reset pages: ") "%.3f\n",
 		       fcps_str, reset_pages);
+		if (subst_reduction >= 0)
+			printf(BOLD("  Subst: ") "%.2f%% fewer instructions per case, "
+			       "out of memory: %lu\n", subst_reduction * 100, out_of_memory);
+		else if (out_of_memory)
+			printf(BOLD("  Subst: ") "out of memory: %lu\n", out_of_memory);
 		printf("\n");
 
 #else
@@ -108,13 +136,13 @@ void print_stats(const Stats& stats, const Corpus& corpus, size_t jobs) {
 		       vm_exits, vm_exits_hc, vm_exits_cov, vm_exits_debug,
 		       reset_pages);
 
-		if (TIMETRACE >= 1)
+		if (timetrace >= Timetrace::Phase)
 			printf("\trun: %.3f, reset: %.3f, mut: %.3f, set_input: %.3f, "
 			       "report_cov: %.3f\n",
 			       run_time, reset_time, mut_time, set_input_time,
 			       report_cov_time);
 
-		if (TIMETRACE >= 2) {
+		if (timetrace >= Timetrace::Fine) {
 			printf("\tkvm: %.3f, hc: %.3f, update_cov: %.3f, mut1: %.3f, "
 			       "mut2: %.3f\n",
 			       kvm_time, vm_exits_time, update_cov_time, mut1_time,
@@ -124,105 +152,69 @@ void print_stats(const Stats& stats, const Corpus& corpus, size_t jobs) {
 
 		// Print stats to file
 		os << elapsed_total.count() << " " << fcps << " " << cov << endl;
-	}
-}
 
-void set_input(Vm& vm, FileRef input) {
-	// Set input as a file which the guest will open and read, making sure
-	// the kernel has already submitted a buffer so the input is copied to its
-	// memory.
-	vm.set_file("input", input, Vm::CheckCopied::Yes);
-
-	// If our target received the input in a buffer instead of using open and
-	// read, we may want to write it to the guest memory, instead of using
-	// memory-loaded files. Assuming vm is at the entry of a function that takes
-	// as parameters the buffer pointer, the input length and the buffer length:
-	// size_t input_size = min((size_t)vm.regs().rdx, input.length);
-	// vm.mmu().write_mem(vm.regs().rdi, input.ptr, input_size);
-	// vm.regs().rsi = input_size;
+		// Export stats in machine-readable formats
+		StatsExporter::Info info = {
+			.elapsed_total  = elapsed_total.count(),
+			.elapsed        = elapsed.count(),
+			.cov            = cov,
+			.corpus_size    = corpus_n,
+			.unique_crashes = unique_crashes,
+		};
+		exporter.dump(info, snapshot, snapshot_old);
+		snapshot_old = move(snapshot);
+	}
 }
 
-void worker(int id, const Vm& base, Corpus& corpus, Stats& stats) {
-	// The vm we'll be running
-	Vm runner(base);
-
-	// Custom RNG: avoids locks and it's simpler
-	Rng rng;
-
-	// Timetracing
-	cycle_t cycles_init, cycles;
-
-	Vm::RunEndReason reason;
-
+#ifdef ENABLE_COVERAGE_BREAKPOINTS
+void export_coverage(const Vm& vm, Corpus& corpus, const string& output_dir,
+                     size_t interval)
+{
+	const chrono::seconds REFRESH_TIME {interval};
+	CoverageExporter exporter(vm.elfs(), vm.basic_blocks(), output_dir + "/coverage");
+	vector<vaddr_t> blocks;
+	size_t exported = 0;
 	while (true) {
-		Stats local_stats;
-		cycles_init = _rdtsc();
-
-		// Run some time saving stats locally
-		while (_rdtsc() - cycles_init < 50000000) {
-			// Get new input
-			cycles = rdtsc1();
-			FileRef input = corpus.get_new_input(id, rng, local_stats);
-			local_stats.mut_cycles += rdtsc1() - cycles;
-
-			// Update input
-			cycles = rdtsc1();
-			set_input(runner, input);
-			local_stats.set_input_cycles += rdtsc1() - cycles;
-
-			// Perform run
-			cycles = rdtsc1();
-			reason = runner.run(local_stats);
-			local_stats.instr += runner.get_instructions_executed_and_reset();
-			local_stats.run_cycles += rdtsc1() - cycles;
-			local_stats.cases++;
-
-			// Check RunEndReason
-			switch (reason) {
-				case Vm::RunEndReason::Breakpoint:
-				case Vm::RunEndReason::Exit:
-					break;
-				case Vm::RunEndReason::Timeout:
-					local_stats.timeouts++;
-					break;
-				case Vm::RunEndReason::Crash:
-					local_stats.crashes++;
-					corpus.report_crash(id, runner);
-					break;
-				default:
-					die("unexpected RunEndReason: %s\n", Vm::reason_str(reason));
-			}
-
-			// Report coverage
-			cycles = rdtsc1();
-			corpus.report_coverage(id, runner.coverage());
-			runner.reset_coverage();
-			local_stats.report_cov_cycles += rdtsc1() - cycles;
-
-			// Dump trace of syscalls
-			runner.tracing().dump_trace(id);
-
-			// Reset vm
-			cycles = rdtsc1();
-			runner.reset(base, local_stats);
-			local_stats.reset_cycles += rdtsc1() - cycles;
-
-			dbgprintf("run ended!\n\n");
+		// Only symbolize the blocks covered since the last time
+		blocks.clear();
+		exported = corpus.new_blocks(exported, blocks);
+		if (!blocks.empty() || exported == 0) {
+			exporter.add(blocks);
+			exporter.dump();
 		}
-		local_stats.total_cycles = _rdtsc() - cycles_init;
-
-		// Update global stats
-		stats.update(local_stats);
+		this_thread::sleep_for(REFRESH_TIME);
 	}
 }
+#endif
 
+// Average number of instructions executed by the seed inputs
+double seed_instructions(const Vm& base, const Harness& harness,
+                         const Corpus& corpus, Stats& stats)
+{
+	Vm runner(base);
+	uint64_t instr = 0;
+	runner.get_instructions_executed_and_reset();
+	for (size_t i = 0; i < corpus.size(); i++) {
+		set_input(runner, harness, corpus.element(i));
+		runner.run(stats);
+		instr += runner.get_instructions_executed_and_reset();
+		runner.reset_coverage();
+		runner.reset(base, stats);
+	}
+	return (double)instr / corpus.size();
+}
 
 int main(int argc, char** argv) {
 	Args args;
 	if (!args.parse(argc, argv))
 		return EXIT_FAILURE;
 
-	system("rm -rf traces; mkdir traces");
+
+	// The number of jobs of a replayed session is the recorded one, so load it
+	// before anything else
+	Replay replay;
+	if (!args.replay_dir.empty())
+		replay.replay(args.replay_dir, args.jobs);
 
 	setvbuf(stdout, nullptr, _IONBF, 0);
 	setvbuf(stderr, nullptr, _IONBF, 0);
@@ -233,24 +225,26 @@ int main(int argc, char** argv) {
 		args.memory,
 		args.kernel_path,
 		args.binary_path,
-		args.binary_argv
+		args.binary_argv,
+		args.sysroot
 	);
 
-	// Set initial file, except if we are doing a single run with no input
-	// file. If we are not doing a single run, the initial file is a dummy
-	// string which will be replaced in the fuzz loop with inputs provided by
-	// the corpus. We set its size to the maximum input size so kernel allocates
-	// a buffer of that size.
-	// Note this is not needed if we are using input injection in set_input
-	// instead of memory-loaded files.
+	// Create the input slot, except if we are doing a single run with no input
+	// file. If we are not doing a single run, inputs will be written to it in
+	// the fuzz loop, so its size is the maximum input size.
+	// Note this is not needed if we are using a harness instead of the file
+	// "input".
 	string file;
 	if (!(args.single_run && args.single_run_input_path.empty())) {
+		size_t input_size = corpus.max_input_size();
 		if (args.single_run) {
 			file = utils::read_file(args.single_run_input_path);
-		} else {
-			file = string(corpus.max_input_size(), 'a');
+			input_size = file.size();
 		}
-		vm.set_file("input", FileRef::from_string(file));
+		if (!args.patch_fixup_path.empty())
+			input_size += FixupPlugin::EXTRA_CAPACITY;
+		if (args.harness.empty())
+			vm.create_input_slot(input_size);
 	}
 
 	// Other memory-loaded files should be set here as well
@@ -258,18 +252,43 @@ int main(int argc, char** argv) {
 		vm.read_and_set_shared_file(path);
 	}
 
-	// Run until main or elf entry point before forking or running single input
-	vaddr_t fork_addr = vm.elf().resolve_symbol("main");
-	if (!fork_addr)
-		fork_addr = vm.elf().entry();
+	// Memory for libc substitution must be reserved before the kernel takes
+	// the rest of it
+	LibcSubst libc_subst;
+	if (args.libc_subst)
+		libc_subst = LibcSubst(vm, args.libc_subst, args.libc_heap);
+
+	// Run until main or elf entry point before forking or running single input.
+	// If we have a harness, run until its entry, and end runs when it returns.
+	vaddr_t fork_addr;
+	if (!args.harness.empty()) {
+		fork_addr = vm.elf().resolve_symbol(args.harness);
+		ASSERT(fork_addr, "harness function '%s' not found", args.harness.c_str());
+	} else {
+		fork_addr = vm.elf().resolve_symbol("main");
+		if (!fork_addr)
+			fork_addr = vm.elf().entry();
+	}
 	vm.run_until(fork_addr, stats);
 
+	Harness harness;
+	if (!args.harness.empty()) {
+		harness = Harness(vm, args.harness_layout, corpus.max_input_size());
+		vm.set_breakpoint(harness.return_addr());
+		printf("Harness %s: buffer of %lu bytes, returning to 0x%lx\n",
+		       args.harness.c_str(), harness.capacity(), harness.return_addr());
+	}
+
 	// Optionally set breakpoints to end the run before the syscall `exit` is
-	// called. Setting a breakpoint at libc function `exit` avoids running exit
-	// handlers, improving performance.
-	vaddr_t exit_addr = vm.elf().resolve_symbol("exit");
-	if (exit_addr)
-		vm.set_breakpoint(exit_addr);
+	// called. Runs can also end at given functions, or when the function they
+	// start at returns.
+	set<vaddr_t> end_addrs;
+	bool can_end = get_end_addrs(vm, harness, args.end_at_return,
+	                             args.end_symbols, end_addrs);
+	ASSERT(can_end, "can't end runs at return: they start at the entry point, "
+	       "which never returns");
+	for (vaddr_t end_addr : end_addrs)
+		vm.set_breakpoint(end_addr);
 
 	// Reset timer so it starts counting from 0, and set specified timeout
 	vm.reset_timer();
@@ -281,6 +300,60 @@ int main(int argc, char** argv) {
 
 	vm.tracing().set_type(args.tracing_type);
 	vm.tracing().set_unit(args.tracing_unit);
+	if (args.tracing_type != Tracing::Type::None)
+		vm.tracing().set_output(args.output_dir + "/traces", args.tracing_sample);
+
+	if (args.profile_period)
+		vm.profiler().enable(args.profile_period, args.output_dir + "/profile");
+
+	vm.console().set_rate_limit(args.output_limit);
+	vm.console().set_capture(args.capture_output);
+
+	if (args.exit_recorder_size) {
+		vm.exit_recorder().enable(args.exit_recorder_size,
+		                          args.output_dir + "/exits",
+		                          chrono::microseconds(args.slow_case_us));
+		signal(SIGUSR1, [](int) { ExitRecorder::request_dump(); });
+	}
+
+	// Substitute libc functions now that libraries are loaded. When fuzzing,
+	// measure the instructions it saves with the seed inputs.
+	double subst_reduction = -1;
+	if (libc_subst.enabled()) {
+#ifdef ENABLE_INSTRUCTION_COUNT
+		bool fuzzing = !args.single_run && !args.minimize_corpus &&
+		               !args.minimize_crashes;
+		double instr_before = 0;
+		if (fuzzing)
+			instr_before = seed_instructions(vm, harness, corpus, stats);
+#endif
+		size_t n = libc_subst.apply(vm);
+		printf("Substituted %lu libc functions\n", n);
+#ifdef ENABLE_INSTRUCTION_COUNT
+		if (instr_before) {
+			double instr_after = seed_instructions(vm, harness, corpus, stats);
+			subst_reduction = 1 - instr_after / instr_before;
+			printf("Instructions per seed input: %.0f before substitution, "
+			       "%.0f after\n", instr_before, instr_after);
+		}
+#endif
+	}
+
+	// Patch the target, keeping a copy of the unpatched vm when fuzzing so
+	// crashes can be verified on it
+	unique_ptr<Vm> unpatched;
+	FixupPlugin fixup;
+	if (!args.patches_path.empty()) {
+		Patches patches(args.patches_path);
+		if (!args.single_run && !args.minimize_corpus && !args.minimize_crashes) {
+			unpatched.reset(new Vm(vm));
+			if (!args.patch_fixup_path.empty())
+				fixup = FixupPlugin(args.patch_fixup_path);
+		}
+		patches.apply(vm);
+		printf("Applied %lu patches from %s\n", patches.size(),
+		       args.patches_path.c_str());
+	}
 
 	if (args.single_run) {
 		// Just perform a single run and exit.
@@ -289,12 +362,20 @@ int main(int argc, char** argv) {
 		} else {
 			printf("Performing single run with input file '%s', length %lu\n",
 			       args.single_run_input_path.c_str(), file.size());
-			set_input(vm, FileRef::from_string(file));
+			set_input(vm, harness, FileRef::from_string(file));
 		}
 		Vm::RunEndReason reason = vm.run(stats);
 		if (reason == Vm::RunEndReason::Crash)
 			vm.print_fault_info();
 		printf("Run ended with reason %s\n", Vm::reason_str(reason));
+		vm.tracing().dump_trace(0, true);
+		if (vm.profiler().enabled()) {
+			vm.profiler().collect();
+			vm.profiler().dump(0, true);
+			printf("Profiler took %lu samples (%lu lost)\n",
+			       vm.profiler().samples(), vm.profiler().lost_samples());
+		}
+		vm.exit_recorder().dump(0, "single run");
 		// vm.dump("libtiff-data");
 		return 0;
 	}
@@ -315,11 +396,12 @@ int main(int argc, char** argv) {
 		Vm runner(vm);
 		Vm::RunEndReason reason;
 		for (size_t i = 0; i < corpus.size(); i++) {
-			set_input(runner, corpus.element(i));
+			set_input(runner, harness, corpus.element(i));
 			reason = runner.run(stats);
 			switch (reason) {
 				case Vm::RunEndReason::Breakpoint:
 				case Vm::RunEndReason::Exit:
+				case Vm::RunEndReason::OutOfMemory:
 					break;
 				case Vm::RunEndReason::Crash:
 					vm.print_fault_info();
@@ -342,7 +424,7 @@ int main(int argc, char** argv) {
 		Vm runner(vm);
 		Vm::RunEndReason reason;
 		for (size_t i = 0; i < corpus.size(); i++) {
-			set_input(runner, corpus.element(i));
+			set_input(runner, harness, corpus.element(i));
 			reason = runner.run(stats);
 			ASSERT(reason == Vm::RunEndReason::Crash, "input '%s' didn't crash",
 			       corpus.seed_filename(i).c_str());
@@ -355,11 +437,22 @@ int main(int argc, char** argv) {
 		// Perform run with each seed input and submit total coverage to corpus
 		Vm runner(vm);
 		for (size_t i = 0; i < corpus.size(); i++) {
-			set_input(runner, corpus.element(i));
+			set_input(runner, harness, corpus.element(i));
 			runner.run(stats);
 			runner.reset(vm, stats);
 		}
 		corpus.set_mode_normal(runner.coverage());
+
+		if (args.record) {
+			uint64_t seed = (args.seed ? args.seed : _rdtsc());
+			replay.record(args.output_dir + "/replay", args.jobs, seed,
+			              corpus.size());
+		} else if (replay.replaying()) {
+			ASSERT(corpus.size() == replay.corpus_size(), "session was recorded "
+			       "with %lu seed inputs, but there are %lu",
+			       replay.corpus_size(), corpus.size());
+		}
+		corpus.set_replay(replay);
 	}
 
 
@@ -367,17 +460,36 @@ int main(int argc, char** argv) {
 	printf("Creating threads...\n");
 	cpu_set_t cpu;
 	vector<thread> threads;
+	ThreadStats thread_stats(args.jobs);
+	worker_t worker_fn = get_worker(args.timetrace);
+	atomic<bool> stop(false);
 	for (uint i = 0; i < args.jobs; i++) {
-		thread t = thread(worker, i, ref(vm), ref(corpus), ref(stats));
+		thread t = thread(worker_fn, i, ref(vm), unpatched.get(), ref(harness),
+		                  ref(fixup), ref(corpus), ref(replay),
+		                  ref(thread_stats[i]), cref(stop));
 		CPU_ZERO(&cpu);
 		CPU_SET(i % thread::hardware_concurrency(), &cpu);
 		int ret = pthread_setaffinity_np(t.native_handle(), sizeof(cpu), &cpu);
 		ASSERT(ret == 0, "Binding thread to core %d: %s", i, strerror(ret));
 		threads.push_back(move(t));
 	}
-	threads.push_back(thread(print_stats, ref(stats), ref(corpus), args.jobs));
+	auto start = chrono::steady_clock::now();
+	thread stats_thread(print_stats, ref(thread_stats), ref(corpus),
+	                    args.output_dir, args.timetrace, subst_reduction);
+#ifdef ENABLE_COVERAGE_BREAKPOINTS
+	if (args.coverage_report && !args.minimize_corpus && !args.minimize_crashes) {
+		thread coverage_thread(export_coverage, cref(vm), ref(corpus),
+		                       args.output_dir, args.coverage_report);
+		coverage_thread.detach();
+	}
+#endif
 
+	// Workers only finish when replaying. The stats and coverage report threads
+	// never do, so we just leave them behind.
 	for (thread& t : threads)
 		t.join();
+	chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+	replay.print_summary(elapsed.count());
+	stats_thread.detach();
 	return 0;
 }
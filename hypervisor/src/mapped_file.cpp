@@ -0,0 +1,72 @@
+#include <unistd.h>
+#include <sys/fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <map>
+#include <mutex>
+#include "mapped_file.h"
+
+using namespace std;
+
+// Files are identified by device and inode instead of by path, so symlinks
+// and hard links to the same library are mapped once. Entries are weak, so
+// a file is unmapped when its last user goes away.
+typedef pair<dev_t, ino_t> FileId;
+static map<FileId, weak_ptr<const MappedFile>> registry;
+static mutex registry_mutex;
+
+shared_ptr<const MappedFile> MappedFile::open(const string& path) {
+	const char* cpath = path.c_str();
+	int fd = ::open(cpath, O_RDONLY);
+	ERROR_ON(fd < 0, "open %s", cpath);
+	struct stat st;
+	ERROR_ON(fstat(fd, &st) < 0, "fstat %s", cpath);
+	ASSERT(S_ISREG(st.st_mode), "%s is not a regular file", cpath);
+
+	lock_guard<mutex> lock(registry_mutex);
+	weak_ptr<const MappedFile>& entry = registry[FileId(st.st_dev, st.st_ino)];
+	shared_ptr<const MappedFile> file = entry.lock();
+	if (file && file->size() == (size_t)st.st_size) {
+		close(fd);
+		return file;
+	}
+
+	// mmap doesn't accept empty mappings
+	uint8_t* data = nullptr;
+	if (st.st_size > 0) {
+		data = (uint8_t*)mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		ERROR_ON(data == MAP_FAILED, "mmap %s", cpath);
+	}
+	close(fd);
+
+	file = shared_ptr<const MappedFile>(new MappedFile(data, st.st_size));
+	entry = file;
+	return file;
+}
+
+MappedFile::MappedFile(const uint8_t* data, size_t size)
+	: m_data(data)
+	, m_size(size)
+{}
+
+MappedFile::~MappedFile() {
+	if (m_data)
+		ERROR_ON(munmap((void*)m_data, m_size) != 0, "munmap");
+}
+
+const uint8_t* MappedFile::data() const {
+	return m_data;
+}
+
+size_t MappedFile::size() const {
+	return m_size;
+}
+
+size_t MappedFile::num_mapped() {
+	lock_guard<mutex> lock(registry_mutex);
+	size_t n = 0;
+	for (const auto& entry : registry)
+		if (!entry.second.expired())
+			n++;
+	return n;
+}
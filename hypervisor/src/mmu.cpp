@@ -16,8 +16,12 @@ Mmu::Mmu(int vm_fd, int vcpu_fd, size_t mem_size)
 	                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0))
 	, m_length(mem_size)
 	, m_ptl4(PAGE_TABLE_PADDR)
+	, m_tlb()
+	, m_tlb_gen(1)
 	, m_can_alloc(true)
 	, m_next_page_alloc(PAGE_TABLE_PADDR + 0x1000)
+	, m_input_slot(nullptr)
+	, m_input_slot_length(0)
 #ifdef ENABLE_KVM_DIRTY_LOG_RING
 	, m_dirty_ring_i(0)
 	, m_dirty_ring_entries(ioctl_chk(m_vm_fd, KVM_CHECK_EXTENSION, KVM_CAP_DIRTY_LOG_RING) / sizeof(kvm_dirty_gfn))
@@ -31,6 +35,7 @@ Mmu::Mmu(int vm_fd, int vcpu_fd, size_t mem_size)
 #endif
 {
 	ASSERT((m_length % PAGE_SIZE) == 0, "not page-aligned memory length");
+	ASSERT(m_length <= INPUT_SLOT_PADDR, "too much memory: %lu", m_length);
 	ERROR_ON(m_memory == MAP_FAILED, "mmap mmu memory");
 #ifdef ENABLE_KVM_DIRTY_LOG_RING
 	ERROR_ON(m_dirty_ring == MAP_FAILED, "mmap dirty log ring");
@@ -53,9 +58,17 @@ Mmu::Mmu(int vm_fd, int vcpu_fd, size_t mem_size)
 Mmu::Mmu(int vm_fd, int vcpu_fd, const Mmu& other)
 	: Mmu(vm_fd, vcpu_fd, other.m_length)
 {
+	m_ptl4 = other.m_ptl4;
 	m_next_page_alloc = other.m_next_page_alloc;
 	memcpy(m_memory, other.m_memory, m_length);
 
+	// The input slot is already mapped in the page tables we just copied,
+	// but it needs its own memory
+	if (other.m_input_slot) {
+		add_input_slot_memory(other.m_input_slot_length);
+		memcpy(m_input_slot, other.m_input_slot, m_input_slot_length);
+	}
+
 #ifdef ENABLE_KVM_DIRTY_LOG_RING
 	ioctl_chk(m_vm_fd, KVM_RESET_DIRTY_RINGS, 0);
 #else
@@ -87,6 +100,8 @@ Mmu::Mmu(int vm_fd, int vcpu_fd, const Mmu& other)
 
 Mmu::~Mmu() {
 	munmap(m_memory, m_length);
+	if (m_input_slot)
+		munmap(m_input_slot, m_input_slot_length);
 #ifdef ENABLE_KVM_DIRTY_LOG_RING
 	munmap(m_dirty_ring, m_dirty_ring_entries * sizeof(kvm_dirty_gfn));
 #else
@@ -106,6 +121,21 @@ void Mmu::disable_allocations() {
 	m_can_alloc = false;
 }
 
+bool Mmu::can_alloc() const {
+	return m_can_alloc;
+}
+
+void Mmu::set_cr3(uint64_t cr3) {
+	// Ignore PCID and flags
+	paddr_t ptl4 = cr3 & PHYS_MASK;
+	ASSERT(ptl4 <= m_length - PAGE_SIZE, "OOB cr3: 0x%lx", cr3);
+	m_ptl4 = ptl4;
+}
+
+paddr_t Mmu::ptl4() const {
+	return m_ptl4;
+}
+
 void Mmu::create_physmap() {
 	// Map all physical memory. This is needed for guest kernel to access page
 	// tables and other physical addresses.
@@ -183,8 +213,10 @@ size_t Mmu::reset(const Mmu& other) {
 	count += m_dirty_extra.size();
 	m_dirty_extra.clear();
 
-	// Reset state
+	// Reset state. Restored pages may include page tables.
+	m_ptl4 = other.m_ptl4;
 	m_next_page_alloc = other.m_next_page_alloc;
+	flush_tlb();
 
 	/* if (memcmp(m_memory, other.m_memory, m_length) != 0) {
 		printf("WOOPS reset is not working\n");
@@ -215,14 +247,57 @@ paddr_t Mmu::get_pte_val(vaddr_t vaddr) {
 }
 
 paddr_t Mmu::virt_to_phys(vaddr_t vaddr) {
-	PageWalker walker(vaddr, *this);
-	return walker.paddr();
+	return (tlb_pte_val(vaddr) & PHYS_MASK) + PAGE_OFFSET(vaddr);
+}
+
+void Mmu::flush_tlb() {
+	m_tlb_gen++;
+}
+
+paddr_t Mmu::tlb_pte_val(vaddr_t vaddr) {
+	vaddr_t vpage = vaddr & PTL1_MASK;
+	TlbEntry& entry = m_tlb[(vpage >> PTL1_SHIFT) % TLB_SIZE];
+	paddr_t pte_val = 0;
+	if (entry.gen == m_tlb_gen && entry.vpage == vpage && entry.ptl4 == m_ptl4)
+		pte_val = readp<paddr_t>(entry.pte);
+
+	if (!pte_val) {
+		// Miss, or the guest unmapped the page since it was cached. Note the
+		// page walk may allocate page tables and flush the TLB, so the
+		// generation must be read after it.
+		PageWalker walker(vpage, *this);
+		pte_val = walker.pte_val();
+		ASSERT(pte_val, "Trying to translate not mapped vaddr: 0x%lx", vaddr);
+		entry = {
+			.ptl4  = m_ptl4,
+			.vpage = vpage,
+			.pte   = walker.pte(),
+			.gen   = m_tlb_gen,
+		};
+	}
+	ASSERT((pte_val & PHYS_MASK) < m_length,
+	       "Trying to translate vaddr 0x%lx outside of guest memory", vaddr);
+	return pte_val;
 }
 
 uint8_t* Mmu::get(vaddr_t guest) {
 	return m_memory + virt_to_phys(guest);
 }
 
+bool Mmu::is_writable(vaddr_t vaddr) {
+	paddr_t table = m_ptl4;
+	paddr_t entry = 0;
+	for (int shift : {PTL4_SHIFT, PTL3_SHIFT, PTL2_SHIFT, PTL1_SHIFT}) {
+		if (table >= m_length)
+			return false;
+		entry = readp<paddr_t>(table + ((vaddr >> shift) & 0x1FF) * sizeof(paddr_t));
+		if (!(entry & PDE64_PRESENT))
+			return false;
+		table = entry & PHYS_MASK;
+	}
+	return (entry & PDE64_RW) && table < m_length;
+}
+
 void Mmu::alloc(vaddr_t start, vsize_t len, uint64_t flags) {
 	ASSERT(len != 0, "alloc %lx zero length", start);
 	flags |= PDE64_PRESENT;
@@ -242,6 +317,12 @@ void Mmu::read_mem(void* dst, vaddr_t src, vsize_t len) {
 	if (len == 0)
 		return;
 
+	// Fast path for accesses inside a page, which are most of them
+	if (PAGE_OFFSET(src) + len <= PAGE_SIZE) {
+		memcpy(dst, m_memory + virt_to_phys(src), len);
+		return;
+	}
+
 	PageWalker pages(src, len, *this);
 	do {
 		// We don't need to check read access: write only pages don't exist
@@ -258,6 +339,17 @@ void Mmu::write_mem(vaddr_t dst, const void* src, vsize_t len, CheckPerms check)
 	if (len == 0)
 		return;
 
+	// Fast path for accesses inside a page, which are most of them
+	if (PAGE_OFFSET(dst) + len <= PAGE_SIZE) {
+		paddr_t pte_val = tlb_pte_val(dst);
+		ASSERT(!(check == CheckPerms::Yes) || (PHYS_FLAGS(pte_val) & PDE64_RW),
+		       "writing to not writable page %lx", dst);
+		paddr_t paddr = (pte_val & PHYS_MASK) + PAGE_OFFSET(dst);
+		memcpy(m_memory + paddr, src, len);
+		m_dirty_extra.push_back(paddr & PTL1_MASK);
+		return;
+	}
+
 	PageWalker pages(dst, len, *this);
 	do {
 		// Check write permissions, perform memcpy and mark page as dirty
@@ -272,6 +364,13 @@ void Mmu::write_mem(vaddr_t dst, const void* src, vsize_t len, CheckPerms check)
 	} while (pages.next());
 }
 
+void Mmu::write_memp(paddr_t dst, const void* src, psize_t len) {
+	ASSERT(dst + len <= m_length, "OOB: 0x%lx", dst);
+	memcpy(m_memory + dst, src, len);
+	for (paddr_t page = dst & PTL1_MASK; page < dst + len; page += PAGE_SIZE)
+		m_dirty_extra.push_back(page);
+}
+
 void Mmu::set_mem(vaddr_t addr, int c, vsize_t len, CheckPerms check) {
 	if (len == 0)
 		return;
@@ -287,13 +386,20 @@ void Mmu::set_mem(vaddr_t addr, int c, vsize_t len, CheckPerms check) {
 }
 
 string Mmu::read_string(vaddr_t addr) {
-	string result = "";
-	char c = read<char>(addr++);
-	while (c) {
-		result += c;
-		c = read<char>(addr++);
+	// Look for the null byte in the whole page at once instead of reading
+	// char by char
+	string result;
+	while (true) {
+		vsize_t size = PAGE_SIZE - PAGE_OFFSET(addr);
+		const char* p = (const char*)get(addr);
+		const char* end = (const char*)memchr(p, 0, size);
+		if (end) {
+			result.append(p, end - p);
+			return result;
+		}
+		result.append(p, size);
+		addr += size;
 	}
-	return result;
 }
 
 string Mmu::read_string_length(vaddr_t addr, vsize_t len) {
@@ -347,6 +453,56 @@ void Mmu::load_elf(const vector<segment_t>& segments, ElfType elf_type) {
 	}
 }
 
+void Mmu::create_input_slot(size_t size) {
+	ASSERT(!m_input_slot, "input slot created twice");
+	add_input_slot_memory(PAGE_SIZE + PAGE_CEIL(size));
+
+	// Map it as shared, so the kernel doesn't copy it when cloning page tables
+	paddr_t paddr = INPUT_SLOT_PADDR;
+	PageWalker pages(INPUT_SLOT_ADDR, m_input_slot_length, *this);
+	do {
+		pages.map(paddr, PDE64_NX | PDE64_SHARED);
+		paddr += PAGE_SIZE;
+	} while (pages.next());
+}
+
+void Mmu::add_input_slot_memory(size_t length) {
+	m_input_slot = (uint8_t*)mmap(nullptr, length, PROT_READ|PROT_WRITE,
+	                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	ERROR_ON(m_input_slot == MAP_FAILED, "mmap input slot");
+	m_input_slot_length = length;
+
+	struct kvm_userspace_memory_region memreg = {
+		.slot = 1,
+		.flags = KVM_MEM_READONLY,
+		.guest_phys_addr = INPUT_SLOT_PADDR,
+		.memory_size = length,
+		.userspace_addr = (unsigned long)m_input_slot
+	};
+	ioctl_chk(m_vm_fd, KVM_SET_USER_MEMORY_REGION, &memreg);
+}
+
+bool Mmu::has_input_slot() const {
+	return m_input_slot != nullptr;
+}
+
+size_t Mmu::input_slot_size() const {
+	return (m_input_slot ? m_input_slot_length - PAGE_SIZE : 0);
+}
+
+void Mmu::write_input_slot(const void* data, size_t len) {
+	ASSERT(len <= input_slot_size(), "input too big for input slot: %lu/%lu",
+	       len, input_slot_size());
+	memcpy(m_input_slot + PAGE_SIZE, data, len);
+	*(vsize_t*)m_input_slot = len;
+}
+
+string Mmu::read_input_slot() const {
+	ASSERT(m_input_slot, "reading input slot but there isn't one");
+	vsize_t len = *(vsize_t*)m_input_slot;
+	return string((const char*)m_input_slot + PAGE_SIZE, len);
+}
+
 void Mmu::dump_memory(psize_t len, const string& filename) const {
 	ASSERT(len <= m_length, "Dump OOB: %ld/%ld", len, m_length);
 	ofstream out(filename);
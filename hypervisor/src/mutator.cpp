@@ -6,6 +6,7 @@ using namespace std;
 Mutator::Mutator(const std::vector<std::string>& corpus)
 	: m_corpus(corpus)
 	, m_max_input_size(1024)
+	, m_corpus_size(0)
 {}
 
 size_t Mutator::max_input_size() const {
@@ -16,6 +17,14 @@ void Mutator::set_max_input_size(size_t size) {
 	m_max_input_size = size;
 }
 
+void Mutator::set_corpus_size(size_t size) {
+	m_corpus_size = size;
+}
+
+size_t Mutator::corpus_size() const {
+	return (m_corpus_size ? m_corpus_size : m_corpus.size());
+}
+
 void Mutator::mutate_input(string& input, Rng& rng, bool minimize){
 	static_assert(MIN_MUTATIONS <= MAX_MUTATIONS, "invalid range");
 	static_assert(MAX_MUTATIONS != 0, "MAX_MUTATIONS must be positive. To "
@@ -76,6 +85,30 @@ const vector<Mutator::mutation_strat_t> Mutator::mut_strats = {
 	&Mutator::mut_splice_insert,
 };
 
+const vector<const char*> Mutator::mut_strats_names = {
+	"shrink",
+	"expand",
+	"bit",
+	"dec_byte",
+	"inc_byte",
+	"neg_byte",
+	"add_sub",
+	"set",
+	"swap",
+	"copy",
+	"inter_splice",
+	"insert_rand",
+	"overwrite_rand",
+	"byte_repeat_overwrite",
+	"byte_repeat_insert",
+	"magic_overwrite",
+	"magic_insert",
+	"random_overwrite",
+	"random_insert",
+	"splice_overwrite",
+	"splice_insert",
+};
+
 const vector<Mutator::mutation_strat_t> Mutator::mut_strats_reduce = {
 	&Mutator::mut_shrink,
 	&Mutator::mut_bit,
@@ -472,7 +505,7 @@ void Mutator::mut_splice_overwrite(string& input, Rng& rng){
 
 	// Get the random input we'll copy from and check it is not empty
 	// TODO: need lock here?
-	const string& inp = m_corpus[rng.rnd(0, m_corpus.size()-1)];
+	const string& inp = m_corpus[rng.rnd(0, corpus_size()-1)];
 	if (inp.empty())
 		return;
 
@@ -495,7 +528,7 @@ void Mutator::mut_splice_insert(string& input, Rng& rng){
 
 	// Get the random input we'll copy from and check it is not empty
 	// TODO: need lock here?
-	const string& inp = m_corpus[rng.rnd(0, m_corpus.size()-1)];
+	const string& inp = m_corpus[rng.rnd(0, corpus_size()-1)];
 	if (inp.empty())
 		return;
 
@@ -53,7 +53,10 @@ vaddr_t Mmu::PageWalker::vaddr() {
 
 paddr_t Mmu::PageWalker::paddr() {
 	ASSERT(pte_val(), "Trying to translate not mapped vaddr: 0x%lx", vaddr());
-	return (pte_val() & PHYS_MASK) + PAGE_OFFSET(vaddr());
+	paddr_t paddr = (pte_val() & PHYS_MASK) + PAGE_OFFSET(vaddr());
+	ASSERT(paddr < m_mmu.m_length,
+	       "Trying to translate vaddr 0x%lx outside of guest memory", vaddr());
+	return paddr;
 }
 
 vsize_t Mmu::PageWalker::page_size() {
@@ -0,0 +1,230 @@
+#include <fstream>
+#include <cstring>
+#include <sstream>
+#include <dlfcn.h>
+#include "patches.h"
+#include "code_builder.h"
+#include "vm.h"
+
+using namespace std;
+
+// Bytes of the original code skip-call and branch need to see
+static const size_t ORIGINAL_LEN = 6;
+
+// Parse a number, which can be negative or hexadecimal
+static bool parse_value(const string& s, uint64_t& value) {
+	if (s.empty())
+		return false;
+	char* end;
+	if (s[0] == '-')
+		value = strtoll(s.c_str(), &end, 0);
+	else
+		value = strtoull(s.c_str(), &end, 0);
+	return *end == '\0';
+}
+
+// Nop of the length of the calls and jumps we replace
+static vector<uint8_t> nop(size_t len) {
+	if (len == 2)
+		return {0x66, 0x90};
+	if (len == 5)
+		return {0x0F, 0x1F, 0x44, 0x00, 0x00};
+	ASSERT(len == 6, "unexpected nop length: %lu", len);
+	return {0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00};
+}
+
+Patches::Patches() {}
+
+Patches::Patches(const string& path) {
+	ifstream is(path);
+	ERROR_ON(!is.good(), "opening patches file %s", path.c_str());
+	string line;
+	size_t line_number = 0;
+	while (getline(is, line)) {
+		line_number++;
+		size_t comment = line.find('#');
+		if (comment != string::npos)
+			line.resize(comment);
+		if (line.find_first_not_of(" \t\r") == string::npos)
+			continue;
+
+		Patch patch;
+		if (!parse(line, patch))
+			die("patches file %s, line %lu: invalid patch '%s'\n", path.c_str(),
+			    line_number, line.c_str());
+		m_patches.push_back(patch);
+		m_lines.push_back(line_number);
+	}
+}
+
+size_t Patches::size() const {
+	return m_patches.size();
+}
+
+bool Patches::parse(const string& line, Patch& patch) {
+	istringstream ss(line);
+	string location, action, arg, extra;
+	if (!(ss >> location >> action))
+		return false;
+	patch.has_value = (bool)(ss >> arg);
+	if (ss >> extra)
+		return false;
+
+	// Location: address or symbol with an optional offset
+	char* end;
+	if (location.compare(0, 2, "0x") == 0) {
+		patch.symbol.clear();
+		patch.addr = strtoull(location.c_str(), &end, 16);
+		if (*end || location.size() == 2)
+			return false;
+	} else {
+		size_t plus = location.find('+');
+		patch.symbol = location.substr(0, plus);
+		patch.addr = 0;
+		if (patch.symbol.empty())
+			return false;
+		if (plus != string::npos) {
+			const char* offset = location.c_str() + plus + 1;
+			patch.addr = strtoull(offset, &end, 0);
+			if (*end || !*offset)
+				return false;
+		}
+	}
+
+	// Action and its argument
+	patch.value = 0;
+	if (action == "ret") {
+		patch.action = Patch::Return;
+		return patch.has_value && parse_value(arg, patch.value);
+	} else if (action == "skip-call") {
+		// The value is set with `mov eax, imm32`
+		patch.action = Patch::SkipCall;
+		if (!patch.has_value)
+			return true;
+		return parse_value(arg, patch.value) &&
+		       ((uint32_t)patch.value == patch.value ||
+		        (int32_t)patch.value == (int64_t)patch.value);
+	} else if (action == "nop") {
+		patch.action = Patch::Nop;
+		return patch.has_value && parse_value(arg, patch.value) &&
+		       patch.value > 0 && patch.value <= PAGE_SIZE;
+	} else if (action == "branch") {
+		patch.action = Patch::Branch;
+		patch.value = (arg == "taken");
+		return arg == "taken" || arg == "not-taken";
+	}
+	return false;
+}
+
+vector<uint8_t> Patches::assemble(const Patch& patch,
+                                  const vector<uint8_t>& original)
+{
+	vector<uint8_t> code;
+	switch (patch.action) {
+		case Patch::Return:
+			// mov rax, simm32 or movabs rax, imm64; ret
+			if ((int64_t)patch.value == (int32_t)patch.value) {
+				code = {0x48, 0xC7, 0xC0};
+				append<int32_t>(code, patch.value);
+			} else {
+				code = {0x48, 0xB8};
+				append<uint64_t>(code, patch.value);
+			}
+			code.push_back(0xC3);
+			break;
+
+		case Patch::SkipCall: {
+			// call rel32 or call [rip+disp32]
+			size_t len;
+			if (original.size() >= 5 && original[0] == 0xE8)
+				len = 5;
+			else if (original.size() >= 6 && original[0] == 0xFF && original[1] == 0x15)
+				len = 6;
+			else
+				break;
+			if (patch.has_value) {
+				code.push_back(0xB8);
+				append<uint32_t>(code, patch.value);
+				code.resize(len, 0x90);
+			} else {
+				code = nop(len);
+			}
+			break;
+		}
+
+		case Patch::Nop:
+			code.assign(patch.value, 0x90);
+			break;
+
+		case Patch::Branch:
+			if (original.size() >= 2 && (original[0] & 0xF0) == 0x70) {
+				// jcc rel8: turn it into jmp rel8
+				if (patch.value)
+					code = {0xEB, original[1]};
+				else
+					code = nop(2);
+			} else if (original.size() >= 6 && original[0] == 0x0F &&
+			           (original[1] & 0xF0) == 0x80) {
+				// jcc rel32: turn it into jmp rel32, which is one byte shorter
+				if (patch.value) {
+					int32_t rel;
+					memcpy(&rel, &original[2], sizeof(rel));
+					code.push_back(0xE9);
+					append<int32_t>(code, rel + 1);
+					code.push_back(0x90);
+				} else {
+					code = nop(6);
+				}
+			}
+			break;
+	}
+	return code;
+}
+
+void Patches::apply(Vm& vm) const {
+	for (size_t i = 0; i < m_patches.size(); i++) {
+		const Patch& patch = m_patches[i];
+		vaddr_t addr = patch.addr;
+		if (!patch.symbol.empty()) {
+			vaddr_t symbol_addr = vm.elfs().resolve_symbol(patch.symbol);
+			ASSERT(symbol_addr, "patch at line %lu: symbol '%s' not found or "
+			       "not a function", m_lines[i], patch.symbol.c_str());
+			addr += symbol_addr;
+		}
+
+		vector<uint8_t> original;
+		if (patch.action == Patch::SkipCall || patch.action == Patch::Branch)
+			original = vm.read_code(addr, ORIGINAL_LEN);
+		vector<uint8_t> code = assemble(patch, original);
+		ASSERT(!code.empty(), "patch at line %lu: unsupported instruction at 0x%lx",
+		       m_lines[i], addr);
+		vm.patch_code(addr, code);
+	}
+}
+
+FixupPlugin::FixupPlugin()
+	: m_fixup(nullptr)
+{}
+
+FixupPlugin::FixupPlugin(const string& path) {
+	// The library is never unloaded
+	void* lib = dlopen(path.c_str(), RTLD_NOW);
+	ASSERT(lib, "loading fixup plugin %s: %s", path.c_str(), dlerror());
+	m_fixup = (fixup_t)dlsym(lib, SYMBOL);
+	ASSERT(m_fixup, "fixup plugin %s doesn't export %s", path.c_str(), SYMBOL);
+}
+
+bool FixupPlugin::enabled() const {
+	return m_fixup != nullptr;
+}
+
+void FixupPlugin::fixup(string& input) const {
+	if (!m_fixup)
+		return;
+	size_t size = input.size();
+	input.resize(size + EXTRA_CAPACITY);
+	size = m_fixup((uint8_t*)&input[0], size, input.size());
+	ASSERT(size <= input.size(), "fixup plugin returned size %lu, capacity was %lu",
+	       size, input.size());
+	input.resize(size);
+}
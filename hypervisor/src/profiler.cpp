@@ -0,0 +1,134 @@
+#include <fstream>
+#include <libgen.h>
+#include "profiler.h"
+#include "vm.h"
+#include "utils.h"
+
+using namespace std;
+
+const size_t Profiler::MAX_FRAMES;
+const size_t Profiler::RING_SIZE;
+const chrono::seconds Profiler::DUMP_INTERVAL(5);
+
+Profiler::Profiler(Vm& vm)
+	: m_vm(vm)
+	, m_ring_addr(0)
+	, m_period(0)
+	, m_ticks(0)
+	, m_samples(0)
+	, m_lost_samples(0)
+	, m_last_dump(chrono::steady_clock::now())
+{}
+
+Profiler::Profiler(Vm& vm, const Profiler& other)
+	: m_vm(vm)
+	, m_ring_addr(other.m_ring_addr)
+	, m_period(other.m_period)
+	, m_output_dir(other.m_output_dir)
+	, m_ticks(other.m_ticks)
+	, m_samples(0)
+	, m_lost_samples(0)
+	, m_last_dump(chrono::steady_clock::now())
+{}
+
+bool Profiler::enabled() const {
+	return m_period != 0;
+}
+
+void Profiler::set_ring_addr(vaddr_t ring_addr) {
+	m_ring_addr = ring_addr;
+}
+
+void Profiler::enable(size_t period, const string& output_dir) {
+	ASSERT(m_ring_addr, "kernel didn't submit profiler ring addr, did you "
+	       "forget to compile with -Denable-profiler?");
+	ASSERT(period, "profiler period can't be 0");
+	m_period = period;
+	m_output_dir = output_dir;
+	m_vm.mmu().write<uint64_t>(m_ring_addr + offsetof(RingHeader, period), m_period);
+	utils::create_folder(m_output_dir);
+}
+
+void Profiler::collect() {
+	if (!enabled())
+		return;
+
+	RingHeader header = m_vm.mmu().read<RingHeader>(m_ring_addr);
+	m_ticks = header.ticks;
+	if (header.count == 0)
+		return;
+
+	size_t count = min<size_t>(header.count, RING_SIZE);
+	vector<Sample> samples(count);
+	m_vm.mmu().read_mem(samples.data(), m_ring_addr + sizeof(RingHeader),
+	                    count*sizeof(Sample));
+	for (const Sample& sample : samples) {
+		size_t len = min<size_t>(sample.len, MAX_FRAMES);
+		m_stacks[vector<vaddr_t>(sample.frames, sample.frames + len)]++;
+	}
+	m_samples      += header.count;
+	m_lost_samples += header.count - count;
+}
+
+void Profiler::reset() {
+	if (!enabled())
+		return;
+	m_vm.mmu().write<uint64_t>(m_ring_addr + offsetof(RingHeader, ticks), m_ticks);
+}
+
+size_t Profiler::samples() const {
+	return m_samples;
+}
+
+size_t Profiler::lost_samples() const {
+	return m_lost_samples;
+}
+
+const string& Profiler::symbolize(vaddr_t addr, bool is_ret_addr) {
+	auto it = m_symbols.find(addr);
+	if (it != m_symbols.end())
+		return it->second;
+
+	// For return addresses, symbolize the call instruction instead of the one
+	// after it, which could belong to another function
+	vaddr_t addr_symbol = (is_ret_addr ? addr - 1 : addr);
+	string result;
+	const ElfParser* elf = m_vm.elfs().elf_with_addr(addr_symbol);
+	const char* name;
+	vsize_t offset;
+	if (elf && elf->addr_to_symbol_name(addr_symbol, name, offset)) {
+		result = name;
+	} else if (elf) {
+		string path = elf->path();
+		result = string(basename(&path[0])) + "+0x" +
+		         utils::to_hex(addr_symbol - elf->load_addr());
+	} else {
+		result = "0x" + utils::to_hex(addr);
+	}
+	return m_symbols[addr] = result;
+}
+
+void Profiler::dump(size_t id, bool force) {
+	if (!enabled())
+		return;
+
+	auto now = chrono::steady_clock::now();
+	if (!force && now - m_last_dump < DUMP_INTERVAL)
+		return;
+	m_last_dump = now;
+
+	// Folded stacks format: frames from outermost to innermost separated by
+	// semicolons, followed by the number of samples
+	string filename = m_output_dir + "/" + to_string(id) + ".folded";
+	ofstream out(filename);
+	ERROR_ON(!out.good(), "opening %s", filename.c_str());
+	for (const auto& stack : m_stacks) {
+		const vector<vaddr_t>& frames = stack.first;
+		for (size_t i = frames.size(); i > 0; i--) {
+			out << symbolize(frames[i-1], i-1 != 0);
+			if (i != 1)
+				out << ";";
+		}
+		out << " " << stack.second << "\n";
+	}
+}
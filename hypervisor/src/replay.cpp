@@ -0,0 +1,198 @@
+#include <algorithm>
+#include <limits>
+#include "replay.h"
+#include "vm.h"
+#include "rng.h"
+#include "utils.h"
+
+using namespace std;
+
+const uint32_t Replay::NOT_ADDED = numeric_limits<uint32_t>::max();
+
+// FNV-1a. Inputs are hashed once per fuzz case, so we want something cheap
+// and stable across builds.
+static uint64_t hash_input(FileRef input) {
+	const uint8_t* p = (const uint8_t*)input.ptr;
+	uint64_t hash = 0xCBF29CE484222325;
+	for (size_t i = 0; i < input.length; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001B3;
+	}
+	return hash;
+}
+
+static string thread_log_path(const string& dir, size_t id) {
+	return dir + "/" + to_string(id) + ".log";
+}
+
+Replay::ThreadLog::ThreadLog(Mode mode, const string& path)
+	: m_mode(mode)
+	, m_next(0)
+	, m_current()
+	, m_input_divergences(0)
+	, m_result_divergences(0)
+{
+	if (m_mode == Mode::Record) {
+		m_os.open(path, ios::binary);
+		ERROR_ON(!m_os.good(), "opening %s", path.c_str());
+	} else if (m_mode == Mode::Replay) {
+		string data = utils::read_file(path);
+		size_t n = data.size() / sizeof(Case);
+		m_cases.resize(n);
+		memcpy(m_cases.data(), data.data(), n * sizeof(Case));
+	}
+}
+
+bool Replay::ThreadLog::next() {
+	ASSERT(m_mode == Mode::Replay, "not replaying");
+	if (m_next == m_cases.size())
+		return false;
+	m_current = m_cases[m_next++];
+	return true;
+}
+
+const Replay::Case& Replay::ThreadLog::current() const {
+	return m_current;
+}
+
+void Replay::ThreadLog::set_parent(size_t parent, size_t corpus_size) {
+	m_current.parent = parent;
+	m_current.corpus_size = corpus_size;
+	m_current.corpus_index = NOT_ADDED;
+}
+
+void Replay::ThreadLog::set_corpus_index(size_t corpus_index) {
+	m_current.corpus_index = corpus_index;
+}
+
+void Replay::ThreadLog::end_case(FileRef input, int result) {
+	uint64_t hash = hash_input(input);
+	if (m_mode == Mode::Record) {
+		m_current.result = result;
+		m_current.input_hash = hash;
+		m_os.write((const char*)&m_current, sizeof(m_current));
+		m_next++;
+	} else if (m_mode == Mode::Replay) {
+		m_input_divergences += (hash != m_current.input_hash);
+		m_result_divergences += ((uint32_t)result != m_current.result);
+	}
+}
+
+size_t Replay::ThreadLog::cases() const {
+	return m_next;
+}
+
+size_t Replay::ThreadLog::input_divergences() const {
+	return m_input_divergences;
+}
+
+size_t Replay::ThreadLog::result_divergences() const {
+	return m_result_divergences;
+}
+
+Replay::Replay()
+	: m_mode(Mode::Off)
+	, m_seed(0)
+	, m_corpus_size(0)
+{}
+
+void Replay::record(const string& dir, size_t jobs, uint64_t seed,
+                    size_t corpus_size)
+{
+	m_mode = Mode::Record;
+	m_seed = seed;
+	m_corpus_size = corpus_size;
+	utils::create_folder(dir);
+	utils::write_file(dir + "/" + SESSION_FILENAME,
+	                  "seed " + to_string(seed) + "\n" +
+	                  "jobs " + to_string(jobs) + "\n" +
+	                  "corpus " + to_string(corpus_size) + "\n");
+	for (size_t i = 0; i < jobs; i++)
+		m_threads.emplace_back(m_mode, thread_log_path(dir, i));
+	printf("Recording session to %s with seed %lu\n", dir.c_str(), seed);
+}
+
+void Replay::replay(const string& dir, uint& jobs) {
+	m_mode = Mode::Replay;
+	string session_path = dir + "/" + SESSION_FILENAME;
+	string session = utils::read_file(session_path);
+	int ret = sscanf(session.c_str(), "seed %lu\njobs %u\ncorpus %lu\n",
+	                 &m_seed, &jobs, &m_corpus_size);
+	ERROR_ON(ret != 3 || jobs == 0, "parsing %s", session_path.c_str());
+
+	for (size_t i = 0; i < jobs; i++)
+		m_threads.emplace_back(m_mode, thread_log_path(dir, i));
+
+	// Logs are cut when the fuzzer is killed, so some of the inputs added to
+	// the corpus may be missing. Stop replaying each thread before the first
+	// case that needs one of them, or it would wait for it forever.
+	vector<bool> added;
+	for (const ThreadLog& log : m_threads) {
+		for (const Case& c : log.m_cases) {
+			if (c.corpus_index == NOT_ADDED)
+				continue;
+			if (c.corpus_index >= added.size())
+				added.resize(c.corpus_index + 1);
+			added[c.corpus_index] = true;
+		}
+	}
+	size_t available = m_corpus_size;
+	while (available < added.size() && added[available])
+		available++;
+
+	size_t total = 0;
+	for (ThreadLog& log : m_threads) {
+		auto it = find_if(log.m_cases.begin(), log.m_cases.end(),
+			[available](const Case& c) {
+				return c.corpus_size > available ||
+				       (c.corpus_index != NOT_ADDED && c.corpus_index >= available);
+			}
+		);
+		log.m_cases.erase(it, log.m_cases.end());
+		total += log.m_cases.size();
+	}
+	printf("Replaying session from %s with seed %lu: %u threads, %lu cases\n",
+	       dir.c_str(), m_seed, jobs, total);
+}
+
+Replay::Mode Replay::mode() const {
+	return m_mode;
+}
+
+bool Replay::recording() const {
+	return m_mode == Mode::Record;
+}
+
+bool Replay::replaying() const {
+	return m_mode == Mode::Replay;
+}
+
+uint64_t Replay::seed() const {
+	return m_seed;
+}
+
+size_t Replay::corpus_size() const {
+	return m_corpus_size;
+}
+
+uint64_t Replay::thread_seed(size_t id) const {
+	uint64_t state = m_seed + id;
+	return Rng::splitmix64(state);
+}
+
+Replay::ThreadLog& Replay::thread(size_t id) {
+	ASSERT(id < m_threads.size(), "OOB: %lu/%lu", id, m_threads.size());
+	return m_threads[id];
+}
+
+void Replay::print_summary(double elapsed) const {
+	size_t cases = 0, input_divergences = 0, result_divergences = 0;
+	for (const ThreadLog& log : m_threads) {
+		cases += log.cases();
+		input_divergences += log.input_divergences();
+		result_divergences += log.result_divergences();
+	}
+	printf("Replayed %lu cases in %.3fs (%.3f fcps). Input divergences: %lu, "
+	       "result divergences: %lu\n", cases, elapsed, cases / elapsed,
+	       input_divergences, result_divergences);
+}
@@ -0,0 +1,278 @@
+#include <cstdlib>
+#include <new>
+#include "stats.h"
+#include "common.h"
+
+using namespace std;
+
+const char* timetrace_str(Timetrace level) {
+	switch (level) {
+		case Timetrace::Off:
+			return "off";
+		case Timetrace::Phase:
+			return "phase";
+		case Timetrace::Fine:
+			return "fine";
+		default:
+			return "?";
+	}
+}
+
+Stats& Stats::operator+=(const Stats& stats) {
+	cases             += stats.cases;
+	instr             += stats.instr;
+	crashes           += stats.crashes;
+	timeouts          += stats.timeouts;
+	out_of_memory     += stats.out_of_memory;
+	vm_exits          += stats.vm_exits;
+	vm_exits_hc       += stats.vm_exits_hc;
+	vm_exits_debug    += stats.vm_exits_debug;
+	vm_exits_cov      += stats.vm_exits_cov;
+	total_cycles      += stats.total_cycles;
+	reset_cycles      += stats.reset_cycles;
+	reset_pages       += stats.reset_pages;
+	run_cycles        += stats.run_cycles;
+	vm_exits_cycles   += stats.vm_exits_cycles;
+	kvm_cycles        += stats.kvm_cycles;
+	mut_cycles        += stats.mut_cycles;
+	mut1_cycles       += stats.mut1_cycles;
+	mut2_cycles       += stats.mut2_cycles;
+	set_input_cycles  += stats.set_input_cycles;
+	update_cov_cycles += stats.update_cov_cycles;
+	report_cov_cycles += stats.report_cov_cycles;
+	mut_latency       += stats.mut_latency;
+	set_input_latency += stats.set_input_latency;
+	run_latency       += stats.run_latency;
+	reset_latency     += stats.reset_latency;
+	vm_exit_latency   += stats.vm_exit_latency;
+	return *this;
+}
+
+Stats& Stats::operator-=(const Stats& stats) {
+	cases             -= stats.cases;
+	instr             -= stats.instr;
+	crashes           -= stats.crashes;
+	timeouts          -= stats.timeouts;
+	out_of_memory     -= stats.out_of_memory;
+	vm_exits          -= stats.vm_exits;
+	vm_exits_hc       -= stats.vm_exits_hc;
+	vm_exits_debug    -= stats.vm_exits_debug;
+	vm_exits_cov      -= stats.vm_exits_cov;
+	total_cycles      -= stats.total_cycles;
+	reset_cycles      -= stats.reset_cycles;
+	reset_pages       -= stats.reset_pages;
+	run_cycles        -= stats.run_cycles;
+	vm_exits_cycles   -= stats.vm_exits_cycles;
+	kvm_cycles        -= stats.kvm_cycles;
+	mut_cycles        -= stats.mut_cycles;
+	mut1_cycles       -= stats.mut1_cycles;
+	mut2_cycles       -= stats.mut2_cycles;
+	set_input_cycles  -= stats.set_input_cycles;
+	update_cov_cycles -= stats.update_cov_cycles;
+	report_cov_cycles -= stats.report_cov_cycles;
+	mut_latency       -= stats.mut_latency;
+	set_input_latency -= stats.set_input_latency;
+	run_latency       -= stats.run_latency;
+	reset_latency     -= stats.reset_latency;
+	vm_exit_latency   -= stats.vm_exit_latency;
+	return *this;
+}
+
+ThreadStats::ThreadStats(size_t n)
+	: m_stats(nullptr)
+	, m_size(n)
+{
+	// operator new doesn't honor alignments bigger than the default one
+	// before C++17, so allocate the memory ourselves
+	size_t size = (n*sizeof(Stats) + alignof(Stats) - 1) & ~(alignof(Stats) - 1);
+	m_stats = (Stats*)aligned_alloc(alignof(Stats), size ? size : alignof(Stats));
+	ERROR_ON(!m_stats, "allocating stats for %lu threads", n);
+	for (size_t i = 0; i < m_size; i++)
+		new (&m_stats[i]) Stats;
+}
+
+ThreadStats::~ThreadStats() {
+	for (size_t i = 0; i < m_size; i++)
+		m_stats[i].~Stats();
+	free(m_stats);
+}
+
+size_t ThreadStats::size() const {
+	return m_size;
+}
+
+Stats& ThreadStats::operator[](size_t i) {
+	ASSERT(i < m_size, "OOB: %lu/%lu", i, m_size);
+	return m_stats[i];
+}
+
+const Stats& ThreadStats::operator[](size_t i) const {
+	ASSERT(i < m_size, "OOB: %lu/%lu", i, m_size);
+	return m_stats[i];
+}
+
+vector<Stats> ThreadStats::snapshot() const {
+	return vector<Stats>(m_stats, m_stats + m_size);
+}
+
+
+namespace {
+
+struct LatencyField {
+	const char* name;
+	Histogram Stats::*histogram;
+};
+
+const LatencyField LATENCIES[] = {
+	{ "mutate",    &Stats::mut_latency },
+	{ "set_input", &Stats::set_input_latency },
+	{ "run",       &Stats::run_latency },
+	{ "reset",     &Stats::reset_latency },
+	{ "vm_exit",   &Stats::vm_exit_latency },
+};
+
+const double PERCENTILES[] = { 50, 90, 99, 99.9 };
+
+Stats sum(const vector<Stats>& stats) {
+	Stats result;
+	for (const Stats& s : stats)
+		result += s;
+	return result;
+}
+
+void json_latencies(ostream& os, const Stats& interval) {
+	os << "{";
+	for (size_t i = 0; i < sizeof(LATENCIES)/sizeof(*LATENCIES); i++) {
+		const Histogram& h = interval.*LATENCIES[i].histogram;
+		os << (i ? "," : "") << "\"" << LATENCIES[i].name << "\":{"
+		   << "\"count\":" << h.count()
+		   << ",\"mean\":" << h.mean()
+		   << ",\"p50\":" << h.percentile(50)
+		   << ",\"p90\":" << h.percentile(90)
+		   << ",\"p99\":" << h.percentile(99)
+		   << ",\"max\":" << h.max() << "}";
+	}
+	os << "}";
+}
+
+void prometheus_header(ostream& os, const char* name, const char* type,
+                       const char* help)
+{
+	os << "# HELP " << name << " " << help << "\n"
+	   << "# TYPE " << name << " " << type << "\n";
+}
+
+}
+
+StatsExporter::StatsExporter(const string& output_dir)
+	: m_prometheus_path(output_dir + "/" + PROMETHEUS_FILENAME)
+	, m_json(output_dir + "/" + JSON_FILENAME, ios::app)
+{
+	ERROR_ON(!m_json.good(), "opening %s/%s", output_dir.c_str(), JSON_FILENAME);
+}
+
+void StatsExporter::dump(const Info& info, const vector<Stats>& stats,
+                         const vector<Stats>& stats_old)
+{
+	ASSERT(stats.size() == stats_old.size(), "snapshots size mismatch: %lu vs %lu",
+	       stats.size(), stats_old.size());
+	dump_json(info, stats, stats_old);
+	dump_prometheus(info, stats, stats_old);
+}
+
+void StatsExporter::dump_json(const Info& info, const vector<Stats>& stats,
+                              const vector<Stats>& stats_old)
+{
+	Stats total = sum(stats);
+	Stats interval = total;
+	interval -= sum(stats_old);
+	uint64_t cases = interval.cases;
+
+	m_json << "{\"time\":" << info.elapsed_total
+	       << ",\"cases\":" << total.cases
+	       << ",\"fcps\":" << cases / info.elapsed
+	       << ",\"cov\":" << info.cov
+	       << ",\"corpus\":" << info.corpus_size
+	       << ",\"crashes\":" << total.crashes
+	       << ",\"unique_crashes\":" << info.unique_crashes
+	       << ",\"timeouts\":" << total.timeouts
+	       << ",\"out_of_memory\":" << total.out_of_memory
+	       << ",\"instr\":" << total.instr
+	       << ",\"vm_exits_per_case\":" << (cases ? (double)interval.vm_exits / cases : 0)
+	       << ",\"reset_pages_per_case\":" << (cases ? (double)interval.reset_pages / cases : 0)
+	       << ",\"latency_cycles\":";
+	json_latencies(m_json, interval);
+	m_json << ",\"runners\":[";
+	for (size_t i = 0; i < stats.size(); i++) {
+		Stats runner_interval = stats[i];
+		runner_interval -= stats_old[i];
+		m_json << (i ? "," : "") << "{\"id\":" << i
+		       << ",\"cases\":" << stats[i].cases
+		       << ",\"fcps\":" << runner_interval.cases / info.elapsed
+		       << ",\"latency_cycles\":";
+		json_latencies(m_json, runner_interval);
+		m_json << "}";
+	}
+	m_json << "]}" << endl;
+}
+
+void StatsExporter::dump_prometheus(const Info& info, const vector<Stats>& stats,
+                                    const vector<Stats>& stats_old)
+{
+	// Write to a temporary file and rename it, so readers never see a
+	// partially written file
+	string tmp_path = m_prometheus_path + ".tmp";
+	ofstream os(tmp_path);
+	ERROR_ON(!os.good(), "opening %s", tmp_path.c_str());
+
+	Stats total = sum(stats);
+	prometheus_header(os, "kvm_fuzz_coverage", "gauge", "Number of basic blocks or bitmap entries covered.");
+	os << "kvm_fuzz_coverage " << info.cov << "\n";
+	prometheus_header(os, "kvm_fuzz_corpus_size", "gauge", "Number of inputs in the corpus.");
+	os << "kvm_fuzz_corpus_size " << info.corpus_size << "\n";
+	prometheus_header(os, "kvm_fuzz_unique_crashes", "gauge", "Number of unique crashes.");
+	os << "kvm_fuzz_unique_crashes " << info.unique_crashes << "\n";
+	prometheus_header(os, "kvm_fuzz_crashes_total", "counter", "Number of crashing runs.");
+	os << "kvm_fuzz_crashes_total " << total.crashes << "\n";
+	prometheus_header(os, "kvm_fuzz_timeouts_total", "counter", "Number of runs which timed out.");
+	os << "kvm_fuzz_timeouts_total " << total.timeouts << "\n";
+	prometheus_header(os, "kvm_fuzz_out_of_memory_total", "counter", "Number of runs which exhausted the substituted heap.");
+	os << "kvm_fuzz_out_of_memory_total " << total.out_of_memory << "\n";
+
+	prometheus_header(os, "kvm_fuzz_cases_total", "counter", "Number of fuzz cases run.");
+	for (size_t i = 0; i < stats.size(); i++)
+		os << "kvm_fuzz_cases_total{runner=\"" << i << "\"} " << stats[i].cases << "\n";
+
+	prometheus_header(os, "kvm_fuzz_vm_exits_total", "counter", "Number of vm exits.");
+	for (size_t i = 0; i < stats.size(); i++)
+		os << "kvm_fuzz_vm_exits_total{runner=\"" << i << "\"} " << stats[i].vm_exits << "\n";
+
+	prometheus_header(os, "kvm_fuzz_reset_pages_total", "counter", "Number of memory pages restored in resets.");
+	for (size_t i = 0; i < stats.size(); i++)
+		os << "kvm_fuzz_reset_pages_total{runner=\"" << i << "\"} " << stats[i].reset_pages << "\n";
+
+	// Quantiles are computed over the last interval, while sum and count are
+	// cumulative, as Prometheus client summaries do
+	prometheus_header(os, "kvm_fuzz_latency_cycles", "summary",
+	                  "Latency of each phase of the fuzz loop, in cycles.");
+	for (size_t i = 0; i < stats.size(); i++) {
+		Stats interval = stats[i];
+		interval -= stats_old[i];
+		for (const LatencyField& field : LATENCIES) {
+			const Histogram& h_interval = interval.*field.histogram;
+			const Histogram& h_total = stats[i].*field.histogram;
+			for (double p : PERCENTILES) {
+				os << "kvm_fuzz_latency_cycles{runner=\"" << i << "\",phase=\""
+				   << field.name << "\",quantile=\"" << p / 100 << "\"} "
+				   << h_interval.percentile(p) << "\n";
+			}
+			os << "kvm_fuzz_latency_cycles_sum{runner=\"" << i << "\",phase=\""
+			   << field.name << "\"} " << h_total.sum() << "\n";
+			os << "kvm_fuzz_latency_cycles_count{runner=\"" << i << "\",phase=\""
+			   << field.name << "\"} " << h_total.count() << "\n";
+		}
+	}
+	os.close();
+	ERROR_ON(rename(tmp_path.c_str(), m_prometheus_path.c_str()) == -1,
+	         "renaming %s to %s", tmp_path.c_str(), m_prometheus_path.c_str());
+}
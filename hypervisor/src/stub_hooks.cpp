@@ -0,0 +1,97 @@
+#include <cstring>
+#include "vm.h"
+#include "code_builder.h"
+
+using namespace std;
+
+void Vm::set_stub_hook(vaddr_t addr, const vector<uint8_t>& stub) {
+	ASSERT(addr < Mmu::USER_END_ADDR, "stub hooks must be in user code: 0x%lx", addr);
+	ASSERT(!m_stub_hooks.count(addr), "stub hook for 0x%lx already exists", addr);
+
+	// Allocate the region for the trampolines and stubs, and the page shared
+	// with the hypervisor
+	if (m_stub_hooks_size == 0) {
+		ASSERT(m_mmu.can_alloc(), "the first stub hook must be set before "
+		       "running the vm");
+		m_mmu.alloc(Mmu::STUB_HOOKS_ADDR, Mmu::STUB_HOOKS_SIZE, PDE64_USER);
+		m_mmu.alloc(Mmu::STUB_HOOKS_SHARED_ADDR, PAGE_SIZE,
+		            PDE64_USER | PDE64_RW | PDE64_NX);
+	}
+	vaddr_t trampoline = Mmu::STUB_HOOKS_ADDR + m_stub_hooks_size;
+
+	// Decode the instructions displaced by the jump to the trampoline. They
+	// are executed from the trampoline, so they must be relocatable.
+	vector<uint8_t> patch;
+	append_jmp(patch, addr, trampoline);
+	vector<DisplacedInst> insts;
+	vsize_t len = 0;
+	while (len < patch.size()) {
+		DisplacedInst inst = decode_displaced(addr + len);
+		ASSERT(inst.emulable(), "can't set stub hook at 0x%lx: unsupported "
+		       "instruction at 0x%lx", addr, addr + len);
+		insts.push_back(inst);
+		len += inst.length();
+	}
+
+	// A breakpoint inside the patched code would mean something jumps there,
+	// as coverage breakpoints are placed at the start of basic blocks. The
+	// coverage breakpoint at `addr` is dropped while the hook is set, as the
+	// jump replaces it.
+	for (vsize_t i = 1; i < len; i++)
+		ASSERT(!m_breakpoints.count(addr + i), "can't set stub hook at 0x%lx: "
+		       "breakpoint at 0x%lx", addr, addr + i);
+	vector<uint8_t> original = read_code(addr, len);
+	StubHook hook;
+	hook.code.resize(len);
+	m_mmu.read_mem(hook.code.data(), addr, len);
+	hook.breakpoint = {};
+	auto bp = m_breakpoints.find(addr);
+	if (bp != m_breakpoints.end()) {
+		ASSERT(bp->second.type == Breakpoint::Coverage, "can't set stub hook "
+		       "at 0x%lx: breakpoint of type %d", addr, bp->second.type);
+		hook.breakpoint = bp->second;
+		m_breakpoints.erase(bp);
+	}
+
+	// Trampoline: skip the red zone, call the stub, execute the displaced
+	// instructions and jump back. The stub goes right after it.
+	vector<uint8_t> code = {
+		0x48, 0x8D, 0x64, 0x24, 0x80,                   // lea rsp, [rsp-0x80]
+		0xE8, 0x00, 0x00, 0x00, 0x00,                   // call stub
+		0x48, 0x8D, 0xA4, 0x24, 0x80, 0x00, 0x00, 0x00, // lea rsp, [rsp+0x80]
+	};
+	const size_t call_end = 10;
+	vsize_t offset = 0;
+	for (const DisplacedInst& inst : insts) {
+		inst.relocate(original.data() + offset, addr + offset, code);
+		offset += inst.length();
+	}
+	append_jmp(code, trampoline + code.size(), addr + len);
+	int32_t call_rel = code.size() - call_end;
+	memcpy(&code[call_end - sizeof(call_rel)], &call_rel, sizeof(call_rel));
+	code.insert(code.end(), stub.begin(), stub.end());
+	ASSERT(m_stub_hooks_size + code.size() <= Mmu::STUB_HOOKS_SIZE,
+	       "not enough space for stub hook at 0x%lx", addr);
+	write_code(trampoline, code.data(), code.size());
+	m_stub_hooks_size += code.size();
+
+	// Patch the hooked code. The rest of displaced bytes should never be
+	// executed, so fill them with int3.
+	patch.resize(len, 0xCC);
+	write_code(addr, patch.data(), patch.size());
+	m_stub_hooks[addr] = move(hook);
+}
+
+void Vm::remove_stub_hook(vaddr_t addr) {
+	// The space of the trampoline and the stub isn't reused
+	auto it = m_stub_hooks.find(addr);
+	ASSERT(it != m_stub_hooks.end(), "stub hook for 0x%lx doesn't exist", addr);
+
+	// Restore the code as it was, including the coverage breakpoint if it
+	// hadn't been hit yet
+	const StubHook& hook = it->second;
+	write_code(addr, hook.code.data(), hook.code.size());
+	if (hook.breakpoint.type)
+		m_breakpoints[addr] = hook.breakpoint;
+	m_stub_hooks.erase(it);
+}
@@ -0,0 +1,85 @@
+#include <algorithm>
+#include <unordered_map>
+#include "symbol_index.h"
+#include "elf_parser.h"
+
+using namespace std;
+
+namespace {
+
+// Whether the symbol is meaningful when symbolizing an address. TLS symbols
+// have offsets inside the TLS segment instead of addresses.
+bool is_indexable(const symbol_t& symbol, vaddr_t base) {
+	return !symbol.name.empty() && symbol.value != 0 && symbol.value >= base &&
+	       symbol.type != STT_SECTION && symbol.type != STT_FILE &&
+	       symbol.type != STT_TLS;
+}
+
+int symbol_rank(const symbol_t& symbol) {
+	int type_rank = (symbol.type == STT_FUNC ? 2 : symbol.type == STT_OBJECT ? 1 : 0);
+	int binding_rank = (symbol.binding == STB_GLOBAL ? 2 : symbol.binding == STB_WEAK ? 1 : 0);
+	return type_rank*3 + binding_rank;
+}
+
+}
+
+SymbolIndex::SymbolIndex() {}
+
+SymbolIndex::SymbolIndex(const vector<symbol_t>& symbols, vaddr_t base) {
+	vector<uint32_t> order;
+	for (uint32_t i = 0; i < symbols.size(); i++)
+		if (is_indexable(symbols[i], base))
+			order.push_back(i);
+
+	// Sort by address, and for symbols with the same address put first the
+	// one we prefer
+	sort(order.begin(), order.end(), [&symbols](uint32_t i1, uint32_t i2) {
+		const symbol_t& s1 = symbols[i1];
+		const symbol_t& s2 = symbols[i2];
+		if (s1.value != s2.value)
+			return s1.value < s2.value;
+		int rank1 = symbol_rank(s1), rank2 = symbol_rank(s2);
+		if (rank1 != rank2)
+			return rank1 > rank2;
+		return i1 < i2;
+	});
+
+	unordered_map<string, uint32_t> name_offsets;
+	for (uint32_t i : order) {
+		const symbol_t& symbol = symbols[i];
+		vaddr_t start = symbol.value - base;
+		if (!m_starts.empty() && m_starts.back() == start)
+			continue;
+
+		auto it = name_offsets.find(symbol.name);
+		uint32_t name;
+		if (it != name_offsets.end()) {
+			name = it->second;
+		} else {
+			name = m_names.size();
+			m_names.append(symbol.name);
+			m_names.push_back('\0');
+			name_offsets[symbol.name] = name;
+		}
+		m_starts.push_back(start);
+		m_entries.push_back({name, i});
+	}
+	m_starts.shrink_to_fit();
+	m_entries.shrink_to_fit();
+	m_names.shrink_to_fit();
+}
+
+bool SymbolIndex::lookup(vaddr_t offset, Result& result) const {
+	auto it = upper_bound(m_starts.begin(), m_starts.end(), offset);
+	if (it == m_starts.begin())
+		return false;
+	size_t i = (it - m_starts.begin()) - 1;
+	result.name = m_names.c_str() + m_entries[i].name;
+	result.start = m_starts[i];
+	result.symbol = m_entries[i].symbol;
+	return true;
+}
+
+size_t SymbolIndex::size() const {
+	return m_starts.size();
+}
@@ -1,30 +1,99 @@
 #include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <limits>
 #include "tracing.h"
 #include "vm.h"
+#include "utils.h"
 
 using namespace std;
 
+const size_t Tracing::RING_SIZE;
+const uint32_t Tracing::NO_ID = numeric_limits<uint32_t>::max();
+const chrono::seconds Tracing::DUMP_INTERVAL(5);
+
+namespace {
+
+// Interned names, shared by every Vm
+struct Names {
+	vector<string> names;
+	unordered_map<string, uint32_t> ids;
+	atomic_flag lock = ATOMIC_FLAG_INIT;
+};
+
+Names& names() {
+	static Names names;
+	return names;
+}
+
+size_t names_count() {
+	Names& n = names();
+	while (n.lock.test_and_set());
+	size_t result = n.names.size();
+	n.lock.clear();
+	return result;
+}
+
+vector<string> names_snapshot() {
+	Names& n = names();
+	while (n.lock.test_and_set());
+	vector<string> result = n.names;
+	n.lock.clear();
+	return result;
+}
+
+}
+
+uint32_t Tracing::intern(const string& name) {
+	Names& n = names();
+	while (n.lock.test_and_set());
+	auto it = n.ids.find(name);
+	uint32_t id;
+	if (it != n.ids.end()) {
+		id = it->second;
+	} else {
+		id = n.names.size();
+		n.names.push_back(name);
+		n.ids[name] = id;
+	}
+	n.lock.clear();
+	return id;
+}
+
 Tracing::Tracing(Vm& vm, Type type, Unit unit)
 	: m_vm(vm)
 	, m_type(type)
 	, m_type_addr(0)
+	, m_ring_addr(0)
 	, m_unit(unit)
-	, m_measure({})
+	, m_measure({NO_ID, 0})
 	, m_next_trace_id(0)
+	, m_exit_group_id(intern("exit_group"))
+	, m_sample_period(0)
+	, m_names_written(0)
+	, m_last_dump(chrono::steady_clock::now())
 {}
 
 Tracing::Tracing(Vm& vm, const Tracing& other)
 	: m_vm(vm)
 	, m_type(other.m_type)
 	, m_type_addr(other.m_type_addr)
+	, m_ring_addr(other.m_ring_addr)
 	, m_unit(other.m_unit)
 	, m_measure(other.m_measure)
 	, m_next_trace_id(other.m_next_trace_id)
+	, m_ids(other.m_ids)
+	, m_exit_group_id(other.m_exit_group_id)
+	, m_output_dir(other.m_output_dir)
+	, m_sample_period(other.m_sample_period)
+	, m_names_written(0)
+	, m_last_dump(chrono::steady_clock::now())
 {}
 
 void Tracing::reset(const Tracing& other) {
 	m_type = other.m_type;
 	m_type_addr = other.m_type_addr;
+	m_ring_addr = other.m_ring_addr;
 	m_unit = other.m_unit;
 	m_measure = other.m_measure;
 }
@@ -40,46 +109,103 @@ void Tracing::set_type_addr(vaddr_t type_addr) {
 	m_vm.mmu().write(m_type_addr, m_type);
 }
 
+void Tracing::set_ring_addr(vaddr_t ring_addr) {
+	m_ring_addr = ring_addr;
+	write_ring_counter();
+}
+
 void Tracing::set_unit(Unit unit) {
 	m_unit = unit;
+	if (m_ring_addr)
+		write_ring_counter();
+}
+
+void Tracing::write_ring_counter() {
+	// Index of the fixed counter the kernel reads with rdpmc
+	uint64_t counter = (m_unit == Unit::Instructions ? 0 : 1);
+	m_vm.mmu().write<uint64_t>(m_ring_addr + offsetof(RingHeader, counter), counter);
 }
 
 Tracing::Type Tracing::type() const {
 	return m_type;
 }
 
+void Tracing::set_output(const string& output_dir, size_t sample_period) {
+	m_output_dir = output_dir;
+	m_sample_period = sample_period;
+	utils::create_folder(m_output_dir);
+}
+
+uint32_t Tracing::addr_id(vaddr_t addr) {
+	auto it = m_ids.find(addr);
+	if (it != m_ids.end())
+		return it->second;
+
+	string name;
+	if (m_type == Type::User) {
+		name = m_vm.elfs().addr_to_symbol_str(addr);
+		if (name.empty())
+			name = utils::to_hex(addr);
+	} else {
+		name = m_vm.mmu().read_string(addr);
+	}
+	uint32_t id = intern(name);
+	m_ids[addr] = id;
+	return id;
+}
+
+void Tracing::add_measure(uint32_t id, uint64_t measure) {
+	if (id >= m_histograms.size())
+		m_histograms.resize(id + 1);
+	m_histograms[id].record(measure);
+	if (m_sample_period)
+		m_trace.push_back({id, measure});
+}
+
 size_t Tracing::trace() {
 	size_t current_measure = get_tracing_measure();
-	if (!m_measure.name.empty()) {
+	if (m_measure.id != NO_ID) {
 		size_t measure = current_measure - m_measure.start;
 		ASSERT(measure != 0, "measure traced by syscall is 0, did you forget to "
 		                     "compile with -Dinstruction-count=all ?");
-		m_trace.push_back({m_measure.name, measure});
+		add_measure(m_measure.id, measure);
 	}
-	m_measure = {};
+	m_measure = {NO_ID, 0};
 	return current_measure;
 }
 
-void Tracing::trace_and_prepare(string name) {
+void Tracing::trace_and_prepare(vaddr_t addr) {
 	size_t current_measure = trace();
 	m_measure = Measure{
-		.name = name,
+		.id = addr_id(addr),
 		.start = current_measure,
 	};
 }
 
-void Tracing::prepare(string name) {
-	// Special case for exit_group, because it's the last syscall and therefore
-	// there won't be a call to trace().
-	if (name == "exit_group") {
-		m_trace.push_back({name, 0});
+void Tracing::drain_ring() {
+	ASSERT(m_ring_addr, "kernel didn't submit tracing ring addr");
+	vaddr_t count_addr = m_ring_addr + offsetof(RingHeader, count);
+	uint64_t count = m_vm.mmu().read<uint64_t>(count_addr);
+	ASSERT(count <= RING_SIZE, "tracing ring count: %lu", count);
+	if (count == 0)
 		return;
-	}
 
-	m_measure = Measure{
-		.name = name,
-		.start = get_tracing_measure(),
-	};
+	SyscallEvent events[RING_SIZE];
+	m_vm.mmu().read_mem(events, m_ring_addr + sizeof(RingHeader),
+	                    count*sizeof(SyscallEvent));
+	for (size_t i = 0; i < count; i++) {
+		const SyscallEvent& event = events[i];
+		uint32_t id = addr_id(event.name);
+
+		// exit_group is the only syscall which doesn't return, and the kernel
+		// gives it a measure of 0
+		uint64_t measure = event.end - event.start;
+		ASSERT(measure != 0 || id == m_exit_group_id, "measure traced by "
+		       "syscall is 0, did you forget to compile with "
+		       "-Dinstruction-count=all ?");
+		add_measure(id, measure);
+	}
+	m_vm.mmu().write<uint64_t>(count_addr, 0);
 }
 
 size_t Tracing::get_tracing_measure() {
@@ -93,15 +219,79 @@ size_t Tracing::get_tracing_measure() {
 	};
 }
 
-void Tracing::dump_trace(size_t id) {
-	if (m_type == Type::None)
+void Tracing::dump_trace(size_t id, bool force) {
+	if (m_type == Type::None || m_output_dir.empty())
 		return;
 
 	size_t trace_id = m_next_trace_id++;
-	string filename = "traces/" + to_string(id) + "_" + to_string(trace_id);
+	if (m_sample_period && trace_id % m_sample_period == 0)
+		write_sample(id);
+	m_trace.clear();
+
+	auto now = chrono::steady_clock::now();
+	if (force || now - m_last_dump >= DUMP_INTERVAL) {
+		m_last_dump = now;
+		write_stats(id);
+	}
+}
+
+void Tracing::write_names(size_t id) {
+	// Every runner may write it, so write to a temporary file and rename it
+	string path = m_output_dir + "/" + NAMES_FILENAME;
+	string tmp_path = path + "." + to_string(id) + ".tmp";
+	ofstream out(tmp_path);
+	ERROR_ON(!out.good(), "opening %s", tmp_path.c_str());
+	vector<string> names = names_snapshot();
+	for (const string& name : names)
+		out << name << "\n";
+	out.close();
+	ERROR_ON(rename(tmp_path.c_str(), path.c_str()) == -1,
+	         "renaming %s to %s", tmp_path.c_str(), path.c_str());
+	m_names_written = names.size();
+}
+
+void Tracing::write_sample(size_t id) {
+	// Binary format: for each trace, the number of entries as an uint32_t
+	// followed by that many pairs of uint32_t id and uint64_t measure. Ids
+	// are line numbers of the names file.
+	if (!m_samples.is_open()) {
+		string filename = m_output_dir + "/" + to_string(id) + ".bin";
+		m_samples.open(filename, ios::binary | ios::trunc);
+		ERROR_ON(!m_samples.good(), "opening %s", filename.c_str());
+	}
+	uint32_t length = m_trace.size();
+	m_samples.write((const char*)&length, sizeof(length));
+	for (const TraceEntry& entry : m_trace) {
+		m_samples.write((const char*)&entry.id, sizeof(entry.id));
+		m_samples.write((const char*)&entry.measure, sizeof(entry.measure));
+	}
+	m_samples.flush();
+
+	// Make sure every id in the sample has a name
+	if (names_count() != m_names_written)
+		write_names(id);
+}
+
+void Tracing::write_stats(size_t id) {
+	vector<string> names = names_snapshot();
+	vector<uint32_t> ids;
+	for (uint32_t i = 0; i < m_histograms.size(); i++)
+		if (m_histograms[i].count())
+			ids.push_back(i);
+	sort(ids.begin(), ids.end(), [this](uint32_t a, uint32_t b) {
+		return m_histograms[a].sum() > m_histograms[b].sum();
+	});
+
+	string filename = m_output_dir + "/" + to_string(id) + ".txt";
 	ofstream out(filename);
-	for (pair<string, size_t> element : m_trace) {
-		out << element.first << " " << to_string(element.second) << endl;
+	ERROR_ON(!out.good(), "opening %s", filename.c_str());
+	out << "# name count total mean p50 p90 p99 max ("
+	    << (m_unit == Unit::Cycles ? "cycles" : "instructions") << ")\n";
+	for (uint32_t i : ids) {
+		const Histogram& h = m_histograms[i];
+		out << names[i] << " " << h.count() << " " << h.sum() << " "
+		    << (uint64_t)h.mean() << " " << h.percentile(50) << " "
+		    << h.percentile(90) << " " << h.percentile(99) << " " << h.max()
+		    << "\n";
 	}
-	m_trace.clear();
-}
\ No newline at end of file
+}
@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <cstring>
+#include "unwind_table.h"
+#include "mmu.h"
+
+using namespace std;
+
+const size_t UnwindTable::N_SAVED_REGS;
+const DwarfReg UnwindTable::SAVED_REGS[N_SAVED_REGS] = {
+	DwarfReg::Rbx, DwarfReg::Rbp, DwarfReg::R12,
+	DwarfReg::R13, DwarfReg::R14, DwarfReg::R15,
+};
+
+UnwindTable::UnwindTable() {}
+
+UnwindTable::UnwindTable(vector<Row> rows)
+	: m_rows(move(rows))
+{
+	// If a FDE ends at the same address another one begins, the end of the
+	// first one must go before
+	stable_sort(m_rows.begin(), m_rows.end(), [](const Row& r1, const Row& r2) {
+		if (r1.addr != r2.addr)
+			return r1.addr < r2.addr;
+		return (r1.kind == Kind::NoInfo && r2.kind != Kind::NoInfo);
+	});
+	m_rows.shrink_to_fit();
+}
+
+const UnwindTable::Row* UnwindTable::find(vaddr_t pc) const {
+	auto it = upper_bound(m_rows.begin(), m_rows.end(), pc,
+		[](vaddr_t pc, const Row& row) {
+			return pc < row.addr;
+		}
+	);
+	if (it == m_rows.begin())
+		return nullptr;
+	--it;
+	return (it->kind == Kind::NoInfo ? nullptr : &*it);
+}
+
+// Whether given rule is unspecified, which means the register keeps its value
+static bool rule_keeps_value(const Dwarf_Regtable_Entry3_s& rule) {
+	return rule.dw_regnum == DW_FRAME_SAME_VAL ||
+	       rule.dw_regnum == DW_FRAME_UNDEFINED_VAL;
+}
+
+// Get the offset from the CFA of a rule in the form of `stored at CFA + N`,
+// or 0 if it's not in that form or it doesn't fit
+static int16_t rule_cfa_offset(const Dwarf_Regtable_Entry3_s& rule) {
+	if (rule.dw_value_type != DW_EXPR_OFFSET || !rule.dw_offset_relevant)
+		return 0;
+	int64_t offset = (int64_t)rule.dw_offset_or_block_len;
+	if (offset < INT16_MIN || offset > INT16_MAX)
+		return 0;
+	return offset;
+}
+
+UnwindTable::Row UnwindTable::make_row(vaddr_t addr, const Dwarf_Regtable3& regtable) {
+	Row row = {};
+	row.addr = addr;
+	row.kind = Kind::Fallback;
+
+	// CFA must be a register plus an offset
+	const Dwarf_Regtable_Entry3_s& cfa = regtable.rt3_cfa_rule;
+	int64_t cfa_offset = (int64_t)cfa.dw_offset_or_block_len;
+	if (cfa.dw_value_type != DW_EXPR_OFFSET || !cfa.dw_offset_relevant ||
+	    cfa.dw_regnum >= DwarfReg::ReturnAddress ||
+	    cfa_offset < INT32_MIN || cfa_offset > INT32_MAX)
+		return row;
+	row.cfa_reg = cfa.dw_regnum;
+	row.cfa_offset = cfa_offset;
+
+	const Dwarf_Regtable_Entry3_s& ra = regtable.rt3_rules[DwarfReg::ReturnAddress];
+	if (ra.dw_regnum == DW_FRAME_UNDEFINED_VAL) {
+		row.kind = Kind::Outermost;
+		return row;
+	}
+	row.ra_offset = rule_cfa_offset(ra);
+	if (!row.ra_offset)
+		return row;
+
+	// Callee-saved registers must be stored in the stack or keep their
+	// values. Any other register must keep its value, as we don't restore
+	// it and it could be needed for getting the CFA of the previous frame.
+	bool saved[DwarfReg::ReturnAddress] = {};
+	for (size_t i = 0; i < N_SAVED_REGS; i++) {
+		DwarfReg reg = SAVED_REGS[i];
+		saved[reg] = true;
+		const Dwarf_Regtable_Entry3_s& rule = regtable.rt3_rules[reg];
+		if (rule_keeps_value(rule))
+			continue;
+		row.saved_offsets[i] = rule_cfa_offset(rule);
+		if (!row.saved_offsets[i])
+			return row;
+	}
+	for (int reg = 0; reg < DwarfReg::ReturnAddress; reg++)
+		if (!saved[reg] && !rule_keeps_value(regtable.rt3_rules[reg]))
+			return row;
+
+	row.kind = Kind::Rules;
+	return row;
+}
+
+size_t UnwindTable::size() const {
+	return m_rows.size();
+}
+
+StackReader::StackReader(Mmu& mmu)
+	: m_mmu(mmu)
+	, m_page(1) // not page aligned, so it never matches
+	, m_page_data(nullptr)
+{}
+
+vsize_t StackReader::read(vaddr_t addr) {
+	if (PAGE_OFFSET(addr) + sizeof(vsize_t) > PAGE_SIZE)
+		return m_mmu.read<vsize_t>(addr);
+
+	vaddr_t page = addr & PTL1_MASK;
+	if (page != m_page) {
+		m_page_data = m_mmu.get(page);
+		m_page = page;
+	}
+	vsize_t value;
+	memcpy(&value, m_page_data + PAGE_OFFSET(addr), sizeof(value));
+	return value;
+}
+
+Mmu& StackReader::mmu() {
+	return m_mmu;
+}
@@ -85,8 +85,9 @@ vector<string> split_string(const string& s, const string& delimiter) {
 	size_t pos1 = 0, pos2;
 	while ((pos2 = s.find(delimiter, pos1)) != string::npos) {
 		result.push_back(s.substr(pos1, pos2-pos1));
-		pos1 = pos2 + 1;
+		pos1 = pos2 + delimiter.size();
 	}
+	result.push_back(s.substr(pos1));
 	return result;
 }
 
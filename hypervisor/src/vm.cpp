@@ -4,6 +4,7 @@
 #include <sys/mman.h>
 #include <cstring>
 #include "vm.h"
+#include "library_resolver.h"
 #include "utils.h"
 
 enum Exception : uint32_t {
@@ -17,7 +18,7 @@ int g_kvm_fd = -1;
 
 const char* Vm::reason_str(Vm::RunEndReason reason) {
 	constexpr const char* reason_strs[] =
-		{"Exit", "Breakpoint", "Debug", "Crash", "Timeout", "Unknown"};
+		{"Exit", "Breakpoint", "Debug", "Crash", "Timeout", "OutOfMemory", "Unknown"};
 	return reason_strs[static_cast<int>(reason)];
 }
 
@@ -41,20 +42,24 @@ SharedFiles Vm::s_shared_files;
 Elfs Vm::s_elfs;
 
 Vm::Vm(vsize_t mem_size, const string& kernel_path, const string& binary_path,
-       const vector<string>& argv)
+       const vector<string>& argv, const string& sysroot)
 	: m_vm_fd(create_vm())
 	, m_mmu(m_vm_fd, m_vcpu_fd, mem_size)
 	, m_running(false)
 	, m_single_stepping(false)
+	, m_stub_hooks_size(0)
 	, m_breakpoints_dirty(false)
 	, m_instructions_executed(0)
 	, m_instructions_executed_prev(0)
 	, m_timer_addr(0)
 	, m_timeout_addr(0)
 	, m_tracing(*this)
+	, m_profiler(*this)
+	, m_exit_recorder(*this)
+	, m_console(*this)
 {
 	m_mmu.create_physmap();
-	s_elfs.init(binary_path, kernel_path);
+	s_elfs.init(binary_path, kernel_path, sysroot);
 	load_elfs();
 	setup_kvm();
 	setup_kernel_execution(argv);
@@ -64,17 +69,24 @@ Vm::Vm(vsize_t mem_size, const string& kernel_path, const string& binary_path,
 Vm::Vm(const Vm& other)
 	: m_vm_fd(create_vm())
 	, m_files(other.m_files)
+	, m_basic_blocks(other.m_basic_blocks)
 	, m_mmu(m_vm_fd, m_vcpu_fd, other.m_mmu)
 	, m_running(false)
 	, m_single_stepping(other.m_single_stepping)
 	, m_breakpoints(other.m_breakpoints)
 	, m_hook_handlers(other.m_hook_handlers)
+	, m_displaced_insts(other.m_displaced_insts)
+	, m_stub_hooks(other.m_stub_hooks)
+	, m_stub_hooks_size(other.m_stub_hooks_size)
 	, m_breakpoints_dirty(other.m_breakpoints_dirty)
 	, m_instructions_executed(other.m_instructions_executed)
 	, m_instructions_executed_prev(other.m_instructions_executed_prev)
 	, m_timer_addr(other.m_timer_addr)
 	, m_timeout_addr(other.m_timeout_addr)
 	, m_tracing(*this, other.m_tracing)
+	, m_profiler(*this, other.m_profiler)
+	, m_exit_recorder(*this, other.m_exit_recorder)
+	, m_console(*this, other.m_console)
 {
 	// Elfs are already relocated by the other VM, we can init vmx pt
 #ifdef ENABLE_COVERAGE_INTEL_PT
@@ -117,6 +129,13 @@ Vm::Vm(const Vm& other)
 	set_sregs_dirty();
 }
 
+Vm::~Vm() {
+	size_t vcpu_run_size = ioctl_chk(g_kvm_fd, KVM_GET_VCPU_MMAP_SIZE, 0);
+	munmap(m_vcpu_run, vcpu_run_size);
+	close(m_vcpu_fd);
+	close(m_vm_fd);
+}
+
 int Vm::create_vm() {
 	m_vm_fd = ioctl_chk(g_kvm_fd, KVM_CREATE_VM, 0);
 
@@ -295,7 +314,7 @@ void Vm::setup_coverage() {
 				ASSERT(elf->load_addr() != 0, "elf '%s' has no load_addr, user "
 				       "loader didn't run yet?", elf->path().c_str());
 			}
-			set_breakpoint(bb, Breakpoint::Type::Coverage);
+			add_basic_block(bb);
 			bbs >> bb;
 			count++;
 		}
@@ -333,11 +352,16 @@ void Vm::load_elfs() {
 		          interpreter->path().c_str(), interpreter->load_addr());
 		m_mmu.load_elf(interpreter->segments(), ElfType::User);
 	}
+	s_elfs.update_modules();
 
 	// Set elf dependencies as memory-loaded files, and add them to the list
-	// of libraries. ElfParsers are created from the data located in s_shared_files.
-	for (const string& library_path : elf.get_dependencies()) {
-		GuestFile file = s_shared_files.set_file(library_path);
+	// of libraries. ElfParsers are created from the data located in s_shared_files,
+	// which maps the files, so both share the same pages. The guest sees them
+	// at the same path they have inside the sysroot.
+	LibraryResolver resolver(s_elfs.sysroot());
+	for (const string& library_path : resolver.resolve(elf.path(), elf.interpreter())) {
+		GuestFile file = s_shared_files.map_file(library_path,
+		                                         resolver.host_path(library_path));
 		s_elfs.add_library(library_path, file.data);
 	}
 }
@@ -409,6 +433,22 @@ Tracing& Vm::tracing() {
 	return m_tracing;
 }
 
+Profiler& Vm::profiler() {
+	return m_profiler;
+}
+
+ExitRecorder& Vm::exit_recorder() {
+	return m_exit_recorder;
+}
+
+Console& Vm::console() {
+	return m_console;
+}
+
+const Elfs& Vm::elfs() const {
+	return s_elfs;
+}
+
 uint64_t Vm::read_msr(uint64_t msr) const {
 	size_t sz = sizeof(kvm_msrs) + sizeof(kvm_msr_entry)*1;
 	kvm_msrs* msrs = (kvm_msrs*)alloca(sz);
@@ -441,11 +481,23 @@ const Coverage& Vm::coverage() const {
 	return m_coverage;
 }
 
+void Vm::add_basic_block(vaddr_t bb) {
+	set_breakpoint(bb, Breakpoint::Type::Coverage);
+	m_basic_blocks.push_back(bb);
+}
+
+const vector<vaddr_t>& Vm::basic_blocks() const {
+	return m_basic_blocks;
+}
+
 void Vm::reset_coverage() {
 	m_coverage.reset();
 }
 
 void Vm::reset(const Vm& other, Stats& stats) {
+	// Drain profiler samples before memory is reset
+	m_profiler.collect();
+
 	// Reset mmu, regs and sregs
 	stats.reset_pages += m_mmu.reset(other.m_mmu);
 	memcpy(m_regs, other.m_regs, sizeof(*m_regs));
@@ -476,22 +528,37 @@ void Vm::reset(const Vm& other, Stats& stats) {
 	// ioctl_chk(m_vcpu_fd, KVM_SET_LAPIC, &lapic);
 
 	m_tracing.reset(other.m_tracing);
+	m_profiler.reset();
+	m_console.reset();
 
 	// Indicate we have dirtied registers
 	set_regs_dirty();
 	set_sregs_dirty();
 }
 
+template <Timetrace timetrace>
 Vm::RunEndReason Vm::run(Stats& stats) {
-	cycle_t cycles;
+	cycle_t cycles, entry_cycles = 0;
+	ExitRecorder::Entry exit_entry;
 	RunEndReason reason = RunEndReason::Unknown;
+	bool record_exits = m_exit_recorder.enabled();
 	m_running = true;
 
 	while (m_running) {
-		cycles = rdtsc2();
+		cycles = rdtsc2<timetrace>();
+		if (record_exits)
+			entry_cycles = _rdtsc();
 		ioctl_chk(m_vcpu_fd, KVM_RUN, 0);
-		stats.kvm_cycles += rdtsc2() - cycles;
-		cycles = rdtsc2();
+		if (timetrace >= Timetrace::Fine)
+			stats.kvm_cycles += rdtsc2<timetrace>() - cycles;
+
+		// The guest may have switched to another process. Sregs are synced in
+		// every exit, so CR3 is up to date. Changes to its page tables don't
+		// need a TLB flush.
+		m_mmu.set_cr3(m_sregs->cr3);
+		if (record_exits)
+			exit_entry = m_exit_recorder.begin_exit(m_vcpu_run, *m_regs, entry_cycles);
+		cycles = rdtsc2<timetrace>();
 		stats.vm_exits++;
 		switch (m_vcpu_run->exit_reason) {
 			case KVM_EXIT_HLT:
@@ -520,7 +587,7 @@ Vm::RunEndReason Vm::run(Stats& stats) {
 						m_running = false;
 						break;
 					case Exception::Breakpoint:
-						handle_breakpoint(reason);
+						handle_breakpoint(reason, stats);
 						break;
 					default:
 						ASSERT(false, "unknown exception %lu", exception);
@@ -531,7 +598,7 @@ Vm::RunEndReason Vm::run(Stats& stats) {
 #ifdef ENABLE_COVERAGE_INTEL_PT
 			case KVM_EXIT_VMX_PT_TOPA_MAIN_FULL:
 				stats.vm_exits_cov++;
-				update_coverage(stats);
+				update_coverage<timetrace>(stats);
 				break;
 #endif
 
@@ -551,20 +618,39 @@ Vm::RunEndReason Vm::run(Stats& stats) {
 				vm_err("UNKNOWN EXIT " + to_string(m_vcpu_run->exit_reason));
 		}
 
-		stats.vm_exits_cycles += rdtsc2() - cycles;
+		if (timetrace >= Timetrace::Fine) {
+			cycles = rdtsc2<timetrace>() - cycles;
+			stats.vm_exits_cycles += cycles;
+			stats.vm_exit_latency.record(cycles);
+		}
+		if (record_exits)
+			m_exit_recorder.end_exit(exit_entry);
 	}
 
 #ifdef ENABLE_COVERAGE_INTEL_PT
 	// Before returning, update coverage if VMX PT has been initialised
 	if (m_vmx_pt) {
-		update_coverage(stats);
+		update_coverage<timetrace>(stats);
 	}
 #endif
 
+	// Print guest output of this run
+	m_console.drain();
+
+	// Aggregate the syscalls left in the tracing ring. This is done for every
+	// end reason: runs ending at a breakpoint don't go through EndRun, and the
+	// count of the ring is restored when the vm is reset.
+	if (m_tracing.type() == Tracing::Type::Kernel)
+		m_tracing.drain_ring();
+
 	return reason;
 }
 
-void Vm::handle_breakpoint(RunEndReason& reason) {
+template Vm::RunEndReason Vm::run<Timetrace::Off>(Stats& stats);
+template Vm::RunEndReason Vm::run<Timetrace::Phase>(Stats& stats);
+template Vm::RunEndReason Vm::run<Timetrace::Fine>(Stats& stats);
+
+void Vm::handle_breakpoint(RunEndReason& reason, Stats& stats) {
 	vaddr_t addr = m_regs->rip;
 	ASSERT(m_breakpoints.count(addr), "not existing breakpoint: 0x%lx", addr);
 
@@ -576,48 +662,54 @@ void Vm::handle_breakpoint(RunEndReason& reason) {
 		m_running = false;
 		return;
 	}
+	if (bp.type & Breakpoint::OutOfMemory) {
+		reason = RunEndReason::OutOfMemory;
+		m_running = false;
+		return;
+	}
 
-	// If it's a hook handle it, then remove breakpoint, single step and set
-	// breakpoint again
+	// If it's a hook handle it, then execute the displaced instruction. If it
+	// can't be emulated, remove breakpoint, single step and set breakpoint
+	// again
 	if (bp.type & Breakpoint::Type::Hook) {
-		// Handle hook and remove breakpoint
 		hook_handler_t hook_handler = m_hook_handlers[addr];
 		ASSERT(hook_handler, "hook breakpoint without hook handler at 0x%lx", addr);
 		hook_handler(*this);
-		remove_breakpoint(addr, Breakpoint::Hook);
-
-		// Single step. Then, we only want to continue executing if it was
-		// was successful (no Exit, Breakpoint, Crash, etc) and we are not
-		// single stepping (we already single stepped). Otherwise, update exit
-		// reason.
-		// Without the ioctl, single_step() doesn't work sometimes. Example:
-		// running at 0x41fef2, supposed to run until 0x41fef6, but ran until
-		// 0xffffffff80200000 (hypercall). I haven't been able to get a failing
-		// test for this.
-		// TODO: even with the ioctl this seems to keep failing!!!!!!!
-		// Parece que es por la interrupcion de la APIC.
-		// Idea: desactivar interrupciones antes del single step y reactivarlas despues
-		// problema: parece que single_step() no funciona si usamos set_regs_dirty()
-		// en vez del primer ioctl.
-		// sigue ejecutando hasta que ejecuta syscall y el assert del kernel peta
-		// porque falta la flag de interrupciones.
-		Stats dummy;
-		// printf("before ss: %lx\n", regs().rip);
-		m_regs->rflags &= ~(1 << 9);
-		// set_regs_dirty();
-		ioctl_chk(m_vcpu_fd, KVM_SET_REGS, m_regs); // removing this makes the kernel assert fail
-		RunEndReason reason_ss = single_step(dummy);
-		m_regs->rflags |= (1 << 9);
-		// set_regs_dirty(); // this doesn't seem to be needed bc kvm_dirty_regs is already 1
-		// ioctl_chk(m_vcpu_fd, KVM_SET_REGS, m_regs);
-		// printf("after ss: %lx %lx\n", regs().rip, m_vcpu_run->kvm_dirty_regs); // WHY IS THIS 1
-		if (reason_ss == RunEndReason::Debug && !m_single_stepping)
-			m_running = true;
-		else
-			reason = reason_ss;
+		if (!emulate_displaced(addr, reason)) {
+			remove_breakpoint(addr, Breakpoint::Hook);
+
+			// Single step. Then, we only want to continue executing if it was
+			// was successful (no Exit, Breakpoint, Crash, etc) and we are not
+			// single stepping (we already single stepped). Otherwise, update exit
+			// reason.
+			// Without the ioctl, single_step() doesn't work sometimes. Example:
+			// running at 0x41fef2, supposed to run until 0x41fef6, but ran until
+			// 0xffffffff80200000 (hypercall). I haven't been able to get a failing
+			// test for this.
+			// TODO: even with the ioctl this seems to keep failing!!!!!!!
+			// Parece que es por la interrupcion de la APIC.
+			// Idea: desactivar interrupciones antes del single step y reactivarlas despues
+			// problema: parece que single_step() no funciona si usamos set_regs_dirty()
+			// en vez del primer ioctl.
+			// sigue ejecutando hasta que ejecuta syscall y el assert del kernel peta
+			// porque falta la flag de interrupciones.
+			// printf("before ss: %lx\n", regs().rip);
+			m_regs->rflags &= ~(1 << 9);
+			// set_regs_dirty();
+			ioctl_chk(m_vcpu_fd, KVM_SET_REGS, m_regs); // removing this makes the kernel assert fail
+			RunEndReason reason_ss = single_step(stats);
+			m_regs->rflags |= (1 << 9);
+			// set_regs_dirty(); // this doesn't seem to be needed bc kvm_dirty_regs is already 1
+			// ioctl_chk(m_vcpu_fd, KVM_SET_REGS, m_regs);
+			// printf("after ss: %lx %lx\n", regs().rip, m_vcpu_run->kvm_dirty_regs); // WHY IS THIS 1
+			if (reason_ss == RunEndReason::Debug && !m_single_stepping)
+				m_running = true;
+			else
+				reason = reason_ss;
 
-		// Restore breakpoint
-		set_breakpoint(addr, Breakpoint::Hook);
+			// Restore breakpoint
+			set_breakpoint(addr, Breakpoint::Hook);
+		}
 	}
 
 #ifdef ENABLE_COVERAGE_BREAKPOINTS
@@ -628,16 +720,18 @@ void Vm::handle_breakpoint(RunEndReason& reason) {
 		if (m_tracing.type() == Tracing::Type::User) {
 			tracing_add_addr(addr);
 
-			// Remove breakpoint, single step, and enable it again. Hopefully
-			// this isn't as buggy as above lol
-			remove_breakpoint(addr, Breakpoint::Coverage);
-			Stats dummy;
-			RunEndReason reason_ss = single_step(dummy);
-			if (reason_ss == RunEndReason::Debug && !m_single_stepping)
-				m_running = true;
-			else
-				reason = reason_ss;
-			set_breakpoint(addr, Breakpoint::Type::Coverage);
+			// Emulate the displaced instruction or remove breakpoint, single
+			// step, and enable it again. Hopefully this isn't as buggy as
+			// above lol
+			if (!emulate_displaced(addr, reason)) {
+				remove_breakpoint(addr, Breakpoint::Coverage);
+				RunEndReason reason_ss = single_step(stats);
+				if (reason_ss == RunEndReason::Debug && !m_single_stepping)
+					m_running = true;
+				else
+					reason = reason_ss;
+				set_breakpoint(addr, Breakpoint::Type::Coverage);
+			}
 		} else {
 			remove_breakpoint(addr, Breakpoint::Coverage);
 		}
@@ -648,12 +742,51 @@ void Vm::handle_breakpoint(RunEndReason& reason) {
 
 }
 
+DisplacedInst Vm::decode_displaced(vaddr_t addr) {
+	// Don't read past the end of the page, as the next one may not be mapped
+	uint8_t code[DisplacedInst::MAX_LEN];
+	size_t len = min(sizeof(code), PAGE_SIZE - PAGE_OFFSET(addr));
+	m_mmu.read_mem(code, addr, len);
+
+	// Put back the original byte of the breakpoint at `addr`. Any other
+	// breakpoint means the instruction ends before it, or that we can't know.
+	for (size_t i = 0; i < len; i++) {
+		auto it = m_breakpoints.find(addr + i);
+		if (it == m_breakpoints.end())
+			continue;
+		if (i == 0) {
+			code[i] = it->second.original_byte;
+		} else {
+			len = i;
+			break;
+		}
+	}
+	return DisplacedInst::decode(code, len);
+}
+
+bool Vm::emulate_displaced(vaddr_t addr, RunEndReason& reason) {
+	// The hook may have changed rip
+	if (m_regs->rip != addr)
+		return false;
+
+	auto it = m_displaced_insts.find(addr);
+	if (it == m_displaced_insts.end())
+		it = m_displaced_insts.insert({addr, decode_displaced(addr)}).first;
+	if (!it->second.emulate(*m_regs, m_mmu))
+		return false;
+	set_regs_dirty();
+
+	// If we are single stepping, the emulated instruction was the step
+	if (m_single_stepping) {
+		reason = RunEndReason::Debug;
+		m_running = false;
+	}
+	return true;
+}
+
 void Vm::tracing_add_addr(vaddr_t addr) {
 	ASSERT(m_tracing.type() == Tracing::Type::User, "tracing type is not user");
-	string symbol = elf().addr_to_symbol_str(addr);
-	if (symbol.empty())
-		symbol = utils::to_hex(addr);
-	m_tracing.trace_and_prepare(symbol);
+	m_tracing.trace_and_prepare(addr);
 }
 
 void Vm::run_until(vaddr_t pc, Stats& stats) {
@@ -717,8 +850,9 @@ void* Vm::fetch_page(uint64_t page, bool* success) {
 	return last_result;
 }
 
+template <Timetrace timetrace>
 void Vm::update_coverage(Stats& stats) {
-	cycle_t cycles = rdtsc2();
+	cycle_t cycles = rdtsc2<timetrace>();
 	size_t size = ioctl_chk(m_vmx_pt_fd, KVM_VMX_PT_RESET, 0);
 
 	if (size) {
@@ -739,7 +873,8 @@ void Vm::update_coverage(Stats& stats) {
 		// auto limits = m_elf.section_limits(".text");
 		// printf("Limits: 0x%lx, 0x%lx\n", limits.first, limits.second);
 	}
-	stats.update_cov_cycles += rdtsc2() - cycles;
+	if (timetrace >= Timetrace::Fine)
+		stats.update_cov_cycles += rdtsc2<timetrace>() - cycles;
 }
 #endif
 
@@ -770,6 +905,39 @@ void Vm::remove_breakpoint_from_memory(vaddr_t addr, uint8_t original_byte) {
 	ASSERT(val == 0xCC, "not set breakpoint at 0x%lx", addr);
 }
 
+void Vm::write_code(vaddr_t addr, const uint8_t* code, vsize_t len) {
+	if (m_breakpoints_dirty) {
+		m_mmu.write_mem(addr, code, len, CheckPerms::No);
+	} else {
+		for (vsize_t i = 0; i < len; i++)
+			*m_mmu.get(addr + i) = code[i];
+	}
+}
+
+vector<uint8_t> Vm::read_code(vaddr_t addr, vsize_t len) {
+	vector<uint8_t> code(len);
+	m_mmu.read_mem(code.data(), addr, len);
+	for (vsize_t i = 0; i < len; i++) {
+		auto it = m_breakpoints.find(addr + i);
+		if (it != m_breakpoints.end())
+			code[i] = it->second.original_byte;
+	}
+	return code;
+}
+
+void Vm::patch_code(vaddr_t addr, const vector<uint8_t>& code) {
+	for (vsize_t i = 0; i < code.size(); i++) {
+		auto it = m_breakpoints.find(addr + i);
+		if (it == m_breakpoints.end())
+			continue;
+		ASSERT(it->second.type == Breakpoint::Coverage, "patching code at 0x%lx "
+		       "with breakpoint at 0x%lx of type %d", addr, addr + i,
+		       it->second.type);
+		m_breakpoints.erase(it);
+	}
+	write_code(addr, code.data(), code.size());
+}
+
 void Vm::set_breakpoint(vaddr_t addr) {
 	set_breakpoint(addr, Breakpoint::Type::RunEnd);
 }
@@ -778,6 +946,10 @@ void Vm::remove_breakpoint(vaddr_t addr) {
 	remove_breakpoint(addr, Breakpoint::Type::RunEnd);
 }
 
+void Vm::set_out_of_memory_breakpoint(vaddr_t addr) {
+	set_breakpoint(addr, Breakpoint::Type::OutOfMemory);
+}
+
 void Vm::set_breakpoint(vaddr_t addr, Breakpoint::Type type) {
 	if (!m_breakpoints.count(addr)) {
 		// Create breakpoint
@@ -840,12 +1012,14 @@ void Vm::set_hook(vaddr_t addr, hook_handler_t hook_handler) {
 	ASSERT(!m_hook_handlers.count(addr), "hook handler for 0x%lx already exists", addr);
 	set_breakpoint(addr, Breakpoint::Type::Hook);
 	m_hook_handlers[addr] = hook_handler;
+	m_displaced_insts[addr] = decode_displaced(addr);
 }
 
 void Vm::remove_hook(vaddr_t addr) {
 	ASSERT(m_hook_handlers.count(addr), "hook handler for 0x%lx doesn't exist", addr);
 	remove_breakpoint(addr, Breakpoint::Type::Hook);
 	m_hook_handlers.erase(addr);
+	m_displaced_insts.erase(addr);
 }
 
 void Vm::set_breakpoints_dirty(bool dirty) {
@@ -853,7 +1027,8 @@ void Vm::set_breakpoints_dirty(bool dirty) {
 }
 
 void Vm::read_and_set_shared_file(const string& filename, CheckCopied check) {
-	set_shared_file(filename, utils::read_file(filename), check);
+	GuestFile file = s_shared_files.map_file(filename);
+	maybe_write_file_to_guest(filename, file, check);
 }
 
 void Vm::set_shared_file(const string& filename, string content, CheckCopied check) {
@@ -885,6 +1060,15 @@ void Vm::maybe_write_file_to_guest(
 	}
 }
 
+void Vm::create_input_slot(size_t size) {
+	ASSERT(!m_files.exists("input"), "creating input slot with an input file");
+	m_mmu.create_input_slot(size);
+}
+
+void Vm::set_input(FileRef input) {
+	m_mmu.write_input_slot(input.ptr, input.length);
+}
+
 void Vm::reset_timer() {
 	ASSERT(m_timer_addr, "trying to reset timer but kernel didn't submit ptr");
 	m_mmu.write<vsize_t>(m_timer_addr, 0);
@@ -953,17 +1137,30 @@ void Vm::dump_memory(psize_t len) const {
 }
 
 void Vm::vm_err(const string& msg) {
+	// Print pending guest output first, so it isn't lost and goes before
+	// the error
+	m_console.drain();
 	cout << endl << "[VM ERROR]" << endl;
 	dump_regs();
 	//dump_memory();
 
-	// Dump current input file to mem
-	if (m_files.exists("input")) {
+	// Dump current input to disk. It's in the input slot if there's one, or
+	// in the file "input" otherwise.
+	string input;
+	bool has_input = true;
+	if (m_mmu.has_input_slot()) {
+		input = m_mmu.read_input_slot();
+	} else if (m_files.exists("input")) {
 		FileRef file = m_files.file_content("input");
+		input.assign((const char*)file.ptr, file.length);
+	} else {
+		has_input = false;
+	}
+	if (has_input) {
 		ofstream os("crash");
-		os.write((const char*)file.ptr, file.length);
+		os.write(input.c_str(), input.size());
 		assert(os.good());
-		cout << "Dumped crash file of size " << file.length << endl;
+		cout << "Dumped crash file of size " << input.size() << endl;
 		os.close();
 	}
 
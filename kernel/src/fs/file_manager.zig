@@ -6,15 +6,45 @@ const fs = @import("fs.zig");
 const Allocator = std.mem.Allocator;
 const log = std.log.scoped(.FileManager);
 const common = @import("../common.zig");
+const assert = std.debug.assert;
 
 var file_contents: std.StringHashMap([]u8) = undefined;
 
+/// Memory shared with the hypervisor where it writes the content of the file
+/// "input" before each run, if it provided one. The first page holds the length
+/// of the input, and its content starts at the next one.
+const InputSlot = struct {
+    length: *const usize,
+    data: [*]const u8,
+    size: usize,
+
+    fn content(self: InputSlot) []const u8 {
+        assert(self.length.* <= self.size);
+        return self.data[0..self.length.*];
+    }
+};
+
+var input_slot: ?InputSlot = null;
+
 /// For each file, get its filename and length and allocate a buffer for its
 /// content. Insert the filename and the buffer into file_contents, and submit
 /// the address of the buffer and the address of the length to the hypervisor,
-/// which will write to them.
-pub fn init(allocator: Allocator, num_files: usize) void {
+/// which will write to them. If the hypervisor provides an input slot, the
+/// file "input" is read from there instead.
+pub fn init(
+    allocator: Allocator,
+    num_files: usize,
+    input_slot_addr: usize,
+    input_slot_size: usize,
+) void {
     file_contents = std.StringHashMap([]u8).init(allocator);
+    if (input_slot_addr != 0) {
+        input_slot = InputSlot{
+            .length = @ptrFromInt(input_slot_addr),
+            .data = @ptrFromInt(input_slot_addr + std.mem.page_size),
+            .size = input_slot_size,
+        };
+    }
 
     // Temporary buffer for the filename
     var filename_buf: [linux.PATH_MAX]u8 = undefined;
@@ -48,15 +78,25 @@ pub fn init(allocator: Allocator, num_files: usize) void {
     log.debug("File Manager initialized\n", .{});
 }
 
+fn isInputSlot(filename: []const u8) bool {
+    return input_slot != null and std.mem.eql(u8, filename, "input");
+}
+
 pub fn exists(filename: []const u8) bool {
-    return file_contents.contains(filename);
+    return isInputSlot(filename) or file_contents.contains(filename);
 }
 
-pub fn fileContent(filename: []const u8) ?[]u8 {
+pub fn fileContent(filename: []const u8) ?[]const u8 {
+    if (isInputSlot(filename))
+        return input_slot.?.content();
     return file_contents.get(filename);
 }
 
 pub fn filenameFromFileContent(file_content: []const u8) ?[]const u8 {
+    if (input_slot) |slot| {
+        if (file_content.ptr == slot.data)
+            return "input";
+    }
     var iter = file_contents.iterator();
     while (iter.next()) |entry| {
         if (entry.value_ptr.ptr == file_content.ptr) {
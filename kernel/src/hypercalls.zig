@@ -4,12 +4,13 @@ const linux = @import("linux.zig");
 const fs = @import("fs/fs.zig");
 const common = @import("common.zig");
 const build_options = @import("build_options");
+const profiler = @import("profiler.zig");
 const printFmt = common.print;
 const panic = common.panic;
 
 pub const Hypercall = enum(c_int) {
     Test,
-    Print,
+    FlushConsole,
     GetMemInfo,
     GetKernelBrk,
     GetInfo,
@@ -20,8 +21,9 @@ pub const Hypercall = enum(c_int) {
     PrintStackTrace,
     LoadLibrary,
     EndRun,
-    NotifySyscallStart,
-    NotifySyscallEnd,
+    SubmitTracingRingPointer,
+    FlushTracingRing,
+    SubmitProfilerRingPointer,
 };
 
 // Keep this the same as in the hypervisor
@@ -42,6 +44,8 @@ pub const VmInfo = extern struct {
     interp_start: usize,
     interp_end: usize,
     phinfo: phinfo_t,
+    input_slot_addr: usize,
+    input_slot_size: usize,
 };
 
 // Keep this the same as in the hypervisor
@@ -119,6 +123,7 @@ pub const RunEndReason = enum(c_int) {
     Debug,
     Crash,
     Timeout,
+    OutOfMemory,
     Unknown,
 };
 
@@ -140,7 +145,7 @@ comptime {
         \\  outb %al, $16;
         \\  ret;
         \\
-        \\_print:
+        \\flushConsole:
         \\  mov $1, %rax
         \\  jmp hypercall
         \\
@@ -184,19 +189,23 @@ comptime {
         \\  mov $11, %rax
         \\  jmp hypercall
         \\
-        \\_notifySyscallStart:
+        \\submitTracingRingPointer:
         \\  mov $12, %rax
         \\  jmp hypercall
         \\
-        \\_notifySyscallEnd:
+        \\flushTracingRing:
         \\  mov $13, %rax
         \\  jmp hypercall
         \\
+        \\submitProfilerRingPointer:
+        \\  mov $14, %rax
+        \\  jmp hypercall
+        \\
         \\getRip:
         \\  movq (%rsp), %rax
         \\  ret
     );
-    checkEquals(.Print, 1);
+    checkEquals(.FlushConsole, 1);
     checkEquals(.GetMemInfo, 2);
     checkEquals(.GetKernelBrk, 3);
     checkEquals(.GetInfo, 4);
@@ -207,11 +216,12 @@ comptime {
     checkEquals(.PrintStackTrace, 9);
     checkEquals(.LoadLibrary, 10);
     checkEquals(.EndRun, 11);
-    checkEquals(.NotifySyscallStart, 12);
-    checkEquals(.NotifySyscallEnd, 13);
+    checkEquals(.SubmitTracingRingPointer, 12);
+    checkEquals(.FlushTracingRing, 13);
+    checkEquals(.SubmitProfilerRingPointer, 14);
 }
 
-extern fn _print(s: [*]const u8) void;
+extern fn flushConsole(ring: *ConsoleRing) void;
 pub extern fn getMemInfo(info: *MemInfo) void;
 pub extern fn getKernelBrk() usize;
 pub extern fn getInfo(info: *VmInfo) void;
@@ -225,13 +235,32 @@ extern fn submitTracingTypePointer(tracing_type_ptr: *TracingType) void;
 extern fn _printStackTrace(stacktrace_regs: *const StackTraceRegs) void;
 extern fn loadLibrary(filename: [*]const u8, filename_len: usize, load_addr: usize) void;
 pub extern fn endRun(reason: RunEndReason, info: ?*const FaultInfo) noreturn;
-extern fn _notifySyscallStart(syscall_name: [*:0]const u8) void;
-extern fn _notifySyscallEnd() void;
+extern fn submitTracingRingPointer(ring: *TracingRing) void;
+extern fn flushTracingRing() void;
+pub extern fn submitProfilerRingPointer(ring: *profiler.Ring) void;
 extern fn getRip() usize;
 
+// Guest console. Output is appended to a ring shared with the hypervisor,
+// which drains it when the run ends, or when we flush it because it's full.
+pub const console_ring_size = 4096;
+
+// Keep this the same as in the hypervisor
+pub const ConsoleRing = extern struct {
+    len: usize,
+    data: [console_ring_size]u8,
+};
+
+var console_ring: ConsoleRing = std.mem.zeroes(ConsoleRing);
+
 pub fn print(s: []const u8) void {
-    for (s) |c| {
-        printChar(c);
+    var remaining = s;
+    while (remaining.len > 0) {
+        if (console_ring.len == console_ring_size)
+            flushConsole(&console_ring);
+        const n = @min(remaining.len, console_ring_size - console_ring.len);
+        @memcpy(console_ring.data[console_ring.len..][0..n], remaining[0..n]);
+        console_ring.len += n;
+        remaining = remaining[n..];
     }
 }
 
@@ -261,36 +290,82 @@ pub fn printStackTrace(stacktrace_regs: ?*const StackTraceRegs) void {
     _printStackTrace(arg);
 }
 
-// Syscall tracing
+// Syscall tracing. Instead of notifying the hypervisor at the start and end
+// of every syscall, we read the performance counter ourselves and append an
+// event to a ring shared with the hypervisor, which drains it when the run
+// ends, or when we ask it to because the ring is full.
 var tracing_type: TracingType = undefined;
 
+/// Number of events that fit in the tracing ring.
+pub const tracing_ring_size = 256;
+
+// Keep this the same as in the hypervisor
+pub const SyscallEvent = extern struct {
+    /// Pointer to the name of the syscall
+    name: [*:0]const u8,
+    start: usize,
+    end: usize,
+};
+
+// Keep this the same as in the hypervisor
+pub const TracingRing = extern struct {
+    /// Fixed performance counter to read: 0 for instructions, 1 for cycles.
+    /// This is set by the hypervisor.
+    counter: usize,
+
+    /// Number of events in the ring.
+    count: usize,
+
+    events: [tracing_ring_size]SyscallEvent,
+};
+
+var tracing_ring: TracingRing = std.mem.zeroes(TracingRing);
+var current_syscall: SyscallEvent = undefined;
+
 pub fn init() void {
+    // This also tells the hypervisor where the console ring is
+    flushConsole(&console_ring);
+
     submitTracingTypePointer(&tracing_type);
+    submitTracingRingPointer(&tracing_ring);
 }
 
-pub fn notifySyscallStart(syscall_n: linux.SYS) void {
-    if (tracing_type == .Kernel)
-        _notifySyscallStart(@tagName(syscall_n));
+fn readTracingCounter() usize {
+    const fixed_counter = 1 << 30;
+    return x86.rdpmc(fixed_counter | @as(u32, @intCast(tracing_ring.counter)));
 }
 
-pub fn notifySyscallEnd() void {
-    if (tracing_type == .Kernel)
-        _notifySyscallEnd();
+fn pushSyscallEvent(event: SyscallEvent) void {
+    if (tracing_ring.count == tracing_ring_size) {
+        flushTracingRing();
+        std.debug.assert(tracing_ring.count == 0);
+    }
+    tracing_ring.events[tracing_ring.count] = event;
+    tracing_ring.count += 1;
 }
 
-const buf_len = 1024;
-var out_buf: [buf_len]u8 = undefined;
-var used: usize = 0;
-fn printChar(c: u8) void {
-    out_buf[used] = c;
-    used += 1;
-    if (c == '\n' or used == buf_len - 1) {
-        out_buf[used] = 0;
-        _print(&out_buf);
-        used = 0;
+pub fn notifySyscallStart(syscall_n: linux.SYS) void {
+    if (tracing_type != .Kernel)
+        return;
+
+    current_syscall.name = @tagName(syscall_n);
+    current_syscall.start = readTracingCounter();
+
+    // exit_group doesn't return, so it's pushed now with a measure of 0
+    if (syscall_n == .exit_group) {
+        current_syscall.end = current_syscall.start;
+        pushSyscallEvent(current_syscall);
     }
 }
 
+pub fn notifySyscallEnd() void {
+    if (tracing_type != .Kernel)
+        return;
+
+    current_syscall.end = readTracingCounter();
+    pushSyscallEvent(current_syscall);
+}
+
 // TODO: try and do this better
 
 // In this case, it seems like @ptrCast in getHypercall is not working as expected,
@@ -5,6 +5,7 @@ const x86 = @import("x86/x86.zig");
 const hypercalls = @import("hypercalls.zig");
 const mem = @import("mem/mem.zig");
 const scheduler = @import("scheduler.zig");
+const profiler = @import("profiler.zig");
 
 /// The type of each interrupt handler entry point, which will end up jumping
 /// to the actual interrupt handler.
@@ -269,6 +270,8 @@ fn handleStackSegmentFault(frame: *InterruptFrame) void {
 }
 
 fn handleApicTimer(frame: *InterruptFrame) void {
+    profiler.sample(frame);
+
     x86.perf.tick();
 
     scheduler.schedule(frame);
@@ -7,6 +7,8 @@ const hypercalls = @import("hypercalls.zig");
 const fs = @import("fs/fs.zig");
 const scheduler = @import("scheduler.zig");
 const Process = @import("process/Process.zig");
+const profiler = @import("profiler.zig");
+const build_options = @import("build_options");
 const print = common.print;
 
 pub const std_options = std.Options{
@@ -36,7 +38,10 @@ export fn kmain(argc: usize, argv: [*][*:0]const u8) noreturn {
     mem.pmm.init();
     mem.vmm.init();
     x86.perf.init();
-    // x86.apic.init();
+    // The profiler takes samples from the APIC timer interrupt
+    if (build_options.enable_profiler)
+        x86.apic.init();
+    profiler.init();
     x86.syscall.init();
 
     mem.heap.initHeapAllocator();
@@ -50,7 +55,7 @@ export fn kmain(argc: usize, argv: [*][*:0]const u8) noreturn {
     else
         mem.heap.block_allocator;
 
-    fs.file_manager.init(allocator, info.num_files);
+    fs.file_manager.init(allocator, info.num_files, info.input_slot_addr, info.input_slot_size);
     hypercalls.setInterpreterRange(info.interp_start, info.interp_end);
 
     var process = Process.initial(allocator, &info) catch unreachable;
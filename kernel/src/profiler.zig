@@ -0,0 +1,92 @@
+const std = @import("std");
+const build_options = @import("build_options");
+const hypercalls = @import("hypercalls.zig");
+const interrupts = @import("interrupts.zig");
+const mem = @import("mem/mem.zig");
+
+/// Maximum number of frames recorded in each sample.
+pub const max_frames = 32;
+
+/// Number of samples that fit in the ring. If a run takes more samples than
+/// this, they are counted but dropped.
+pub const ring_size = 256;
+
+// Keep this the same as in the hypervisor
+pub const Sample = extern struct {
+    len: usize,
+    frames: [max_frames]usize,
+};
+
+// Keep this the same as in the hypervisor
+pub const Ring = extern struct {
+    /// Take a sample every `period` timer ticks, or never if it's 0. This is
+    /// set by the hypervisor before forking.
+    period: usize,
+
+    /// Timer ticks since the last sample. Memory is reset after every run, so
+    /// the hypervisor restores this to keep the period across runs.
+    ticks: usize,
+
+    /// Number of samples taken in this run. It may be bigger than ring_size.
+    count: usize,
+
+    samples: [ring_size]Sample,
+};
+
+var ring: Ring = std.mem.zeroes(Ring);
+
+pub fn init() void {
+    if (!build_options.enable_profiler)
+        return;
+
+    hypercalls.submitProfilerRingPointer(&ring);
+}
+
+/// Called from the APIC timer handler. Records the interrupted RIP and, if it
+/// was user code, the return addresses found following the frame pointer
+/// chain. Targets compiled without frame pointers will only get the leaf
+/// function.
+pub fn sample(frame: *const interrupts.InterruptFrame) void {
+    if (!build_options.enable_profiler)
+        return;
+
+    if (ring.period == 0)
+        return;
+    ring.ticks += 1;
+    if (ring.ticks < ring.period)
+        return;
+    ring.ticks = 0;
+
+    const idx = ring.count;
+    ring.count += 1;
+    if (idx >= ring_size)
+        return;
+
+    const s = &ring.samples[idx];
+    s.frames[0] = frame.rip;
+    s.len = 1;
+
+    const is_user = (frame.cs & 3) == 3;
+    if (!is_user)
+        return;
+
+    var fp = frame.rbp;
+    while (s.len < max_frames and fp != 0 and std.mem.isAligned(fp, @alignOf(usize))) {
+        // Each frame record holds the caller frame pointer followed by the
+        // return address. The stack may be garbage, so read it safely.
+        const record_ptr = mem.safe.UserPtr(*const [2]usize).fromFlat(fp) catch break;
+        const record = mem.safe.copyFromUserSingle([2]usize, record_ptr) catch break;
+        const prev_fp = record[0];
+        const ret_addr = record[1];
+        if (ret_addr == 0)
+            break;
+        s.frames[s.len] = ret_addr;
+        s.len += 1;
+
+        // Caller frames are at higher addresses. This also makes sure we don't
+        // loop forever with a corrupted chain.
+        if (prev_fp <= fp)
+            break;
+        fp = prev_fp;
+    }
+}
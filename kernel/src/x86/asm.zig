@@ -153,6 +153,19 @@ pub fn hlt() void {
     asm volatile ("hlt");
 }
 
+/// Read performance counter. Bit 30 of `counter` selects the fixed counters.
+pub fn rdpmc(counter: u32) usize {
+    var high: u32 = undefined;
+    var low: u32 = undefined;
+    asm volatile (
+        \\rdpmc
+        : [high] "={edx}" (high),
+          [low] "={eax}" (low),
+        : [counter] "{ecx}" (counter),
+    );
+    return (@as(u64, @intCast(high)) << 32) | low;
+}
+
 pub fn rdtsc() usize {
     var high: u32 = undefined;
     var low: u32 = undefined;
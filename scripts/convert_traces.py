@@ -0,0 +1,50 @@
+#!/usr/bin/env python3
+import os
+import sys
+import struct
+from pathlib import Path
+
+# Converts the sampled traces written with --tracing-sample, which are in a
+# compact binary format, into one text file per trace as read by markov.py.
+
+def read_names(dir):
+	with open(dir / "names") as f:
+		return f.read().splitlines()
+
+def read_traces(path):
+	with open(path, "rb") as f:
+		data = f.read()
+	traces = []
+	off = 0
+	while off + 4 <= len(data):
+		length = struct.unpack_from("<I", data, off)[0]
+		off += 4
+		if off + length*12 > len(data):
+			# Incomplete trace, the fuzzer was interrupted while writing it
+			break
+		trace = [struct.unpack_from("<IQ", data, off + i*12) for i in range(length)]
+		off += length*12
+		traces.append(trace)
+	return traces
+
+def main():
+	if len(sys.argv) < 2:
+		print("usage: %s traces_dir [output_dir]" % sys.argv[0])
+		sys.exit(-1)
+
+	input_dir = Path(sys.argv[1])
+	output_dir = Path(sys.argv[2] if len(sys.argv) > 2 else "./traces")
+	os.makedirs(output_dir, exist_ok=True)
+	names = read_names(input_dir)
+	count = 0
+	for path in sorted(input_dir.glob("*.bin")):
+		for i, trace in enumerate(read_traces(path)):
+			with open(output_dir / ("%s_%d" % (path.stem, i)), "w") as f:
+				for id, measure in trace:
+					name = names[id] if id < len(names) else "id%d" % id
+					f.write("%s %d\n" % (name, measure))
+			count += 1
+	print("Written %d traces to '%s'" % (count, output_dir))
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,13 @@
+// Both files of this binary have a static function called `helper`, which
+// the coverage report must keep apart
+
+int other(int x);
+
+__attribute__((noinline))
+static int helper(int x) {
+	return x * 3;
+}
+
+int main(int argc, char** argv) {
+	return helper(argc) + other(argc);
+}
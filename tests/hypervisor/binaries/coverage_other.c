@@ -0,0 +1,8 @@
+__attribute__((noinline))
+static int helper(int x) {
+	return x + 5;
+}
+
+int other(int x) {
+	return helper(x);
+}
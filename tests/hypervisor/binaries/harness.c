@@ -0,0 +1,19 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// The buffer is bigger than the input the harness is first called with
+static uint8_t buf[64];
+
+__attribute_noinline__
+int harness(const uint8_t* data, size_t size) {
+	int sum = 0;
+	for (size_t i = 0; i < size; i++)
+		sum += data[i];
+	return sum;
+}
+
+int main() {
+	memcpy(buf, "seed", 4);
+	return harness(buf, 4) == 0;
+}
@@ -8,4 +8,16 @@ _start:
 	nop
 	nop
 	nop
-	nop
\ No newline at end of file
+	nop
+.type hooked, @function
+hooked:
+	push %rbp
+	mov %rsp, %rbp
+	sub $0x10, %rsp
+	nop
+	nop
+
+.data
+.type hooked_data, @object
+hooked_data:
+	.quad 0
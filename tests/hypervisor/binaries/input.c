@@ -0,0 +1,28 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static char buf[4 * 4096];
+
+// The test checks the input read from the file "input" when this is reached
+__attribute_noinline__
+void got_input(const char* data, size_t size, size_t file_size) {
+	__asm__ volatile("" : : "r"(data), "r"(size), "r"(file_size) : "memory");
+}
+
+int main() {
+	int fd = open("input", O_RDONLY);
+	if (fd < 0)
+		return 1;
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+		return 1;
+
+	size_t size = 0;
+	ssize_t bytes_read;
+	while ((bytes_read = read(fd, buf + size, sizeof(buf) - size)) > 0)
+		size += bytes_read;
+	got_input(buf, size, st.st_size);
+	close(fd);
+	return 0;
+}
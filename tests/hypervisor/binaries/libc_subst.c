@@ -0,0 +1,70 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Allocations checked by the test when `check` is reached
+struct results {
+	char* small;
+	char* zeroed;
+	char* grown;
+	char* shrunk;
+	char* from_libc;
+	char* from_mmapped;
+	char* too_big;
+	char* overflow;
+};
+
+// Sizes are read through volatiles so the compiler doesn't reason about them
+static volatile size_t one = 1;
+static volatile size_t huge = SIZE_MAX / 2;
+
+#ifndef __GLIBC__
+// Chunks with the glibc header, as they would be if libc was glibc: the
+// size with the flags in its low bits right before the data
+static uint64_t fake_chunk[2 + 6] = {0, 0x30 | 1};
+static uint64_t fake_mmapped_chunk[2 + 510] = {0, 0x1000 | 2};
+#endif
+
+// The test substitutes libc functions when this is reached
+__attribute_noinline__
+void substitute(void) {
+	__asm__ volatile("" ::: "memory");
+}
+
+__attribute_noinline__
+void check(struct results* results) {
+	__asm__ volatile("" : : "r"(results) : "memory");
+}
+
+int main() {
+	// Chunks allocated by libc before substituting
+#ifdef __GLIBC__
+	char* early = malloc(40);
+	char* early_mmapped = malloc(256 * 1024);
+#else
+	char* early = (char*)&fake_chunk[2];
+	char* early_mmapped = (char*)&fake_mmapped_chunk[2];
+#endif
+	strcpy(early, "allocated by libc");
+	strcpy(early_mmapped, "mmapped by libc");
+	substitute();
+
+	struct results results;
+	results.small = malloc(one);
+	results.zeroed = calloc(10, 10 * one);
+	char* chunk = malloc(20 * one);
+	strcpy(chunk, "allocated by subst");
+	results.grown = realloc(chunk, 200 * one);
+	results.shrunk = realloc(results.grown, 5 * one);
+	results.from_libc = realloc(early, 100 * one);
+	results.from_mmapped = realloc(early_mmapped, 100 * one);
+	results.too_big = malloc(huge);
+	results.overflow = calloc(huge, 4);
+	check(&results);
+
+	// Run out of heap
+	while (1) {
+		volatile char* p = malloc(4096 * one);
+		p[0] = 1;
+	}
+}
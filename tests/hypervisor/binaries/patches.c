@@ -0,0 +1,30 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+static uint8_t buf[64];
+
+// Checksum that mutated inputs almost never get right: the first byte is a
+// hash of the rest
+__attribute_noinline__
+int check_crc(const uint8_t* data, size_t size) {
+	uint8_t crc = 0;
+	for (size_t i = 1; i < size; i++)
+		crc = crc*31 + data[i];
+	return size > 0 && data[0] == crc;
+}
+
+// Crashes on inputs with the right checksum followed by "bad"
+__attribute_noinline__
+int harness(const uint8_t* data, size_t size) {
+	if (!check_crc(data, size))
+		return 1;
+	if (size >= 4 && memcmp(data + 1, "bad", 3) == 0)
+		*(volatile int*)0 = 0;
+	return 0;
+}
+
+int main() {
+	memcpy(buf, "seed", 4);
+	return harness(buf, sizeof(buf));
+}
@@ -0,0 +1,93 @@
+#include "common.h"
+#include "coverage_breakpoints.h"
+#include "coverage_exporter.h"
+#include "utils.h"
+
+TEST_CASE("coverage new blocks") {
+	SharedCoverageBreakpoints shared;
+	CoverageBreakpoints<> cov;
+	cov.add(0x1000);
+	cov.add(0x2000);
+	shared = cov;
+
+	std::vector<vaddr_t> blocks;
+	size_t exported = shared.new_blocks(0, blocks);
+	REQUIRE(exported == 2);
+	REQUIRE(blocks.size() == 2);
+
+	// Only blocks which weren't covered yet are reported, in order
+	cov.reset();
+	cov.add(0x2000);
+	cov.add(0x3000);
+	REQUIRE(shared.add(cov));
+	REQUIRE(!shared.add(cov));
+	blocks.clear();
+	exported = shared.new_blocks(exported, blocks);
+	REQUIRE(exported == 3);
+	REQUIRE(blocks == std::vector<vaddr_t>{0x3000});
+
+	blocks.clear();
+	REQUIRE(shared.new_blocks(exported, blocks) == 3);
+	REQUIRE(blocks.empty());
+}
+
+TEST_CASE("coverage report") {
+	Vm vm(8*1024*1024, "zig-out/bin/kernel", "zig-out/bin/test_files", {});
+	vaddr_t test_me = vm.elf().resolve_symbol("test_me");
+	vaddr_t main = vm.elf().resolve_symbol("main");
+	REQUIRE(test_me != 0);
+	REQUIRE(main != 0);
+
+	char tmp[] = "/tmp/coverage_report_XXXXXX";
+	REQUIRE(mkdtemp(tmp) != nullptr);
+	CoverageExporter exporter(vm.elfs(), {test_me, main}, tmp);
+	exporter.add(std::vector<vaddr_t>{test_me});
+	exporter.dump();
+	REQUIRE(exporter.blocks() == 1);
+	REQUIRE(exporter.unknown_blocks() == 0);
+
+	// Both functions and their lines are reported, but only one is hit
+	std::string path = std::string(tmp) + "/" + CoverageExporter::LCOV_FILENAME;
+	std::string lcov = utils::read_file(path);
+	REQUIRE(lcov.find("FNDA:1,test_me\n") != std::string::npos);
+	REQUIRE(lcov.find("FNDA:0,main\n") != std::string::npos);
+	REQUIRE(lcov.find("FNF:2\nFNH:1\n") != std::string::npos);
+	REQUIRE(lcov.find(",0\nLF:2\nLH:1\n") != std::string::npos);
+
+	unlink(path.c_str());
+	unlink((std::string(tmp) + "/" + CoverageExporter::JSON_FILENAME).c_str());
+	rmdir(tmp);
+}
+
+TEST_CASE("coverage report functions with the same name") {
+	Vm vm(8*1024*1024, "zig-out/bin/kernel", "zig-out/bin/test_coverage", {});
+	std::vector<vaddr_t> helpers;
+	for (const symbol_t& symbol : vm.elf().symbols())
+		if (symbol.type == STT_FUNC && symbol.name == "helper")
+			helpers.push_back(symbol.value);
+	REQUIRE(helpers.size() == 2);
+
+	char tmp[] = "/tmp/coverage_report_XXXXXX";
+	REQUIRE(mkdtemp(tmp) != nullptr);
+	CoverageExporter exporter(vm.elfs(), helpers, tmp);
+	exporter.add(std::vector<vaddr_t>{helpers[0]});
+	exporter.dump();
+
+	// Each static function is reported in the record of its own file, and
+	// only one of them is hit
+	std::string path = std::string(tmp) + "/" + CoverageExporter::LCOV_FILENAME;
+	std::string lcov = utils::read_file(path);
+	size_t hit = lcov.find("FNDA:1,helper\n"), not_hit = lcov.find("FNDA:0,helper\n");
+	REQUIRE(hit != std::string::npos);
+	REQUIRE(not_hit != std::string::npos);
+	REQUIRE(lcov.find("end_of_record", std::min(hit, not_hit)) <
+	        std::max(hit, not_hit));
+
+	std::string json_path = std::string(tmp) + "/" + CoverageExporter::JSON_FILENAME;
+	std::string json = utils::read_file(json_path);
+	REQUIRE(json.find("{\"name\":\"helper\"") != json.rfind("{\"name\":\"helper\""));
+
+	unlink(path.c_str());
+	unlink(json_path.c_str());
+	rmdir(tmp);
+}
@@ -0,0 +1,65 @@
+#include "common.h"
+
+static DisplacedInst decode(const std::vector<uint8_t>& code) {
+	return DisplacedInst::decode(code.data(), code.size());
+}
+
+TEST_CASE("displaced inst decode") {
+	REQUIRE(decode({0xF3, 0x0F, 0x1E, 0xFA}).length() == 4);        // endbr64
+	REQUIRE(decode({0x55}).length() == 1);                          // push rbp
+	REQUIRE(decode({0x41, 0x57}).length() == 2);                    // push r15
+	REQUIRE(decode({0x48, 0x89, 0xE5}).length() == 3);              // mov rbp, rsp
+	REQUIRE(decode({0x48, 0x83, 0xEC, 0x10}).length() == 4);        // sub rsp, 0x10
+	REQUIRE(decode({0x48, 0x8D, 0x05, 0, 0, 0, 0}).length() == 7);  // lea rax, [rip]
+	REQUIRE(decode({0x66, 0x0F, 0x1F, 0x44, 0, 0}).length() == 6);  // nop
+
+	REQUIRE(!decode({0x48, 0xFF, 0xC0}).emulable());               // inc rax
+	REQUIRE(!decode({0x48, 0x89, 0x07}).emulable());               // mov [rdi], rax
+	REQUIRE(!decode({0x48, 0x83, 0xEC}).emulable());               // truncated
+	REQUIRE(!decode({0x41, 0x90}).emulable());                     // xchg r8, rax
+}
+
+TEST_CASE("displaced inst emulate") {
+	Vm vm(8*1024*1024, "zig-out/bin/kernel", "zig-out/bin/test_hooks", {});
+	Mmu& mmu = vm.mmu();
+	kvm_regs regs = vm.regs();
+	regs.rip = 0x1000;
+	regs.rsp = Mmu::KERNEL_STACK_START_ADDR - 0x100;
+	regs.rbp = 0x1234;
+
+	// push rbp
+	REQUIRE(decode({0x55}).emulate(regs, mmu));
+	REQUIRE(regs.rip == 0x1001);
+	REQUIRE(regs.rsp == Mmu::KERNEL_STACK_START_ADDR - 0x108);
+	REQUIRE(mmu.read<uint64_t>(regs.rsp) == 0x1234);
+
+	// mov rbp, rsp
+	REQUIRE(decode({0x48, 0x89, 0xE5}).emulate(regs, mmu));
+	REQUIRE(regs.rbp == regs.rsp);
+
+	// lea rdi, [rbp-0x10]
+	REQUIRE(decode({0x48, 0x8D, 0x7D, 0xF0}).emulate(regs, mmu));
+	REQUIRE(regs.rdi == regs.rbp - 0x10);
+
+	// lea rax, [rip+0x10]
+	vaddr_t rip = regs.rip;
+	REQUIRE(decode({0x48, 0x8D, 0x05, 0x10, 0, 0, 0}).emulate(regs, mmu));
+	REQUIRE(regs.rax == rip + 7 + 0x10);
+
+	// sub rsp, 0x10 and sub to zero
+	REQUIRE(decode({0x48, 0x83, 0xEC, 0x10}).emulate(regs, mmu));
+	REQUIRE(regs.rsp == Mmu::KERNEL_STACK_START_ADDR - 0x118);
+	REQUIRE(!(regs.rflags & (1 << 6)));
+	regs.rcx = 1;
+	REQUIRE(decode({0x48, 0x83, 0xE9, 0x01}).emulate(regs, mmu));
+	REQUIRE(regs.rcx == 0);
+	REQUIRE(regs.rflags & (1 << 6));
+	REQUIRE(!(regs.rflags & (1 << 0)));
+
+	// Pushing to an unmapped stack must be left to the guest
+	regs.rsp = 0x10;
+	rip = regs.rip;
+	REQUIRE(!decode({0x55}).emulate(regs, mmu));
+	REQUIRE(regs.rip == rip);
+	REQUIRE(regs.rsp == 0x10);
+}
@@ -1,4 +1,6 @@
 #include "common.h"
+#include "mapped_file.h"
+#include "utils.h"
 
 static Vm default_vm() {
 	Vm vm(8*1024*1024, "zig-out/bin/kernel", "zig-out/bin/test_files", {});
@@ -22,3 +24,18 @@ TEST_CASE("files") {
 	REQUIRE(s == "hello");
 }
 
+
+TEST_CASE("mapped files") {
+	std::string content = utils::read_file("./tests/input_hello_world");
+	std::shared_ptr<const MappedFile> file = MappedFile::open("./tests/input_hello_world");
+	REQUIRE(file->size() == content.size());
+	REQUIRE(memcmp(file->data(), content.c_str(), content.size()) == 0);
+
+	// Opening the same file through another path gives the same mapping
+	std::shared_ptr<const MappedFile> same = MappedFile::open("tests/../tests/input_hello_world");
+	REQUIRE(same == file);
+	size_t num_mapped = MappedFile::num_mapped();
+	same.reset();
+	file.reset();
+	REQUIRE(MappedFile::num_mapped() == num_mapped - 1);
+}
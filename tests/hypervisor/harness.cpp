@@ -0,0 +1,91 @@
+#include "common.h"
+#include "harness.h"
+
+TEST_CASE("harness layout") {
+	Harness::Layout layout;
+	REQUIRE(Harness::parse_layout("rdi,rsi", layout));
+	REQUIRE(layout.ptr == &kvm_regs::rdi);
+	REQUIRE(layout.len == &kvm_regs::rsi);
+	REQUIRE(layout.size == nullptr);
+	REQUIRE(layout.max_size == 0);
+
+	REQUIRE(Harness::parse_layout("rsi,rdx,rcx", layout));
+	REQUIRE(layout.ptr == &kvm_regs::rsi);
+	REQUIRE(layout.len == &kvm_regs::rdx);
+	REQUIRE(layout.size == &kvm_regs::rcx);
+
+	REQUIRE(Harness::parse_layout("rdi,rsi,0x1000", layout));
+	REQUIRE(layout.size == nullptr);
+	REQUIRE(layout.max_size == 0x1000);
+
+	REQUIRE(!Harness::parse_layout("rdi", layout));
+	REQUIRE(!Harness::parse_layout("rdi,rdi", layout));
+	REQUIRE(!Harness::parse_layout("rdi,rax", layout));
+	REQUIRE(!Harness::parse_layout("rdi,rsi,0", layout));
+	REQUIRE(!Harness::parse_layout("rdi,rsi,12k", layout));
+	REQUIRE(!Harness::parse_layout("rdi,rsi,rdx,rcx", layout));
+}
+
+TEST_CASE("harness run") {
+	Vm vm(8*1024*1024, "zig-out/bin/kernel", "zig-out/bin/test_harness", {});
+	vm.run_until(vm.elfs().resolve_symbol("harness"), stats);
+	vaddr_t buffer = vm.regs().rdi;
+
+	// Without a size, the buffer is as big as the first input
+	Harness harness(vm, Harness::DEFAULT_LAYOUT, 1024);
+	REQUIRE(harness.capacity() == 4);
+	vaddr_t main = vm.elfs().resolve_symbol("main");
+	REQUIRE(harness.return_addr() > main);
+
+	// Inputs are truncated to the capacity, and the function receives them
+	Vm runner(vm);
+	harness.set_input(runner, FileRef::from_string("abcdefgh"));
+	REQUIRE(runner.regs().rsi == 4);
+	runner.run_until(harness.return_addr(), stats);
+	REQUIRE(runner.regs().rax == 'a' + 'b' + 'c' + 'd');
+	REQUIRE(runner.mmu().read_string(buffer) == "abcd");
+
+	runner.reset(vm, stats);
+	harness.set_input(runner, FileRef::from_string("xy"));
+	runner.run_until(harness.return_addr(), stats);
+	REQUIRE(runner.regs().rax == 'x' + 'y');
+
+	// A given size overrides it
+	Harness::Layout layout;
+	REQUIRE(Harness::parse_layout("rdi,rsi,64", layout));
+	REQUIRE(Harness(vm, layout, 1024).capacity() == 64);
+}
+
+TEST_CASE("end addresses") {
+	Vm vm(8*1024*1024, "zig-out/bin/kernel", "zig-out/bin/test_harness", {});
+	vaddr_t harness_addr = vm.elfs().resolve_symbol("harness");
+
+	// Runs starting at the entry point can't end at return
+	std::set<vaddr_t> end_addrs;
+	vm.run_until(vm.elf().entry(), stats);
+	REQUIRE(!get_end_addrs(vm, Harness(), true, {}, end_addrs));
+	REQUIRE(get_end_addrs(vm, Harness(), false, {"harness"}, end_addrs));
+	REQUIRE(end_addrs.count(harness_addr));
+
+	// Runs starting at main end when it returns to libc, with its result
+	vm.run_until(vm.elfs().resolve_symbol("main"), stats);
+	vaddr_t return_addr = vm.mmu().read<vaddr_t>(vm.regs().rsp);
+	vaddr_t exit_addr = vm.elfs().resolve_symbol("exit");
+	REQUIRE(get_end_addrs(vm, Harness(), true, {}, end_addrs));
+	REQUIRE(end_addrs.count(return_addr));
+	REQUIRE(end_addrs.size() == (exit_addr ? 2 : 1));
+
+	Vm runner(vm);
+	runner.set_breakpoint(return_addr);
+	REQUIRE(runner.run(stats) == Vm::RunEndReason::Breakpoint);
+	REQUIRE(runner.regs().rip == return_addr);
+	REQUIRE(runner.regs().rax == 0);
+
+	// The return address of the harness is left out, as it has its own
+	// breakpoint
+	vm.run_until(harness_addr, stats);
+	Harness harness(vm, Harness::DEFAULT_LAYOUT, 1024);
+	REQUIRE(get_end_addrs(vm, harness, true, {"harness"}, end_addrs));
+	REQUIRE(!end_addrs.count(harness.return_addr()));
+	REQUIRE(end_addrs.count(harness_addr));
+}
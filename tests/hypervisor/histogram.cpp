@@ -0,0 +1,41 @@
+#include "common.h"
+
+TEST_CASE("histogram buckets") {
+	// Small values have their own bucket
+	for (uint64_t i = 0; i < Histogram::SUB_BUCKETS; i++) {
+		REQUIRE(Histogram::bucket_index(i) == (int)i);
+		REQUIRE(Histogram::bucket_value(i) == i);
+	}
+
+	// Bigger values are approximated with bounded relative error
+	for (uint64_t v = 1; v < (1ULL << 62); v = v*3 + 7) {
+		int i = Histogram::bucket_index(v);
+		REQUIRE(i < Histogram::BUCKETS);
+		uint64_t approx = Histogram::bucket_value(i);
+		uint64_t diff = (approx > v ? approx - v : v - approx);
+		REQUIRE(diff <= v / Histogram::SUB_BUCKETS);
+	}
+	REQUIRE(Histogram::bucket_index(UINT64_MAX) == Histogram::BUCKETS - 1);
+}
+
+TEST_CASE("histogram percentiles") {
+	Histogram h;
+	REQUIRE(h.percentile(99) == 0);
+	for (uint64_t i = 1; i <= 1000; i++)
+		h.record(i);
+	REQUIRE(h.count() == 1000);
+	REQUIRE(h.sum() == 500500);
+	REQUIRE(h.percentile(50) >= 500 - 500/Histogram::SUB_BUCKETS);
+	REQUIRE(h.percentile(50) <= 500 + 500/Histogram::SUB_BUCKETS);
+	REQUIRE(h.percentile(99) >= 990 - 990/Histogram::SUB_BUCKETS);
+	REQUIRE(h.percentile(99) <= 990 + 990/Histogram::SUB_BUCKETS);
+	REQUIRE(h.max() >= 1000 - 1000/Histogram::SUB_BUCKETS);
+
+	// Interval between two snapshots
+	Histogram old = h;
+	h.record(1000000);
+	Histogram interval = h;
+	interval -= old;
+	REQUIRE(interval.count() == 1);
+	REQUIRE(interval.percentile(50) == h.max());
+}
@@ -98,3 +98,81 @@ TEST_CASE("hook changes rip") {
 	REQUIRE(vm.regs().rbx == 0xdeadbeef);
 	REQUIRE(vm.regs().rax == 0);
 }
+
+/*
+000000000020112d <hooked>:
+  20112d:       55                      push   rbp
+  20112e:       48 89 e5                mov    rbp,rsp
+  201131:       48 83 ec 10             sub    rsp,0x10
+  201135:       90                      nop
+*/
+
+// Increment the counter in the shared page
+static const std::vector<uint8_t> counter_stub = {
+	0x50,                                     // push rax
+	0x48, 0xB8, 0, 0, 0x11, 0, 0, 0, 0, 0,    // movabs rax, 0x110000
+	0x48, 0xFF, 0x00,                         // inc qword ptr [rax]
+	0x58,                                     // pop rax
+	0xC3,                                     // ret
+};
+static_assert(Mmu::STUB_HOOKS_SHARED_ADDR == 0x110000, "update the stub");
+
+TEST_CASE("stub hook") {
+	Vm vm = default_vm();
+	vm.set_stub_hook(addr(vm, 0xd), counter_stub);
+
+	vm.run_until(addr(vm, 0xd), stats);
+	vaddr_t rsp = vm.regs().rsp;
+	vm.run_until(addr(vm, 0x15), stats);
+	REQUIRE(vm.mmu().read<uint64_t>(Mmu::STUB_HOOKS_SHARED_ADDR) == 1);
+
+	// The stub preserves the value set by the hook at offset 9
+	REQUIRE(vm.regs().rax == UINT64_MAX);
+	REQUIRE(vm.regs().rbp == rsp - 8);
+	REQUIRE(vm.regs().rsp == rsp - 0x18);
+}
+
+TEST_CASE("remove stub hook") {
+	Vm vm = default_vm();
+	vaddr_t hooked = addr(vm, 0xd);
+	std::vector<uint8_t> original = vm.read_code(hooked, 8);
+	vm.set_stub_hook(hooked, counter_stub);
+	vm.remove_stub_hook(hooked);
+	REQUIRE(vm.read_code(hooked, 8) == original);
+
+	vm.run_until(addr(vm, 0x15), stats);
+	REQUIRE(vm.mmu().read<uint64_t>(Mmu::STUB_HOOKS_SHARED_ADDR) == 0);
+	REQUIRE(vm.regs().rax == UINT64_MAX);
+}
+
+TEST_CASE("remove stub hook + coverage breakpoint") {
+	Vm vm = default_vm();
+	vaddr_t hooked = addr(vm, 0xd);
+	std::vector<uint8_t> original = vm.read_code(hooked, 8);
+
+	// The coverage breakpoint is replaced by the jump while the hook is set,
+	// and it's back once it's removed
+	vm.add_basic_block(hooked);
+	REQUIRE(vm.mmu().read<uint8_t>(hooked) == 0xCC);
+	vm.set_stub_hook(hooked, counter_stub);
+	REQUIRE(vm.mmu().read<uint8_t>(hooked) != 0xCC);
+	vm.remove_stub_hook(hooked);
+	REQUIRE(vm.mmu().read<uint8_t>(hooked) == 0xCC);
+	REQUIRE(vm.read_code(hooked, 8) == original);
+}
+
+TEST_CASE("end symbol") {
+	Vm vm = default_vm();
+	vaddr_t hooked = vm.elfs().resolve_symbol("hooked");
+	REQUIRE(hooked == addr(vm, 0xd));
+	REQUIRE(vm.elfs().resolve_symbol("missing") == 0);
+
+	// Only functions can be end symbols
+	REQUIRE(vm.elf().resolve_symbol("hooked_data") != 0);
+	REQUIRE(vm.elfs().resolve_symbol("hooked_data") == 0);
+
+	vm.set_breakpoint(hooked);
+	REQUIRE(vm.run(stats) == Vm::RunEndReason::Breakpoint);
+	REQUIRE(vm.regs().rip == hooked);
+	REQUIRE(vm.regs().rax == UINT64_MAX);
+}
@@ -0,0 +1,80 @@
+#include "common.h"
+#include "libc_subst.h"
+
+TEST_CASE("libc subst groups") {
+	unsigned groups;
+	REQUIRE(LibcSubst::parse_groups("alloc", groups));
+	REQUIRE(groups == LibcSubst::Group::Alloc);
+	REQUIRE(LibcSubst::parse_groups("stdio,locale", groups));
+	REQUIRE(groups == (LibcSubst::Group::Stdio | LibcSubst::Group::Locale));
+	REQUIRE(!LibcSubst::parse_groups("", groups));
+	REQUIRE(!LibcSubst::parse_groups("alloc,qsort", groups));
+}
+
+TEST_CASE("libc subst assemble") {
+	std::vector<uint8_t> code;
+	std::vector<LibcSubst::Replacement> replacements;
+	LibcSubst::assemble(LibcSubst::Group::Alloc | LibcSubst::Group::Locale,
+	                    1024*1024, code, replacements);
+	std::map<std::string, vsize_t> offsets;
+	for (const LibcSubst::Replacement& replacement : replacements)
+		offsets[replacement.name] = replacement.offset;
+	REQUIRE(offsets.size() == 5);
+	REQUIRE(offsets.count("malloc"));
+	REQUIRE(!offsets.count("printf"));
+
+	// The out of memory trap comes before the replacements, and returns null
+	// when there's no breakpoint
+	REQUIRE(offsets["malloc"] > LibcSubst::OUT_OF_MEMORY_OFFSET);
+	REQUIRE(code[LibcSubst::OUT_OF_MEMORY_OFFSET] == 0x31);
+
+	// Every replacement ends with ret, and free does nothing
+	REQUIRE(code[offsets["free"]] == 0xC3);
+	REQUIRE(code[offsets["calloc"] - 1] == 0xC3);
+	REQUIRE(code[offsets["setlocale"] - 1] == 0xC3);
+}
+
+TEST_CASE("libc subst run") {
+	const vsize_t heap_size = 64*1024;
+	const vaddr_t heap_end = Mmu::LIBC_SUBST_HEAP_ADDR + heap_size;
+	Vm vm(8*1024*1024, "zig-out/bin/kernel", "zig-out/bin/test_libc_subst", {});
+	LibcSubst libc_subst(vm, LibcSubst::Group::Alloc, heap_size);
+	vm.run_until(vm.elfs().resolve_symbol("substitute"), stats);
+	REQUIRE(libc_subst.apply(vm) >= 3);
+
+	// Read the results struct of the binary
+	vm.run_until(vm.elfs().resolve_symbol("check"), stats);
+	vaddr_t results = vm.regs().rdi;
+	auto result = [&](int i) {
+		return vm.mmu().read<vaddr_t>(results + i*sizeof(vaddr_t));
+	};
+	vaddr_t small = result(0), zeroed = result(1), grown = result(2),
+	        shrunk = result(3), from_libc = result(4), from_mmapped = result(5);
+
+	// Chunks are aligned and inside the heap
+	for (vaddr_t chunk : {small, zeroed, grown, shrunk, from_libc, from_mmapped}) {
+		REQUIRE(chunk % 16 == 0);
+		REQUIRE(chunk > Mmu::LIBC_SUBST_HEAP_ADDR);
+		REQUIRE(chunk < heap_end);
+	}
+
+	uint8_t zeros[100], buf[100] = {0xFF};
+	memset(zeros, 0, sizeof(zeros));
+	vm.mmu().read_mem(buf, zeroed, sizeof(buf));
+	REQUIRE(memcmp(buf, zeros, sizeof(buf)) == 0);
+
+	// Realloc copies from chunks of the bump allocator and from chunks
+	// allocated by libc before substituting, up to the new size
+	REQUIRE(vm.mmu().read_string(grown) == "allocated by subst");
+	REQUIRE(vm.mmu().read_string(shrunk) == "alloc");
+	REQUIRE(vm.mmu().read_string(from_libc) == "allocated by libc");
+	REQUIRE(vm.mmu().read_string(from_mmapped) == "mmapped by libc");
+
+	// Requests bigger than the heap fail
+	REQUIRE(result(6) == 0);
+	REQUIRE(result(7) == 0);
+
+	// Exhausting the heap ends the run
+	REQUIRE(vm.run(stats) == Vm::RunEndReason::OutOfMemory);
+	REQUIRE(vm.regs().rip == Mmu::LIBC_SUBST_ADDR + LibcSubst::OUT_OF_MEMORY_OFFSET);
+}
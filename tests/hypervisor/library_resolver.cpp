@@ -0,0 +1,282 @@
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cstring>
+#include "common.h"
+#include "library_resolver.h"
+#include "elf_parser.h"
+#include "utils.h"
+
+using std::string;
+using std::vector;
+
+// Temporary directory used as sysroot, removed with everything created in it
+class Sysroot {
+public:
+	Sysroot() {
+		strcpy(m_root, "/tmp/test_resolver_XXXXXX");
+		REQUIRE(mkdtemp(m_root) != nullptr);
+	}
+
+	~Sysroot() {
+		for (auto it = m_created.rbegin(); it != m_created.rend(); ++it)
+			remove(it->c_str());
+		rmdir(m_root);
+	}
+
+	string root() const {
+		return m_root;
+	}
+
+	string host(const string& path) const {
+		return root() + path;
+	}
+
+	// Write a file at `path` in the guest, creating its directories
+	void write(const string& path, const string& content) {
+		size_t pos = 0;
+		while ((pos = path.find('/', pos + 1)) != string::npos) {
+			string dir = host(path.substr(0, pos));
+			if (mkdir(dir.c_str(), 0755) == 0)
+				m_created.push_back(dir);
+		}
+		utils::write_file(host(path), content);
+		m_created.push_back(host(path));
+	}
+
+private:
+	char m_root[32];
+	vector<string> m_created;
+};
+
+template <class T>
+static void append(string& data, T value) {
+	data.append((const char*)&value, sizeof(value));
+}
+
+static void add_dyn(vector<Elf64_Dyn>& dyns, Elf64_Sxword tag, Elf64_Xword val) {
+	Elf64_Dyn dyn;
+	dyn.d_tag = tag;
+	dyn.d_un.d_val = val;
+	dyns.push_back(dyn);
+}
+
+// Minimal shared object with only what the loader looks at: a PT_LOAD
+// mapping the whole file and a PT_DYNAMIC with the given entries
+static string make_elf(const vector<string>& needed, const string& rpath = "",
+                       const string& runpath = "")
+{
+	string strtab(1, '\0');
+	vector<Elf64_Dyn> dyns;
+	auto add_string = [&](Elf64_Sxword tag, const string& s) {
+		add_dyn(dyns, tag, strtab.size());
+		strtab += s;
+		strtab += '\0';
+	};
+	for (const string& name : needed)
+		add_string(DT_NEEDED, name);
+	if (!rpath.empty())
+		add_string(DT_RPATH, rpath);
+	if (!runpath.empty())
+		add_string(DT_RUNPATH, runpath);
+
+	// Virtual addresses are the same as file offsets
+	size_t strtab_offset = sizeof(Elf64_Ehdr) + 2*sizeof(Elf64_Phdr);
+	size_t dyn_offset = (strtab_offset + strtab.size() + 7) & ~7;
+	add_dyn(dyns, DT_STRTAB, strtab_offset);
+	add_dyn(dyns, DT_NULL, 0);
+	size_t size = dyn_offset + dyns.size()*sizeof(Elf64_Dyn);
+
+	Elf64_Ehdr ehdr;
+	memset(&ehdr, 0, sizeof(ehdr));
+	memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+	ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+	ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+	ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+	ehdr.e_type = ET_DYN;
+	ehdr.e_machine = EM_X86_64;
+	ehdr.e_version = EV_CURRENT;
+	ehdr.e_phoff = sizeof(Elf64_Ehdr);
+	ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+	ehdr.e_phentsize = sizeof(Elf64_Phdr);
+	ehdr.e_phnum = 2;
+
+	Elf64_Phdr phdrs[2];
+	memset(phdrs, 0, sizeof(phdrs));
+	phdrs[0].p_type = PT_LOAD;
+	phdrs[0].p_filesz = phdrs[0].p_memsz = size;
+	phdrs[1].p_type = PT_DYNAMIC;
+	phdrs[1].p_offset = phdrs[1].p_vaddr = dyn_offset;
+	phdrs[1].p_filesz = phdrs[1].p_memsz = size - dyn_offset;
+
+	string elf;
+	append(elf, ehdr);
+	for (const Elf64_Phdr& phdr : phdrs)
+		append(elf, phdr);
+	elf += strtab;
+	elf.resize(dyn_offset, '\0');
+	for (const Elf64_Dyn& dyn : dyns)
+		append(elf, dyn);
+	return elf;
+}
+
+struct CacheEntry {
+	int32_t flags;
+	string soname;
+	string path;
+};
+
+// Flags of x86_64 libraries in the loader cache
+static const int32_t CACHE_X8664 = 0x0303;
+
+// ld.so.cache as written by glibc's ldconfig, optionally after a header in
+// the old format, as older versions do
+static string make_cache(const vector<CacheEntry>& entries, bool with_old) {
+	string cache;
+	if (with_old) {
+		cache.append("ld.so-1.7.0", 12);
+		append<uint32_t>(cache, 1);
+		append<int32_t>(cache, 1);
+		append<uint32_t>(cache, 0);
+		append<uint32_t>(cache, 0);
+		cache.resize((cache.size() + 7) & ~7, '\0');
+	}
+
+	// Strings follow the entries. Their offsets are relative to the header.
+	const size_t header_size = 48, entry_size = 24;
+	string strings;
+	size_t header = cache.size();
+	cache.append("glibc-ld.so.cache1.1", 20);
+	append<uint32_t>(cache, entries.size());
+	size_t len_strings = cache.size();
+	append<uint32_t>(cache, 0);
+	cache.resize(header + header_size, '\0');
+	size_t strings_offset = header_size + entries.size()*entry_size;
+	for (const CacheEntry& entry : entries) {
+		append<int32_t>(cache, entry.flags);
+		append<uint32_t>(cache, strings_offset + strings.size());
+		strings += entry.soname + '\0';
+		append<uint32_t>(cache, strings_offset + strings.size());
+		strings += entry.path + '\0';
+		append<uint32_t>(cache, 0);
+		append<uint64_t>(cache, 0);
+	}
+	uint32_t strings_size = strings.size();
+	memcpy(&cache[len_strings], &strings_size, sizeof(strings_size));
+	return cache + strings;
+}
+
+// Used to split DT_RPATH and DT_RUNPATH, and the lists of sweep_exp
+TEST_CASE("split string") {
+	REQUIRE(utils::split_string("/lib", ":") == vector<string>{"/lib"});
+	REQUIRE(utils::split_string("/a:/b", ":") == vector<string>{"/a", "/b"});
+	REQUIRE(utils::split_string("/a::/b:", ":") == vector<string>{"/a", "", "/b", ""});
+	REQUIRE(utils::split_string("", ",") == vector<string>{""});
+	REQUIRE(utils::split_string("1, 2, 3", ", ") == vector<string>{"1", "2", "3"});
+}
+
+TEST_CASE("library resolver rpath and runpath") {
+	Sysroot sysroot;
+	sysroot.write("/rpath/liba.so", make_elf({}));
+	sysroot.write("/runpath/liba.so", make_elf({}));
+	sysroot.write("/lib/liba.so", make_elf({}));
+	sysroot.write("/bad/liba.so", "not an elf");
+	sysroot.write("/rpath/libparent.so", make_elf({"libchild.so"}));
+	sysroot.write("/deps/libchild.so", make_elf({}));
+	sysroot.write("/bin/none", make_elf({"liba.so"}));
+	sysroot.write("/bin/rpath", make_elf({"liba.so"}, "/bad:/rpath"));
+	sysroot.write("/bin/both", make_elf({"liba.so"}, "/rpath", "/runpath"));
+	sysroot.write("/bin/rpath_deps", make_elf({"libparent.so"}, "/rpath:/deps"));
+	sysroot.write("/bin/runpath_deps", make_elf({"libparent.so"}, "", "/rpath:/deps"));
+
+	LibraryResolver resolver(sysroot.root());
+
+	// Default directories are the last ones searched
+	REQUIRE(resolver.resolve(sysroot.host("/bin/none")) ==
+	        vector<string>{"/lib/liba.so"});
+
+	// DT_RPATH goes first, skipping files that aren't libraries
+	REQUIRE(resolver.resolve(sysroot.host("/bin/rpath")) ==
+	        vector<string>{"/rpath/liba.so"});
+
+	// DT_RPATH is ignored if there's DT_RUNPATH
+	REQUIRE(resolver.resolve(sysroot.host("/bin/both")) ==
+	        vector<string>{"/runpath/liba.so"});
+
+	// The DT_RPATH of the executable is used for the dependencies of its
+	// libraries, but its DT_RUNPATH isn't
+	REQUIRE(resolver.resolve(sysroot.host("/bin/rpath_deps")) ==
+	        vector<string>{"/rpath/libparent.so", "/deps/libchild.so"});
+	REQUIRE(resolver.resolve(sysroot.host("/bin/runpath_deps")) ==
+	        vector<string>{"/rpath/libparent.so"});
+}
+
+TEST_CASE("library resolver origin") {
+	Sysroot sysroot;
+	sysroot.write("/opt/app/bin/prog", make_elf({"liborigin.so"}, "", "$ORIGIN/../lib"));
+	sysroot.write("/opt/app/lib/liborigin.so", make_elf({"libplugin.so"}, "",
+	                                                    "${ORIGIN}/plugins"));
+	sysroot.write("/opt/app/lib/plugins/libplugin.so", make_elf({}));
+	sysroot.write("/bin/unsupported", make_elf({"liborigin.so"}, "", "$LIB/../opt/app/lib"));
+
+	// $ORIGIN is the directory of the elf that needs the library, not of the
+	// executable
+	LibraryResolver resolver(sysroot.root());
+	REQUIRE(resolver.resolve(sysroot.host("/opt/app/bin/prog")) == vector<string>{
+		"/opt/app/bin/../lib/liborigin.so",
+		"/opt/app/bin/../lib/plugins/libplugin.so",
+	});
+
+	// Other dynamic string tokens make the directory be skipped
+	REQUIRE(resolver.resolve(sysroot.host("/bin/unsupported")).empty());
+}
+
+TEST_CASE("library resolver sysroot") {
+	Sysroot sysroot;
+	sysroot.write("/bin/prog", make_elf({"libfoo.so", "/opt/libabs.so", "libc.so.6"}));
+	sysroot.write("/usr/lib/libfoo.so", make_elf({}));
+	sysroot.write("/opt/libabs.so", make_elf({}));
+
+	// Trailing slashes in the sysroot are ignored
+	LibraryResolver resolver(sysroot.root() + "//");
+	REQUIRE(resolver.host_path("/usr/lib/libfoo.so") == sysroot.host("/usr/lib/libfoo.so"));
+	REQUIRE(resolver.host_path("relative") == "relative");
+
+	// Paths are the ones in the guest, and libraries of the host such as
+	// libc aren't found
+	REQUIRE(resolver.resolve(sysroot.host("/bin/prog")) ==
+	        vector<string>{"/usr/lib/libfoo.so", "/opt/libabs.so"});
+
+	// Without sysroot, paths are the ones in the host
+	LibraryResolver host_resolver;
+	REQUIRE(host_resolver.host_path("/usr/lib/libfoo.so") == "/usr/lib/libfoo.so");
+	sysroot.write("/bin/abs", make_elf({sysroot.host("/opt/libabs.so")}));
+	REQUIRE(host_resolver.resolve(sysroot.host("/bin/abs")) ==
+	        vector<string>{sysroot.host("/opt/libabs.so")});
+}
+
+TEST_CASE("library resolver ld.so.cache") {
+	for (bool with_old : {false, true}) {
+		Sysroot sysroot;
+		sysroot.write("/etc/ld.so.cache", make_cache({
+			{CACHE_X8664, "libcached.so.1", "/cached/libcached.so.1"},
+			{CACHE_X8664, "libboth.so", "/cached/libboth.so"},
+			{0x0003, "libwrong.so", "/wrong/libwrong.so"},
+			{CACHE_X8664, "libstale.so", "/missing/libstale.so"},
+			{CACHE_X8664, "libstale.so", "/stale/libstale.so"},
+		}, with_old));
+		sysroot.write("/cached/libcached.so.1", make_elf({}));
+		sysroot.write("/cached/libboth.so", make_elf({}));
+		sysroot.write("/lib/libboth.so", make_elf({}));
+		sysroot.write("/wrong/libwrong.so", make_elf({}));
+		sysroot.write("/stale/libstale.so", make_elf({}));
+		sysroot.write("/bin/prog", make_elf({"libcached.so.1", "libboth.so",
+		                                     "libwrong.so", "libstale.so"}));
+
+		// The cache goes before the default directories. Entries of other
+		// architectures and of libraries that don't exist are skipped.
+		LibraryResolver resolver(sysroot.root());
+		REQUIRE(resolver.resolve(sysroot.host("/bin/prog")) == vector<string>{
+			"/cached/libcached.so.1", "/cached/libboth.so", "/stale/libstale.so",
+		});
+	}
+}
@@ -0,0 +1,59 @@
+#include "common.h"
+#include "line_table.h"
+#include "utils.h"
+
+static std::vector<LineTable::Row> test_rows() {
+	// Two sequences from different compilation units, the second of them
+	// starting at the same address the first one ends
+	std::vector<LineTable::Row> rows = {
+		{0x2000, 1, 7},
+		{0x2010, 1, 8},
+		{0x2020, LineTable::END_SEQUENCE, 0},
+		{0x1000, 0, 1},
+		{0x1004, 0, 2},
+		{0x1004, 0, 3},
+		{0x1010, 0, 4},
+		{0x2000, LineTable::END_SEQUENCE, 0},
+	};
+	return rows;
+}
+
+static const std::vector<std::string> test_files = {"a.c", "b.c"};
+
+TEST_CASE("line table lookup") {
+	LineTable table(test_rows(), test_files);
+	REQUIRE(table.size() == 8);
+	REQUIRE(table.addr_to_source(0xfff) == "");
+	REQUIRE(table.addr_to_source(0x1000) == "a.c:1");
+	REQUIRE(table.addr_to_source(0x1003) == "a.c:1");
+
+	// The last row of an address is the one that counts
+	REQUIRE(table.addr_to_source(0x1004) == "a.c:3");
+	REQUIRE(table.addr_to_source(0x1fff) == "a.c:4");
+	REQUIRE(table.addr_to_source(0x2000) == "b.c:7");
+	REQUIRE(table.addr_to_source(0x201f) == "b.c:8");
+	REQUIRE(table.addr_to_source(0x2020) == "");
+}
+
+TEST_CASE("line table save and load") {
+	char tmp[] = "/tmp/kvm-fuzz-line-table-XXXXXX";
+	int fd = mkstemp(tmp);
+	REQUIRE(fd >= 0);
+	close(fd);
+
+	LineTable built(test_rows(), test_files);
+	REQUIRE(built.save(tmp));
+	LineTable table;
+	REQUIRE(table.load(tmp));
+	REQUIRE(table.size() == 8);
+	REQUIRE(table.addr_to_source(0x1004) == "a.c:3");
+	REQUIRE(table.addr_to_source(0x2010) == "b.c:8");
+
+	// Invalid files are rejected
+	std::string bad_path = std::string(tmp) + ".bad";
+	utils::write_file(bad_path, "not a line table");
+	REQUIRE(!table.load(bad_path));
+	REQUIRE(table.addr_to_source(0x2010) == "b.c:8");
+	unlink(bad_path.c_str());
+	unlink(tmp);
+}
@@ -0,0 +1,101 @@
+#include "common.h"
+
+static Vm default_vm() {
+	Vm vm(8*1024*1024, "zig-out/bin/kernel", "zig-out/bin/test_files", {});
+	return vm;
+}
+
+TEST_CASE("mmu string across pages") {
+	Vm vm = default_vm();
+	Mmu& mmu = vm.mmu();
+
+	// The kernel stack is mapped and writable
+	vaddr_t addr = Mmu::KERNEL_STACK_START_ADDR - PAGE_SIZE - 3;
+	const char s[] = "hello world";
+	mmu.write_mem(addr, s, sizeof(s));
+	REQUIRE(mmu.read_string(addr) == s);
+	REQUIRE(mmu.read_string(addr + 4) == s + 4);
+
+	// Cached translations are the same as after a flush
+	mmu.write<uint64_t>(addr, 0x4142434445464748);
+	paddr_t paddr = mmu.virt_to_phys(addr + 8);
+	mmu.flush_tlb();
+	REQUIRE(mmu.virt_to_phys(addr + 8) == paddr);
+	REQUIRE(mmu.read<uint64_t>(addr) == 0x4142434445464748);
+	REQUIRE(*mmu.get(addr + 8) == 'r');
+}
+
+// Physical address of the last level entry of `vaddr`, which must be mapped
+static paddr_t pte_paddr(Mmu& mmu, vaddr_t vaddr) {
+	paddr_t table = mmu.ptl4();
+	paddr_t entry = 0;
+	for (int shift : {PTL4_SHIFT, PTL3_SHIFT, PTL2_SHIFT, PTL1_SHIFT}) {
+		entry = table + ((vaddr >> shift) & 0x1FF) * sizeof(paddr_t);
+		table = mmu.readp<paddr_t>(entry) & PHYS_MASK;
+	}
+	return entry;
+}
+
+TEST_CASE("mmu tlb sees guest page table changes") {
+	Vm vm = default_vm();
+	Mmu& mmu = vm.mmu();
+	vaddr_t page1 = Mmu::KERNEL_STACK_START_ADDR - PAGE_SIZE;
+	vaddr_t page2 = page1 - PAGE_SIZE;
+	paddr_t paddr1 = mmu.virt_to_phys(page1);
+	paddr_t paddr2 = mmu.virt_to_phys(page2);
+	REQUIRE(paddr1 != paddr2);
+
+	// Remap the first page to the frame of the second one, writing to the
+	// page table as the guest does, which doesn't flush the TLB. The cached
+	// translation must not be stale.
+	paddr_t pte1 = pte_paddr(mmu, page1);
+	paddr_t pte1_val = mmu.readp<paddr_t>(pte1);
+	paddr_t remapped = mmu.readp<paddr_t>(pte_paddr(mmu, page2));
+	mmu.write_memp(pte1, &remapped, sizeof(remapped));
+	REQUIRE(mmu.virt_to_phys(page1 + 8) == paddr2 + 8);
+
+	mmu.write_memp(pte1, &pte1_val, sizeof(pte1_val));
+	REQUIRE(mmu.virt_to_phys(page1) == paddr1);
+}
+
+TEST_CASE("input slot") {
+	Vm vm(8*1024*1024, "zig-out/bin/kernel", "zig-out/bin/test_input", {});
+	vm.create_input_slot(PAGE_SIZE + 1);
+	REQUIRE(vm.mmu().input_slot_size() == 2*PAGE_SIZE);
+	vaddr_t main = vm.elfs().resolve_symbol("main");
+	vaddr_t got_input = vm.elfs().resolve_symbol("got_input");
+	vm.run_until(main, stats);
+
+	// Each copy has its own slot, so inputs written to one aren't seen by
+	// the vm it was copied from
+	Vm runner(vm);
+	std::string input(2*PAGE_SIZE, '\0');
+	for (size_t i = 0; i < input.size(); i++)
+		input[i] = 'a' + i % 26;
+	for (size_t len : {(size_t)5, PAGE_SIZE + 3, 2*PAGE_SIZE, (size_t)0}) {
+		std::string content = input.substr(input.size() - len);
+		runner.set_input(FileRef::from_string(content));
+		runner.run_until(got_input, stats);
+		REQUIRE(runner.regs().rsi == len);
+		REQUIRE(runner.regs().rdx == len);
+		std::string data(len, '\0');
+		runner.mmu().read_mem(&data[0], runner.regs().rdi, len);
+		REQUIRE(data == content);
+		runner.reset(vm, stats);
+	}
+
+	vm.run_until(got_input, stats);
+	REQUIRE(vm.regs().rsi == 0);
+}
+
+TEST_CASE("empty input slot") {
+	// An empty input still gives a slot, and the file "input" exists
+	Vm vm(8*1024*1024, "zig-out/bin/kernel", "zig-out/bin/test_input", {});
+	vm.create_input_slot(0);
+	REQUIRE(vm.mmu().has_input_slot());
+	REQUIRE(vm.mmu().input_slot_size() == 0);
+	vm.set_input(FileRef::from_string(""));
+	vm.run_until(vm.elfs().resolve_symbol("got_input"), stats);
+	REQUIRE(vm.regs().rsi == 0);
+	REQUIRE(vm.regs().rdx == 0);
+}
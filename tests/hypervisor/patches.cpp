@@ -0,0 +1,212 @@
+#include <dirent.h>
+#include <ftw.h>
+#include "common.h"
+#include "patches.h"
+#include "harness.h"
+#include "corpus.h"
+#include "fuzz_worker.h"
+#include "utils.h"
+
+static std::vector<uint8_t> assemble(const std::string& line,
+                                     const std::vector<uint8_t>& original = {})
+{
+	Patches::Patch patch;
+	REQUIRE(Patches::parse(line, patch));
+	return Patches::assemble(patch, original);
+}
+
+TEST_CASE("patches parse") {
+	Patches::Patch patch;
+	REQUIRE(Patches::parse("check_crc+0x10 ret 1", patch));
+	REQUIRE(patch.symbol == "check_crc");
+	REQUIRE(patch.addr == 0x10);
+	REQUIRE(patch.action == Patches::Patch::Return);
+	REQUIRE(patch.value == 1);
+
+	REQUIRE(Patches::parse("0x401000 skip-call", patch));
+	REQUIRE(patch.symbol.empty());
+	REQUIRE(patch.addr == 0x401000);
+	REQUIRE(!patch.has_value);
+
+	REQUIRE(Patches::parse("verify ret -1", patch));
+	REQUIRE(patch.value == (uint64_t)-1);
+
+	REQUIRE(!Patches::parse("verify", patch));
+	REQUIRE(!Patches::parse("verify ret", patch));
+	REQUIRE(!Patches::parse("verify nop 0", patch));
+	REQUIRE(!Patches::parse("verify branch maybe", patch));
+	REQUIRE(!Patches::parse("verify skip-call 0x100000000", patch));
+	REQUIRE(!Patches::parse("0xzz ret 0", patch));
+	REQUIRE(!Patches::parse("verify ret 0 1", patch));
+}
+
+TEST_CASE("patches assemble") {
+	using bytes = std::vector<uint8_t>;
+	REQUIRE(assemble("f ret 1") == bytes({0x48, 0xC7, 0xC0, 1, 0, 0, 0, 0xC3}));
+	REQUIRE(assemble("f ret 0x100000000") ==
+	        bytes({0x48, 0xB8, 0, 0, 0, 0, 1, 0, 0, 0, 0xC3}));
+	REQUIRE(assemble("f nop 3") == bytes({0x90, 0x90, 0x90}));
+
+	// call rel32, call [rip+disp32]
+	bytes call = {0xE8, 1, 2, 3, 4, 0xCC};
+	bytes call_rip = {0xFF, 0x15, 1, 2, 3, 4};
+	REQUIRE(assemble("f skip-call", call) == bytes({0x0F, 0x1F, 0x44, 0, 0}));
+	REQUIRE(assemble("f skip-call 2", call) == bytes({0xB8, 2, 0, 0, 0}));
+	REQUIRE(assemble("f skip-call 2", call_rip) == bytes({0xB8, 2, 0, 0, 0, 0x90}));
+	REQUIRE(assemble("f skip-call", {0x90, 0x90, 0x90, 0x90, 0x90, 0x90}).empty());
+
+	// jne rel8, jne rel32
+	bytes jcc8 = {0x75, 0x10, 0, 0, 0, 0};
+	bytes jcc32 = {0x0F, 0x85, 0x10, 0, 0, 0};
+	REQUIRE(assemble("f branch taken", jcc8) == bytes({0xEB, 0x10}));
+	REQUIRE(assemble("f branch not-taken", jcc8) == bytes({0x66, 0x90}));
+	REQUIRE(assemble("f branch taken", jcc32) == bytes({0xE9, 0x11, 0, 0, 0, 0x90}));
+	REQUIRE(assemble("f branch not-taken", jcc32).size() == 6);
+	REQUIRE(assemble("f branch taken", call).empty());
+}
+
+// Input that crashes the test binary if the checksum is right or check_crc
+// is patched
+static std::string crashing_input(bool right_crc) {
+	uint8_t crc = 0;
+	for (char c : std::string("bad"))
+		crc = crc*31 + (uint8_t)c;
+	return std::string(1, crc + !right_crc) + "bad";
+}
+
+// Run an input through the harness, ending when it returns
+static Vm::RunEndReason run_input(const Vm& base, const Harness& harness,
+                                  const std::string& input)
+{
+	Vm runner(base);
+	harness.set_input(runner, FileRef::from_string(input));
+	return runner.run(stats);
+}
+
+static Patches load_patches(const std::string& content) {
+	char tmp[] = "/tmp/test_patches_XXXXXX";
+	int fd = mkstemp(tmp);
+	REQUIRE(fd != -1);
+	close(fd);
+	utils::write_file(tmp, content);
+	Patches patches(tmp);
+	unlink(tmp);
+	return patches;
+}
+
+// Vm at the entry of the harness of the test binary, with a breakpoint where
+// it returns
+static Vm harness_vm(Harness& harness) {
+	Vm vm(8*1024*1024, "zig-out/bin/kernel", "zig-out/bin/test_patches", {});
+	vm.run_until(vm.elfs().resolve_symbol("harness"), stats);
+	harness = Harness(vm, Harness::DEFAULT_LAYOUT, 1024);
+	vm.set_breakpoint(harness.return_addr());
+	return vm;
+}
+
+TEST_CASE("patches apply") {
+	Harness harness;
+	Vm vm = harness_vm(harness);
+	vaddr_t harness_addr = vm.elfs().resolve_symbol("harness");
+	vaddr_t check_crc = vm.elfs().resolve_symbol("check_crc");
+	REQUIRE(check_crc != 0);
+
+	// Find the call to check_crc
+	std::vector<uint8_t> code = vm.read_code(harness_addr, 0x40);
+	vsize_t call_offset = 0;
+	for (vsize_t i = 0; i + 5 <= code.size() && !call_offset; i++) {
+		int32_t rel;
+		memcpy(&rel, &code[i + 1], sizeof(rel));
+		if (code[i] == 0xE8 && harness_addr + i + 5 + rel == check_crc)
+			call_offset = i;
+	}
+	REQUIRE(call_offset != 0);
+	vaddr_t call = harness_addr + call_offset;
+
+	// Without patches, the checksum stops the crash
+	REQUIRE(run_input(vm, harness, crashing_input(false)) == Vm::RunEndReason::Breakpoint);
+	REQUIRE(run_input(vm, harness, crashing_input(true)) == Vm::RunEndReason::Crash);
+
+	// Make check_crc return 1, given its symbol. The coverage breakpoint
+	// there is dropped, as the patch replaces it.
+	Vm ret_patched(vm);
+	ret_patched.add_basic_block(check_crc);
+	load_patches("check_crc ret 1  # always right\n").apply(ret_patched);
+	REQUIRE(ret_patched.read_code(check_crc, 8) ==
+	        std::vector<uint8_t>({0x48, 0xC7, 0xC0, 1, 0, 0, 0, 0xC3}));
+	REQUIRE(ret_patched.mmu().read<uint8_t>(check_crc) == 0x48);
+	REQUIRE(run_input(ret_patched, harness, crashing_input(false)) == Vm::RunEndReason::Crash);
+
+	// Replace the call, which must be read through the coverage breakpoint
+	Vm call_patched(vm);
+	call_patched.add_basic_block(call);
+	std::vector<uint8_t> original = vm.read_code(call, 5);
+	REQUIRE(call_patched.mmu().read<uint8_t>(call) == 0xCC);
+	REQUIRE(call_patched.read_code(call, 5) == original);
+	load_patches("harness+" + std::to_string(call_offset) + " skip-call 1\n")
+		.apply(call_patched);
+	REQUIRE(call_patched.read_code(call, 5) == std::vector<uint8_t>({0xB8, 1, 0, 0, 0}));
+	REQUIRE(run_input(call_patched, harness, crashing_input(false)) == Vm::RunEndReason::Crash);
+
+	// The original vm isn't modified
+	REQUIRE(vm.read_code(call, 5) == original);
+	REQUIRE(run_input(vm, harness, crashing_input(false)) == Vm::RunEndReason::Breakpoint);
+}
+
+static size_t count_files(const std::string& path) {
+	size_t count = 0;
+	DIR* dir = opendir(path.c_str());
+	REQUIRE(dir != nullptr);
+	while (struct dirent* ent = readdir(dir))
+		count += (ent->d_type == DT_REG);
+	closedir(dir);
+	return count;
+}
+
+TEST_CASE("patches verify crash") {
+	char tmp[] = "/tmp/test_patches_XXXXXX";
+	REQUIRE(mkdtemp(tmp) != nullptr);
+	std::string input_dir = std::string(tmp) + "/input";
+	std::string output_dir = std::string(tmp) + "/output";
+	utils::create_folder(input_dir);
+	utils::write_file(input_dir + "/seed", "seed");
+	Corpus corpus(1, input_dir, output_dir);
+	corpus.set_mode_normal(Coverage());
+
+	Harness harness;
+	Vm vm = harness_vm(harness);
+	Vm patched(vm);
+	load_patches("check_crc ret 1\n").apply(patched);
+	std::unique_ptr<Vm> verifier;
+	FixupPlugin fixup;
+
+	// Crashes that need the patches are saved apart
+	std::string input = crashing_input(false);
+	Vm runner(patched);
+	harness.set_input(runner, FileRef::from_string(input));
+	REQUIRE(runner.run(stats) == Vm::RunEndReason::Crash);
+	verify_crash(0, runner, vm, verifier, harness, fixup, corpus,
+	             FileRef::from_string(input));
+	REQUIRE(verifier != nullptr);
+	REQUIRE(corpus.unique_crashes() == 0);
+	REQUIRE(count_files(output_dir + "/" + Corpus::CRASHES_PATCHED_DIR) == 1);
+	REQUIRE(count_files(output_dir + "/" + Corpus::CRASHES_DIR) == 0);
+
+	// Crashes that also happen without them are reported as usual, with the
+	// input that reproduces them
+	input = crashing_input(true);
+	runner.reset(patched, stats);
+	harness.set_input(runner, FileRef::from_string(input));
+	REQUIRE(runner.run(stats) == Vm::RunEndReason::Crash);
+	verify_crash(0, runner, vm, verifier, harness, fixup, corpus,
+	             FileRef::from_string(input));
+	REQUIRE(corpus.unique_crashes() == 1);
+	REQUIRE(count_files(output_dir + "/" + Corpus::CRASHES_PATCHED_DIR) == 1);
+	std::string crash_file = output_dir + "/" + Corpus::CRASHES_DIR + "/" +
+	                         runner.fault().filename();
+	REQUIRE(utils::read_file(crash_file) == input);
+
+	nftw(tmp, [](const char* path, const struct stat*, int, struct FTW*) {
+		return remove(path);
+	}, 8, FTW_DEPTH | FTW_PHYS);
+}
@@ -0,0 +1,60 @@
+#include "common.h"
+
+static symbol_t make_symbol(const std::string& name, vaddr_t value,
+                            uint8_t type = STT_FUNC, uint8_t binding = STB_GLOBAL)
+{
+	symbol_t symbol = {};
+	symbol.name = name;
+	symbol.type = type;
+	symbol.binding = binding;
+	symbol.value = value;
+	return symbol;
+}
+
+TEST_CASE("symbol index lookup") {
+	std::vector<symbol_t> symbols = {
+		make_symbol("c", 0x1300),
+		make_symbol("", 0x1100),
+		make_symbol("a", 0x1000),
+		make_symbol("section", 0x1050, STT_SECTION),
+		make_symbol("undefined", 0),
+		make_symbol("b_local", 0x1200, STT_FUNC, STB_LOCAL),
+		make_symbol("b", 0x1200),
+		make_symbol("b_object", 0x1200, STT_OBJECT),
+	};
+	SymbolIndex index(symbols, 0x1000);
+	REQUIRE(index.size() == 3);
+
+	SymbolIndex::Result result;
+	REQUIRE(index.lookup(0, result));
+	REQUIRE(std::string(result.name) == "a");
+	REQUIRE(result.start == 0);
+	REQUIRE(result.symbol == 2);
+
+	// Closest symbol below, regardless of its size
+	REQUIRE(index.lookup(0x2ff, result));
+	REQUIRE(std::string(result.name) == "b");
+	REQUIRE(result.start == 0x200);
+	REQUIRE(result.symbol == 6);
+
+	REQUIRE(index.lookup(0x300, result));
+	REQUIRE(std::string(result.name) == "c");
+	REQUIRE(index.lookup(0x100000, result));
+	REQUIRE(std::string(result.name) == "c");
+
+	SymbolIndex empty;
+	REQUIRE(!empty.lookup(0x1000, result));
+}
+
+TEST_CASE("symbol index of relocatable elf") {
+	std::vector<symbol_t> symbols = {
+		make_symbol("_start", 0x40),
+		make_symbol("main", 0x120),
+	};
+	SymbolIndex index(symbols, 0);
+	SymbolIndex::Result result;
+	REQUIRE(!index.lookup(0x3f, result));
+	REQUIRE(index.lookup(0x130, result));
+	REQUIRE(std::string(result.name) == "main");
+	REQUIRE(result.start == 0x120);
+}
@@ -0,0 +1,43 @@
+#include <unistd.h>
+#include <cstring>
+#include <sstream>
+#include <set>
+#include "common.h"
+#include "utils.h"
+
+using namespace std;
+
+// The kernel measures syscalls in kernel mode, so it must be compiled with
+// `-Dinstruction-count=all`. Otherwise measures are 0 and tracing asserts.
+// This is why these tests are disabled by default, but can be run separately
+// doing `hypervisor_tests [tracing]`
+TEST_CASE("kernel tracing run ended at breakpoint", "[.tracing]") {
+	char output_dir[] = "/tmp/test_tracing_XXXXXX";
+	REQUIRE(mkdtemp(output_dir) != nullptr);
+
+	Vm vm(8*1024*1024, "zig-out/bin/kernel", "zig-out/bin/test_files", {});
+	vm.read_and_set_shared_file("./tests/input_hello_world");
+	vm.tracing().set_type(Tracing::Type::Kernel);
+	vm.tracing().set_output(output_dir, 0);
+
+	// The run doesn't issue EndRun, but the syscalls before the breakpoint
+	// must be traced anyway
+	vaddr_t test_me = vm.elf().resolve_symbol("test_me");
+	REQUIRE(test_me != 0);
+	vm.set_breakpoint(test_me);
+	REQUIRE(vm.run(stats) == Vm::RunEndReason::Breakpoint);
+	vm.tracing().dump_trace(0, true);
+
+	string stats_path = string(output_dir) + "/0.txt";
+	istringstream lines(utils::read_file(stats_path));
+	unlink(stats_path.c_str());
+	rmdir(output_dir);
+
+	set<string> traced;
+	string line;
+	while (getline(lines, line))
+		if (line[0] != '#')
+			traced.insert(line.substr(0, line.find(' ')));
+	REQUIRE(traced.count("read"));
+	REQUIRE(traced.count("close") == 0);
+}
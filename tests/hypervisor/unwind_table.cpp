@@ -0,0 +1,219 @@
+#include <cstring>
+#include "common.h"
+#include "unwind_table.h"
+#include "utils.h"
+
+using namespace std;
+
+// Rules computed by libdwarf for a row. By default every register keeps its
+// value, the CFA is rsp + 8 and the return address is stored at CFA - 8, as
+// in the first instruction of a function.
+struct Rules {
+	Dwarf_Regtable3 regtable;
+	Dwarf_Regtable_Entry3_s rules[DW_REG_TABLE_SIZE];
+
+	Rules() {
+		memset(rules, 0, sizeof(rules));
+		for (Dwarf_Regtable_Entry3_s& rule : rules)
+			rule.dw_regnum = DW_FRAME_SAME_VAL;
+		memset(&regtable, 0, sizeof(regtable));
+		regtable.rt3_reg_table_size = DW_REG_TABLE_SIZE;
+		regtable.rt3_rules = rules;
+		regtable.rt3_cfa_rule.dw_offset_relevant = 1;
+		regtable.rt3_cfa_rule.dw_value_type = DW_EXPR_OFFSET;
+		regtable.rt3_cfa_rule.dw_regnum = DwarfReg::Rsp;
+		regtable.rt3_cfa_rule.dw_offset_or_block_len = 8;
+		stored(DwarfReg::ReturnAddress, -8);
+	}
+
+	Rules(const Rules&) = delete;
+
+	// The register is stored at CFA + offset
+	void stored(int reg, int64_t offset) {
+		rules[reg].dw_offset_relevant = 1;
+		rules[reg].dw_value_type = DW_EXPR_OFFSET;
+		rules[reg].dw_regnum = DW_FRAME_CFA_COL3;
+		rules[reg].dw_offset_or_block_len = offset;
+	}
+
+	UnwindTable::Row row(vaddr_t addr) const {
+		return UnwindTable::make_row(addr, regtable);
+	}
+};
+
+static UnwindTable::Row no_info(vaddr_t addr) {
+	UnwindTable::Row row = {};
+	row.addr = addr;
+	row.kind = UnwindTable::Kind::NoInfo;
+	return row;
+}
+
+TEST_CASE("unwind table rows") {
+	// Frame pointer based frame, after `push rbp; mov rbp, rsp; push rbx`
+	Rules frame;
+	frame.regtable.rt3_cfa_rule.dw_regnum = DwarfReg::Rbp;
+	frame.regtable.rt3_cfa_rule.dw_offset_or_block_len = 16;
+	frame.stored(DwarfReg::Rbp, -16);
+	frame.stored(DwarfReg::Rbx, -24);
+	UnwindTable::Row row = frame.row(0x1000);
+	REQUIRE(row.kind == UnwindTable::Kind::Rules);
+	REQUIRE(row.addr == 0x1000);
+	REQUIRE(row.cfa_reg == DwarfReg::Rbp);
+	REQUIRE(row.cfa_offset == 16);
+	REQUIRE(row.ra_offset == -8);
+	for (size_t i = 0; i < UnwindTable::N_SAVED_REGS; i++) {
+		DwarfReg reg = UnwindTable::SAVED_REGS[i];
+		int16_t expected = (reg == DwarfReg::Rbp ? -16 : reg == DwarfReg::Rbx ? -24 : 0);
+		REQUIRE(row.saved_offsets[i] == expected);
+	}
+
+	// Undefined return address
+	Rules outermost;
+	outermost.rules[DwarfReg::ReturnAddress].dw_regnum = DW_FRAME_UNDEFINED_VAL;
+	REQUIRE(outermost.row(0).kind == UnwindTable::Kind::Outermost);
+
+	// CFA given by a DWARF expression
+	Rules cfa_expression;
+	cfa_expression.regtable.rt3_cfa_rule.dw_value_type = DW_EXPR_EXPRESSION;
+	REQUIRE(cfa_expression.row(0).kind == UnwindTable::Kind::Fallback);
+
+	// CFA offset which doesn't fit
+	Rules cfa_offset;
+	cfa_offset.regtable.rt3_cfa_rule.dw_offset_or_block_len = 1UL << 32;
+	REQUIRE(cfa_offset.row(0).kind == UnwindTable::Kind::Fallback);
+
+	// Return address not stored in the stack
+	Rules ra_register;
+	ra_register.rules[DwarfReg::ReturnAddress].dw_offset_relevant = 0;
+	ra_register.rules[DwarfReg::ReturnAddress].dw_regnum = DwarfReg::Rax;
+	REQUIRE(ra_register.row(0).kind == UnwindTable::Kind::Fallback);
+
+	// Callee-saved register with an offset which doesn't fit
+	Rules saved_far;
+	saved_far.stored(DwarfReg::R12, 0x10000);
+	REQUIRE(saved_far.row(0).kind == UnwindTable::Kind::Fallback);
+
+	// Register which isn't callee-saved and doesn't keep its value
+	Rules clobbered;
+	clobbered.stored(DwarfReg::Rax, -16);
+	REQUIRE(clobbered.row(0).kind == UnwindTable::Kind::Fallback);
+}
+
+TEST_CASE("unwind table find") {
+	Rules entry, body;
+	body.regtable.rt3_cfa_rule.dw_offset_or_block_len = 16;
+	Rules outermost;
+	outermost.rules[DwarfReg::ReturnAddress].dw_regnum = DW_FRAME_UNDEFINED_VAL;
+
+	// Rows of three FDEs, out of order. The second one begins where the
+	// first one ends, and the third one is after a gap.
+	UnwindTable table({
+		entry.row(0x2000), body.row(0x2004), no_info(0x2010),
+		outermost.row(0x3000), no_info(0x3008),
+		entry.row(0x1000), body.row(0x1001), no_info(0x2000),
+	});
+	REQUIRE(table.size() == 8);
+
+	REQUIRE(table.find(0xfff) == nullptr);
+	REQUIRE(table.find(0x1000)->cfa_offset == 8);
+	REQUIRE(table.find(0x1001)->cfa_offset == 16);
+	REQUIRE(table.find(0x1fff)->cfa_offset == 16);
+
+	// The end of the first FDE goes before the beginning of the second one,
+	// so it doesn't hide it
+	REQUIRE(table.find(0x2000) != nullptr);
+	REQUIRE(table.find(0x2000)->addr == 0x2000);
+	REQUIRE(table.find(0x2000)->cfa_offset == 8);
+	REQUIRE(table.find(0x2004)->cfa_offset == 16);
+
+	REQUIRE(table.find(0x2010) == nullptr);
+	REQUIRE(table.find(0x2fff) == nullptr);
+	REQUIRE(table.find(0x3004)->kind == UnwindTable::Kind::Outermost);
+	REQUIRE(table.find(0x3008) == nullptr);
+	REQUIRE(table.find(-1) == nullptr);
+
+	REQUIRE(UnwindTable().find(0x1000) == nullptr);
+}
+
+TEST_CASE("stack reader") {
+	Vm vm(8*1024*1024, "zig-out/bin/kernel", "zig-out/bin/test_files", {});
+	Mmu& mmu = vm.mmu();
+
+	// The last two pages of the kernel stack are mapped
+	vaddr_t page1 = Mmu::KERNEL_STACK_START_ADDR - 2*PAGE_SIZE;
+	vaddr_t page2 = page1 + PAGE_SIZE;
+	for (vaddr_t addr = page2 - 16; addr < page2 + 16; addr++)
+		mmu.write<uint8_t>(addr, addr & 0xFF);
+	mmu.write<vsize_t>(page1, 0x1111);
+	mmu.write<vsize_t>(page2 + 64, 0x2222);
+
+	StackReader stack(mmu);
+	REQUIRE(stack.read(page1) == 0x1111);
+	REQUIRE(stack.read(page2 + 64) == 0x2222);
+
+	// Reads from the cached page see writes done after caching it
+	REQUIRE(stack.read(page1) == 0x1111);
+	mmu.write<vsize_t>(page1 + 8, 0x3333);
+	REQUIRE(stack.read(page1 + 8) == 0x3333);
+
+	// Words crossing a page boundary are read from both pages
+	vaddr_t cross = page2 - 3;
+	vsize_t expected = mmu.read<vsize_t>(cross);
+	REQUIRE((expected & 0xFF) == (cross & 0xFF));
+	REQUIRE(stack.read(cross) == expected);
+	REQUIRE(stack.read(page2 - 8) == mmu.read<vsize_t>(page2 - 8));
+	REQUIRE(stack.read(page2) == mmu.read<vsize_t>(page2));
+}
+
+static void kvm_to_dwarf_regs(const kvm_regs& kregs, vaddr_t regs[DwarfReg::MAX]) {
+	memset(regs, 0, sizeof(vaddr_t)*DwarfReg::MAX);
+	regs[DwarfReg::Rbx] = kregs.rbx;
+	regs[DwarfReg::Rbp] = kregs.rbp;
+	regs[DwarfReg::Rsp] = kregs.rsp;
+	regs[DwarfReg::R12] = kregs.r12;
+	regs[DwarfReg::R13] = kregs.r13;
+	regs[DwarfReg::R14] = kregs.r14;
+	regs[DwarfReg::R15] = kregs.r15;
+	regs[DwarfReg::ReturnAddress] = kregs.rip;
+}
+
+TEST_CASE("unwind table matches cfi") {
+	Vm vm(8*1024*1024, "zig-out/bin/kernel", "zig-out/bin/test_patches", {});
+	vm.run_until(vm.elfs().resolve_symbol("check_crc"), stats);
+
+	// Debug info of the binary, which addresses are relative to its load
+	// address if it's PIE
+	const ElfParser& elf = vm.elf();
+	string data = utils::read_file(elf.path());
+	ElfDebug debug((const uint8_t*)data.c_str(), data.size());
+	REQUIRE(debug.has_frames());
+	vaddr_t load_addr = (elf.is_pie() ? elf.load_addr() : 0);
+	auto text = elf.section_limits(".text");
+
+	// Start from the frame of harness, as unwinders expect return addresses:
+	// check_crc hasn't run yet, so its return address is at the top of the
+	// stack. Unwind harness and main with both unwinders, until getting out
+	// of the binary.
+	StackReader stack(vm.mmu());
+	vaddr_t regs[DwarfReg::MAX], regs_cfi[DwarfReg::MAX];
+	kvm_to_dwarf_regs(vm.regs(), regs);
+	regs[DwarfReg::ReturnAddress] = stack.read(regs[DwarfReg::Rsp]);
+	regs[DwarfReg::Rsp] += sizeof(vaddr_t);
+	size_t frames = 0;
+	while (regs[DwarfReg::ReturnAddress] >= text.first &&
+	       regs[DwarfReg::ReturnAddress] < text.second)
+	{
+		regs[DwarfReg::ReturnAddress] -= load_addr;
+		memcpy(regs_cfi, regs, sizeof(regs));
+		bool ok = debug.next_frame(regs, stack);
+		REQUIRE(ok == debug.next_frame_cfi(regs_cfi, stack));
+		if (!ok)
+			break;
+		for (int reg = 0; reg < DwarfReg::MAX; reg++) {
+			INFO("frame " << frames << ", register " << reg);
+			REQUIRE(regs[reg] == regs_cfi[reg]);
+		}
+		frames++;
+	}
+	REQUIRE(frames >= 2);
+}